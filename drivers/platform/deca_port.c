@@ -6,15 +6,17 @@
 
 LOG_MODULE_REGISTER(deca_port, LOG_LEVEL_DBG);
 
+/* excludes the IRQ thread as well, masking the GPIO alone does not stop
+ * a dwt_isr() that is already running */
 decaIrqStatus_t decamutexon(void)
 {
-    dw3000_hw_interrupt_disable();
+    dw3000_hw_lock();
     return 1;
 }
 
 void decamutexoff(decaIrqStatus_t s)
 {
-    dw3000_hw_interrupt_enable();
+    dw3000_hw_unlock();
 }
 
 void deca_sleep(unsigned int time_ms)
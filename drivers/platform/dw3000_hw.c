@@ -3,6 +3,8 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/kernel.h>
 
+#include <string.h>
+
 #include "deca_device_api.h"
 #include "dw3000_hw.h"
 #include "dw3000_spi.h"
@@ -12,7 +14,24 @@ LOG_MODULE_REGISTER(dw3000, LOG_LEVEL_DBG);
 #define DW_INST DT_INST(0, qorvo_dw3000)
 
 static struct gpio_callback gpio_cb;
+
+/* cycle count latched at the last IRQ edge */
+static volatile uint32_t irq_cycles;
+
+/* held by dwt_isr() and by decamutexon()..decamutexoff(), so the IRQ
+ * thread cannot run between the calls of a multi-call driver sequence */
+static K_MUTEX_DEFINE(dw3000_mutex);
+static int mutex_depth;
+
+#if defined(CONFIG_DW3000_IRQ_THREAD)
+static K_SEM_DEFINE(dw3000_irq_sem, 0, 1);
+#else
 static struct k_work dw3000_isr_work;
+#endif
+
+#if defined(CONFIG_DW3000_IRQ_STATS)
+static struct dw3000_irq_stats irq_stats;
+#endif
 
 struct dw3000_config {
 	struct gpio_dt_spec gpio_irq;
@@ -64,21 +83,120 @@ int dw3000_hw_init()
 	return dw3000_spi_init();
 }
 
+static void dw3000_hw_irq_latency(void)
+{
+#if defined(CONFIG_DW3000_IRQ_STATS)
+	uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - irq_cycles);
+	int bucket = us ? 32 - __builtin_clz(us) : 0;
+
+	if (bucket >= DW3000_IRQ_HIST_BUCKETS) {
+		bucket = DW3000_IRQ_HIST_BUCKETS - 1;
+	}
+
+	irq_stats.count++;
+	irq_stats.hist[bucket]++;
+	if (us > irq_stats.max_us) {
+		irq_stats.max_us = us;
+	}
+#endif
+}
+
+/* run dwt_isr() until the DW3000 releases its IRQ line, so events that
+ * arrive while a previous one is being handled are not lost to the edge
+ * trigger. bounded in case the line is stuck. */
+static void dw3000_hw_irq_drain(void)
+{
+	int n = 0;
+
+	k_mutex_lock(&dw3000_mutex, K_FOREVER);
+
+	dw3000_hw_irq_latency();
+
+	do {
+		dwt_isr();
+	} while (gpio_pin_get_dt(&conf.gpio_irq) > 0 && ++n < 8);
+
+	k_mutex_unlock(&dw3000_mutex);
+}
+
+#if defined(CONFIG_DW3000_IRQ_THREAD)
+static void dw3000_hw_irq_thread(void *a, void *b, void *c)
+{
+	while (1) {
+		k_sem_take(&dw3000_irq_sem, K_FOREVER);
+		dw3000_hw_irq_drain();
+	}
+}
+
+K_THREAD_DEFINE(dw3000_irq_tid, CONFIG_DW3000_IRQ_THREAD_STACK_SIZE,
+		dw3000_hw_irq_thread, NULL, NULL, NULL,
+		K_PRIO_COOP(CONFIG_DW3000_IRQ_THREAD_PRIO), 0, 0);
+#else
 static void dw3000_hw_isr_work_handler(struct k_work* item)
 {
-	dwt_isr();
+	dw3000_hw_irq_drain();
+}
+#endif
+
+static void dw3000_hw_irq_kick(void)
+{
+#if defined(CONFIG_DW3000_IRQ_THREAD)
+	k_sem_give(&dw3000_irq_sem);
+#else
+	k_work_submit(&dw3000_isr_work);
+#endif
 }
 
 static void dw3000_hw_isr(const struct device* dev, struct gpio_callback* cb,
 						  uint32_t pins)
 {
-	k_work_submit(&dw3000_isr_work);
+	irq_cycles = k_cycle_get_32();
+	dw3000_hw_irq_kick();
 }
 
+uint32_t dw3000_hw_irq_cycles(void)
+{
+	return irq_cycles;
+}
+
+#if defined(CONFIG_DW3000_IRQ_STATS)
+void dw3000_hw_irq_stats_get(struct dw3000_irq_stats *stats)
+{
+	unsigned int key = irq_lock();
+
+	*stats = irq_stats;
+	irq_unlock(key);
+}
+
+void dw3000_hw_irq_stats_reset(void)
+{
+	unsigned int key = irq_lock();
+
+	memset(&irq_stats, 0, sizeof(irq_stats));
+	irq_unlock(key);
+}
+
+void dw3000_hw_irq_stats_log(void)
+{
+	struct dw3000_irq_stats st;
+
+	dw3000_hw_irq_stats_get(&st);
+
+	LOG_INF("IRQ latency: n=%u max=%u us", st.count, st.max_us);
+	for (int i = 0; i < DW3000_IRQ_HIST_BUCKETS; i++) {
+		if (st.hist[i]) {
+			LOG_INF("  <%6u us: %u", 1U << i, st.hist[i]);
+		}
+	}
+}
+#endif
+
 int dw3000_hw_init_interrupt(void)
 {
 	if (conf.gpio_irq.port) {
+#if !defined(CONFIG_DW3000_IRQ_THREAD)
 		k_work_init(&dw3000_isr_work, dw3000_hw_isr_work_handler);
+#endif
 
 		gpio_pin_configure_dt(&conf.gpio_irq, GPIO_INPUT);
 		gpio_init_callback(&gpio_cb, dw3000_hw_isr, BIT(conf.gpio_irq.pin));
@@ -98,6 +216,12 @@ void dw3000_hw_interrupt_enable(void)
 {
 	if (conf.gpio_irq.port) {
 		gpio_pin_interrupt_configure_dt(&conf.gpio_irq, GPIO_INT_EDGE_RISING);
+
+		/* an edge that came while masked is gone, the level is not */
+		if (gpio_pin_get_dt(&conf.gpio_irq) > 0) {
+			irq_cycles = k_cycle_get_32();
+			dw3000_hw_irq_kick();
+		}
 	}
 }
 
@@ -108,6 +232,26 @@ void dw3000_hw_interrupt_disable(void)
 	}
 }
 
+/* recursive, so dwt_isr() callbacks may call driver functions that take
+ * it again. only the outermost lock masks the IRQ */
+void dw3000_hw_lock(void)
+{
+	k_mutex_lock(&dw3000_mutex, K_FOREVER);
+
+	if (mutex_depth++ == 0) {
+		dw3000_hw_interrupt_disable();
+	}
+}
+
+void dw3000_hw_unlock(void)
+{
+	if (--mutex_depth == 0) {
+		dw3000_hw_interrupt_enable();
+	}
+
+	k_mutex_unlock(&dw3000_mutex);
+}
+
 void dw3000_hw_fini(void)
 {
 	// TODO
@@ -132,11 +276,11 @@ void dw3000_hw_wakeup(void)
 {
 	if (conf.gpio_wakeup.port) {
 		/* Use WAKEUP pin if available */
-		LOG_INF("WAKEUP PIN");
+		LOG_DBG("WAKEUP PIN");
 		gpio_pin_set_dt(&conf.gpio_wakeup, 1);
 	} else {
 		/* Use SPI CS pin */
-		LOG_INF("WAKEUP CS");
+		LOG_DBG("WAKEUP CS");
 		dw3000_spi_wakeup();
 	}
 	k_sleep(K_MSEC(1));
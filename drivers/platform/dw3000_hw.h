@@ -5,6 +5,17 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
+/* bucket n counts IRQs serviced in [2^(n-1), 2^n) us, bucket 0 is < 1 us */
+#define DW3000_IRQ_HIST_BUCKETS 16
+
+struct dw3000_irq_stats {
+	uint32_t count;
+	uint32_t max_us;
+	uint32_t hist[DW3000_IRQ_HIST_BUCKETS];
+};
+
 int dw3000_hw_init(void);
 int dw3000_hw_init_interrupt(void);
 void dw3000_hw_fini(void);
@@ -13,6 +24,12 @@ void dw3000_hw_wakeup(void);
 void dw3000_hw_wakeup_pin_low(void);
 void dw3000_hw_interrupt_enable(void);
 void dw3000_hw_interrupt_disable(void);
+void dw3000_hw_lock(void);
+void dw3000_hw_unlock(void);
+uint32_t dw3000_hw_irq_cycles(void);
+void dw3000_hw_irq_stats_get(struct dw3000_irq_stats *stats);
+void dw3000_hw_irq_stats_reset(void);
+void dw3000_hw_irq_stats_log(void);
 #ifdef __cplusplus
 }
 #endif
@@ -9,6 +9,8 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/kernel.h>
 #include <zephyr/drivers/gpio.h>
+#include <errno.h>
+#include <string.h>
 #include "dw3000_spi.h"
 
 /* This file implements the SPI functions required by decadriver */
@@ -17,6 +19,11 @@ LOG_MODULE_DECLARE(dw3000, LOG_LEVEL_DBG);
 
 #define TX_WAIT_RESP_NRF52840_DELAY 30
 
+/* extended address mode header: R/W, EAM, 5-bit file, 7-bit offset */
+#define DW3000_SPI_HDR_WR	0x80
+#define DW3000_SPI_HDR_EAM	0x40
+#define DW3000_SPI_HDR_LEN	2
+
 #define DW_INST DT_INST(0, qorvo_dw3000)
 #define DW_SPI	DT_PARENT(DT_INST(0, qorvo_dw3000))
 
@@ -28,6 +35,32 @@ static struct spi_cs_control cs_ctrl = {
 static struct spi_config spi_cfgs[2] = {0}; // configs for slow and fast
 static struct spi_config* spi_cfg;
 
+#if defined(CONFIG_DW3000_SPI_STATS)
+static struct dw3000_spi_stats spi_stats;
+
+static void spi_stats_add(enum dw3000_spi_op_kind kind, uint32_t t0,
+						  uint32_t xfers, uint32_t bytes)
+{
+	uint32_t cycles = k_cycle_get_32() - t0;
+	unsigned int key = irq_lock();
+	struct dw3000_spi_op_stats *st = &spi_stats.op[kind];
+
+	st->count++;
+	st->xfers += xfers;
+	st->bytes += bytes;
+	st->cycles += cycles;
+	if (cycles > st->max_cycles) {
+		st->max_cycles = cycles;
+	}
+	irq_unlock(key);
+}
+
+#define SPI_STATS_T0() k_cycle_get_32()
+#else
+#define spi_stats_add(kind, t0, xfers, bytes) ((void)(t0))
+#define SPI_STATS_T0() 0
+#endif
+
 int dw3000_spi_init(void)
 {
 	/* set common SPI config */
@@ -104,8 +137,13 @@ int dw3000_spi_write_crc(uint16_t headerLength, const uint8_t* headerBuffer,
 		.buffers = tx_buf,
 		.count = ARRAY_SIZE(tx_buf),
 	};
+	uint32_t t0 = SPI_STATS_T0();
+
+	int ret = spi_transceive(spi, spi_cfg, &tx, NULL);
 
-	return spi_transceive(spi, spi_cfg, &tx, NULL);
+	spi_stats_add(DW3000_SPI_OP_WRITE, t0, 1, headerLength + bodyLength + 1);
+
+	return ret;
 }
 
 int dw3000_spi_write(uint16_t headerLength, const uint8_t* headerBuffer,
@@ -125,8 +163,13 @@ int dw3000_spi_write(uint16_t headerLength, const uint8_t* headerBuffer,
 		.buffers = tx_buf,
 		.count = ARRAY_SIZE(tx_buf),
 	};
+	uint32_t t0 = SPI_STATS_T0();
 
-	return spi_transceive(spi, spi_cfg, &tx, NULL);
+	int ret = spi_transceive(spi, spi_cfg, &tx, NULL);
+
+	spi_stats_add(DW3000_SPI_OP_WRITE, t0, 1, headerLength + bodyLength);
+
+	return ret;
 }
 
 int dw3000_spi_read(uint16_t headerLength, uint8_t* headerBuffer,
@@ -155,6 +198,8 @@ int dw3000_spi_read(uint16_t headerLength, uint8_t* headerBuffer,
 		.count = ARRAY_SIZE(rx_buf),
 	};
 
+	uint32_t t0 = SPI_STATS_T0();
+
 	int ret = spi_transceive(spi, spi_cfg, &tx, &rx);
 
 #if (CONFIG_SOC_NRF52840_QIAA)
@@ -171,9 +216,142 @@ int dw3000_spi_read(uint16_t headerLength, uint8_t* headerBuffer,
 	}
 #endif
 
+	spi_stats_add(DW3000_SPI_OP_READ, t0, 1, headerLength + readLength);
+
 	return ret;
 }
 
+int dw3000_spi_batch(const struct dw3000_spi_op *ops, int n)
+{
+	uint8_t hdr[DW3000_SPI_HDR_LEN];
+	const struct spi_buf hdr_buf = {
+		.buf = hdr,
+		.len = sizeof(hdr),
+	};
+	struct spi_buf bufs[DW3000_SPI_BATCH_MAX + 1];
+	uint32_t t0 = SPI_STATS_T0();
+	uint32_t xfers = 0;
+	uint32_t bytes = 0;
+	bool read = false;
+
+	if (n < 0 || n > DW3000_SPI_BATCH_MAX) {
+		return -EINVAL;
+	}
+
+	for (int i = 0; i < n;) {
+		const struct dw3000_spi_op *op = &ops[i];
+		uint32_t file = (op->reg >> 16) & 0x1F;
+		uint32_t ofs = op->reg & 0xFFFF;
+		uint32_t end = op->reg;
+		int k = 0;
+		int ret;
+
+		if (ofs > 0x7F) {
+			return -EINVAL;
+		}
+
+		hdr[0] = (op->write ? DW3000_SPI_HDR_WR : 0) | DW3000_SPI_HDR_EAM |
+			 (file << 1) | (ofs >> 6);
+		hdr[1] = (ofs << 2) & 0xFC;
+
+		/* the device auto-increments the address, so following
+		 * accesses that start where this one ends join its frame */
+		do {
+			bufs[1 + k].buf = ops[i + k].buf;
+			bufs[1 + k].len = ops[i + k].len;
+			end = ops[i + k].reg + ops[i + k].len;
+			k++;
+		} while (i + k < n && ops[i + k].write == op->write &&
+			 ops[i + k].reg == end);
+
+		if (op->write) {
+			bufs[0] = hdr_buf;
+			const struct spi_buf_set tx = {
+				.buffers = bufs,
+				.count = k + 1,
+			};
+
+			ret = spi_transceive(spi, spi_cfg, &tx, NULL);
+		} else {
+			bufs[0].buf = NULL;
+			bufs[0].len = sizeof(hdr);
+			const struct spi_buf_set tx = {
+				.buffers = &hdr_buf,
+				.count = 1,
+			};
+			const struct spi_buf_set rx = {
+				.buffers = bufs,
+				.count = k + 1,
+			};
+
+			ret = spi_transceive(spi, spi_cfg, &tx, &rx);
+			read = true;
+		}
+
+		if (ret != 0) {
+			return ret;
+		}
+
+		xfers++;
+		bytes += sizeof(hdr) + (end - op->reg);
+		i += k;
+	}
+
+#if (CONFIG_SOC_NRF52840_QIAA)
+	/* same workaround as dw3000_spi_read(), once per batch */
+	if (read) {
+		for (volatile int i = 0; i < TX_WAIT_RESP_NRF52840_DELAY; i++) {
+			/* spin */
+		}
+	}
+#else
+	(void)read;
+#endif
+
+	spi_stats_add(DW3000_SPI_OP_BATCH, t0, xfers, bytes);
+
+	return 0;
+}
+
+#if defined(CONFIG_DW3000_SPI_STATS)
+void dw3000_spi_stats_get(struct dw3000_spi_stats *stats)
+{
+	unsigned int key = irq_lock();
+
+	*stats = spi_stats;
+	irq_unlock(key);
+}
+
+void dw3000_spi_stats_reset(void)
+{
+	unsigned int key = irq_lock();
+
+	memset(&spi_stats, 0, sizeof(spi_stats));
+	irq_unlock(key);
+}
+
+void dw3000_spi_stats_log(void)
+{
+	static const char *const names[DW3000_SPI_OP_KINDS] = {
+		"read", "write", "batch",
+	};
+	struct dw3000_spi_stats st;
+
+	dw3000_spi_stats_get(&st);
+
+	for (int i = 0; i < DW3000_SPI_OP_KINDS; i++) {
+		const struct dw3000_spi_op_stats *op = &st.op[i];
+
+		if (!op->count) {
+			continue;
+		}
+		LOG_INF("SPI %s: n=%u frames=%u bytes=%u avg=%u max=%u cycles",
+			names[i], op->count, op->xfers, op->bytes,
+			op->cycles / op->count, op->max_cycles);
+	}
+}
+#endif
+
 void dw3000_spi_wakeup()
 {
 	gpio_pin_set_dt(&cs_ctrl.gpio, 1);
@@ -7,6 +7,37 @@ extern "C" {
 
 #include <stdint.h>
 
+/* largest number of accesses in one dw3000_spi_batch() */
+#define DW3000_SPI_BATCH_MAX 8
+
+/* one register access of a batch. reg is a decadriver register id,
+ * (file << 16) | offset, e.g. SYS_STATUS_ID. */
+struct dw3000_spi_op {
+	uint32_t reg;
+	uint16_t len;
+	uint8_t write;
+	uint8_t *buf;
+};
+
+enum dw3000_spi_op_kind {
+	DW3000_SPI_OP_READ,
+	DW3000_SPI_OP_WRITE,
+	DW3000_SPI_OP_BATCH,
+	DW3000_SPI_OP_KINDS,
+};
+
+struct dw3000_spi_op_stats {
+	uint32_t count;
+	uint32_t xfers;		/* CS frames */
+	uint32_t bytes;		/* header and data */
+	uint32_t cycles;
+	uint32_t max_cycles;
+};
+
+struct dw3000_spi_stats {
+	struct dw3000_spi_op_stats op[DW3000_SPI_OP_KINDS];
+};
+
 int dw3000_spi_init(void);
 void dw3000_spi_fini(void);
 void dw3000_spi_wakeup(void);
@@ -19,6 +50,19 @@ int dw3000_spi_write(uint16_t headerLength, const uint8_t* headerBuffer,
 int dw3000_spi_write_crc(uint16_t headerLength, const uint8_t* headerBuffer,
 						 uint16_t bodyLength, const uint8_t* bodyBuffer,
 						 uint8_t crc8);
+
+/* run up to DW3000_SPI_BATCH_MAX register accesses in order. accesses
+ * in the same direction to adjacent registers of one register file share
+ * a single CS frame: the header goes out once and the data moves through
+ * a scatter list over the caller's buffers. the caller serialises against
+ * dwt_isr(): call from the DW3000 IRQ thread or with the IRQ disabled.
+ * returns 0, or a negative errno. */
+int dw3000_spi_batch(const struct dw3000_spi_op *ops, int n);
+
+/* per-operation counters, only with CONFIG_DW3000_SPI_STATS */
+void dw3000_spi_stats_get(struct dw3000_spi_stats *stats);
+void dw3000_spi_stats_reset(void);
+void dw3000_spi_stats_log(void);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,59 @@
+#include <math.h>
+
+#include "loc_linalg.h"
+
+int loc_ldl_factor(float a[4][4], int m)
+{
+    for(int j = 0; j < m; j++)
+    {
+        float v[4];
+        float dj = a[j][j];
+
+        for(int k = 0; k < j; k++)
+        {
+            v[k] = a[j][k] * a[k][k];
+            dj -= a[j][k] * v[k];
+        }
+
+        if(!(dj > 1e-6f * a[j][j]))
+            return -1;
+
+        a[j][j] = dj;
+
+        for(int i = j + 1; i < m; i++)
+        {
+            float s = a[i][j];
+
+            for(int k = 0; k < j; k++)
+                s -= a[i][k] * v[k];
+
+            a[i][j] = s / dj;
+        }
+    }
+
+    return 0;
+}
+
+void loc_ldl_subst(float a[4][4], int m, float *x)
+{
+    for(int i = 0; i < m; i++)
+        for(int k = 0; k < i; k++)
+            x[i] -= a[i][k] * x[k];
+
+    for(int i = 0; i < m; i++)
+        x[i] /= a[i][i];
+
+    for(int i = m - 1; i >= 0; i--)
+        for(int k = i + 1; k < m; k++)
+            x[i] -= a[k][i] * x[k];
+}
+
+float loc_norm(const float *v, int dim)
+{
+    float s = 0;
+
+    for(int k = 0; k < dim; k++)
+        s += v[k] * v[k];
+
+    return sqrtf(s);
+}
@@ -0,0 +1,17 @@
+#ifndef LOC_LINALG_H
+#define LOC_LINALG_H
+
+/* Small dense solves shared by the lib/loc solvers: normal equations of
+ * at most 4 unknowns, only the lower triangle is filled in. */
+
+/* in-place LDL^T: D ends up on the diagonal, L below it. returns -1 if
+ * a pivot is lost to rounding, i.e. the geometry does not fix the
+ * solution. */
+int loc_ldl_factor(float a[4][4], int m);
+
+/* solve with a factored matrix, x holds the right hand side */
+void loc_ldl_subst(float a[4][4], int m, float *x);
+
+float loc_norm(const float *v, int dim);
+
+#endif
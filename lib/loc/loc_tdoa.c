@@ -0,0 +1,582 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "loc_linalg.h"
+#include "loc_tdoa.h"
+
+/* Gauss-Newton stops once a step is below this, in scaled units, i.e.
+ * 10 um per meter of anchor spread */
+#define GN_TOL          1e-5f
+
+/* fixed point working format: Q20 in int64, scaled units */
+#define QN              20
+#define Q_ONE           (1LL << QN)
+#define Q_GN_TOL        8
+
+/* 1 tick = 4.6903 mm, Q16 */
+#define MM_PER_TICK_Q16 307387
+
+/* float */
+
+/* Chan's linearised solution in scaled units, anchor 0 at the origin */
+static int chan_init(const struct loc_tdoa_ws *ws, int dim, int n, float *p)
+{
+    float nm[4][4] = {0};
+    float v[4] = {0};
+    float w[4] = {0};
+    int m = (n - 1 > dim) ? dim + 1 : dim;
+
+    for(int i = 1; i < n; i++)
+    {
+        float row[4];
+        float b = -ws->d[i] * ws->d[i];
+
+        for(int k = 0; k < dim; k++)
+        {
+            row[k] = 2 * ws->a[i][k];
+            b += ws->a[i][k] * ws->a[i][k];
+        }
+        row[dim] = 2 * ws->d[i];
+
+        for(int r = 0; r < m; r++)
+        {
+            v[r] += row[r] * b;
+            w[r] -= row[r] * row[dim];
+
+            for(int c = 0; c <= r; c++)
+                nm[r][c] += row[r] * row[c];
+        }
+    }
+
+    if(loc_ldl_factor(nm, m) != 0)
+        return -1;
+
+    loc_ldl_subst(nm, m, v);
+
+    if(m > dim)
+    {
+        for(int k = 0; k < dim; k++)
+            p[k] = v[k];
+        return 0;
+    }
+
+    /* p = v + w r_0, and |p| = r_0 */
+    loc_ldl_subst(nm, m, w);
+
+    float qa = -1, qb = 0, qc = 0;
+
+    for(int k = 0; k < dim; k++)
+    {
+        qa += w[k] * w[k];
+        qb += 2 * v[k] * w[k];
+        qc += v[k] * v[k];
+    }
+
+    float roots[2];
+    int nr = 0;
+
+    if(fabsf(qa) < 1e-6f)
+    {
+        if(qb != 0)
+            roots[nr++] = -qc / qb;
+    }
+    else
+    {
+        float disc = qb * qb - 4 * qa * qc;
+        float s = sqrtf(disc > 0 ? disc : 0);
+
+        roots[nr++] = (-qb + s) / (2 * qa);
+        roots[nr++] = (-qb - s) / (2 * qa);
+    }
+
+    /* two fits are exact here: keep the one nearer the anchors */
+    float centre[3] = {0};
+    float best = INFINITY;
+
+    for(int i = 0; i < n; i++)
+        for(int k = 0; k < dim; k++)
+            centre[k] += ws->a[i][k] / n;
+
+    for(int k = 0; k < dim; k++)
+        p[k] = v[k];
+
+    for(int j = 0; j < nr; j++)
+    {
+        if(!(roots[j] >= 0))
+            continue;
+
+        float e = 0;
+        for(int k = 0; k < dim; k++)
+        {
+            float c = v[k] + w[k] * roots[j] - centre[k];
+            e += c * c;
+        }
+
+        if(e < best)
+        {
+            best = e;
+            for(int k = 0; k < dim; k++)
+                p[k] = v[k] + w[k] * roots[j];
+        }
+    }
+
+    return 0;
+}
+
+/* sum of squared residuals at p */
+static float tdoa_rss(const struct loc_tdoa_ws *ws, int dim, int n, const float *p)
+{
+    float r0 = loc_norm(p, dim);
+    float ss = 0;
+
+    for(int i = 1; i < n; i++)
+    {
+        float diff[3];
+
+        for(int k = 0; k < dim; k++)
+            diff[k] = p[k] - ws->a[i][k];
+
+        float f = loc_norm(diff, dim) - r0 - ws->d[i];
+        ss += f * f;
+    }
+
+    return ss;
+}
+
+int loc_tdoa_solve(struct loc_tdoa_ws *ws, int dim, int n, const float (*anchors)[3],
+                   const float *d, struct loc_fix *fix)
+{
+    if((dim != 2 && dim != 3) || n < dim + 1 || n > LOC_MAX_ANCHORS)
+        return -1;
+
+    float scale = 0;
+
+    for(int i = 1; i < n; i++)
+    {
+        scale = fmaxf(scale, fabsf(d[i]));
+
+        for(int k = 0; k < dim; k++)
+            scale = fmaxf(scale, fabsf(anchors[i][k] - anchors[0][k]));
+    }
+
+    if(!(scale > 0))
+        return -1;
+
+    float inv = 1.0f / scale;
+
+    for(int i = 0; i < n; i++)
+    {
+        for(int k = 0; k < dim; k++)
+            ws->a[i][k] = (anchors[i][k] - anchors[0][k]) * inv;
+        ws->d[i] = (i > 0) ? d[i] * inv : 0;
+    }
+
+    float p[3] = {0};
+
+    if(chan_init(ws, dim, n, p) != 0)
+        return -1;
+
+    int it = 0;
+
+    while(it < LOC_GN_ITERS)
+    {
+        float h[4][4] = {0};
+        float g[4] = {0};
+        float r0 = fmaxf(loc_norm(p, dim), 1e-6f);
+
+        for(int i = 1; i < n; i++)
+        {
+            float diff[3], j[3];
+
+            for(int k = 0; k < dim; k++)
+                diff[k] = p[k] - ws->a[i][k];
+
+            float ri = fmaxf(loc_norm(diff, dim), 1e-6f);
+            float f = ri - r0 - ws->d[i];
+
+            for(int k = 0; k < dim; k++)
+            {
+                j[k] = diff[k] / ri - p[k] / r0;
+                g[k] += j[k] * f;
+
+                for(int c = 0; c <= k; c++)
+                    h[k][c] += j[k] * j[c];
+            }
+        }
+
+        if(loc_ldl_factor(h, dim) != 0)
+            return -1;
+
+        loc_ldl_subst(h, dim, g);
+        it++;
+
+        for(int k = 0; k < dim; k++)
+            p[k] -= g[k];
+
+        if(loc_norm(g, dim) < GN_TOL)
+            break;
+    }
+
+    for(int k = 0; k < 3; k++)
+        fix->p[k] = (k < dim) ? p[k] * scale + anchors[0][k] : 0;
+
+    fix->rms = sqrtf(tdoa_rss(ws, dim, n, p) / (n - 1)) * scale;
+    fix->iters = it;
+
+    return 0;
+}
+
+/* Q16.16 */
+
+static int64_t shr_round(int64_t v, int s)
+{
+    if(s <= 0)
+        return v * (1LL << -s);
+
+    int64_t half = 1LL << (s - 1);
+
+    return (v < 0) ? -((-v + half) >> s) : (v + half) >> s;
+}
+
+static int64_t max64(int64_t a, int64_t b)
+{
+    return (a > b) ? a : b;
+}
+
+static int64_t qmul(int64_t a, int64_t b)
+{
+    return shr_round(a * b, QN);
+}
+
+static int64_t qdiv(int64_t a, int64_t b)
+{
+    return (a * Q_ONE) / b;
+}
+
+static uint64_t isqrt64(uint64_t v)
+{
+    uint64_t r = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while(bit > v)
+        bit >>= 2;
+
+    while(bit)
+    {
+        if(v >= r + bit)
+        {
+            v -= r + bit;
+            r = (r >> 1) + bit;
+        }
+        else
+        {
+            r >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return r;
+}
+
+/* |v| of a Q20 vector, in Q20 */
+static int64_t qnorm(const int64_t *v, int dim)
+{
+    uint64_t s = 0;
+
+    for(int k = 0; k < dim; k++)
+        s += v[k] * v[k];
+
+    return isqrt64(s);
+}
+
+/* same as loc_ldl_factor(), on Q20 values */
+static int ldl_factor_q(int64_t a[4][4], int m)
+{
+    for(int j = 0; j < m; j++)
+    {
+        int64_t v[4];
+        int64_t dj = a[j][j];
+
+        for(int k = 0; k < j; k++)
+        {
+            v[k] = qmul(a[j][k], a[k][k]);
+            dj -= qmul(a[j][k], v[k]);
+        }
+
+        if(dj <= 0 || dj <= (a[j][j] >> 16))
+            return -1;
+
+        a[j][j] = dj;
+
+        for(int i = j + 1; i < m; i++)
+        {
+            int64_t s = a[i][j];
+
+            for(int k = 0; k < j; k++)
+                s -= qmul(a[i][k], v[k]);
+
+            a[i][j] = qdiv(s, dj);
+        }
+    }
+
+    return 0;
+}
+
+static void ldl_subst_q(int64_t a[4][4], int m, int64_t *x)
+{
+    for(int i = 0; i < m; i++)
+        for(int k = 0; k < i; k++)
+            x[i] -= qmul(a[i][k], x[k]);
+
+    for(int i = 0; i < m; i++)
+        x[i] = qdiv(x[i], a[i][i]);
+
+    for(int i = m - 1; i >= 0; i--)
+        for(int k = i + 1; k < m; k++)
+            x[i] -= qmul(a[k][i], x[k]);
+}
+
+static int chan_init_q(const struct loc_tdoa_ws_q16 *ws, int dim, int n, int64_t *p)
+{
+    int64_t nm[4][4] = {0};
+    int64_t v[4] = {0};
+    int64_t w[4] = {0};
+    int m = (n - 1 > dim) ? dim + 1 : dim;
+
+    /* products are summed in Q40 and rounded once */
+    for(int i = 1; i < n; i++)
+    {
+        int64_t row[4];
+        int64_t b = -(int64_t)ws->d[i] * ws->d[i];
+
+        for(int k = 0; k < dim; k++)
+        {
+            row[k] = 2 * (int64_t)ws->a[i][k];
+            b += (int64_t)ws->a[i][k] * ws->a[i][k];
+        }
+        row[dim] = 2 * (int64_t)ws->d[i];
+        b = shr_round(b, QN);
+
+        for(int r = 0; r < m; r++)
+        {
+            v[r] += row[r] * b;
+            w[r] -= row[r] * row[dim];
+
+            for(int c = 0; c <= r; c++)
+                nm[r][c] += row[r] * row[c];
+        }
+    }
+
+    for(int r = 0; r < m; r++)
+    {
+        v[r] = shr_round(v[r], QN);
+        w[r] = shr_round(w[r], QN);
+
+        for(int c = 0; c <= r; c++)
+            nm[r][c] = shr_round(nm[r][c], QN);
+    }
+
+    if(ldl_factor_q(nm, m) != 0)
+        return -1;
+
+    ldl_subst_q(nm, m, v);
+
+    if(m > dim)
+    {
+        for(int k = 0; k < dim; k++)
+            p[k] = v[k];
+        return 0;
+    }
+
+    ldl_subst_q(nm, m, w);
+
+    int64_t qa = -Q_ONE, qb = 0, qc = 0;
+
+    for(int k = 0; k < dim; k++)
+    {
+        qa += qmul(w[k], w[k]);
+        qb += 2 * qmul(v[k], w[k]);
+        qc += qmul(v[k], v[k]);
+    }
+
+    int64_t roots[2];
+    int nr = 0;
+
+    if(llabs(qa) < (Q_ONE >> 12))
+    {
+        if(qb != 0)
+            roots[nr++] = qdiv(-qc, qb);
+    }
+    else
+    {
+        int64_t disc = qmul(qb, qb) - 4 * qmul(qa, qc);
+        int64_t s = (disc > 0) ? (int64_t)isqrt64((uint64_t)disc << QN) : 0;
+
+        roots[nr++] = qdiv(-qb + s, 2 * qa);
+        roots[nr++] = qdiv(-qb - s, 2 * qa);
+    }
+
+    int64_t centre[3] = {0};
+    int64_t best = INT64_MAX;
+
+    for(int i = 0; i < n; i++)
+        for(int k = 0; k < dim; k++)
+            centre[k] += ws->a[i][k];
+
+    for(int k = 0; k < dim; k++)
+    {
+        centre[k] /= n;
+        p[k] = v[k];
+    }
+
+    for(int j = 0; j < nr; j++)
+    {
+        if(roots[j] < 0)
+            continue;
+
+        int64_t e = 0;
+        for(int k = 0; k < dim; k++)
+        {
+            int64_t c = v[k] + qmul(w[k], roots[j]) - centre[k];
+            e += qmul(c, c);
+        }
+
+        if(e < best)
+        {
+            best = e;
+            for(int k = 0; k < dim; k++)
+                p[k] = v[k] + qmul(w[k], roots[j]);
+        }
+    }
+
+    return 0;
+}
+
+/* sum of squared residuals at p, Q40 */
+static int64_t tdoa_rss_q(const struct loc_tdoa_ws_q16 *ws, int dim, int n, const int64_t *p)
+{
+    int64_t r0 = qnorm(p, dim);
+    int64_t ss = 0;
+
+    for(int i = 1; i < n; i++)
+    {
+        int64_t diff[3];
+
+        for(int k = 0; k < dim; k++)
+            diff[k] = p[k] - ws->a[i][k];
+
+        int64_t f = qnorm(diff, dim) - r0 - ws->d[i];
+        ss += f * f;
+    }
+
+    return ss;
+}
+
+int loc_tdoa_solve_q16(struct loc_tdoa_ws_q16 *ws, int dim, int n, const int32_t (*anchors)[3],
+                       const int32_t *d, struct loc_fix_q16 *fix)
+{
+    if((dim != 2 && dim != 3) || n < dim + 1 || n > LOC_MAX_ANCHORS)
+        return -1;
+
+    int64_t extent = 0;
+
+    for(int i = 1; i < n; i++)
+    {
+        extent = max64(extent, llabs(d[i]));
+
+        for(int k = 0; k < dim; k++)
+            extent = max64(extent, llabs((int64_t)anchors[i][k] - anchors[0][k]));
+    }
+
+    if(extent == 0)
+        return -1;
+
+    /* scale by 2^-sh so everything is within +-1 */
+    int sh = 0;
+    while(extent >= (1LL << (16 + sh)))
+        sh++;
+
+    /* Q16 meters to Q20 scaled units is a shift by sh - 4 */
+    int to_q = sh - (QN - 16);
+
+    for(int i = 0; i < n; i++)
+    {
+        for(int k = 0; k < dim; k++)
+            ws->a[i][k] = shr_round((int64_t)anchors[i][k] - anchors[0][k], to_q);
+        ws->d[i] = (i > 0) ? shr_round(d[i], to_q) : 0;
+    }
+
+    int64_t p[3] = {0};
+
+    if(chan_init_q(ws, dim, n, p) != 0)
+        return -1;
+
+    int it = 0;
+
+    while(it < LOC_GN_ITERS)
+    {
+        int64_t h[4][4] = {0};
+        int64_t g[4] = {0};
+        int64_t r0 = max64(qnorm(p, dim), 1);
+
+        for(int i = 1; i < n; i++)
+        {
+            int64_t diff[3], j[3];
+
+            for(int k = 0; k < dim; k++)
+                diff[k] = p[k] - ws->a[i][k];
+
+            int64_t ri = max64(qnorm(diff, dim), 1);
+            int64_t f = ri - r0 - ws->d[i];
+
+            for(int k = 0; k < dim; k++)
+            {
+                j[k] = qdiv(diff[k], ri) - qdiv(p[k], r0);
+                g[k] += j[k] * f;
+
+                for(int c = 0; c <= k; c++)
+                    h[k][c] += j[k] * j[c];
+            }
+        }
+
+        for(int k = 0; k < dim; k++)
+        {
+            g[k] = shr_round(g[k], QN);
+
+            for(int c = 0; c <= k; c++)
+                h[k][c] = shr_round(h[k][c], QN);
+        }
+
+        if(ldl_factor_q(h, dim) != 0)
+            return -1;
+
+        ldl_subst_q(h, dim, g);
+        it++;
+
+        int64_t step = 0;
+
+        for(int k = 0; k < dim; k++)
+        {
+            p[k] -= g[k];
+            step = max64(step, llabs(g[k]));
+        }
+
+        if(step < Q_GN_TOL)
+            break;
+    }
+
+    for(int k = 0; k < 3; k++)
+        fix->p[k] = (k < dim) ? shr_round(p[k], -to_q) + anchors[0][k] : 0;
+
+    fix->rms = shr_round(isqrt64(tdoa_rss_q(ws, dim, n, p) / (n - 1)), -to_q);
+    fix->iters = it;
+
+    return 0;
+}
+
+int32_t loc_ticks_to_m_q16(int64_t ticks)
+{
+    int64_t p = ticks * MM_PER_TICK_Q16;
+
+    return (int32_t)((p < 0) ? (p - 500) / 1000 : (p + 500) / 1000);
+}
@@ -0,0 +1,58 @@
+#ifndef LOC_TDOA_H
+#define LOC_TDOA_H
+
+#include <stdint.h>
+
+/* TDoA multilateration, 2D or 3D.
+ *
+ * Anchor 0 is the reference: d[i] = r_i - r_0 is the range difference of
+ * anchor i in meters (the TDoA times c), d[0] is ignored.
+ *
+ * Chan's linearisation 2 a_i.p + 2 d_i r_0 = |a_i|^2 - d_i^2 (anchor 0 at
+ * the origin) is solved by least squares for p and r_0 to seed the
+ * Gauss-Newton refinement of r_i - r_0 = d_i. With only dim + 1 anchors
+ * it is short one equation and r_0 comes from |p| = r_0 instead.
+ *
+ * Anchors are moved to anchor 0 and scaled down so both variants work on
+ * numbers near 1. The float one suits the nRF52833 FPU, the Q16.16 one
+ * (meters, int32) builds without it. Workspaces are the caller's, e.g.
+ * static, nothing is allocated. */
+
+#define LOC_MAX_ANCHORS     16
+#define LOC_GN_ITERS        8
+
+struct loc_tdoa_ws {
+    float a[LOC_MAX_ANCHORS][3];
+    float d[LOC_MAX_ANCHORS];
+};
+
+struct loc_tdoa_ws_q16 {
+    int32_t a[LOC_MAX_ANCHORS][3];
+    int32_t d[LOC_MAX_ANCHORS];
+};
+
+struct loc_fix {
+    float   p[3];
+    float   rms;            /* of the range difference residuals, m */
+    uint8_t iters;
+};
+
+struct loc_fix_q16 {
+    int32_t p[3];
+    int32_t rms;
+    uint8_t iters;
+};
+
+/* solve for n anchors (dim + 1 <= n <= LOC_MAX_ANCHORS). z of the
+ * anchors is ignored and p[2] set to 0 in 2D. returns -1 on bad input
+ * or degenerate geometry. */
+int loc_tdoa_solve(struct loc_tdoa_ws *ws, int dim, int n, const float (*anchors)[3],
+                   const float *d, struct loc_fix *fix);
+
+int loc_tdoa_solve_q16(struct loc_tdoa_ws_q16 *ws, int dim, int n, const int32_t (*anchors)[3],
+                       const int32_t *d, struct loc_fix_q16 *fix);
+
+/* DW3000 ticks of a time difference to meters, Q16.16 */
+int32_t loc_ticks_to_m_q16(int64_t ticks);
+
+#endif
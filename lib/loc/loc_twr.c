@@ -0,0 +1,219 @@
+#include <math.h>
+
+#include "loc_linalg.h"
+#include "loc_twr.h"
+
+/* Gauss-Newton stops once a step is below this, m */
+#define GN_TOL  1e-4f
+
+static float dot(const float *a, const float *b, int dim)
+{
+    float s = 0;
+
+    for(int k = 0; k < dim; k++)
+        s += a[k] * b[k];
+
+    return s;
+}
+
+/* linear seed: |p - a_i|^2 - r_i^2 is the same for all anchors, so its
+ * weighted mean can be subtracted out. anchors are already centred. */
+static int twr_init(const struct loc_twr_ws *ws, int dim, int n, float *p)
+{
+    float nm[4][4] = {0};
+    float v[4] = {0};
+    float mean_a[3] = {0};
+    float mean_b = 0;
+    float sw = 0;
+
+    for(int i = 0; i < n; i++)
+    {
+        if(!ws->used[i])
+            continue;
+
+        sw += ws->w[i];
+        mean_b += ws->w[i] * (ws->r[i] * ws->r[i] - dot(ws->a[i], ws->a[i], dim));
+
+        for(int k = 0; k < dim; k++)
+            mean_a[k] += ws->w[i] * ws->a[i][k];
+    }
+
+    mean_b /= sw;
+    for(int k = 0; k < dim; k++)
+        mean_a[k] /= sw;
+
+    /* -2 (a_i - mean_a).p = (r_i^2 - |a_i|^2) - mean_b */
+    for(int i = 0; i < n; i++)
+    {
+        if(!ws->used[i])
+            continue;
+
+        float row[3];
+        float b = ws->r[i] * ws->r[i] - dot(ws->a[i], ws->a[i], dim) - mean_b;
+
+        for(int k = 0; k < dim; k++)
+            row[k] = -2 * (ws->a[i][k] - mean_a[k]);
+
+        for(int k = 0; k < dim; k++)
+        {
+            v[k] += ws->w[i] * row[k] * b;
+
+            for(int c = 0; c <= k; c++)
+                nm[k][c] += ws->w[i] * row[k] * row[c];
+        }
+    }
+
+    if(loc_ldl_factor(nm, dim) != 0)
+        return -1;
+
+    loc_ldl_subst(nm, dim, v);
+
+    for(int k = 0; k < dim; k++)
+        p[k] = v[k];
+
+    return 0;
+}
+
+/* weighted Gauss-Newton from p, leaves the residuals in ws->res */
+static int twr_refine(struct loc_twr_ws *ws, int dim, int n, float *p, int *iters)
+{
+    int it = 0;
+
+    while(it < LOC_GN_ITERS)
+    {
+        float h[4][4] = {0};
+        float g[4] = {0};
+
+        for(int i = 0; i < n; i++)
+        {
+            if(!ws->used[i])
+                continue;
+
+            float diff[3];
+
+            for(int k = 0; k < dim; k++)
+                diff[k] = p[k] - ws->a[i][k];
+
+            float ri = fmaxf(loc_norm(diff, dim), 1e-6f);
+            float f = ri - ws->r[i];
+
+            for(int k = 0; k < dim; k++)
+            {
+                float jk = diff[k] / ri;
+                g[k] += ws->w[i] * jk * f;
+
+                for(int c = 0; c <= k; c++)
+                    h[k][c] += ws->w[i] * jk * diff[c] / ri;
+            }
+        }
+
+        if(loc_ldl_factor(h, dim) != 0)
+            return -1;
+
+        loc_ldl_subst(h, dim, g);
+        it++;
+
+        for(int k = 0; k < dim; k++)
+            p[k] -= g[k];
+
+        if(loc_norm(g, dim) < GN_TOL)
+            break;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        float diff[3];
+
+        for(int k = 0; k < dim; k++)
+            diff[k] = p[k] - ws->a[i][k];
+
+        ws->res[i] = loc_norm(diff, dim) - ws->r[i];
+    }
+
+    *iters += it;
+
+    return 0;
+}
+
+int loc_twr_solve(struct loc_twr_ws *ws, int dim, int n, const float (*anchors)[3],
+                  const float *r, const float *sigma, struct loc_twr_fix *fix)
+{
+    if((dim != 2 && dim != 3) || n < dim + 1 || n > LOC_MAX_ANCHORS)
+        return -1;
+
+    /* centred on the anchors, so the seed is not lost in rounding far
+     * from the origin */
+    float centre[3] = {0};
+
+    for(int i = 0; i < n; i++)
+        for(int k = 0; k < dim; k++)
+            centre[k] += anchors[i][k] / n;
+
+    for(int i = 0; i < n; i++)
+    {
+        float s = sigma ? sigma[i] : LOC_TWR_SIGMA_M;
+
+        for(int k = 0; k < dim; k++)
+            ws->a[i][k] = anchors[i][k] - centre[k];
+
+        ws->r[i] = r[i];
+        ws->w[i] = 1.0f / (s * s);
+        ws->used[i] = (s > 0 && r[i] >= 0);
+    }
+
+    int n_used = 0;
+    for(int i = 0; i < n; i++)
+        n_used += ws->used[i];
+
+    float p[3] = {0};
+    int iters = 0;
+
+    fix->rejected = 0;
+
+    for(int drop = 0; ; drop++)
+    {
+        if(n_used < dim + 1 || twr_init(ws, dim, n, p) != 0 ||
+           twr_refine(ws, dim, n, p, &iters) != 0)
+            return -1;
+
+        if(drop == LOC_TWR_MAX_DROP || n_used <= dim + 2)
+            break;
+
+        /* worst residual in sigmas */
+        int worst = -1;
+        float worst_z = LOC_TWR_GATE;
+
+        for(int i = 0; i < n; i++)
+        {
+            float z = fabsf(ws->res[i]) * sqrtf(ws->w[i]);
+
+            if(ws->used[i] && z > worst_z)
+            {
+                worst_z = z;
+                worst = i;
+            }
+        }
+
+        if(worst < 0)
+            break;
+
+        ws->used[worst] = 0;
+        fix->rejected |= 1 << worst;
+        n_used--;
+    }
+
+    float ss = 0;
+
+    for(int i = 0; i < n; i++)
+        if(ws->used[i])
+            ss += ws->res[i] * ws->res[i];
+
+    for(int k = 0; k < 3; k++)
+        fix->p[k] = (k < dim) ? p[k] + centre[k] : 0;
+
+    fix->rms = sqrtf(ss / n_used);
+    fix->n_used = n_used;
+    fix->iters = iters;
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#ifndef LOC_TWR_H
+#define LOC_TWR_H
+
+#include <stdint.h>
+#include "loc_tdoa.h"
+
+/* TWR multilateration by weighted least squares, 2D or 3D.
+ *
+ * All ranges go into one fit, weighted by 1/sigma^2: differencing
+ * |p - a_i|^2 = r_i^2 against the weighted mean gives a linear seed,
+ * then Gauss-Newton refines |p - a_i| = r_i. Both are one pass over the
+ * anchors per iteration.
+ *
+ * Outliers (NLOS, a bad antenna delay) are rejected on residuals: while
+ * more than dim + 2 anchors remain, the worst range whose residual is
+ * beyond LOC_TWR_GATE sigma is dropped and the fit repeated, at most
+ * LOC_TWR_MAX_DROP times, so a fix stays O(N). With fewer, the fit left
+ * after a drop is exact and says nothing about which range was bad. */
+
+#define LOC_TWR_SIGMA_M     0.1f    /* range sigma when the caller has none */
+#define LOC_TWR_GATE        3.0f
+#define LOC_TWR_MAX_DROP    2
+
+struct loc_twr_ws {
+    float   a[LOC_MAX_ANCHORS][3];
+    float   r[LOC_MAX_ANCHORS];
+    float   w[LOC_MAX_ANCHORS];
+    float   res[LOC_MAX_ANCHORS];
+    uint8_t used[LOC_MAX_ANCHORS];
+};
+
+struct loc_twr_fix {
+    float    p[3];
+    float    rms;           /* of the residuals of the ranges used, m */
+    uint8_t  n_used;
+    uint8_t  iters;
+    uint16_t rejected;      /* bit i: range i dropped as an outlier */
+};
+
+/* solve from n ranges r[i] (m) to anchors[i]. sigma may be NULL. z of
+ * the anchors is ignored and p[2] set to 0 in 2D. returns -1 on bad
+ * input or degenerate geometry. */
+int loc_twr_solve(struct loc_twr_ws *ws, int dim, int n, const float (*anchors)[3],
+                  const float *r, const float *sigma, struct loc_twr_fix *fix);
+
+#endif
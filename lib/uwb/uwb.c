@@ -1,25 +1,50 @@
+#include <string.h>
+
 #include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_msg.h"
 #include "deca_probe_interface.h"
 #include "dw3000_hw.h"
+#include "dw3000_spi.h"
 #include "port.h"
 
+/* last window written to the radio, see uwb_rx_window_set() */
+static struct uwb_rx_window rx_window;
+
+/* frames that did not fit the caller's buffer in rx_take() */
+static uint32_t rx_too_long;
+
 dwt_config_t uwb_default_config = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
+    .chan = UWB_PROFILE_CHAN,
+    .txPreambLength = UWB_PROFILE_PLEN,
+    .rxPAC = UWB_PROFILE_PAC,
+    .txCode = UWB_PROFILE_CODE,
+    .rxCode = UWB_PROFILE_CODE,
+    .sfdType = UWB_PROFILE_SFD,
+    .dataRate = UWB_PROFILE_BR,
     .phrMode = DWT_PHRMODE_STD,
     .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
+    .sfdTO = UWB_SFD_TO,
+    .stsMode = UWB_PROFILE_STS_MODE,
+    .stsLength = UWB_PROFILE_STS_LEN,
     .pdoaMode = DWT_PDOA_M0,
 };
 
-int uwb_init(uint16_t ant_dly)
+#if defined(CONFIG_UWB_PROFILE_STS)
+/* every node in the network must use the same key and IV */
+static dwt_sts_cp_key_t sts_key = {
+    0x14EB220F, 0xF86050A8, 0xD1D336AA, 0x14148674
+};
+
+static dwt_sts_cp_iv_t sts_iv = {
+    0x1F9A3DE4, 0xD37EC3CA, 0xC44FA8FB, 0x362EEB34
+};
+
+/* added to the counter word of sts_iv, see uwb_sts_set_index() */
+static uint32_t sts_index;
+#endif
+
+int uwb_radio_init(uint16_t ant_dly)
 {
     dw_device_init();
     dw3000_hw_wakeup_pin_low();
@@ -38,15 +63,68 @@ int uwb_init(uint16_t ant_dly)
     if(dwt_configure(&uwb_default_config) != DWT_SUCCESS)
         return -1;
 
+    /* the reset cleared the RX-after-TX delay and both timeouts */
+    memset(&rx_window, 0, sizeof(rx_window));
+
     if(ant_dly > 0)
     {
         dwt_setrxantennadelay(ant_dly);
         dwt_settxantennadelay(ant_dly);
     }
 
+#if defined(CONFIG_UWB_PROFILE_STS)
+    dwt_configurestskey(&sts_key);
+    uwb_sts_reload();
+#endif
+
     return 0;
 }
 
+int uwb_init(uint16_t ant_dly)
+{
+    if(uwb_radio_init(ant_dly) != 0)
+        return -1;
+
+    return uwb_async_init();
+}
+
+void uwb_sts_reload(void)
+{
+#if defined(CONFIG_UWB_PROFILE_STS)
+    dwt_sts_cp_iv_t iv = sts_iv;
+
+    iv.iv0 += sts_index;
+    dwt_configurestsiv(&iv);
+    dwt_configurestsloadiv();
+#endif
+}
+
+void uwb_sts_set_index(uint32_t idx)
+{
+#if defined(CONFIG_UWB_PROFILE_STS)
+    /* the IRQ thread reloads too, in the continuous receiver */
+    decaIrqStatus_t s = decamutexon();
+
+    sts_index = idx;
+    uwb_sts_reload();
+
+    decamutexoff(s);
+#else
+    (void)idx;
+#endif
+}
+
+int uwb_sts_ok(void)
+{
+#if defined(CONFIG_UWB_PROFILE_STS)
+    int16_t q;
+
+    return dwt_readstsquality(&q) >= 0;
+#else
+    return 1;
+#endif
+}
+
 uint64_t uwb_get_tx_ts(void)
 {
     uint8_t ts[5];
@@ -83,54 +161,180 @@ uint64_t uwb_get_sys_time(void)
     return val;
 }
 
-void uwb_tx(uint8_t *data, uint16_t len)
+uint64_t uwb_delayed_tx_ts(uint32_t dly, uint16_t ant_dly)
+{
+    return ((((uint64_t)(dly & 0xFFFFFFFEUL)) << 8) + ant_dly) & 0xFFFFFFFFFFULL;
+}
+
+/* values from deca_regs.h and the DW3000 user manual (the header does
+ * not build in this tree). SYS_STATUS, SYS_STATUS_HI and RX_FINFO are
+ * adjacent and share one SPI frame; 0x50-0x63 is reserved, so the RX
+ * timestamp takes a second one. the others sit in their own register
+ * files and take a frame each. */
+#define UWB_REG_SYS_STATUS  0x44
+#define UWB_REG_RX_FINFO    0x4C
+#define UWB_REG_RX_TIME     0x64
+#define UWB_REG_DRX_CAR_INT 0x60029     /* 21 bits, signed */
+#define UWB_REG_CIA_DIAG_0  0xC0020     /* clock offset in bits 12:0, signed */
+#define UWB_REG_RX_BUFFER_0 0x120000
+#define UWB_RXFLEN_MASK     0x3FF
+
+int uwb_rx_info_read(struct uwb_rx_info *info)
+{
+    uint8_t st[UWB_REG_RX_FINFO + 4 - UWB_REG_SYS_STATUS];
+    uint8_t ts[5];
+    const struct dw3000_spi_op ops[] = {
+        { .reg = UWB_REG_SYS_STATUS, .len = sizeof(st), .buf = st },
+        { .reg = UWB_REG_RX_TIME, .len = sizeof(ts), .buf = ts },
+    };
+
+    if(dw3000_spi_batch(ops, ARRAY_SIZE(ops)) != 0)
+        return -1;
+
+    const uint8_t *finfo = st + UWB_REG_RX_FINFO - UWB_REG_SYS_STATUS;
+
+    info->status = st[0] | (st[1] << 8) | (st[2] << 16) | ((uint32_t)st[3] << 24);
+    info->len = (finfo[0] | (finfo[1] << 8)) & UWB_RXFLEN_MASK;
+    info->rx_ts = uwb_unpack_ts(ts);
+
+    return 0;
+}
+
+int uwb_rx_frame_read(struct uwb_rx_desc *d)
 {
-    dwt_writetxdata(len, data, 0);
-    dwt_writetxfctrl(len + FCS_LEN, 0, 0);
-    dwt_starttx(DWT_START_TX_IMMEDIATE);
+    uint8_t ts[5], ci[3], coe[2];
+    const struct dw3000_spi_op ops[] = {
+        { .reg = UWB_REG_RX_TIME, .len = sizeof(ts), .buf = ts },
+        { .reg = UWB_REG_DRX_CAR_INT, .len = sizeof(ci), .buf = ci },
+        { .reg = UWB_REG_CIA_DIAG_0, .len = sizeof(coe), .buf = coe },
+        { .reg = UWB_REG_RX_BUFFER_0, .len = d->len, .buf = d->data },
+    };
+
+    /* nothing to read of an FCS-only frame */
+    if(dw3000_spi_batch(ops, ARRAY_SIZE(ops) - !d->len) != 0)
+        return -1;
+
+    d->rx_ts = uwb_unpack_ts(ts);
+    /* sign-extend, as dwt_readcarrierintegrator() and dwt_readclockoffset() */
+    d->carrier_integrator = (int32_t)((uint32_t)(ci[0] | (ci[1] << 8) | (ci[2] << 16)) << 11) >> 11;
+    d->clock_offset = (int16_t)((uint16_t)(coe[0] | (coe[1] << 8)) << 3) >> 3;
 
-    while(!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-    dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
+    return 0;
 }
 
-int uwb_tx_delayed(uint8_t *data, uint16_t len, uint32_t tx_time)
+void uwb_tx(uint8_t *data, uint16_t len)
 {
-    dwt_setdelayedtrxtime(tx_time);
-    dwt_writetxdata(len, data, 0);
-    dwt_writetxfctrl(len + FCS_LEN, 0, 0);
+    uwb_tx_submit(data, len, DWT_START_TX_IMMEDIATE, 0);
+    uwb_tx_await(NULL, K_FOREVER);
+}
 
-    if(dwt_starttx(DWT_START_TX_DELAYED) != DWT_SUCCESS)
+int uwb_tx_delayed(uint8_t *data, uint16_t len, uint32_t tx_time)
+{
+    if(uwb_tx_submit(data, len, DWT_START_TX_DELAYED, tx_time) != 0)
         return -1;
 
-    while(!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-    dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
+    uwb_tx_await(NULL, K_FOREVER);
 
     return 0;
 }
 
-int uwb_rx(uint8_t *rx_buf, uint16_t *rx_len)
+/* wait for the RX in progress and copy out its frame */
+static int rx_take(uint8_t *rx_buf, uint16_t size, uint16_t *rx_len)
 {
-    dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    struct uwb_rx_desc *d;
 
-    uint32_t status;
-    while(!((status = dwt_readsysstatuslo()) &
-          (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)));
+    /* the radio always ends an RX with a frame, timeout or error event */
+    uwb_rx_await(&d, K_FOREVER);
 
-    if(!(status & DWT_INT_RXFCG_BIT_MASK))
+    if(!(d->status & DWT_INT_RXFCG_BIT_MASK))
     {
-        uwb_clear_status();
+        uwb_rx_release(d);
         return -1;
     }
 
-    uint16_t len = dwt_getframelength();
-    dwt_readrxdata(rx_buf, len - FCS_LEN, 0);
+    /* some other exchange's frame, a truncated one would only misparse */
+    if(d->len > size)
+    {
+        rx_too_long++;
+        uwb_rx_release(d);
+        return -1;
+    }
+
+    memcpy(rx_buf, d->data, d->len);
 
     if(rx_len)
-        *rx_len = len - FCS_LEN;
+        *rx_len = d->len;
+
+    uwb_rx_release(d);
 
     return 0;
 }
 
+int uwb_rx(uint8_t *rx_buf, uint16_t size, uint16_t *rx_len)
+{
+    uwb_rx_submit(DWT_START_RX_IMMEDIATE);
+
+    return rx_take(rx_buf, size, rx_len);
+}
+
+uint32_t uwb_rx_too_long(void)
+{
+    return rx_too_long;
+}
+
+void uwb_rx_window_set(const struct uwb_rx_window *w)
+{
+    static const struct uwb_rx_window none;
+    decaIrqStatus_t s;
+
+    if(!w)
+        w = &none;
+
+    s = decamutexon();
+
+    if(w->delay_uus != rx_window.delay_uus)
+        dwt_setrxaftertxdelay(w->delay_uus);
+
+    if(w->timeout_uus != rx_window.timeout_uus)
+        dwt_setrxtimeout(w->timeout_uus);
+
+    if(w->pre_timeout_pacs != rx_window.pre_timeout_pacs)
+        dwt_setpreambledetecttimeout(w->pre_timeout_pacs);
+
+    rx_window = *w;
+
+    decamutexoff(s);
+}
+
+/* the TX completion comes first, then the RX one of the chained receive */
+static int tx_rx_await(uint8_t *rx_buf, uint16_t size, uint16_t *rx_len)
+{
+    uwb_tx_await(NULL, K_FOREVER);
+
+    return rx_take(rx_buf, size, rx_len);
+}
+
+int uwb_tx_rx(uint8_t *data, uint16_t len, uint8_t *rx_buf, uint16_t size,
+              uint16_t *rx_len)
+{
+    uwb_tx_submit(data, len, DWT_START_TX_IMMEDIATE | DWT_RESPONSE_EXPECTED, 0);
+
+    return tx_rx_await(rx_buf, size, rx_len);
+}
+
+int uwb_tx_delayed_rx(uint8_t *data, uint16_t len, uint32_t tx_time,
+                      uint8_t *rx_buf, uint16_t size, uint16_t *rx_len)
+{
+    if(uwb_tx_submit(data, len, DWT_START_TX_DELAYED | DWT_RESPONSE_EXPECTED, tx_time) != 0)
+    {
+        /* neither TX nor the chained RX will complete */
+        dwt_forcetrxoff();
+        return -1;
+    }
+
+    return tx_rx_await(rx_buf, size, rx_len);
+}
+
 void uwb_clear_status(void)
 {
     dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
@@ -138,17 +342,43 @@ void uwb_clear_status(void)
         DWT_INT_TXFRS_BIT_MASK);
 }
 
+/* IDLE_RC polling after the wake pulse, in 20 us steps */
+#define UWB_WAKE_POLLS 100
+
+void uwb_sleep_config(void)
+{
+    dwt_configuresleep(DWT_CONFIG, DWT_PRES_SLEEP | DWT_WAKE_WUP | DWT_WAKE_CSN |
+                                   DWT_SLEEP | DWT_SLP_EN);
+    dwt_entersleepafter(DWT_TX_COMPLETE);
+}
+
+int uwb_wakeup(void)
+{
+    dw3000_hw_wakeup();
+    dw3000_hw_wakeup_pin_low();
+
+    for(int i = 0; i < UWB_WAKE_POLLS; i++)
+    {
+        if(dwt_checkidlerc())
+        {
+            dwt_restoreconfig();
+            /* auto sleep is armed per TX */
+            dwt_entersleepafter(DWT_TX_COMPLETE);
+            return 0;
+        }
+
+        k_busy_wait(20);
+    }
+
+    return -1;
+}
+
 void uwb_pack_ts(uint64_t ts, uint8_t *buf)
 {
-    for(int i = 0; i < 5; i++)
-        buf[i] = (ts >> (8 * i));
+    uwb_msg_put_ts(buf, ts);
 }
 
 uint64_t uwb_unpack_ts(const uint8_t *buf)
 {
-    uint64_t val = 0;
-    for(int i = 0; i < 5; i++)
-        val |= ((uint64_t)buf[i]) << (8 * i);
-
-    return val;
+    return uwb_msg_get_ts(buf);
 }
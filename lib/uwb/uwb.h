@@ -3,16 +3,38 @@
 
 #include <stdint.h>
 #include "deca_device_api.h"
+#include "uwb_profile.h"
 
 #define SPEED_OF_LIGHT  299702547.0
 #define UUS_TO_DWT_TIME 63898
 
-/* default config: channel 9, 6.8 Mbps, 128 preamble, no STS */
+/* radio config built from the CONFIG_UWB_PROFILE_* choice (uwb_profile.h) */
 extern dwt_config_t uwb_default_config;
 
-/* init DW3000: probe, configure, set antenna delays */
+/* init DW3000: probe, configure, set antenna delays.
+ * interrupts stay off, for samples that poll dwt_readsysstatuslo(). */
+int uwb_radio_init(uint16_t ant_dly);
+
+/* uwb_radio_init() and start the IRQ engine */
 int uwb_init(uint16_t ant_dly);
 
+/* STS profile: load the shared IV with its counter word offset by the
+ * index set below. the radio steps the counter on every STS frame, so a
+ * node that missed one would fall out of step for good; instead every TX
+ * and RX starts from the index. call before dwt_starttx() /
+ * dwt_rxenable(), no-op in the other profiles. */
+void uwb_sts_reload(void);
+
+/* STS profile: key the following frames to idx and load it now. both
+ * ends of a frame must agree on it, e.g. the TDMA samples use the SYNC
+ * sequence, so a frame replayed from an earlier superframe carries the
+ * wrong STS. samples that never set it send the same STS every frame. */
+void uwb_sts_set_index(uint32_t idx);
+
+/* STS quality of the frame just received: 0 if the STS did not match
+ * and its timestamp cannot be trusted, always 1 in the other profiles */
+int uwb_sts_ok(void);
+
 /* read 40-bit TX timestamp */
 uint64_t uwb_get_tx_ts(void);
 
@@ -22,20 +44,88 @@ uint64_t uwb_get_rx_ts(void);
 /* read 40-bit system time */
 uint64_t uwb_get_sys_time(void);
 
-/* send a frame immediately, blocks until TX done */
+/* TX timestamp of a frame sent with dwt_setdelayedtrxtime(dly), known
+ * before it goes out: the radio ignores the low bit of dly and stamps
+ * the frame ant_dly later */
+uint64_t uwb_delayed_tx_ts(uint32_t dly, uint16_t ant_dly);
+
+/* send a frame immediately, sleeps until TX done */
 void uwb_tx(uint8_t *data, uint16_t len);
 
-/* send a frame at a delayed time, blocks until TX done */
+/* send a frame at a delayed time, sleeps until TX done */
 int uwb_tx_delayed(uint8_t *data, uint16_t len, uint32_t tx_time);
 
-/* enable RX and wait for a frame or timeout/error.
- * returns 0 on success (frame received), -1 on timeout/error.
- * on success, frame is in rx_buf (len written to *rx_len). */
-int uwb_rx(uint8_t *rx_buf, uint16_t *rx_len);
+/* receive window opened by the radio itself after a TX with
+ * DWT_RESPONSE_EXPECTED, so no host turnaround sits between the end of
+ * our frame and RX on. the timeouts also bound uwb_rx(). all zero means
+ * RX on right after TX and no timeouts. */
+struct uwb_rx_window {
+    uint32_t delay_uus;         /* end of our frame -> RX on */
+    uint32_t timeout_uus;       /* RX on -> frame wait timeout */
+    uint16_t pre_timeout_pacs;  /* RX on -> preamble detect timeout */
+};
+
+/* program the window. registers are only written when it changed, so
+ * this is cheap to call before every exchange. NULL clears it. */
+void uwb_rx_window_set(const struct uwb_rx_window *w);
+
+/* send a frame immediately and receive the reply in the window set with
+ * uwb_rx_window_set(). sleeps until both are done. returns -1 on RX
+ * timeout/error, the frame went out either way. on success the reply is
+ * in rx_buf (len written to *rx_len). a reply longer than size is
+ * dropped like an RX error, see uwb_rx_too_long(). */
+int uwb_tx_rx(uint8_t *data, uint16_t len, uint8_t *rx_buf, uint16_t size,
+              uint16_t *rx_len);
+
+/* uwb_tx_rx() with a delayed TX. returns -1 if the TX was late (nothing
+ * sent, receiver stays off) or on RX timeout/error. */
+int uwb_tx_delayed_rx(uint8_t *data, uint16_t len, uint32_t tx_time,
+                      uint8_t *rx_buf, uint16_t size, uint16_t *rx_len);
+
+/* frame status, length and RX timestamp of the last reception */
+struct uwb_rx_info {
+    uint32_t status;        /* SYS_STATUS low word, as dwt_readsysstatuslo() */
+    uint16_t len;           /* frame length including FCS, as dwt_getframelength() */
+    uint64_t rx_ts;
+};
+
+/* read uwb_rx_info in one SPI batch instead of three driver calls.
+ * single RX buffer mode only; the double buffer keeps its own copies.
+ * returns -1 on an SPI error. */
+int uwb_rx_info_read(struct uwb_rx_info *info);
+
+struct uwb_rx_desc;
+
+/* fill d->data (d->len bytes), rx_ts, clock_offset and
+ * carrier_integrator of the last reception in one SPI batch. single RX
+ * buffer mode only, call from the DW3000 IRQ thread. returns -1 on an
+ * SPI error. */
+int uwb_rx_frame_read(struct uwb_rx_desc *d);
+
+/* enable RX and sleep until a frame or timeout/error.
+ * returns 0 on success (frame received), -1 on timeout/error or a frame
+ * longer than size. on success, frame is in rx_buf (len written to
+ * *rx_len). size UWB_MSG_MAX takes any frame. */
+int uwb_rx(uint8_t *rx_buf, uint16_t size, uint16_t *rx_len);
+
+/* frames dropped by uwb_rx(), uwb_tx_rx() and uwb_tx_delayed_rx()
+ * because they did not fit the caller's buffer */
+uint32_t uwb_rx_too_long(void);
 
 /* clear all RX/TX status flags */
 void uwb_clear_status(void);
 
+/* low-power tags: let the DW3000 drop into SLEEP by itself after every
+ * TX, keeping its configuration in the AON block. only for the polled
+ * uwb_radio_init() setup: a sleeping chip must not see SPI traffic from
+ * an ISR, any access wakes it. */
+void uwb_sleep_config(void);
+
+/* wake the DW3000 from SLEEP and restore its configuration. the TX
+ * buffer is not retained, reload the frame afterwards. returns -1 if the
+ * chip did not reach IDLE_RC. */
+int uwb_wakeup(void);
+
 /* pack a 40-bit timestamp into 5 bytes (little-endian) */
 void uwb_pack_ts(uint64_t ts, uint8_t *buf);
 
@@ -0,0 +1,315 @@
+#include "uwb_async.h"
+#include "uwb.h"
+#include "port.h"
+
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(uwb_async, LOG_LEVEL_INF);
+
+BUILD_ASSERT((UWB_TX_RING_LEN & (UWB_TX_RING_LEN - 1)) == 0, "TX ring must be a power of two");
+
+#define UWB_ASYNC_INT_MASK (DWT_INT_TXFRS_BIT_MASK | DWT_INT_RXFCG_BIT_MASK | \
+                            SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)
+
+/* RX: descriptors are allocated from the pool by the driver callbacks and
+ * queued to rx_done in completion order. TX: single producer (callbacks),
+ * single consumer (application thread), head only written by the callbacks,
+ * tail only by the consumer, and the semaphore counts filled descriptors. */
+
+K_MEM_SLAB_DEFINE_STATIC(rx_pool, sizeof(struct uwb_rx_desc), UWB_RX_POOL_LEN, 4);
+static K_FIFO_DEFINE(rx_done);
+
+static struct uwb_tx_desc tx_ring[UWB_TX_RING_LEN];
+static volatile uint32_t tx_head;
+static volatile uint32_t tx_tail;
+static K_SEM_DEFINE(tx_sem, 0, UWB_TX_RING_LEN);
+
+static struct uwb_async_stats stats;
+
+/* set while the anchor double-buffer receiver is running */
+static volatile bool rx_continuous;
+
+/* free RX descriptor, or NULL if consumers hold the whole pool */
+static struct uwb_rx_desc *rx_alloc(void)
+{
+    void *mem;
+
+    if(k_mem_slab_alloc(&rx_pool, &mem, K_NO_WAIT) != 0)
+    {
+        stats.rx_dropped++;
+        return NULL;
+    }
+
+    struct uwb_rx_desc *d = mem;
+    atomic_set(&d->ref, 1);
+
+    return d;
+}
+
+static void rx_push(struct uwb_rx_desc *d)
+{
+    k_fifo_put(&rx_done, d);
+}
+
+static void rx_ok_cb(const dwt_cb_data_t *cb)
+{
+    struct uwb_rx_desc *d = rx_alloc();
+    if(!d)
+    {
+        /* the radio must still get its buffer back */
+        if(rx_continuous)
+        {
+            uwb_sts_reload();
+            dwt_signal_rx_buff_free();
+        }
+        return;
+    }
+
+    uint16_t len = cb->datalength;
+    if(len < FCS_LEN || len - FCS_LEN > UWB_FRAME_MAX)
+        len = FCS_LEN;
+
+    d->len = len - FCS_LEN;
+    /* in double-buffer mode RXFCG is reported in RDB_STATUS, not in
+     * SYS_STATUS; keep the flag so consumers test it the same way */
+    d->status = cb->status | DWT_INT_RXFCG_BIT_MASK;
+    /* skew of the sender, only valid until the next frame lands. the
+     * double buffer keeps these in the filled buffer's own register set,
+     * which only the driver tracks */
+    if(rx_continuous || uwb_rx_frame_read(d) != 0)
+    {
+        dwt_readrxdata(d->data, d->len, 0);
+        d->rx_ts = uwb_get_rx_ts();
+        d->clock_offset = dwt_readclockoffset();
+        d->carrier_integrator = dwt_readcarrierintegrator();
+    }
+    d->sts_bad = !uwb_sts_ok();
+    if(d->sts_bad)
+        stats.rx_sts_bad++;
+
+    /* data and timestamp are out, the radio may refill this buffer */
+    if(rx_continuous)
+    {
+        uwb_sts_reload();
+        dwt_signal_rx_buff_free();
+    }
+
+    stats.rx_ok++;
+    rx_push(d);
+}
+
+static void rx_fail(const dwt_cb_data_t *cb)
+{
+    if(rx_continuous)
+    {
+        /* nobody waits on a single RX here: just count and listen again */
+        if(cb->status & DWT_INT_RXOVRR_BIT_MASK)
+        {
+            stats.rx_overrun++;
+            dwt_forcetrxoff();
+        }
+
+        uwb_sts_reload();
+        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+        return;
+    }
+
+    struct uwb_rx_desc *d = rx_alloc();
+    if(!d)
+        return;
+
+    d->len = 0;
+    d->rx_ts = 0;
+    d->clock_offset = 0;
+    d->carrier_integrator = 0;
+    d->sts_bad = 0;
+    d->status = cb->status;
+
+    rx_push(d);
+}
+
+static void rx_to_cb(const dwt_cb_data_t *cb)
+{
+    stats.rx_timeout++;
+    rx_fail(cb);
+}
+
+static void rx_err_cb(const dwt_cb_data_t *cb)
+{
+    stats.rx_error++;
+    rx_fail(cb);
+}
+
+static void tx_done_cb(const dwt_cb_data_t *cb)
+{
+    stats.tx_done++;
+
+    /* a chained RX is already waiting: the reply must find the IV too */
+    uwb_sts_reload();
+
+    if(tx_head - tx_tail >= UWB_TX_RING_LEN)
+        return;
+
+    struct uwb_tx_desc *d = &tx_ring[tx_head & (UWB_TX_RING_LEN - 1)];
+    d->status = cb->status;
+    d->tx_ts = uwb_get_tx_ts();
+
+    tx_head++;
+    k_sem_give(&tx_sem);
+}
+
+int uwb_async_init(void)
+{
+    dwt_setcallbacks(tx_done_cb, rx_ok_cb, rx_to_cb, rx_err_cb, NULL, NULL, NULL);
+
+    dwt_setinterrupt(UWB_ASYNC_INT_MASK, 0, DWT_ENABLE_INT_ONLY);
+    dwt_writesysstatuslo(UWB_ASYNC_INT_MASK);
+
+    uwb_async_flush();
+
+    /* routes the DW3000 IRQ GPIO to dwt_isr() */
+    port_set_dwic_isr(dwt_isr);
+
+    return 0;
+}
+
+int uwb_rx_submit(int mode)
+{
+    decaIrqStatus_t s = decamutexon();
+    int ret = 0;
+
+    uwb_sts_reload();
+    if(dwt_rxenable(mode) != DWT_SUCCESS)
+        ret = -1;
+
+    decamutexoff(s);
+
+    return ret;
+}
+
+int uwb_rx_continuous_start(void)
+{
+    decaIrqStatus_t s = decamutexon();
+    int ret = 0;
+
+    dwt_forcetrxoff();
+    uwb_async_flush();
+
+    /* through the cache, so a window set again afterwards is written */
+    uwb_rx_window_set(NULL);
+
+    dwt_setdblrxbuffmode(DBL_BUF_STATE_EN, DBL_BUF_MODE_MAN);
+    dwt_setinterrupt_db(RDB_STATUS_RXOK, DWT_ENABLE_INT_ONLY);
+    dwt_setinterrupt(UWB_ASYNC_INT_MASK | DWT_INT_RXOVRR_BIT_MASK, 0, DWT_ENABLE_INT_ONLY);
+
+    rx_continuous = true;
+
+    uwb_sts_reload();
+    if(dwt_rxenable(DWT_START_RX_IMMEDIATE) != DWT_SUCCESS)
+    {
+        uwb_rx_continuous_stop();
+        ret = -1;
+    }
+
+    decamutexoff(s);
+
+    return ret;
+}
+
+void uwb_rx_continuous_stop(void)
+{
+    decaIrqStatus_t s = decamutexon();
+
+    dwt_forcetrxoff();
+
+    rx_continuous = false;
+
+    dwt_setinterrupt_db(0, DWT_ENABLE_INT_ONLY);
+    dwt_setdblrxbuffmode(DBL_BUF_STATE_DIS, DBL_BUF_MODE_MAN);
+    dwt_setinterrupt(UWB_ASYNC_INT_MASK, 0, DWT_ENABLE_INT_ONLY);
+
+    uwb_async_flush();
+
+    decamutexoff(s);
+}
+
+int uwb_rx_await(struct uwb_rx_desc **desc, k_timeout_t timeout)
+{
+    struct uwb_rx_desc *d = k_fifo_get(&rx_done, timeout);
+    if(!d)
+        return -1;
+
+    *desc = d;
+    return 0;
+}
+
+void uwb_rx_hold(struct uwb_rx_desc *desc)
+{
+    atomic_inc(&desc->ref);
+}
+
+void uwb_rx_release(struct uwb_rx_desc *desc)
+{
+    __ASSERT(atomic_get(&desc->ref) > 0, "RX descriptor released twice");
+
+    if(atomic_dec(&desc->ref) == 1)
+        k_mem_slab_free(&rx_pool, desc);
+}
+
+uint32_t uwb_rx_pool_used(void)
+{
+    return k_mem_slab_num_used_get(&rx_pool);
+}
+
+int uwb_tx_submit(const uint8_t *data, uint16_t len, uint8_t mode, uint32_t tx_time)
+{
+    /* keep dwt_isr() out until the whole TX is set up */
+    decaIrqStatus_t s = decamutexon();
+    int ret = 0;
+
+    dwt_writetxdata(len, (uint8_t *)data, 0);
+    dwt_writetxfctrl(len + FCS_LEN, 0, 0);
+
+    if(mode & DWT_START_TX_DELAYED)
+        dwt_setdelayedtrxtime(tx_time);
+
+    uwb_sts_reload();
+    if(dwt_starttx(mode) != DWT_SUCCESS)
+    {
+        stats.tx_late++;
+        ret = -1;
+    }
+
+    decamutexoff(s);
+
+    return ret;
+}
+
+int uwb_tx_await(struct uwb_tx_desc *desc, k_timeout_t timeout)
+{
+    if(k_sem_take(&tx_sem, timeout) != 0)
+        return -1;
+
+    if(desc)
+        *desc = tx_ring[tx_tail & (UWB_TX_RING_LEN - 1)];
+
+    tx_tail++;
+    return 0;
+}
+
+void uwb_async_flush(void)
+{
+    /* descriptors already handed out stay valid until released */
+    struct uwb_rx_desc *d;
+
+    while((d = k_fifo_get(&rx_done, K_NO_WAIT)) != NULL)
+        uwb_rx_release(d);
+
+    k_sem_reset(&tx_sem);
+    tx_tail = tx_head;
+}
+
+void uwb_async_get_stats(struct uwb_async_stats *out)
+{
+    *out = stats;
+}
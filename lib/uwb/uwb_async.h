@@ -0,0 +1,107 @@
+#ifndef UWB_ASYNC_H
+#define UWB_ASYNC_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+#include "deca_device_api.h"
+
+/* Interrupt-driven RX/TX engine.
+ *
+ * dwt_isr() runs from the DW3000 IRQ (dw3000_hw.c) and the driver callbacks
+ * fill RX/TX completion descriptors. Threads submit an operation and then
+ * sleep in *_await() instead of spinning on dwt_readsysstatuslo() over SPI.
+ *
+ * RX descriptors come from a fixed pool: the frame is read from the radio
+ * once, straight into the descriptor, and handlers and exporters work on
+ * it by reference. A descriptor goes back to the pool when its last
+ * reference is released, in any order. */
+
+#define UWB_FRAME_MAX    127
+
+/* RX descriptors, including those held by consumers */
+#define UWB_RX_POOL_LEN  8
+
+/* TX ring size, must be a power of two */
+#define UWB_TX_RING_LEN  4
+
+/* RX completion: a good frame, or a timeout/error event with len == 0.
+ * status is the SYS_STATUS value latched by dwt_isr(), so callers test
+ * DWT_INT_RXFCG_BIT_MASK exactly like the polling loops did. */
+struct uwb_rx_desc {
+    void    *fifo_reserved;         /* k_fifo link, owned by uwb_async */
+    atomic_t ref;
+    uint8_t  data[UWB_FRAME_MAX];
+    uint16_t len;
+    uint64_t rx_ts;
+    uint32_t status;
+    int16_t  clock_offset;          /* dwt_readclockoffset() for this frame */
+    int32_t  carrier_integrator;    /* dwt_readcarrierintegrator() for this frame */
+    uint8_t  sts_bad;               /* STS profile: wrong STS, rx_ts is not trusted */
+};
+
+/* TX completion */
+struct uwb_tx_desc {
+    uint64_t tx_ts;
+    uint32_t status;
+};
+
+struct uwb_async_stats {
+    uint32_t rx_ok;
+    uint32_t rx_timeout;
+    uint32_t rx_error;
+    uint32_t rx_dropped;    /* completions lost because the RX pool was empty */
+    uint32_t rx_overrun;    /* frames lost because both radio RX buffers were full */
+    uint32_t rx_sts_bad;    /* good frames whose STS did not match (uwb_sts_ok()) */
+    uint32_t tx_done;
+    uint32_t tx_late;       /* delayed TX rejected by the radio */
+};
+
+/* register callbacks, enable DW3000 interrupts and the host IRQ line.
+ * called by uwb_init(), after dwt_configure(). */
+int uwb_async_init(void);
+
+/* enable the receiver (DWT_START_RX_IMMEDIATE / DWT_START_RX_DELAYED).
+ * completion is delivered to the RX ring. returns -1 if the radio
+ * rejected a delayed start. */
+int uwb_rx_submit(int mode);
+
+/* anchor mode: keep the receiver on with the DW3000 double RX buffer.
+ * the radio fills the alternate buffer while the previous frame is being
+ * read, and gets its buffer back as soon as data and timestamp are copied
+ * into the ring. only good frames are delivered; errors and timeouts
+ * just re-enable the receiver. do not call uwb_rx_submit() in this mode.
+ * returns -1 if the receiver could not be started. */
+int uwb_rx_continuous_start(void);
+
+/* leave anchor mode and return to single-buffer RX */
+void uwb_rx_continuous_stop(void);
+
+/* wait for the next RX completion. returns 0 and a descriptor holding
+ * one reference for the caller, or -1 if nothing completed within
+ * timeout. */
+int uwb_rx_await(struct uwb_rx_desc **desc, k_timeout_t timeout);
+
+/* take another reference, e.g. before passing the descriptor to another
+ * thread that releases it on its own */
+void uwb_rx_hold(struct uwb_rx_desc *desc);
+
+/* drop a reference, the last one returns the descriptor to the pool */
+void uwb_rx_release(struct uwb_rx_desc *desc);
+
+/* descriptors currently out of the pool */
+uint32_t uwb_rx_pool_used(void);
+
+/* load a frame and start TX (DWT_START_TX_IMMEDIATE / DWT_START_TX_DELAYED,
+ * optionally | DWT_RESPONSE_EXPECTED). tx_time is only used for delayed TX.
+ * returns -1 if the radio rejected a delayed start (too late). */
+int uwb_tx_submit(const uint8_t *data, uint16_t len, uint8_t mode, uint32_t tx_time);
+
+/* wait for the next TX completion. desc may be NULL. */
+int uwb_tx_await(struct uwb_tx_desc *desc, k_timeout_t timeout);
+
+/* drop any pending completions, e.g. after dwt_forcetrxoff() */
+void uwb_async_flush(void);
+
+void uwb_async_get_stats(struct uwb_async_stats *stats);
+
+#endif
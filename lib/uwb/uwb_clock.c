@@ -0,0 +1,256 @@
+#include <math.h>
+#include <string.h>
+
+#include "uwb.h"
+#include "uwb_clock.h"
+#include "uwb_ts.h"
+
+#define FULL40  (2 * UWB_TS_HALF)
+
+/* DW ticks per second */
+#define TICKS_PER_S (1.0 / DWT_TIME_UNITS)
+
+/* carrier integrator -> Hz -> ppm, channel 9 (see samples/clock_drift) */
+#define FREQ_OFFSET_MULTIPLIER      (998.4e6 / 2.0 / 1024.0 / 131072.0)
+#define HERTZ_TO_PPM_MULTIPLIER_CH9 (-1.0e6 / 7987.2e6)
+
+const struct uwb_clock_cfg uwb_clock_default_cfg = {
+    .states   = 2,
+    .ts_sigma = 8.0,        /* ~125 ps */
+    .skew_q   = 1.0e6,      /* ~0.016 ppm/sqrt(s), follows the ~0.07 ppm
+                             * skew steps seen in the tdoa_data captures */
+    .rate_q   = 1.0e2,
+    .gate     = 5.0,
+};
+
+static double wrap40(double d)
+{
+    while(d >= (double)UWB_TS_HALF)
+        d -= (double)FULL40;
+    while(d < -(double)UWB_TS_HALF)
+        d += (double)FULL40;
+
+    return d;
+}
+
+static double dt_seconds(uint64_t from, uint64_t to)
+{
+    return (double)uwb_ts_sub(to, from) * DWT_TIME_UNITS;
+}
+
+void uwb_clock_init(struct uwb_clock *c, const struct uwb_clock_cfg *cfg)
+{
+    memset(c, 0, sizeof(*c));
+    c->cfg = cfg ? *cfg : uwb_clock_default_cfg;
+
+    if(c->cfg.states != 3)
+        c->cfg.states = 2;
+}
+
+static void restart(struct uwb_clock *c, uint64_t local_rx, double offset)
+{
+    int n = c->cfg.states;
+
+    memset(c->x, 0, sizeof(c->x));
+    memset(c->P, 0, sizeof(c->P));
+
+    c->x[0] = offset;
+    c->P[0][0] = c->cfg.ts_sigma * c->cfg.ts_sigma;
+    c->P[1][1] = 50e-6 * TICKS_PER_S * 50e-6 * TICKS_PER_S;   /* +-50 ppm */
+    if(n == 3)
+        c->P[2][2] = 1e-6 * TICKS_PER_S * 1e-6 * TICKS_PER_S; /* 1 ppm/s */
+
+    c->ref_local = local_rx;
+    c->valid = true;
+    c->rejects = 0;
+}
+
+/* x = F x, P = F P F' + Q over dt seconds */
+static void predict(struct uwb_clock *c, double dt)
+{
+    int n = c->cfg.states;
+    double F[3][3] = {
+        { 1, dt, 0.5 * dt * dt },
+        { 0, 1,  dt },
+        { 0, 0,  1 },
+    };
+    if(n == 2)
+        F[0][2] = F[1][2] = 0;
+
+    double x[3] = { 0 };
+    for(int i = 0; i < n; i++)
+        for(int j = 0; j < n; j++)
+            x[i] += F[i][j] * c->x[j];
+    memcpy(c->x, x, sizeof(x));
+
+    double FP[3][3] = { { 0 } };
+    for(int i = 0; i < n; i++)
+        for(int j = 0; j < n; j++)
+            for(int k = 0; k < n; k++)
+                FP[i][j] += F[i][k] * c->P[k][j];
+
+    double P[3][3] = { { 0 } };
+    for(int i = 0; i < n; i++)
+        for(int j = 0; j < n; j++)
+            for(int k = 0; k < n; k++)
+                P[i][j] += FP[i][k] * F[j][k];
+
+    /* white noise on the highest derivative, integrated over dt */
+    double dt2 = dt * dt, dt3 = dt2 * dt;
+    double q = c->cfg.skew_q;
+
+    P[0][0] += q * dt3 / 3;
+    P[0][1] += q * dt2 / 2;
+    P[1][0] += q * dt2 / 2;
+    P[1][1] += q * dt;
+
+    if(n == 3)
+    {
+        double r = c->cfg.rate_q;
+        double dt4 = dt3 * dt, dt5 = dt4 * dt;
+
+        P[0][0] += r * dt5 / 20;
+        P[0][1] += r * dt4 / 8;
+        P[1][0] += r * dt4 / 8;
+        P[0][2] += r * dt3 / 6;
+        P[2][0] += r * dt3 / 6;
+        P[1][1] += r * dt3 / 3;
+        P[1][2] += r * dt2 / 2;
+        P[2][1] += r * dt2 / 2;
+        P[2][2] += r * dt;
+    }
+
+    memcpy(c->P, P, sizeof(P));
+}
+
+/* scalar update of state h (0: offset, 1: skew) with innovation y and
+ * variance R. returns -1 if gated. */
+static int update(struct uwb_clock *c, int h, double y, double R, bool gated)
+{
+    int n = c->cfg.states;
+    double S = c->P[h][h] + R;
+
+    if(gated && y * y > c->cfg.gate * c->cfg.gate * S)
+        return -1;
+
+    double K[3];
+    for(int i = 0; i < n; i++)
+        K[i] = c->P[i][h] / S;
+
+    for(int i = 0; i < n; i++)
+        c->x[i] += K[i] * y;
+
+    double Ph[3];
+    for(int j = 0; j < n; j++)
+        Ph[j] = c->P[h][j];
+
+    for(int i = 0; i < n; i++)
+        for(int j = 0; j < n; j++)
+            c->P[i][j] -= K[i] * Ph[j];
+
+    return 0;
+}
+
+int uwb_clock_sync(struct uwb_clock *c, uint64_t local_rx, uint64_t master_tx)
+{
+    double z = (double)uwb_ts_sub(local_rx, master_tx);
+
+    if(!c->valid)
+    {
+        restart(c, local_rx, z);
+        c->n_accepted++;
+        return 0;
+    }
+
+    struct uwb_clock saved = *c;
+
+    predict(c, dt_seconds(c->ref_local, local_rx));
+    c->ref_local = local_rx;
+
+    double y = wrap40(z - c->x[0]);
+    double R = c->cfg.ts_sigma * c->cfg.ts_sigma;
+
+    if(update(c, 0, y, R, true) != 0)
+    {
+        /* keep the old state, so a run of outliers does not drag P up */
+        *c = saved;
+        c->n_rejected++;
+
+        if(++c->rejects >= UWB_CLOCK_MAX_REJECTS)
+            restart(c, local_rx, z);
+
+        return -1;
+    }
+
+    c->x[0] = wrap40(c->x[0]);
+    c->rejects = 0;
+    c->n_accepted++;
+
+    return 0;
+}
+
+void uwb_clock_skew(struct uwb_clock *c, double ppm, double sigma_ppm)
+{
+    if(!c->valid)
+        return;
+
+    double z = ppm * 1e-6 * TICKS_PER_S;
+    double s = sigma_ppm * 1e-6 * TICKS_PER_S;
+
+    update(c, 1, z - c->x[1], s * s, true);
+}
+
+double uwb_clock_offset_to_ppm(int16_t clock_offset)
+{
+    return (double)clock_offset / 16.0;
+}
+
+double uwb_clock_ci_to_ppm(int32_t carrier_integrator)
+{
+    /* the negative Hz->ppm multiplier gives the same sign as CLK_OFFSET,
+     * the two are interchangeable in the Decawave SS-TWR examples */
+    return (double)carrier_integrator * FREQ_OFFSET_MULTIPLIER * HERTZ_TO_PPM_MULTIPLIER_CH9;
+}
+
+uint64_t uwb_clock_to_master(const struct uwb_clock *c, uint64_t local)
+{
+    double dt = dt_seconds(c->ref_local, local);
+    double off = c->x[0] + c->x[1] * dt;
+
+    if(c->cfg.states == 3)
+        off += 0.5 * c->x[2] * dt * dt;
+
+    return uwb_ts_add(local, -llround(off));
+}
+
+int64_t uwb_clock_offset(const struct uwb_clock *c)
+{
+    return llround(c->x[0]);
+}
+
+double uwb_clock_skew_ppm(const struct uwb_clock *c)
+{
+    return c->x[1] / TICKS_PER_S * 1e6;
+}
+
+double uwb_clock_ratio(const struct uwb_clock *c)
+{
+    return 1.0 - c->x[1] / TICKS_PER_S;
+}
+
+int32_t uwb_clock_skew_q32(const struct uwb_clock *c)
+{
+    double q = c->x[1] / TICKS_PER_S * 4294967296.0;
+
+    if(q > UWB_SKEW_Q32_MAX)
+        q = UWB_SKEW_Q32_MAX;
+    if(q < -UWB_SKEW_Q32_MAX)
+        q = -UWB_SKEW_Q32_MAX;
+
+    return (int32_t)lround(q);
+}
+
+double uwb_clock_sigma_ps(const struct uwb_clock *c)
+{
+    return sqrt(c->P[0][0]) * DWT_TIME_UNITS * 1e12;
+}
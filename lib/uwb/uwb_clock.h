@@ -0,0 +1,77 @@
+#ifndef UWB_CLOCK_H
+#define UWB_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Kalman clock tracker for slave anchors.
+ *
+ * State: offset (local - master, DW ticks), skew (ticks/s) and, with
+ * three states, skew rate (ticks/s^2). Time steps are local elapsed
+ * seconds between SYNCs. Measurements are the SYNC timestamp pair
+ * (local RX, master TX of the same frame) and, optionally, the skew the
+ * receiver itself reports for that frame (dwt_readclockoffset() or
+ * dwt_readcarrierintegrator()). Offset innovations beyond the gate are
+ * rejected; after UWB_CLOCK_MAX_REJECTS in a row the filter restarts,
+ * e.g. when the master rebooted. */
+
+#define UWB_CLOCK_MAX_REJECTS 5
+
+/* 1-sigma noise of the receiver skew estimates, ppm */
+#define UWB_CLOCK_CO_SIGMA_PPM  0.1     /* CLK_OFFSET, 1/16 ppm steps */
+#define UWB_CLOCK_CI_SIGMA_PPM  0.01    /* carrier integrator */
+
+struct uwb_clock_cfg {
+    int    states;          /* 2: offset, skew  3: + skew rate */
+    double ts_sigma;        /* timestamp noise, ticks */
+    double skew_q;          /* skew random walk, (ticks/s)^2 per s */
+    double rate_q;          /* skew rate random walk, (ticks/s^2)^2 per s */
+    double gate;            /* rejection threshold, in sigmas */
+};
+
+/* sensible values for a TCXO-less DWM3001C */
+extern const struct uwb_clock_cfg uwb_clock_default_cfg;
+
+struct uwb_clock {
+    struct uwb_clock_cfg cfg;
+    double   x[3];
+    double   P[3][3];
+    uint64_t ref_local;     /* local time the state refers to */
+    bool     valid;
+    uint8_t  rejects;       /* consecutive gated offsets */
+    uint32_t n_accepted;
+    uint32_t n_rejected;
+};
+
+void uwb_clock_init(struct uwb_clock *c, const struct uwb_clock_cfg *cfg);
+
+/* feed one SYNC: local RX and master TX timestamps of the same frame.
+ * returns 0 if used, -1 if gated out as an outlier. */
+int uwb_clock_sync(struct uwb_clock *c, uint64_t local_rx, uint64_t master_tx);
+
+/* feed the receiver's skew estimate for the SYNC just passed to
+ * uwb_clock_sync(). ppm > 0 means the local clock runs fast. */
+void uwb_clock_skew(struct uwb_clock *c, double ppm, double sigma_ppm);
+
+/* receiver skew estimates in ppm, from the raw register values */
+double uwb_clock_offset_to_ppm(int16_t clock_offset);
+double uwb_clock_ci_to_ppm(int32_t carrier_integrator);
+
+/* local 40-bit timestamp -> master 40-bit timestamp */
+uint64_t uwb_clock_to_master(const struct uwb_clock *c, uint64_t local);
+
+/* current estimates */
+int64_t uwb_clock_offset(const struct uwb_clock *c);
+double uwb_clock_skew_ppm(const struct uwb_clock *c);
+
+/* master ticks per local tick, what the old two-point estimate called
+ * drift */
+double uwb_clock_ratio(const struct uwb_clock *c);
+
+/* skew as a Q32 fraction, for the integer helpers in uwb_ts.h */
+int32_t uwb_clock_skew_q32(const struct uwb_clock *c);
+
+/* 1-sigma offset uncertainty, ps */
+double uwb_clock_sigma_ps(const struct uwb_clock *c);
+
+#endif
@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "uwb_dedup.h"
+
+static uint32_t hash(uint64_t tag, uint32_t seq)
+{
+    uint32_t h = ((uint32_t)tag ^ (uint32_t)(tag >> 32)) * 0x9E3779B1u;
+
+    h ^= seq * 0x85EBCA6Bu;
+    h ^= h >> 16;
+
+    return h & (UWB_DEDUP_SIZE - 1);
+}
+
+void uwb_dedup_init(struct uwb_dedup *d, uint32_t window_ms)
+{
+    memset(d, 0, sizeof(*d));
+    d->window_ms = window_ms;
+}
+
+int uwb_dedup_check(struct uwb_dedup *d, uint64_t tag, uint32_t seq, uint32_t now_ms)
+{
+    uint32_t i = hash(tag, seq);
+    uint32_t now = now_ms | 1;      /* same rounding as the stored times */
+    struct uwb_dedup_ent *slot = NULL;
+    struct uwb_dedup_ent *oldest = NULL;
+
+    for(int k = 0; k < UWB_DEDUP_PROBE; k++)
+    {
+        struct uwb_dedup_ent *e = &d->ent[(i + k) & (UWB_DEDUP_SIZE - 1)];
+        uint32_t age = now - e->t_ms;
+
+        if(e->t_ms == 0 || age >= d->window_ms)
+        {
+            if(!slot)
+                slot = e;
+            continue;
+        }
+
+        if(e->tag == tag && e->seq == seq)
+        {
+            d->stats.dup++;
+            return 1;
+        }
+
+        if(!oldest || age > now - oldest->t_ms)
+            oldest = e;
+    }
+
+    if(!slot)
+    {
+        slot = oldest;
+        d->stats.evicted++;
+    }
+
+    slot->tag = tag;
+    slot->seq = seq;
+    slot->t_ms = now;
+
+    return 0;
+}
@@ -0,0 +1,44 @@
+#ifndef UWB_DEDUP_H
+#define UWB_DEDUP_H
+
+#include <stdint.h>
+
+/* Blinks seen in the last window_ms, keyed on (tag, seq).
+ *
+ * Anchors pass each blink on once: a tag may repeat a blink for
+ * reliability, and with several tags the seq alone no longer names one.
+ * The table is a fixed open-addressed hash. A lookup probes at most
+ * UWB_DEDUP_PROBE slots from the key's hash; entries older than the
+ * window count as free and are reused in place, so nothing has to be
+ * swept. If every probed slot is live the oldest is overwritten and
+ * counted in evicted, which means the table is too small for the blink
+ * rate times the window. */
+
+#define UWB_DEDUP_BITS      7
+#define UWB_DEDUP_SIZE      (1 << UWB_DEDUP_BITS)
+#define UWB_DEDUP_PROBE     8
+
+struct uwb_dedup_ent {
+    uint64_t tag;
+    uint32_t seq;
+    uint32_t t_ms;          /* time seen | 1, 0 = never used */
+};
+
+struct uwb_dedup_stats {
+    uint32_t dup;           /* blinks already in the table */
+    uint32_t evicted;       /* live entries overwritten */
+};
+
+struct uwb_dedup {
+    uint32_t window_ms;
+    struct uwb_dedup_stats stats;
+    struct uwb_dedup_ent ent[UWB_DEDUP_SIZE];
+};
+
+void uwb_dedup_init(struct uwb_dedup *d, uint32_t window_ms);
+
+/* returns 1 if (tag, seq) was seen in the window before now_ms (uptime),
+ * otherwise records it and returns 0 */
+int uwb_dedup_check(struct uwb_dedup *d, uint64_t tag, uint32_t seq, uint32_t now_ms);
+
+#endif
@@ -0,0 +1,153 @@
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_hub.h"
+
+BUILD_ASSERT(UWB_HUB_REPORT_LEN(UWB_HUB_MAX_RECS) <= UWB_FRAME_MAX, "REPORT does not fit a frame");
+
+void uwb_hub_report_begin(struct uwb_hub_report *r, uint8_t anchor, uint8_t sync_seq)
+{
+    r->anchor = anchor;
+    r->sync_seq = sync_seq;
+    r->n = 0;
+}
+
+int uwb_hub_report_add(struct uwb_hub_report *r, uint16_t tag, uint16_t seq, uint64_t ts)
+{
+    if(r->n >= UWB_HUB_MAX_RECS)
+        return -1;
+
+    struct uwb_hub_rec *rec = &r->recs[r->n++];
+    rec->tag = tag;
+    rec->seq = seq;
+    rec->ts = ts;
+
+    return 0;
+}
+
+int uwb_hub_encode(const struct uwb_hub_report *r, uint8_t *frame, uint16_t max)
+{
+    int len = UWB_HUB_REPORT_LEN(r->n);
+    if(len > max)
+        return -1;
+
+    struct uwb_msg_report hdr = {
+        .anchor = r->anchor,
+        .sync_seq = r->sync_seq,
+        .n = r->n,
+    };
+
+    uwb_msg_report_pack(&hdr, frame);
+
+    for(int i = 0; i < r->n; i++)
+    {
+        struct uwb_msg_report_rec rec = {
+            .tag = r->recs[i].tag,
+            .seq = r->recs[i].seq,
+            .ts = r->recs[i].ts,
+        };
+
+        uwb_msg_report_rec_pack(&rec, UWB_MSG_TAIL_AT(REPORT, REPORT_REC, frame, i));
+    }
+
+    return len;
+}
+
+int uwb_hub_decode(struct uwb_hub_report *r, const uint8_t *frame, uint16_t len)
+{
+    struct uwb_msg_report hdr;
+
+    if(uwb_msg_report_unpack(&hdr, frame, len) != 0)
+        return -1;
+
+    if(hdr.n > UWB_HUB_MAX_RECS || len < UWB_HUB_REPORT_LEN(hdr.n))
+        return -1;
+
+    r->anchor = hdr.anchor;
+    r->sync_seq = hdr.sync_seq;
+    r->n = hdr.n;
+
+    for(int i = 0; i < hdr.n; i++)
+    {
+        struct uwb_msg_report_rec rec;
+
+        uwb_msg_report_rec_unpack(&rec, UWB_MSG_TAIL_AT(REPORT, REPORT_REC, frame, i));
+
+        r->recs[i].tag = rec.tag;
+        r->recs[i].seq = rec.seq;
+        r->recs[i].ts = rec.ts;
+    }
+
+    return 0;
+}
+
+void uwb_hub_begin(struct uwb_hub *h, uint8_t sync_seq)
+{
+    h->sync_seq = sync_seq;
+    h->n_blinks = 0;
+}
+
+int uwb_hub_add(struct uwb_hub *h, uint8_t anchor, const struct uwb_hub_rec *rec)
+{
+    struct uwb_hub_blink *b = NULL;
+
+    /* a handful of tags per superframe, a linear scan is enough */
+    for(int i = 0; i < h->n_blinks; i++)
+    {
+        if(h->blinks[i].tag == rec->tag && h->blinks[i].seq == rec->seq)
+        {
+            b = &h->blinks[i];
+            break;
+        }
+    }
+
+    if(!b)
+    {
+        if(h->n_blinks >= UWB_HUB_MAX_BLINKS)
+        {
+            h->stats.overflow++;
+            return -1;
+        }
+
+        b = &h->blinks[h->n_blinks++];
+        b->tag = rec->tag;
+        b->seq = rec->seq;
+        b->n = 0;
+    }
+
+    for(int i = 0; i < b->n; i++)
+    {
+        if(b->anchors[i] == anchor)
+        {
+            h->stats.dup++;
+            return -1;
+        }
+    }
+
+    if(b->n >= UWB_HUB_MAX_ANCHORS)
+    {
+        h->stats.overflow++;
+        return -1;
+    }
+
+    b->anchors[b->n] = anchor;
+    b->ts[b->n] = rec->ts;
+    b->n++;
+
+    return 0;
+}
+
+int uwb_hub_add_report(struct uwb_hub *h, const struct uwb_hub_report *r)
+{
+    if(r->sync_seq != h->sync_seq)
+    {
+        h->stats.stale++;
+        return -1;
+    }
+
+    h->stats.reports++;
+
+    for(int i = 0; i < r->n; i++)
+        uwb_hub_add(h, r->anchor, &r->recs[i]);
+
+    return 0;
+}
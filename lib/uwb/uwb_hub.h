@@ -0,0 +1,100 @@
+#ifndef UWB_HUB_H
+#define UWB_HUB_H
+
+#include <stdint.h>
+#include <zephyr/sys/util.h>
+#include "uwb_msg.h"
+#include "uwb_tdma.h"
+
+/* TDoA hub: slave anchors forward the blinks they heard to the master
+ * over UWB, each in its report slot of the superframe (uwb_tdma.h), and
+ * the master groups them per blink. One node then exports every anchor's
+ * timestamps, instead of one BLE link per anchor.
+ *
+ * REPORT frame:
+ *
+ *   [0]  UWB_HUB_MSG_REPORT
+ *   [1]  anchor id
+ *   [2]  seq of the SYNC that opened the superframe
+ *   [3]  record count
+ *   [4..] records: tag[2], blink seq[2], ts[5]
+ *
+ * ts is the blink RX time already converted to master time. tag and seq
+ * are those of the short blink (uwb_msg.h), the one TDMA tags send; a
+ * blink only counts if its tag is the one scheduled in the slot it
+ * landed in. */
+
+#define UWB_HUB_MSG_REPORT  UWB_MSG_REPORT
+#define UWB_HUB_HDR_LEN     UWB_MSG_REPORT_LEN
+#define UWB_HUB_REC_LEN     UWB_MSG_REPORT_REC_LEN
+
+/* at most one blink per tag slot */
+#define UWB_HUB_MAX_BLINKS  UWB_TDMA_MAX_SLOTS
+
+/* records one REPORT frame holds, the rest of a superframe's blinks are
+ * dropped */
+#define UWB_HUB_MAX_RECS    MIN(UWB_HUB_MAX_BLINKS, \
+                                (UWB_MSG_MAX - UWB_MSG_REPORT_LEN) / UWB_MSG_REPORT_REC_LEN)
+
+#define UWB_HUB_REPORT_LEN(n) UWB_MSG_TAIL_LEN(REPORT, REPORT_REC, n)
+
+/* slave anchors plus the master itself */
+#define UWB_HUB_MAX_ANCHORS (UWB_TDMA_MAX_ANCHORS + 1)
+
+struct uwb_hub_rec {
+    uint16_t tag;
+    uint16_t seq;
+    uint64_t ts;
+};
+
+struct uwb_hub_report {
+    uint8_t  anchor;
+    uint8_t  sync_seq;
+    uint8_t  n;
+    struct uwb_hub_rec recs[UWB_HUB_MAX_RECS];
+};
+
+/* one blink as seen by n anchors, timestamps in master time */
+struct uwb_hub_blink {
+    uint16_t tag;
+    uint16_t seq;
+    uint8_t  n;
+    uint8_t  anchors[UWB_HUB_MAX_ANCHORS];
+    uint64_t ts[UWB_HUB_MAX_ANCHORS];
+};
+
+struct uwb_hub_stats {
+    uint32_t reports;
+    uint32_t stale;         /* reports for another superframe */
+    uint32_t dup;           /* an anchor reporting a blink twice */
+    uint32_t overflow;      /* more blinks than the table holds */
+};
+
+/* grouping table for the current superframe */
+struct uwb_hub {
+    uint8_t  sync_seq;
+    uint8_t  n_blinks;
+    struct uwb_hub_blink blinks[UWB_HUB_MAX_BLINKS];
+    struct uwb_hub_stats stats;
+};
+
+/* report builder, for slave anchors */
+void uwb_hub_report_begin(struct uwb_hub_report *r, uint8_t anchor, uint8_t sync_seq);
+int uwb_hub_report_add(struct uwb_hub_report *r, uint16_t tag, uint16_t seq, uint64_t ts);
+
+/* returns the frame length, or -1 if it does not fit in max bytes */
+int uwb_hub_encode(const struct uwb_hub_report *r, uint8_t *frame, uint16_t max);
+
+/* returns -1 if frame is not a well-formed REPORT */
+int uwb_hub_decode(struct uwb_hub_report *r, const uint8_t *frame, uint16_t len);
+
+/* start grouping the superframe opened by SYNC sync_seq. stats are kept. */
+void uwb_hub_begin(struct uwb_hub *h, uint8_t sync_seq);
+
+/* add one anchor's timestamp of a blink, e.g. the master's own */
+int uwb_hub_add(struct uwb_hub *h, uint8_t anchor, const struct uwb_hub_rec *rec);
+
+/* add a slave's report. returns -1 if it belongs to another superframe. */
+int uwb_hub_add_report(struct uwb_hub *h, const struct uwb_hub_report *r);
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef UWB_MSG_H
+#define UWB_MSG_H
+
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/toolchain.h>
+
+/* UWB frame layouts, defined once.
+ *
+ * Every frame starts with its type byte, followed by the fields in
+ * table order. Field kinds are U8, U16, U32, U64 and TS (40-bit
+ * timestamp), all little endian. UWB_MSG_TABLE expands into, per message NAME/name:
+ *
+ *   UWB_MSG_NAME             type byte
+ *   UWB_MSG_NAME_LEN         frame length, a constant expression
+ *   struct uwb_msg_name      the fields
+ *   uwb_msg_name_pack()      fill a frame, returns UWB_MSG_NAME_LEN
+ *   uwb_msg_name_unpack()    -1 on a short frame or another type
+ *
+ * Records (UWB_MSG_REC_TABLE) are the same without the type byte, for
+ * the repeated part of a frame. UWB_MSG_TAIL_TABLE says which frames end
+ * with how many records; SYNC carries the TDMA schedule (uwb_tdma.h)
+ * after its fixed part.
+ *
+ * scripts/gen_uwb_msg.py reads the tables below and writes the host
+ * decoder scripts/uwb_msg.py. Rerun it after changing them. */
+
+#define UWB_MSG_TABLE(M) \
+    M(POLL,    poll,    0x01, UWB_MSG_POLL_F) \
+    M(RESP,    resp,    0x02, UWB_MSG_RESP_F) \
+    M(FINAL,   final,   0x03, UWB_MSG_FINAL_F) \
+    M(BPOLL,   bpoll,   0x05, UWB_MSG_BPOLL_F) \
+    M(BRESP,   bresp,   0x06, UWB_MSG_BRESP_F) \
+    M(BFINAL,  bfinal,  0x07, UWB_MSG_BFINAL_F) \
+    M(SYNC,    sync,    0x10, UWB_MSG_SYNC_F) \
+    M(BLINK,   blink,   0x85, UWB_MSG_BLINK_F) \
+    M(BLINK64, blink64, 0xC5, UWB_MSG_BLINK64_F) \
+    M(REPORT,  report,  0x30, UWB_MSG_REPORT_F)
+
+#define UWB_MSG_REC_TABLE(R) \
+    R(BFINAL_ENT, bfinal_ent, UWB_MSG_BFINAL_ENT_F) \
+    R(REPORT_REC, report_rec, UWB_MSG_REPORT_REC_F)
+
+/* frame, count field, record */
+#define UWB_MSG_TAIL_TABLE(T) \
+    T(BFINAL, n, BFINAL_ENT) \
+    T(REPORT, n, REPORT_REC)
+
+/* DS-TWR. anchor 0 in a POLL addresses any responder. the POLL carries
+ * the tag's POLL->RESP and RESP->FINAL reply delays, samples with fixed
+ * delays leave them 0. a RESP returns the distance of the previous
+ * exchange with that tag, or UWB_MSG_DIST_NONE. */
+#define UWB_MSG_POLL_F(F) \
+    F(U8, seq) F(U8, anchor) F(U8, tag) F(U16, resp_dly_uus) F(U16, final_dly_uus)
+#define UWB_MSG_RESP_F(F) \
+    F(U8, seq) F(U8, tag) F(U8, anchor) F(TS, t2) F(TS, t3) \
+    F(U8, last_seq) F(U16, last_mm)
+#define UWB_MSG_FINAL_F(F) \
+    F(U8, seq) F(U8, anchor) F(U8, tag) F(TS, t1) F(TS, t4) F(TS, t5)
+
+/* broadcast DS-TWR, anchor k answers resp_dly + (k-1)*slot after the
+ * POLL, the FINAL goes out final_dly after the last slot */
+#define UWB_MSG_BPOLL_F(F) \
+    F(U8, seq) F(U8, tag) F(U16, resp_dly_uus) F(U16, slot_uus) \
+    F(U16, final_dly_uus)
+#define UWB_MSG_BRESP_F(F) \
+    F(U8, seq) F(U8, tag) F(U8, anchor) F(U8, last_seq) F(U16, last_mm)
+#define UWB_MSG_BFINAL_F(F) \
+    F(U8, seq) F(U8, tag) F(U8, n) F(TS, t1) F(TS, t5)
+#define UWB_MSG_BFINAL_ENT_F(F) \
+    F(U8, anchor) F(TS, t4)
+
+/* TDoA. SYNC carries its own TX time: the master sends it delayed and
+ * knows the timestamp in advance (uwb_delayed_tx_ts()), so one frame is
+ * a complete (master TX, local RX) pair.
+ *
+ * Blinks are 802.15.4 multipurpose frames with a one-byte frame control
+ * and only a source address: 0x85 for a 16-bit tag address, 0xC5 for a
+ * 64-bit one. The sequence number is widened from the standard's 8 bits
+ * so (tag, seq) stays unique for a whole session: 16 bits wrap after
+ * 109 minutes at 10 Hz, 32 bits never do. */
+#define UWB_MSG_SYNC_F(F) \
+    F(U8, seq) F(U8, node) F(TS, tx_ts)
+#define UWB_MSG_BLINK_F(F) \
+    F(U16, seq) F(U16, tag)
+#define UWB_MSG_BLINK64_F(F) \
+    F(U32, seq) F(U64, tag)
+
+/* hub REPORT (uwb_hub.h), record ts in master time */
+#define UWB_MSG_REPORT_F(F) \
+    F(U8, anchor) F(U8, sync_seq) F(U8, n)
+#define UWB_MSG_REPORT_REC_F(F) \
+    F(U16, tag) F(U16, seq) F(TS, ts)
+
+#define UWB_MSG_DIST_NONE   0xFFFF
+
+/* largest payload, the FCS is added by the radio */
+#define UWB_MSG_MAX         125
+
+/* field kinds. multi-byte fields are single unaligned loads and stores,
+ * which Cortex-M4 allows for words and halfwords. */
+BUILD_ASSERT(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "codec assumes a little-endian host");
+
+#define UWB_MSG_CTYPE_U8    uint8_t
+#define UWB_MSG_CTYPE_U16   uint16_t
+#define UWB_MSG_CTYPE_U32   uint32_t
+#define UWB_MSG_CTYPE_U64   uint64_t
+#define UWB_MSG_CTYPE_TS    uint64_t
+
+#define UWB_MSG_SZ_U8       1
+#define UWB_MSG_SZ_U16      2
+#define UWB_MSG_SZ_U32      4
+#define UWB_MSG_SZ_U64      8
+#define UWB_MSG_SZ_TS       5
+
+static inline void uwb_msg_put_u8(uint8_t *p, uint8_t v)
+{
+    p[0] = v;
+}
+
+static inline void uwb_msg_put_u16(uint8_t *p, uint16_t v)
+{
+    memcpy(p, &v, 2);
+}
+
+static inline void uwb_msg_put_u32(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+}
+
+static inline void uwb_msg_put_u64(uint8_t *p, uint64_t v)
+{
+    memcpy(p, &v, 8);
+}
+
+static inline void uwb_msg_put_ts(uint8_t *p, uint64_t v)
+{
+    uint32_t lo = (uint32_t)v;
+
+    memcpy(p, &lo, 4);
+    p[4] = v >> 32;
+}
+
+static inline uint8_t uwb_msg_get_u8(const uint8_t *p)
+{
+    return p[0];
+}
+
+static inline uint16_t uwb_msg_get_u16(const uint8_t *p)
+{
+    uint16_t v;
+
+    memcpy(&v, p, 2);
+    return v;
+}
+
+static inline uint32_t uwb_msg_get_u32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t uwb_msg_get_u64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t uwb_msg_get_ts(const uint8_t *p)
+{
+    uint32_t lo;
+
+    memcpy(&lo, p, 4);
+    return lo | ((uint64_t)p[4] << 32);
+}
+
+#define UWB_MSG_PUT_U8      uwb_msg_put_u8
+#define UWB_MSG_PUT_U16     uwb_msg_put_u16
+#define UWB_MSG_PUT_U32     uwb_msg_put_u32
+#define UWB_MSG_PUT_U64     uwb_msg_put_u64
+#define UWB_MSG_PUT_TS      uwb_msg_put_ts
+#define UWB_MSG_GET_U8      uwb_msg_get_u8
+#define UWB_MSG_GET_U16     uwb_msg_get_u16
+#define UWB_MSG_GET_U32     uwb_msg_get_u32
+#define UWB_MSG_GET_U64     uwb_msg_get_u64
+#define UWB_MSG_GET_TS      uwb_msg_get_ts
+
+/* per-field expansions */
+#define UWB_MSG_X_MEMBER(kind, f)   UWB_MSG_CTYPE_##kind f;
+#define UWB_MSG_X_SIZE(kind, f)     + UWB_MSG_SZ_##kind
+#define UWB_MSG_X_PUT(kind, f)      UWB_MSG_PUT_##kind(p, m->f); p += UWB_MSG_SZ_##kind;
+#define UWB_MSG_X_GET(kind, f)      m->f = UWB_MSG_GET_##kind(p); p += UWB_MSG_SZ_##kind;
+
+/* p only ever advances by constants, so after inlining every field is a
+ * store at a fixed offset */
+#define UWB_MSG_X_CODEC(name, fields) \
+    static inline void uwb_msg_##name##_put(const struct uwb_msg_##name *m, uint8_t *p) \
+    { \
+        fields(UWB_MSG_X_PUT) \
+    } \
+    static inline void uwb_msg_##name##_get(struct uwb_msg_##name *m, const uint8_t *p) \
+    { \
+        fields(UWB_MSG_X_GET) \
+    }
+
+#define UWB_MSG_X_ENUM(NAME, name, type, fields) UWB_MSG_##NAME = type,
+
+enum uwb_msg_type {
+    UWB_MSG_TABLE(UWB_MSG_X_ENUM)
+};
+
+#define UWB_MSG_X_DEFINE(NAME, name, type, fields) \
+    struct uwb_msg_##name { \
+        fields(UWB_MSG_X_MEMBER) \
+    }; \
+    enum { UWB_MSG_##NAME##_LEN = 1 fields(UWB_MSG_X_SIZE) }; \
+    BUILD_ASSERT(UWB_MSG_##NAME##_LEN <= UWB_MSG_MAX, #NAME " does not fit a frame"); \
+    UWB_MSG_X_CODEC(name, fields) \
+    static inline uint16_t uwb_msg_##name##_pack(const struct uwb_msg_##name *m, uint8_t *buf) \
+    { \
+        buf[0] = UWB_MSG_##NAME; \
+        uwb_msg_##name##_put(m, buf + 1); \
+        return UWB_MSG_##NAME##_LEN; \
+    } \
+    static inline int uwb_msg_##name##_unpack(struct uwb_msg_##name *m, const uint8_t *buf, \
+                                              uint16_t len) \
+    { \
+        if(len < UWB_MSG_##NAME##_LEN || buf[0] != UWB_MSG_##NAME) \
+            return -1; \
+        uwb_msg_##name##_get(m, buf + 1); \
+        return 0; \
+    }
+
+#define UWB_MSG_X_REC_DEFINE(NAME, name, fields) \
+    struct uwb_msg_##name { \
+        fields(UWB_MSG_X_MEMBER) \
+    }; \
+    enum { UWB_MSG_##NAME##_LEN = 0 fields(UWB_MSG_X_SIZE) }; \
+    UWB_MSG_X_CODEC(name, fields) \
+    static inline uint16_t uwb_msg_##name##_pack(const struct uwb_msg_##name *m, uint8_t *buf) \
+    { \
+        uwb_msg_##name##_put(m, buf); \
+        return UWB_MSG_##NAME##_LEN; \
+    } \
+    static inline void uwb_msg_##name##_unpack(struct uwb_msg_##name *m, const uint8_t *buf) \
+    { \
+        uwb_msg_##name##_get(m, buf); \
+    }
+
+UWB_MSG_TABLE(UWB_MSG_X_DEFINE)
+UWB_MSG_REC_TABLE(UWB_MSG_X_REC_DEFINE)
+
+/* length of a frame with n records, e.g. UWB_MSG_TAIL_LEN(BFINAL, BFINAL_ENT, n) */
+#define UWB_MSG_TAIL_LEN(NAME, REC, n) \
+    (UWB_MSG_##NAME##_LEN + (n) * UWB_MSG_##REC##_LEN)
+
+/* the i-th record after the fixed part */
+#define UWB_MSG_TAIL_AT(NAME, REC, buf, i) \
+    ((buf) + UWB_MSG_##NAME##_LEN + (i) * UWB_MSG_##REC##_LEN)
+
+/* either blink, with a 16-bit address and seq widened */
+struct uwb_msg_blink_id {
+    uint64_t tag;
+    uint32_t seq;
+};
+
+static inline int uwb_msg_blink_id_unpack(struct uwb_msg_blink_id *id, const uint8_t *buf,
+                                          uint16_t len)
+{
+    struct uwb_msg_blink b;
+    struct uwb_msg_blink64 b64;
+
+    if(uwb_msg_blink_unpack(&b, buf, len) == 0)
+    {
+        id->tag = b.tag;
+        id->seq = b.seq;
+        return 0;
+    }
+
+    if(uwb_msg_blink64_unpack(&b64, buf, len) == 0)
+    {
+        id->tag = b64.tag;
+        id->seq = b64.seq;
+        return 0;
+    }
+
+    return -1;
+}
+
+#endif
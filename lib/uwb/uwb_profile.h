@@ -0,0 +1,118 @@
+#ifndef UWB_PROFILE_H
+#define UWB_PROFILE_H
+
+/* Build-time radio profile, selected with CONFIG_UWB_PROFILE_*.
+ *
+ * Everything here is a constant expression, so frame airtimes and reply
+ * delays fold into immediates. All profiles use channel 9 with preamble
+ * code 9, which is a 64 MHz PRF code. */
+
+#if defined(CONFIG_UWB_PROFILE_LOW_LATENCY)
+#define UWB_PROFILE_NAME        "low-latency"
+#define UWB_PROFILE_PLEN        DWT_PLEN_64
+#define UWB_PROFILE_PLEN_SYMS   64
+#define UWB_PROFILE_PAC         DWT_PAC8
+#define UWB_PROFILE_PAC_SYMS    8
+#define UWB_PROFILE_SFD         DWT_SFD_DW_8
+#define UWB_PROFILE_SFD_SYMS    8
+#define UWB_PROFILE_BR          DWT_BR_6M8
+#define UWB_PROFILE_STS_MODE    DWT_STS_MODE_OFF
+#define UWB_PROFILE_STS_LEN     DWT_STS_LEN_64
+#define UWB_PROFILE_STS_SYMS    0
+#elif defined(CONFIG_UWB_PROFILE_LONG_RANGE)
+#define UWB_PROFILE_NAME        "long-range"
+#define UWB_PROFILE_PLEN        DWT_PLEN_1024
+#define UWB_PROFILE_PLEN_SYMS   1024
+#define UWB_PROFILE_PAC         DWT_PAC32
+#define UWB_PROFILE_PAC_SYMS    32
+#define UWB_PROFILE_SFD         DWT_SFD_DW_8
+#define UWB_PROFILE_SFD_SYMS    8
+#define UWB_PROFILE_BR          DWT_BR_850K
+#define UWB_PROFILE_STS_MODE    DWT_STS_MODE_OFF
+#define UWB_PROFILE_STS_LEN     DWT_STS_LEN_64
+#define UWB_PROFILE_STS_SYMS    0
+#elif defined(CONFIG_UWB_PROFILE_STS)
+#define UWB_PROFILE_NAME        "sts"
+#define UWB_PROFILE_PLEN        DWT_PLEN_128
+#define UWB_PROFILE_PLEN_SYMS   128
+#define UWB_PROFILE_PAC         DWT_PAC8
+#define UWB_PROFILE_PAC_SYMS    8
+#define UWB_PROFILE_SFD         DWT_SFD_IEEE_4Z
+#define UWB_PROFILE_SFD_SYMS    8
+#define UWB_PROFILE_BR          DWT_BR_6M8
+#define UWB_PROFILE_STS_MODE    DWT_STS_MODE_1
+#define UWB_PROFILE_STS_LEN     DWT_STS_LEN_64
+#define UWB_PROFILE_STS_SYMS    64
+#else
+#define UWB_PROFILE_NAME        "default"
+#define UWB_PROFILE_PLEN        DWT_PLEN_128
+#define UWB_PROFILE_PLEN_SYMS   128
+#define UWB_PROFILE_PAC         DWT_PAC8
+#define UWB_PROFILE_PAC_SYMS    8
+#define UWB_PROFILE_SFD         DWT_SFD_DW_8
+#define UWB_PROFILE_SFD_SYMS    8
+#define UWB_PROFILE_BR          DWT_BR_6M8
+#define UWB_PROFILE_STS_MODE    DWT_STS_MODE_OFF
+#define UWB_PROFILE_STS_LEN     DWT_STS_LEN_64
+#define UWB_PROFILE_STS_SYMS    0
+#endif
+
+#define UWB_PROFILE_CHAN        9
+#define UWB_PROFILE_CODE        9
+
+#if defined(CONFIG_UWB_HOST_TURNAROUND_US)
+#define UWB_HOST_TURNAROUND_US  CONFIG_UWB_HOST_TURNAROUND_US
+#else
+#define UWB_HOST_TURNAROUND_US  300
+#endif
+
+/* SFD timeout in symbols: preamble + 1 + SFD - PAC */
+#define UWB_SFD_TO \
+    (UWB_PROFILE_PLEN_SYMS + 1 + UWB_PROFILE_SFD_SYMS - UWB_PROFILE_PAC_SYMS)
+
+/* symbol durations in ps. preamble and STS symbols at 64 MHz PRF, the PHR
+ * is always sent at 850 kbps (DWT_PHRRATE_STD). */
+#define UWB_PSYM_PS             1017628ULL
+#define UWB_STS_SYM_PS          1025641ULL
+#define UWB_PHR_SYM_PS          1025641ULL
+#define UWB_PHR_BITS            21
+
+#if defined(CONFIG_UWB_PROFILE_LONG_RANGE)
+#define UWB_DATA_SYM_PS         1025641ULL
+#else
+#define UWB_DATA_SYM_PS         128205ULL
+#endif
+
+/* payload bits including the 2-byte FCS, plus 48 Reed-Solomon parity bits
+ * per started 330-bit block */
+#define UWB_DATA_BITS(len) \
+    (((len) + 2) * 8 + 48 * ((((len) + 2) * 8 + 329) / 330))
+
+#define UWB_SHR_NS \
+    ((uint32_t)(((UWB_PROFILE_PLEN_SYMS + UWB_PROFILE_SFD_SYMS) * UWB_PSYM_PS) / 1000))
+#define UWB_STS_NS \
+    ((uint32_t)((UWB_PROFILE_STS_SYMS * UWB_STS_SYM_PS) / 1000))
+#define UWB_PHR_NS \
+    ((uint32_t)((UWB_PHR_BITS * UWB_PHR_SYM_PS) / 1000))
+#define UWB_DATA_NS(len) \
+    ((uint32_t)((UWB_DATA_BITS(len) * UWB_DATA_SYM_PS) / 1000))
+
+/* whole frame on air, len is the payload without FCS */
+#define UWB_FRAME_NS(len) \
+    (UWB_SHR_NS + UWB_STS_NS + UWB_PHR_NS + UWB_DATA_NS(len))
+#define UWB_FRAME_US(len) ((UWB_FRAME_NS(len) + 999) / 1000)
+
+/* RX timestamps are taken at the RMARKER (end of SFD) and a delayed TX
+ * time also names the RMARKER of the outgoing frame. The smallest safe
+ * RX timestamp -> TX timestamp delay is therefore the rest of the
+ * received frame, the host turnaround, and the SHR of the reply. */
+#define UWB_REPLY_DLY_NS(rx_len) \
+    (UWB_STS_NS + UWB_PHR_NS + UWB_DATA_NS(rx_len) + \
+     UWB_HOST_TURNAROUND_US * 1000 + UWB_SHR_NS)
+#define UWB_REPLY_DLY_UUS(rx_len) ((UWB_REPLY_DLY_NS(rx_len) + 999) / 1000)
+
+/* preamble detection timeout covering one whole preamble, in PACs */
+#define UWB_PRE_TO_PACS \
+    (UWB_PROFILE_PLEN_SYMS / UWB_PROFILE_PAC_SYMS + 1)
+
+#endif
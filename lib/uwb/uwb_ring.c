@@ -0,0 +1,123 @@
+#include "uwb_ring.h"
+
+#define IDX_MASK    0xFFFFFF
+
+#define TAIL_IDX(t)     ((uint32_t)(t) >> 8)
+#define TAIL_CLAIMED(t) ((uint32_t)(t) & 0xFF)
+#define TAIL(idx, n)    ((atomic_val_t)((((idx) & IDX_MASK) << 8) | (n)))
+
+static uint32_t used(uint32_t head, uint32_t idx)
+{
+    return (head - idx) & IDX_MASK;
+}
+
+void uwb_ring_init(struct uwb_ring *r)
+{
+    atomic_set(&r->head, 0);
+    atomic_set(&r->tail, 0);
+    atomic_set(&r->put, 0);
+    atomic_set(&r->dropped, 0);
+    atomic_set(&r->refused, 0);
+
+    k_sem_init(&r->data, 0, 1);
+}
+
+void *uwb_ring_reserve(struct uwb_ring *r)
+{
+    uint32_t head = atomic_get(&r->head);
+
+    while(1)
+    {
+        atomic_val_t t = atomic_get(&r->tail);
+
+        if(used(head, TAIL_IDX(t)) < r->len)
+            break;
+
+        /* full: the slot at head is the oldest record */
+        if(TAIL_CLAIMED(t) != 0)
+        {
+            atomic_inc(&r->refused);
+            return NULL;
+        }
+
+        if(atomic_cas(&r->tail, t, TAIL(TAIL_IDX(t) + 1, 0)))
+        {
+            atomic_inc(&r->dropped);
+            break;
+        }
+
+        /* the consumer claimed or released meanwhile, look again */
+    }
+
+    return &r->buf[(head & (r->len - 1)) * r->size];
+}
+
+void uwb_ring_commit(struct uwb_ring *r)
+{
+    atomic_set(&r->head, (atomic_get(&r->head) + 1) & IDX_MASK);
+    atomic_inc(&r->put);
+
+    k_sem_give(&r->data);
+}
+
+int uwb_ring_put(struct uwb_ring *r, const void *rec)
+{
+    void *slot = uwb_ring_reserve(r);
+    if(!slot)
+        return -1;
+
+    memcpy(slot, rec, r->size);
+    uwb_ring_commit(r);
+
+    return 0;
+}
+
+int uwb_ring_peek(struct uwb_ring *r, void **first, int max, k_timeout_t timeout)
+{
+    bool waited = false;
+
+    while(1)
+    {
+        atomic_val_t t = atomic_get(&r->tail);
+        uint32_t idx = TAIL_IDX(t);
+        uint32_t n = used(atomic_get(&r->head), idx);
+
+        if(n == 0)
+        {
+            if(waited || k_sem_take(&r->data, timeout) != 0)
+                return 0;
+
+            waited = true;
+            continue;
+        }
+
+        /* contiguous run only, up to the end of the buffer */
+        uint32_t slot = idx & (r->len - 1);
+
+        n = MIN(n, r->len - slot);
+        n = MIN(n, (uint32_t)max);
+
+        if(atomic_cas(&r->tail, t, TAIL(idx, n)))
+        {
+            *first = &r->buf[slot * r->size];
+            return n;
+        }
+
+        /* the producer dropped the oldest record, start over */
+    }
+}
+
+void uwb_ring_release(struct uwb_ring *r, int n)
+{
+    /* the producer leaves tail alone while records are claimed */
+    atomic_val_t t = atomic_get(&r->tail);
+
+    atomic_set(&r->tail, TAIL(TAIL_IDX(t) + n, 0));
+}
+
+void uwb_ring_get_stats(struct uwb_ring *r, struct uwb_ring_stats *s)
+{
+    s->put = atomic_get(&r->put);
+    s->dropped = atomic_get(&r->dropped);
+    s->refused = atomic_get(&r->refused);
+}
@@ -0,0 +1,71 @@
+#ifndef UWB_RING_H
+#define UWB_RING_H
+
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/* Lock-free single-producer/single-consumer ring of fixed-size records.
+ *
+ * The producer (UWB thread) fills records in place with reserve/commit.
+ * The consumer (BLE thread) claims a run of records with peek, uses them
+ * in place and hands them back with release. When the ring is full the
+ * producer drops the oldest record; if the consumer holds the oldest
+ * right then, the new record is refused instead. Both are counted.
+ *
+ * tail packs the read index (upper 24 bits) with the number of records
+ * the consumer has claimed (lower 8 bits), so dropping and claiming are
+ * each one CAS and can never overlap. */
+
+/* record count limit, one claim must fit the 8-bit field */
+#define UWB_RING_MAX_LEN    128
+
+struct uwb_ring {
+    uint8_t  *buf;
+    uint16_t  size;         /* bytes per record */
+    uint16_t  len;          /* records, power of two */
+    atomic_t  head;         /* write index, producer only */
+    atomic_t  tail;         /* read index << 8 | claimed */
+    atomic_t  put;
+    atomic_t  dropped;      /* oldest records overwritten */
+    atomic_t  refused;      /* new records lost while the oldest was claimed */
+    struct k_sem data;      /* given on commit, taken by peek */
+};
+
+struct uwb_ring_stats {
+    uint32_t put;
+    uint32_t dropped;
+    uint32_t refused;
+};
+
+/* static storage for len records of type */
+#define UWB_RING_DEFINE(name, type, n)                                      \
+    BUILD_ASSERT((n) <= UWB_RING_MAX_LEN && ((n) & ((n) - 1)) == 0,        \
+                 "ring length must be a power of two <= 128");             \
+    static type name##_buf[n];                                             \
+    static struct uwb_ring name = { .buf = (uint8_t *)name##_buf,          \
+                                    .size = sizeof(type), .len = (n) }
+
+/* reset indices and counters, call before the threads start */
+void uwb_ring_init(struct uwb_ring *r);
+
+/* producer: slot for the next record, or NULL if it was refused */
+void *uwb_ring_reserve(struct uwb_ring *r);
+
+/* producer: publish the reserved record */
+void uwb_ring_commit(struct uwb_ring *r);
+
+/* producer: reserve, copy and commit. returns -1 if refused. */
+int uwb_ring_put(struct uwb_ring *r, const void *rec);
+
+/* consumer: claim up to max records, contiguous in memory from *first.
+ * waits up to timeout if the ring is empty. returns the number claimed,
+ * 0 on timeout. */
+int uwb_ring_peek(struct uwb_ring *r, void **first, int max, k_timeout_t timeout);
+
+/* consumer: drop the first n claimed records. n may be less than was
+ * claimed, the rest go back to the ring. */
+void uwb_ring_release(struct uwb_ring *r, int n);
+
+void uwb_ring_get_stats(struct uwb_ring *r, struct uwb_ring_stats *s);
+
+#endif
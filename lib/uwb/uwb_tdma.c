@@ -0,0 +1,186 @@
+#include "uwb.h"
+#include "uwb_tdma.h"
+
+/* SYNC length with a schedule of n_slots tags and n_anchors reports */
+static int sync_len(int n_slots, int n_anchors)
+{
+    int len = UWB_TDMA_HDR_OFS + UWB_TDMA_HDR_LEN + n_slots * UWB_TDMA_TAG_LEN;
+
+    if(n_anchors > 0)
+        len += UWB_TDMA_RPT_HDR_LEN + n_anchors;
+
+    return len;
+}
+
+int uwb_tdma_init(struct uwb_tdma_sched *s, const uint16_t *tags, int n, uint16_t blink_len)
+{
+    if(n < 0 || n > UWB_TDMA_MAX_SLOTS)
+        return -1;
+
+    s->n_slots = n;
+    s->slot_uus = UWB_TDMA_SLOT_UUS(blink_len);
+    s->first_slot_uus = UWB_TDMA_FIRST_SLOT_UUS(sync_len(n, 0));
+
+    for(int i = 0; i < n; i++)
+        s->tags[i] = tags[i];
+
+    s->n_anchors = 0;
+    s->report_ofs_uus = 0;
+    s->report_uus = 0;
+
+    return 0;
+}
+
+int uwb_tdma_set_reports(struct uwb_tdma_sched *s, const uint8_t *anchors, int n, uint16_t report_len)
+{
+    if(n < 0 || n > UWB_TDMA_MAX_ANCHORS)
+        return -1;
+
+    /* the longer SYNC pushes the tag slots out a little */
+    s->first_slot_uus = UWB_TDMA_FIRST_SLOT_UUS(sync_len(s->n_slots, n));
+
+    s->n_anchors = n;
+    s->report_uus = UWB_TDMA_SLOT_UUS(report_len);
+    s->report_ofs_uus = s->first_slot_uus + s->n_slots * s->slot_uus + UWB_TDMA_REPORT_GAP_US;
+
+    for(int i = 0; i < n; i++)
+        s->anchors[i] = anchors[i];
+
+    return 0;
+}
+
+int uwb_tdma_encode(const struct uwb_tdma_sched *s, uint8_t *frame, uint16_t max)
+{
+    int len = sync_len(s->n_slots, s->n_anchors);
+
+    if(len > max)
+        return -1;
+
+    uint8_t *p = &frame[UWB_TDMA_HDR_OFS];
+
+    p[0] = s->n_slots;
+    p[1] = s->slot_uus;
+    p[2] = s->slot_uus >> 8;
+    p[3] = s->first_slot_uus;
+    p[4] = s->first_slot_uus >> 8;
+
+    for(int i = 0; i < s->n_slots; i++)
+        uwb_msg_put_u16(&p[UWB_TDMA_HDR_LEN + i * UWB_TDMA_TAG_LEN], s->tags[i]);
+
+    if(s->n_anchors > 0)
+    {
+        p += UWB_TDMA_HDR_LEN + s->n_slots * UWB_TDMA_TAG_LEN;
+
+        p[0] = s->n_anchors;
+        p[1] = s->report_ofs_uus;
+        p[2] = s->report_ofs_uus >> 8;
+        p[3] = s->report_uus;
+        p[4] = s->report_uus >> 8;
+
+        for(int i = 0; i < s->n_anchors; i++)
+            p[UWB_TDMA_RPT_HDR_LEN + i] = s->anchors[i];
+    }
+
+    return len;
+}
+
+int uwb_tdma_decode(struct uwb_tdma_sched *s, const uint8_t *frame, uint16_t len)
+{
+    if(len < UWB_TDMA_HDR_OFS + UWB_TDMA_HDR_LEN)
+        return -1;
+
+    const uint8_t *p = &frame[UWB_TDMA_HDR_OFS];
+
+    if(p[0] > UWB_TDMA_MAX_SLOTS || len < sync_len(p[0], 0))
+        return -1;
+
+    s->n_slots = p[0];
+    s->slot_uus = p[1] | (p[2] << 8);
+    s->first_slot_uus = p[3] | (p[4] << 8);
+
+    for(int i = 0; i < s->n_slots; i++)
+        s->tags[i] = uwb_msg_get_u16(&p[UWB_TDMA_HDR_LEN + i * UWB_TDMA_TAG_LEN]);
+
+    s->n_anchors = 0;
+    s->report_ofs_uus = 0;
+    s->report_uus = 0;
+
+    /* optional report section */
+    int ofs = sync_len(s->n_slots, 0);
+    p = &frame[ofs];
+
+    if(len >= ofs + UWB_TDMA_RPT_HDR_LEN && p[0] <= UWB_TDMA_MAX_ANCHORS &&
+       len >= ofs + UWB_TDMA_RPT_HDR_LEN + p[0])
+    {
+        s->n_anchors = p[0];
+        s->report_ofs_uus = p[1] | (p[2] << 8);
+        s->report_uus = p[3] | (p[4] << 8);
+
+        for(int i = 0; i < s->n_anchors; i++)
+            s->anchors[i] = p[UWB_TDMA_RPT_HDR_LEN + i];
+    }
+
+    return 0;
+}
+
+int uwb_tdma_slot_of(const struct uwb_tdma_sched *s, uint16_t tag_id)
+{
+    for(int i = 0; i < s->n_slots; i++)
+    {
+        if(s->tags[i] == tag_id)
+            return i;
+    }
+
+    return -1;
+}
+
+uint32_t uwb_tdma_tx_time(const struct uwb_tdma_sched *s, uint64_t sync_rx_ts, int slot)
+{
+    uint64_t dly = s->first_slot_uus + (uint64_t)slot * s->slot_uus;
+
+    return (uint32_t)((sync_rx_ts + dly * UUS_TO_DWT_TIME) >> 8);
+}
+
+int uwb_tdma_slot_at(const struct uwb_tdma_sched *s, uint64_t sync_rx_ts, uint64_t rx_ts)
+{
+    uint64_t first = (uint64_t)s->first_slot_uus * UUS_TO_DWT_TIME;
+    uint64_t dt = (rx_ts - sync_rx_ts) & 0xFFFFFFFFFFULL;
+
+    if(dt < first || s->slot_uus == 0)
+        return -1;
+
+    uint64_t slot = (dt - first) / ((uint64_t)s->slot_uus * UUS_TO_DWT_TIME);
+
+    return (slot < s->n_slots) ? (int)slot : -1;
+}
+
+int uwb_tdma_report_of(const struct uwb_tdma_sched *s, uint8_t anchor_id)
+{
+    for(int i = 0; i < s->n_anchors; i++)
+    {
+        if(s->anchors[i] == anchor_id)
+            return i;
+    }
+
+    return -1;
+}
+
+uint32_t uwb_tdma_report_ofs_uus(const struct uwb_tdma_sched *s, int k)
+{
+    return s->report_ofs_uus + (uint32_t)k * s->report_uus;
+}
+
+uint32_t uwb_tdma_report_tx_time(const struct uwb_tdma_sched *s, uint64_t sync_rx_ts, int k)
+{
+    uint64_t dly = uwb_tdma_report_ofs_uus(s, k);
+
+    return (uint32_t)((sync_rx_ts + dly * UUS_TO_DWT_TIME) >> 8);
+}
+
+uint32_t uwb_tdma_end_uus(const struct uwb_tdma_sched *s)
+{
+    if(s->n_anchors > 0)
+        return uwb_tdma_report_ofs_uus(s, s->n_anchors);
+
+    return s->first_slot_uus + (uint32_t)s->n_slots * s->slot_uus;
+}
@@ -0,0 +1,114 @@
+#ifndef UWB_TDMA_H
+#define UWB_TDMA_H
+
+#include <stdint.h>
+#include "uwb_msg.h"
+#include "uwb_profile.h"
+
+/* TDMA superframe for TDoA blinks.
+ *
+ * The master's SYNC starts a superframe. Tag slot k begins
+ * first_slot_uus + k * slot_uus after the SYNC RMARKER, measured by each
+ * tag on its own RX timestamp, so tags need no clock sync beyond
+ * receiving SYNC. The schedule rides in the SYNC frame right after its
+ * fixed part (struct uwb_msg_sync, 8 bytes):
+ *
+ *   [8]      n_slots
+ *   [9..10]  slot_uus        (le16)
+ *   [11..12] first_slot_uus  (le16)
+ *   [13..]   n_slots tag ids (le16, 0 = free slot), the 16-bit blink
+ *            addresses
+ *
+ * In hub mode the tag slots are followed by one report slot per slave
+ * anchor, in which it forwards the blinks it heard in this superframe
+ * to the master (see uwb_hub.h). That section follows the tag ids:
+ *
+ *   [0]      n_anchors
+ *   [1..2]   report_ofs_uus  (le16, first report slot after SYNC)
+ *   [3..4]   report_uus      (le16)
+ *   [5..]    n_anchors anchor ids
+ *
+ * A SYNC without it schedules no reports. */
+
+#define UWB_TDMA_HDR_OFS    UWB_MSG_SYNC_LEN
+#define UWB_TDMA_HDR_LEN    5
+#define UWB_TDMA_MAX_SLOTS  16
+#define UWB_TDMA_TAG_LEN    2
+
+#define UWB_TDMA_RPT_HDR_LEN 5
+#define UWB_TDMA_MAX_ANCHORS 8
+
+/* longest SYNC with a full schedule */
+#define UWB_TDMA_SYNC_MAX   (UWB_TDMA_HDR_OFS + UWB_TDMA_HDR_LEN + \
+                             UWB_TDMA_MAX_SLOTS * UWB_TDMA_TAG_LEN + \
+                             UWB_TDMA_RPT_HDR_LEN + UWB_TDMA_MAX_ANCHORS)
+
+/* covers RX timestamp jitter and the slaves re-arming between blinks */
+#define UWB_TDMA_GUARD_US   50
+
+/* slot width for blinks of blink_len bytes */
+#define UWB_TDMA_SLOT_UUS(blink_len) (UWB_FRAME_US(blink_len) + UWB_TDMA_GUARD_US)
+
+/* first slot: far enough after SYNC for a tag to finish receiving it
+ * and program its delayed TX */
+#define UWB_TDMA_FIRST_SLOT_UUS(sync_len) UWB_REPLY_DLY_UUS(sync_len)
+
+/* between the last tag slot and the first report: a slave collects the
+ * last blink, stops its receiver and loads the report */
+#define UWB_TDMA_REPORT_GAP_US  (2 * UWB_HOST_TURNAROUND_US)
+
+/* STS profile, uwb_sts_set_index(): the blinks and reports of a
+ * superframe are keyed to its SYNC sequence, and the SYNC itself to the
+ * superframe before it, which is what a node that heard that one still
+ * has loaded. a node that missed it resyncs from the SYNC's sequence. */
+#define UWB_TDMA_SYNC_STS_INDEX(seq) ((uint16_t)((seq) - 1))
+
+struct uwb_tdma_sched {
+    uint8_t  n_slots;
+    uint16_t slot_uus;
+    uint16_t first_slot_uus;
+    uint16_t tags[UWB_TDMA_MAX_SLOTS];
+    uint8_t  n_anchors;
+    uint16_t report_ofs_uus;
+    uint16_t report_uus;
+    uint8_t  anchors[UWB_TDMA_MAX_ANCHORS];
+};
+
+/* fill a schedule giving tags[i] slot i, with slot widths from the
+ * build-time radio profile. returns -1 if n is too large. */
+int uwb_tdma_init(struct uwb_tdma_sched *s, const uint16_t *tags, int n, uint16_t blink_len);
+
+/* add report slots for anchors[i], sized for reports of report_len
+ * bytes, UWB_TDMA_REPORT_GAP_US after the last tag slot. call after
+ * uwb_tdma_init(). returns -1 if n is too large. */
+int uwb_tdma_set_reports(struct uwb_tdma_sched *s, const uint8_t *anchors, int n, uint16_t report_len);
+
+/* append the schedule to a SYNC frame at UWB_TDMA_HDR_OFS. returns the
+ * total frame length, or -1 if it does not fit in max bytes. */
+int uwb_tdma_encode(const struct uwb_tdma_sched *s, uint8_t *frame, uint16_t max);
+
+/* parse the schedule out of a received SYNC. returns -1 if the frame
+ * has none (e.g. an older master) or it is malformed. */
+int uwb_tdma_decode(struct uwb_tdma_sched *s, const uint8_t *frame, uint16_t len);
+
+/* slot of a tag, or -1 if it is not scheduled */
+int uwb_tdma_slot_of(const struct uwb_tdma_sched *s, uint16_t tag_id);
+
+/* slot a frame received at rx_ts fell in, or -1 if outside all slots */
+int uwb_tdma_slot_at(const struct uwb_tdma_sched *s, uint64_t sync_rx_ts, uint64_t rx_ts);
+
+/* report slot of an anchor, or -1 if it has none */
+int uwb_tdma_report_of(const struct uwb_tdma_sched *s, uint8_t anchor_id);
+
+/* offset of a report slot from the SYNC, and the end of the last one */
+uint32_t uwb_tdma_report_ofs_uus(const struct uwb_tdma_sched *s, int k);
+uint32_t uwb_tdma_end_uus(const struct uwb_tdma_sched *s);
+
+/* delayed TX time (dwt_setdelayedtrxtime units) for a slot, relative to
+ * the SYNC RX timestamp */
+uint32_t uwb_tdma_tx_time(const struct uwb_tdma_sched *s, uint64_t sync_rx_ts, int slot);
+
+/* same for report slot k */
+uint32_t uwb_tdma_report_tx_time(const struct uwb_tdma_sched *s, uint64_t sync_rx_ts, int k);
+
+#endif
@@ -0,0 +1,274 @@
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_timing.h"
+
+LOG_MODULE_REGISTER(uwb_timing, LOG_LEVEL_INF);
+
+/* symbol durations in ps, 64 MHz PRF (codes 9-12) or 16 MHz PRF (1-8) */
+#define PSYM_PRF64_PS   1017628U
+#define PSYM_PRF16_PS   993590U
+#define STS_SYM_PS      1025641U
+#define BIT_850K_PS     1025641U
+#define BIT_6M8_PS      128205U
+#define PHR_BITS        21
+
+/* wake-up of the consumer thread after the DW3000 IRQ edge */
+#define IRQ_LATENCY_NS  50000U
+
+/* added on top of the self-test result */
+#define SELFTEST_MARGIN_UUS 20
+#define SELFTEST_TRIALS     4
+#define SELFTEST_MAX_UUS    3000
+
+/* RX on before the reply preamble, and frame wait kept after its end */
+#define RX_WINDOW_GUARD_UUS 10
+
+/* SPI write model: fixed cost per transaction + cost per byte */
+static uint32_t spi_fixed_ns = 20000;
+static uint32_t spi_byte_ns = 1000;
+
+/* smallest good delay from the self-test, 0 if not run */
+static uint32_t tx_lead_uus;
+
+static uint32_t plen_syms(const dwt_config_t *cfg)
+{
+    switch(cfg->txPreambLength)
+    {
+    case DWT_PLEN_32:   return 32;
+    case DWT_PLEN_64:   return 64;
+    case DWT_PLEN_72:   return 72;
+    case DWT_PLEN_128:  return 128;
+    case DWT_PLEN_256:  return 256;
+    case DWT_PLEN_512:  return 512;
+    case DWT_PLEN_1024: return 1024;
+    case DWT_PLEN_1536: return 1536;
+    case DWT_PLEN_2048: return 2048;
+    case DWT_PLEN_4096: return 4096;
+    default:            return 128;
+    }
+}
+
+static uint32_t sfd_syms(const dwt_config_t *cfg)
+{
+    switch(cfg->sfdType)
+    {
+    case DWT_SFD_DW_16: return 16;
+    default:            return 8;
+    }
+}
+
+static uint32_t sts_syms(const dwt_config_t *cfg)
+{
+    if((cfg->stsMode & DWT_STS_CONFIG_MASK) == DWT_STS_MODE_OFF)
+        return 0;
+
+    /* DWT_STS_LEN_32 .. DWT_STS_LEN_2048 */
+    return 32U << cfg->stsLength;
+}
+
+static uint32_t psym_ps(const dwt_config_t *cfg)
+{
+    return cfg->txCode >= 9 ? PSYM_PRF64_PS : PSYM_PRF16_PS;
+}
+
+static uint32_t pac_syms(const dwt_config_t *cfg)
+{
+    switch(cfg->rxPAC)
+    {
+    case DWT_PAC4:  return 4;
+    case DWT_PAC16: return 16;
+    case DWT_PAC32: return 32;
+    default:        return 8;
+    }
+}
+
+uint32_t uwb_shr_ns(const dwt_config_t *cfg)
+{
+    return (uint32_t)(((uint64_t)(plen_syms(cfg) + sfd_syms(cfg)) * psym_ps(cfg)) / 1000);
+}
+
+uint32_t uwb_rx_tail_ns(const dwt_config_t *cfg, uint16_t len)
+{
+    uint32_t bits = (len + FCS_LEN) * 8;
+
+    /* 48 Reed-Solomon parity bits per started 330-bit block */
+    bits += 48 * ((bits + 329) / 330);
+
+    uint64_t ps = (uint64_t)sts_syms(cfg) * STS_SYM_PS;
+
+    ps += (uint64_t)PHR_BITS *
+          (cfg->phrRate == DWT_PHRRATE_DTA && cfg->dataRate == DWT_BR_6M8 ? BIT_6M8_PS : BIT_850K_PS);
+    ps += (uint64_t)bits * (cfg->dataRate == DWT_BR_6M8 ? BIT_6M8_PS : BIT_850K_PS);
+
+    return (uint32_t)(ps / 1000);
+}
+
+uint32_t uwb_airtime_ns(const dwt_config_t *cfg, uint16_t len)
+{
+    return uwb_shr_ns(cfg) + uwb_rx_tail_ns(cfg, len);
+}
+
+uint32_t uwb_spi_write_ns(uint16_t len)
+{
+    return spi_fixed_ns + len * spi_byte_ns;
+}
+
+uint32_t uwb_rx_service_ns(uint16_t rx_len)
+{
+    /* status, frame data and RX timestamp: three transactions. reads
+     * clock the same as writes. */
+    return IRQ_LATENCY_NS + 3 * spi_fixed_ns + (rx_len + 4 + 5) * spi_byte_ns;
+}
+
+static uint32_t time_write(uint8_t *buf, uint16_t len)
+{
+    uint32_t best = UINT32_MAX;
+
+    /* best of a few, to keep interrupts out of the figure */
+    for(int i = 0; i < 4; i++)
+    {
+        uint32_t t0 = k_cycle_get_32();
+        dwt_writetxdata(len, buf, 0);
+        uint32_t dt = k_cycle_get_32() - t0;
+
+        if(dt < best)
+            best = dt;
+    }
+
+    return (uint32_t)k_cyc_to_ns_floor64(best);
+}
+
+void uwb_timing_calibrate(void)
+{
+    uint8_t buf[UWB_FRAME_MAX];
+    memset(buf, 0, sizeof(buf));
+
+    uint32_t t_small = time_write(buf, 1);
+    uint32_t t_large = time_write(buf, UWB_FRAME_MAX - FCS_LEN);
+
+    if(t_large > t_small)
+        spi_byte_ns = (t_large - t_small) / (UWB_FRAME_MAX - FCS_LEN - 1);
+
+    spi_fixed_ns = t_small > spi_byte_ns ? t_small - spi_byte_ns : 0;
+
+    LOG_INF("SPI write: %u ns + %u ns/byte", spi_fixed_ns, spi_byte_ns);
+}
+
+/* one delayed TX at now + dly. returns 0 if the radio accepted it in time */
+static int try_delay(const uint8_t *buf, uint16_t len, uint32_t dly_uus)
+{
+    uint64_t now = uwb_get_sys_time();
+    uint32_t tx_time = (uint32_t)((now + (uint64_t)dly_uus * UUS_TO_DWT_TIME) >> 8);
+
+    decaIrqStatus_t s = decamutexon();
+
+    dwt_writetxdata(len, (uint8_t *)buf, 0);
+    dwt_writetxfctrl(len + FCS_LEN, 0, 0);
+    dwt_setdelayedtrxtime(tx_time);
+    uwb_sts_reload();
+
+    int ok = dwt_starttx(DWT_START_TX_DELAYED) == DWT_SUCCESS &&
+             !(dwt_readsysstatuslo() & DWT_INT_HPDWARN_BIT_MASK);
+
+    decamutexoff(s);
+
+    /* let an accepted frame go out, then reset so both the polled and the
+     * interrupt-driven modes start from a clean radio */
+    if(ok)
+        k_usleep(dly_uus + 2000);
+
+    dwt_forcetrxoff();
+    dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK | DWT_INT_HPDWARN_BIT_MASK);
+    uwb_async_flush();
+
+    return ok ? 0 : -1;
+}
+
+int uwb_timing_selftest(uint16_t tx_len)
+{
+    uint8_t buf[UWB_FRAME_MAX];
+    memset(buf, 0, sizeof(buf));
+
+    if(tx_len > UWB_FRAME_MAX - FCS_LEN)
+        tx_len = UWB_FRAME_MAX - FCS_LEN;
+
+    uint32_t lo = 0;
+    uint32_t hi = SELFTEST_MAX_UUS;
+
+    /* the upper bound must work at all */
+    for(int i = 0; i < SELFTEST_TRIALS; i++)
+    {
+        if(try_delay(buf, tx_len, hi) != 0)
+        {
+            LOG_ERR("delayed TX fails even at %u uus", hi);
+            return -1;
+        }
+    }
+
+    /* lo always fails, hi always succeeds */
+    while(hi - lo > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        int good = 1;
+
+        for(int i = 0; i < SELFTEST_TRIALS && good; i++)
+        {
+            if(try_delay(buf, tx_len, mid) != 0)
+                good = 0;
+        }
+
+        if(good)
+            hi = mid;
+        else
+            lo = mid;
+    }
+
+    tx_lead_uus = hi + SELFTEST_MARGIN_UUS;
+
+    LOG_INF("TX lead for %u bytes: %u uus (+%u margin)", tx_len, hi, SELFTEST_MARGIN_UUS);
+
+    return (int)hi;
+}
+
+uint32_t uwb_reply_dly_uus(const dwt_config_t *cfg, uint16_t rx_len, uint16_t tx_len)
+{
+    uint32_t ns = uwb_rx_tail_ns(cfg, rx_len) + uwb_rx_service_ns(rx_len);
+
+    if(tx_lead_uus)
+        ns += tx_lead_uus * 1000;
+    else
+        ns += 3 * spi_fixed_ns + uwb_spi_write_ns(tx_len) + uwb_shr_ns(cfg) +
+              SELFTEST_MARGIN_UUS * 1000;
+
+    return (ns + 999) / 1000;
+}
+
+void uwb_rx_window_for_reply(struct uwb_rx_window *w, const dwt_config_t *cfg,
+                             uint16_t tx_len, uint32_t reply_dly_uus, uint16_t reply_len)
+{
+    /* the RX-after-TX delay counts from the end of our frame, the reply
+     * delay from its RMARKER */
+    uint32_t tail_uus = (uwb_rx_tail_ns(cfg, tx_len) + 999) / 1000;
+    uint32_t shr_uus = (uwb_shr_ns(cfg) + 999) / 1000;
+    uint32_t lead_uus = tail_uus + shr_uus + RX_WINDOW_GUARD_UUS;
+
+    w->delay_uus = reply_dly_uus > lead_uus ? reply_dly_uus - lead_uus : 0;
+
+    /* from RX on to the reply RMARKER, then the rest of the reply. a
+     * reply too quick for the guard finds the receiver on at TX end. */
+    uint32_t start_uus = w->delay_uus ? shr_uus + RX_WINDOW_GUARD_UUS :
+                         reply_dly_uus > tail_uus ? reply_dly_uus - tail_uus : shr_uus;
+    uint32_t reply_uus = (uwb_rx_tail_ns(cfg, reply_len) + 999) / 1000;
+
+    w->timeout_uus = start_uus + reply_uus + RX_WINDOW_GUARD_UUS;
+
+    /* preamble must be detected within guard + its own length. the
+     * radio adds one PAC to the value. */
+    uint32_t pac_ns = (uint32_t)(((uint64_t)pac_syms(cfg) * psym_ps(cfg)) / 1000);
+
+    w->pre_timeout_pacs = (start_uus * 1000 + pac_ns - 1) / pac_ns;
+}
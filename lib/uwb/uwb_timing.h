@@ -0,0 +1,57 @@
+#ifndef UWB_TIMING_H
+#define UWB_TIMING_H
+
+#include <stdint.h>
+#include "deca_device_api.h"
+#include "uwb.h"
+
+/* Runtime airtime and turnaround model.
+ *
+ * uwb_profile.h gives the same numbers at build time for the Kconfig
+ * profile. The functions here work from any dwt_config_t and replace the
+ * host turnaround budget with values measured on the running board:
+ * SPI write cost from uwb_timing_calibrate() and the real TX lead time
+ * from uwb_timing_selftest(). */
+
+/* preamble + SFD */
+uint32_t uwb_shr_ns(const dwt_config_t *cfg);
+
+/* whole frame on air, len is the payload without FCS */
+uint32_t uwb_airtime_ns(const dwt_config_t *cfg, uint16_t len);
+
+/* part of a frame after its RMARKER (STS, PHR, data), i.e. how long after
+ * the RX timestamp the frame is actually complete */
+uint32_t uwb_rx_tail_ns(const dwt_config_t *cfg, uint16_t len);
+
+/* time SPI takes to write len bytes of TX data */
+uint32_t uwb_spi_write_ns(uint16_t len);
+
+/* time the host needs to get a frame of rx_len out of the radio once it
+ * has ended: IRQ latency plus the data and timestamp reads */
+uint32_t uwb_rx_service_ns(uint16_t rx_len);
+
+/* measure SPI write cost with the cycle counter. call after uwb_init() or
+ * uwb_radio_init(), with the fast SPI rate selected. */
+void uwb_timing_calibrate(void);
+
+/* binary-search the smallest "timestamp known -> TX RMARKER" delay at
+ * which a delayed TX of tx_len bytes is neither rejected as late nor
+ * flags HPDWARN. transmits test frames of type 0x00. the result, plus a
+ * margin, is used by uwb_reply_dly_uus(). returns the delay in uus, or
+ * -1 if even the upper bound failed. */
+int uwb_timing_selftest(uint16_t tx_len);
+
+/* smallest safe RX timestamp -> delayed TX timestamp offset for replying
+ * to a frame of rx_len bytes with one of tx_len bytes */
+uint32_t uwb_reply_dly_uus(const dwt_config_t *cfg, uint16_t rx_len, uint16_t tx_len);
+
+/* receive window for a reply of reply_len bytes whose RMARKER comes
+ * reply_dly_uus after the RMARKER of our tx_len frame. the receiver goes
+ * on a guard time before the reply preamble, the preamble timeout ends
+ * the RX early when nothing is on air, and the frame wait timeout covers
+ * the whole reply. reply_dly_uus is a reply delay as seen by the
+ * responder, flight time is inside the guard. */
+void uwb_rx_window_for_reply(struct uwb_rx_window *w, const dwt_config_t *cfg,
+                             uint16_t tx_len, uint32_t reply_dly_uus, uint16_t reply_len);
+
+#endif
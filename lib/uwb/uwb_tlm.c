@@ -0,0 +1,139 @@
+#include "uwb_msg.h"
+#include "uwb_tlm.h"
+
+#define SYNC_BODY           24
+#define BLINK_SHORT_BODY    10
+#define BLINK_LONG_BODY     18
+#define BLINK_DELTA_BODY    7
+
+void uwb_tlm_begin(struct uwb_tlm *t, uint8_t anchor_id, uint16_t max)
+{
+    t->max = (max > UWB_TLM_MAX) ? UWB_TLM_MAX : max;
+    t->len = UWB_TLM_HDR_LEN;
+    t->count = 0;
+    t->ntags = 0;
+    t->last_sync = -1;
+
+    t->data[0] = UWB_TLM_VERSION;
+    t->data[1] = anchor_id;
+    t->data[2] = 0;
+}
+
+/* room for one record of len bytes. returns the write pointer, or NULL
+ * if it does not fit. */
+static uint8_t *put_rec(struct uwb_tlm *t, int len)
+{
+    if(t->count == 0xFF || t->len + len > t->max)
+        return NULL;
+
+    uint8_t *p = &t->data[t->len];
+
+    t->len += len;
+    t->data[2] = ++t->count;
+
+    return p;
+}
+
+/* SYNC header and optional absolute seq. returns the write pointer, or
+ * NULL if the header plus body do not fit. */
+static uint8_t *put_sync_hdr(struct uwb_tlm *t, uint8_t seq)
+{
+    uint8_t delta = (uint8_t)(seq - t->last_sync);
+    int esc = (t->last_sync < 0 || delta >= UWB_TLM_SEQ_ESC);
+
+    uint8_t *p = put_rec(t, 1 + esc + SYNC_BODY);
+    if(!p)
+        return NULL;
+
+    *p++ = (UWB_TLM_SYNC << 6) | (esc ? UWB_TLM_SEQ_ESC : delta);
+    if(esc)
+        *p++ = seq;
+
+    t->last_sync = seq;
+
+    return p;
+}
+
+int uwb_tlm_add_sync(struct uwb_tlm *t, uint8_t seq, uint64_t tx_ts, uint64_t rx_ts,
+                     int64_t offset, int32_t skew_q32, uint64_t corrected)
+{
+    uint8_t *p = put_sync_hdr(t, seq);
+    if(!p)
+        return -1;
+
+    uwb_msg_put_ts(&p[0], tx_ts);
+    uwb_msg_put_ts(&p[5], rx_ts);
+    uwb_msg_put_ts(&p[10], (uint64_t)offset);
+
+    for(int i = 0; i < 4; i++)
+        p[15 + i] = (uint32_t)skew_q32 >> (8 * i);
+
+    uwb_msg_put_ts(&p[19], corrected);
+
+    return 0;
+}
+
+static int tag_find(const struct uwb_tlm *t, uint64_t tag)
+{
+    for(int i = 0; i < t->ntags; i++)
+        if(t->tag[i] == tag)
+            return i;
+
+    return -1;
+}
+
+int uwb_tlm_add_blink(struct uwb_tlm *t, uint64_t tag, uint32_t seq, uint8_t sync_seq,
+                      uint64_t corrected)
+{
+    int n = tag_find(t, tag);
+    uint32_t delta = (n >= 0) ? seq - t->tag_seq[n] : 0;
+    uint8_t *p;
+
+    if(delta >= 1 && delta <= UINT8_MAX)
+    {
+        p = put_rec(t, 1 + BLINK_DELTA_BODY);
+        if(!p)
+            return -1;
+
+        *p++ = (UWB_TLM_BLINK << 6) | n;
+        *p++ = sync_seq;
+        *p++ = delta;
+    }
+    else
+    {
+        int shrt = (tag <= UINT16_MAX && seq <= UINT16_MAX);
+
+        p = put_rec(t, 1 + (shrt ? BLINK_SHORT_BODY : BLINK_LONG_BODY));
+        if(!p)
+            return -1;
+
+        *p++ = (UWB_TLM_BLINK << 6) | (shrt ? UWB_TLM_BLINK_SHORT : UWB_TLM_BLINK_LONG);
+        *p++ = sync_seq;
+
+        if(shrt)
+        {
+            uwb_msg_put_u16(&p[0], tag);
+            uwb_msg_put_u16(&p[2], seq);
+            p += 4;
+        }
+        else
+        {
+            uwb_msg_put_u64(&p[0], tag);
+            uwb_msg_put_u32(&p[8], seq);
+            p += 12;
+        }
+
+        if(n < 0 && t->ntags < UWB_TLM_TAGS)
+        {
+            n = t->ntags++;
+            t->tag[n] = tag;
+        }
+    }
+
+    if(n >= 0)
+        t->tag_seq[n] = seq;
+
+    uwb_msg_put_ts(p, corrected);
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#ifndef UWB_TLM_H
+#define UWB_TLM_H
+
+#include <stdint.h>
+
+/* Packed anchor telemetry, batched into BLE notifications.
+ *
+ * One notification is a packet:
+ *
+ *   [0] version    UWB_TLM_VERSION
+ *   [1] anchor id
+ *   [2] record count
+ *   [3..] records
+ *
+ * Every record starts with one byte, the type in bits 7..6. For SYNC,
+ * bits 5..0 are the seq delta to the previous SYNC in the packet;
+ * UWB_TLM_SEQ_ESC there (always for the first one) means the absolute
+ * seq follows in the next byte.
+ *
+ * For BLINK, bits 5..0 are UWB_TLM_BLINK_SHORT or UWB_TLM_BLINK_LONG
+ * when tag and seq are sent in full, at the widths of the two blink
+ * frames (uwb_msg.h). Each tag sent in full gets the next tag number in
+ * the packet, up to UWB_TLM_TAGS. A later blink from a numbered tag
+ * whose seq is 1..255 ahead of that tag's previous one is sent as the
+ * tag number in bits 5..0 and the seq delta. Multi-byte fields are
+ * little endian, timestamps are 40 bits.
+ *
+ *   SYNC:  hdr, [seq], tx_ts[5], rx_ts[5], offset[5] (signed),
+ *          skew[4] (Q32, see uwb_ts.h), corrected[5]
+ *   BLINK: hdr, sync_seq, tag[2|8], seq[2|4], corrected[5]
+ *          hdr, sync_seq, seq_delta, corrected[5]
+ *
+ * A BLINK's sync TX time is the tx_ts of the last SYNC record with that
+ * sync_seq, so it is not repeated. scripts/uwb_tlm.py decodes this. */
+
+#define UWB_TLM_VERSION     3
+#define UWB_TLM_HDR_LEN     3
+
+/* ATT payload with the 247-byte L2CAP MTU */
+#define UWB_TLM_MAX         244
+
+#define UWB_TLM_SYNC        1
+#define UWB_TLM_BLINK       2
+
+#define UWB_TLM_SEQ_ESC     0x3F
+
+#define UWB_TLM_BLINK_SHORT 0x3E
+#define UWB_TLM_BLINK_LONG  0x3F
+
+/* as many tags as short full blinks fit a packet */
+#define UWB_TLM_TAGS        21
+
+struct uwb_tlm {
+    uint8_t  data[UWB_TLM_MAX];
+    uint16_t len;
+    uint16_t max;
+    uint8_t  count;
+    uint8_t  ntags;
+    int16_t  last_sync;         /* -1 = none yet */
+    uint64_t tag[UWB_TLM_TAGS];
+    uint32_t tag_seq[UWB_TLM_TAGS];
+};
+
+/* start an empty packet of at most max bytes (the notification MTU) */
+void uwb_tlm_begin(struct uwb_tlm *t, uint8_t anchor_id, uint16_t max);
+
+/* append a record. returns -1 if it does not fit, the packet is then
+ * unchanged and should be sent before trying again. */
+int uwb_tlm_add_sync(struct uwb_tlm *t, uint8_t seq, uint64_t tx_ts, uint64_t rx_ts,
+                     int64_t offset, int32_t skew_q32, uint64_t corrected);
+/* a blink is delta-coded when its tag already has a number, otherwise
+ * the short form is used when tag and seq both fit 16 bits */
+int uwb_tlm_add_blink(struct uwb_tlm *t, uint64_t tag, uint32_t seq, uint8_t sync_seq,
+                      uint64_t corrected);
+
+#endif
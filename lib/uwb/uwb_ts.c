@@ -0,0 +1,94 @@
+#include "uwb_ts.h"
+
+/* mm per tick, Q16: 299702547 m/s / 63.8976 GHz */
+#define MM_PER_TICK_Q16 307387
+
+static int64_t div_round(int64_t n, int64_t d)
+{
+    return (n < 0) ? (n - d / 2) / d : (n + d / 2) / d;
+}
+
+static int32_t skew_clamp(int64_t s)
+{
+    if(s > UWB_SKEW_Q32_MAX)
+        return UWB_SKEW_Q32_MAX;
+    if(s < -UWB_SKEW_Q32_MAX)
+        return -UWB_SKEW_Q32_MAX;
+
+    return (int32_t)s;
+}
+
+int32_t uwb_skew_q32(int64_t local_dt, int64_t ref_dt)
+{
+    if(local_dt <= 0)
+        return 0;
+
+    int64_t diff = local_dt - ref_dt;
+
+    /* keeps diff << 32 inside 64 bits; anything this large is clamped anyway */
+    if(diff >= (1LL << 30) || diff <= -(1LL << 30))
+        return skew_clamp(diff > 0 ? INT64_MAX : INT64_MIN);
+
+    return skew_clamp(div_round(diff * (1LL << 32), local_dt));
+}
+
+int32_t uwb_skew_q32_from_ppb(int32_t ppb)
+{
+    return skew_clamp(div_round((int64_t)ppb * (1LL << 32), 1000000000));
+}
+
+int64_t uwb_skew_apply(int64_t dt, int32_t skew_q32)
+{
+    /* |dt| < 2^40 and |skew| <= 2^22: the product fits */
+    int64_t p = dt * skew_clamp(skew_q32);
+
+    return (p < 0) ? -((-p + (1LL << 31)) >> 32) : (p + (1LL << 31)) >> 32;
+}
+
+uint64_t uwb_ts_to_remote(uint64_t local, uint64_t ref_local,
+                          uint64_t ref_remote, int32_t skew_q32)
+{
+    int64_t dt = uwb_ts_sub(local, ref_local);
+
+    return uwb_ts_add(ref_remote, dt - uwb_skew_apply(dt, skew_q32));
+}
+
+int uwb_ds_twr_tof_q8(uint64_t t1, uint64_t t2, uint64_t t3,
+                      uint64_t t4, uint64_t t5, uint64_t t6, int64_t *tof_q8)
+{
+    int64_t ra = uwb_ts_sub(t4, t1);
+    int64_t rb = uwb_ts_sub(t6, t3);
+    int64_t da = uwb_ts_sub(t5, t4);
+    int64_t db = uwb_ts_sub(t3, t2);
+
+    if(ra < 0 || rb < 0 || da < 0 || db < 0)
+        return -1;
+    if(ra > UINT32_MAX || rb > UINT32_MAX || da > UINT32_MAX || db > UINT32_MAX)
+        return -1;
+
+    /* the products are exact in 64 bits but may exceed 2^63, so they
+     * must not be cast or subtracted as signed. the unsigned difference
+     * wraps modulo 2^64 and still equals the true one, tof * den, which
+     * is far below 2^63 for any real link, so the cast to int64 is exact
+     * and keeps its sign */
+    int64_t num = (int64_t)((uint64_t)ra * (uint64_t)rb - (uint64_t)da * (uint64_t)db);
+    int64_t den = ra + rb + da + db;
+
+    if(den == 0)
+        return -1;
+
+    if(num < (1LL << 54) && num > -(1LL << 54))
+        *tof_q8 = div_round(num * 256, den);
+    else
+        *tof_q8 = div_round(num, den) * 256;
+
+    return 0;
+}
+
+int32_t uwb_tof_q8_to_mm(int64_t tof_q8)
+{
+    /* valid for ToF below 2^32 ticks, far beyond any UWB link */
+    int64_t p = tof_q8 * MM_PER_TICK_Q16;
+
+    return (int32_t)((p < 0) ? -((-p + (1LL << 23)) >> 24) : (p + (1LL << 23)) >> 24);
+}
@@ -0,0 +1,68 @@
+#ifndef UWB_TS_H
+#define UWB_TS_H
+
+#include <stdint.h>
+
+/* Integer arithmetic on 40-bit DW3000 timestamps.
+ *
+ * Timestamps are uint64_t holding 40 bits, 15.65 ps per tick, wrapping
+ * every ~17.2 s. Differences are signed and assume the two stamps are
+ * less than half a wrap (~8.6 s) apart. Skews are Q32 fractions
+ * (1 ppm ~= 4295), limited to +-UWB_SKEW_Q32_MAX (~977 ppm) so that
+ * scaling a full 40-bit interval stays within 64 bits. */
+
+#define UWB_TS_MASK         0xFFFFFFFFFFULL
+#define UWB_TS_HALF         (1LL << 39)
+
+#define UWB_SKEW_Q32_MAX    (1L << 22)
+
+static inline uint64_t uwb_ts_add(uint64_t ts, int64_t d)
+{
+    return (ts + (uint64_t)d) & UWB_TS_MASK;
+}
+
+/* a - b, in (-2^39, 2^39] */
+static inline int64_t uwb_ts_sub(uint64_t a, uint64_t b)
+{
+    int64_t d = (int64_t)((a - b) & UWB_TS_MASK);
+
+    if(d > UWB_TS_HALF)
+        d -= 2 * UWB_TS_HALF;
+
+    return d;
+}
+
+/* <0, 0, >0 as a is before, at, after b */
+static inline int uwb_ts_cmp(uint64_t a, uint64_t b)
+{
+    int64_t d = uwb_ts_sub(a, b);
+
+    return (d > 0) - (d < 0);
+}
+
+/* skew of a local clock against a reference, in Q32:
+ * (local_dt - ref_dt) / local_dt, clamped to +-UWB_SKEW_Q32_MAX */
+int32_t uwb_skew_q32(int64_t local_dt, int64_t ref_dt);
+
+/* parts per billion -> Q32, for dwt_readclockoffset() style inputs */
+int32_t uwb_skew_q32_from_ppb(int32_t ppb);
+
+/* dt * skew, rounded to the nearest tick */
+int64_t uwb_skew_apply(int64_t dt, int32_t skew_q32);
+
+/* map a local timestamp to the reference clock, given one matched pair
+ * of stamps (ref_local, ref_remote) and the local skew */
+uint64_t uwb_ts_to_remote(uint64_t local, uint64_t ref_local,
+                          uint64_t ref_remote, int32_t skew_q32);
+
+/* asymmetric DS-TWR time of flight in 1/256 ticks.
+ * t1 poll TX, t4 resp RX, t5 final TX on the initiator,
+ * t2 poll RX, t3 resp TX, t6 final RX on the responder.
+ * returns -1 if an interval is negative or longer than 2^32 ticks (67 ms). */
+int uwb_ds_twr_tof_q8(uint64_t t1, uint64_t t2, uint64_t t3,
+                      uint64_t t4, uint64_t t5, uint64_t t6, int64_t *tof_q8);
+
+/* time of flight in 1/256 ticks -> distance in mm */
+int32_t uwb_tof_q8_to_mm(int64_t tof_q8);
+
+#endif
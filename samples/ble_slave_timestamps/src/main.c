@@ -11,15 +11,15 @@
 #include <zephyr/bluetooth/gatt.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_msg.h"
+#include "uwb_ring.h"
 
 LOG_MODULE_REGISTER(ble_slave, LOG_LEVEL_INF);
 
 #define NODE_ID   2
 #define ANT_DLY   26194
-#define MSG_SYNC  0x10
 
 #define MASK40  0xFFFFFFFFFFULL
 #define HALF40  (1LL << 39)
@@ -34,7 +34,10 @@ struct slave_entry {
 	double   corrected;
 };
 
-K_MSGQ_DEFINE(slave_queue, sizeof(struct slave_entry), 32, 4);
+UWB_RING_DEFINE(slave_ring, struct slave_entry, 32);
+
+/* records formatted per wakeup of the BLE thread */
+#define DRAIN_MAX 8
 
 #define BT_UUID_NUS_VAL \
 	BT_UUID_128_ENCODE(0x6E400001, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9EULL)
@@ -119,67 +122,6 @@ BT_CONN_CB_DEFINE(conn_cb) = {
 	.disconnected = disconnected,
 };
 
-static dwt_config_t uwb_cfg = {
-	.chan           = 9,
-	.txPreambLength = DWT_PLEN_128,
-	.rxPAC          = DWT_PAC8,
-	.txCode         = 9,
-	.rxCode         = 9,
-	.sfdType        = DWT_SFD_DW_8,
-	.dataRate       = DWT_BR_6M8,
-	.phrMode        = DWT_PHRMODE_STD,
-	.phrRate        = DWT_PHRRATE_STD,
-	.sfdTO          = (129 + 8 - 8),
-	.stsMode        = DWT_STS_MODE_OFF,
-	.stsLength      = DWT_STS_LEN_64,
-	.pdoaMode       = DWT_PDOA_M0,
-};
-
-static int uwb_init(void)
-{
-	dw_device_init();
-	dw3000_hw_wakeup_pin_low();
-	Sleep(5);
-	port_set_dw_ic_spi_slowrate();
-
-	if (dwt_probe((struct dwt_probe_s *)&dw3000_probe_interf) != DWT_SUCCESS) {
-		LOG_ERR("dwt_probe failed");
-		return -1;
-	}
-
-	port_set_dw_ic_spi_fastrate();
-
-	if (dwt_initialise(DWT_DW_INIT) != DWT_SUCCESS) {
-		LOG_ERR("dwt_initialise failed");
-		return -1;
-	}
-
-	if (dwt_configure(&uwb_cfg) != DWT_SUCCESS) {
-		LOG_ERR("dwt_configure failed");
-		return -1;
-	}
-
-	dwt_settxantennadelay(ANT_DLY);
-	dwt_setrxantennadelay(ANT_DLY);
-
-	return 0;
-}
-
-static uint64_t get_rx_ts(void)
-{
-	uint8_t ts[5];
-
-	dwt_readrxtimestamp(ts);
-
-	uint64_t val = 0;
-
-	for (int i = 4; i >= 0; i--) {
-		val = (val << 8) | ts[i];
-	}
-
-	return val;
-}
-
 #define UWB_STACK_SIZE 4096
 #define UWB_PRIORITY   5
 
@@ -191,42 +133,30 @@ static void uwb_rx_thread(void *a, void *b, void *c)
 
 	LOG_INF("UWB RX thread started");
 
-	uint8_t  rx_buf[32];
 	uint64_t prev_tx = 0;
 	uint64_t prev_rx = 0;
 	double   drift   = 1.0;
 
-	while (1) {
-		dwt_rxenable(DWT_START_RX_IMMEDIATE);
-
-		uint32_t status;
-
-		while (!((status = dwt_readsysstatuslo()) &
-			 (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR))) {
-		}
-
-		if (!(status & DWT_INT_RXFCG_BIT_MASK)) {
-			dwt_writesysstatuslo(SYS_STATUS_ALL_RX_ERR);
-			continue;
-		}
+	/* frames are read once, in the IRQ path, into pool descriptors */
+	if (uwb_rx_continuous_start() != 0) {
+		LOG_ERR("continuous RX start failed");
+	}
 
-		uint16_t len = dwt_getframelength();
+	while (1) {
+		struct uwb_rx_desc *rx;
+		struct uwb_msg_sync sync;
 
-		dwt_readrxdata(rx_buf, len - FCS_LEN, 0);
+		uwb_rx_await(&rx, K_FOREVER);
 
-		if (rx_buf[0] != MSG_SYNC) {
-			dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR);
+		if (!(rx->status & DWT_INT_RXFCG_BIT_MASK) ||
+		    uwb_msg_sync_unpack(&sync, rx->data, rx->len) != 0) {
+			uwb_rx_release(rx);
 			continue;
 		}
 
-		uint8_t  seq     = rx_buf[1];
-		uint64_t rx_time = get_rx_ts();
-
-		uint64_t tx_time = 0;
-
-		for (int i = 0; i < 5; i++) {
-			tx_time |= ((uint64_t)rx_buf[3 + i]) << (8 * i);
-		}
+		uint8_t  seq     = sync.seq;
+		uint64_t rx_time = rx->rx_ts;
+		uint64_t tx_time = sync.tx_ts;
 
 		int64_t diff = (int64_t)((rx_time - tx_time) & MASK40);
 
@@ -245,24 +175,25 @@ static void uwb_rx_thread(void *a, void *b, void *c)
 
 		double corrected = ((double)rx_time - (double)offset) / drift;
 
-		struct slave_entry entry = {
-			.seq       = seq,
-			.tx_ts     = tx_time,
-			.rx_ts     = rx_time,
-			.offset    = offset,
-			.drift     = drift,
-			.corrected = corrected,
-		};
-
-		if (k_msgq_put(&slave_queue, &entry, K_NO_WAIT) != 0) {
-			k_msgq_purge(&slave_queue);
-			k_msgq_put(&slave_queue, &entry, K_NO_WAIT);
+		/* a full ring drops its oldest record, not the whole backlog */
+		struct slave_entry *e = uwb_ring_reserve(&slave_ring);
+
+		if (e) {
+			*e = (struct slave_entry){
+				.seq       = seq,
+				.tx_ts     = tx_time,
+				.rx_ts     = rx_time,
+				.offset    = offset,
+				.drift     = drift,
+				.corrected = corrected,
+			};
+			uwb_ring_commit(&slave_ring);
 		}
 
 		prev_tx = tx_time;
 		prev_rx = rx_time;
 
-		dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR);
+		uwb_rx_release(rx);
 	}
 }
 
@@ -273,12 +204,14 @@ int main(void)
 {
 	LOG_INF("BLE Slave Timestamp Streamer starting");
 
-	if (uwb_init() != 0) {
+	if (uwb_init(ANT_DLY) != 0) {
 		LOG_ERR("DW3000 init failed");
 		return -1;
 	}
 	LOG_INF("DW3000 ready");
 
+	uwb_ring_init(&slave_ring);
+
 	k_thread_create(&uwb_thread_data, uwb_stack, UWB_STACK_SIZE,
 			uwb_rx_thread, NULL, NULL, NULL,
 			UWB_PRIORITY, 0, K_NO_WAIT);
@@ -296,25 +229,43 @@ int main(void)
 	}
 	LOG_INF("Advertising as \"%s\"", CONFIG_BT_DEVICE_NAME);
 
-	struct slave_entry entry;
-	char buf[80];
+	char buf[DRAIN_MAX][80];
+	int len[DRAIN_MAX];
+	uint32_t lost = 0;
 
 	while (1) {
-		k_msgq_get(&slave_queue, &entry, K_FOREVER);
+		struct slave_entry *e;
+		int n = uwb_ring_peek(&slave_ring, (void **)&e, DRAIN_MAX, K_FOREVER);
+
+		/* format in place, then let go before notify can block */
+		for (int i = 0; i < n; i++) {
+			len[i] = snprintf(buf[i], sizeof(buf[i]),
+					  "%u,%llu,%llu,%lld,%.9f,%.0f\n",
+					  e[i].seq,
+					  e[i].tx_ts,
+					  e[i].rx_ts,
+					  e[i].offset,
+					  e[i].drift,
+					  e[i].corrected);
+		}
+
+		uwb_ring_release(&slave_ring, n);
 
-		int len = snprintf(buf, sizeof(buf),
-				   "%u,%llu,%llu,%lld,%.9f,%.0f\n",
-				   entry.seq,
-				   entry.tx_ts,
-				   entry.rx_ts,
-				   entry.offset,
-				   entry.drift,
-				   entry.corrected);
+		for (int i = 0; i < n; i++) {
+			printk("%s", buf[i]);
+
+			if (notify_enabled && current_conn) {
+				bt_gatt_notify(current_conn, TX_ATTR, buf[i], len[i]);
+			}
+		}
 
-		printk("%s", buf);
+		struct uwb_ring_stats rs;
 
-		if (notify_enabled && current_conn) {
-			bt_gatt_notify(current_conn, TX_ATTR, buf, len);
+		uwb_ring_get_stats(&slave_ring, &rs);
+		if (rs.dropped + rs.refused != lost) {
+			lost = rs.dropped + rs.refused;
+			LOG_WRN("records lost: %u oldest dropped, %u refused",
+				rs.dropped, rs.refused);
 		}
 	}
 
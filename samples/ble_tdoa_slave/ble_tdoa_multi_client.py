@@ -5,18 +5,31 @@ BLE TDoA Multi-Slave Client
 Scans for all DWM3001-TDOA devices, connects to every one concurrently,
 and streams data from all of them tagged by device address.
 
-Each board runs the same ble_tdoa_slave firmware.  No firmware changes needed.
+Each board runs the same ble_tdoa_slave firmware and sends packed binary
+telemetry, decoded with scripts/uwb_tlm.py.
 
 Output format:
   [HH:MM:SS.mmm] [AA:BB:CC:DD:EE:FF] SYNC  seq=N  tx=...  rx=...  offset=...  drift=...  corrected=...
-  [HH:MM:SS.mmm] [AA:BB:CC:DD:EE:FF] BLINK rx=...  master_time=...
+  [HH:MM:SS.mmm] [AA:BB:CC:DD:EE:FF] BLINK tag=...  bseq=...  master_time=...
 
 CSV log columns (--log):
-  time, addr, type, seq, tx_ts, rx_ts, offset, drift, corrected, master_time
+  time, addr, type, seq, tx_ts, rx_ts, offset, drift, corrected, master_time,
+  ..., tag
+
+Blinks are grouped across anchors by (tag, seq), so several tags can
+blink at once. Each group is solved once, when every connected anchor has
+reported or --group-deadline after the first report. A [GROUPS] line with
+latency and completeness counters is printed every few seconds.
+
+Every SYNC, BLINK, TDOA and POS entry is also appended to a binary session
+log (scripts/uwb_log.py, default tdoa_TIMESTAMP.uwbl) as it is printed;
+replay it with `uwb_log.py replay`.
 
 Usage:
   python ble_tdoa_multi_client.py
   python ble_tdoa_multi_client.py --scan-time 10 --log tdoa.csv
+  python ble_tdoa_multi_client.py --record session.uwbl
+  python ble_tdoa_multi_client.py --group-deadline 0.5
     python ble_tdoa_multi_client.py --anchor 10:0,0 --anchor 11:5,0 --anchor 12:0,4
 """
 
@@ -24,37 +37,44 @@ import asyncio
 import atexit
 import argparse
 import csv
-import json
 import math
+import os
 import signal
 import sys
+import time
 from datetime import datetime
 
 from bleak import BleakClient, BleakScanner
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "scripts"))
+import uwb_log
+import uwb_solver
+import uwb_tlm
+
 DEVICE_NAME   = "DWM3001-TDOA"
 NUS_TX_UUID   = "6e400003-b5a3-f393-e0a9-e50e24dcca9e"
 RECONNECT_SEC = 5          # seconds to wait before reconnect attempt
 
-# Collects every printed entry so we can dump to JSON on exit.
-all_entries = []
+# Session log, every printed entry is appended as it happens.
+recorder = None
 quiet_mode = False
-_json_saved = False
 
-def _save_json():
-    global _json_saved
-    if _json_saved or not all_entries:
+def record(entry: dict):
+    if recorder:
+        recorder.write(entry)
+
+def _close_recorder():
+    global recorder
+    if recorder is None:
         return
-    _json_saved = True
-    path = "tdoa_data.json"
-    with open(path, "w") as f:
-        json.dump(all_entries, f, indent=2)
-    print(f"\nSaved {len(all_entries)} entries to {path}")
+    recorder.close()
+    print(f"\nSaved {recorder.count} entries to {recorder.path}")
+    recorder = None
 
-atexit.register(_save_json)
+atexit.register(_close_recorder)
 
 def _sigint_handler(sig, frame):
-    _save_json()
+    _close_recorder()
     sys.exit(0)
 
 signal.signal(signal.SIGINT, _sigint_handler)
@@ -64,11 +84,29 @@ DWT_TIME_UNIT_S = 1.0 / (499.2e6 * 128.0)
 SPEED_OF_LIGHT_M_S = 299_792_458.0
 
 # Aggregate same BLINK observed by multiple anchors.
-# Key = blink_seq only (uint8 set by the tag frame - identical on every anchor
-# that receives the same blink, regardless of which sync they last processed).
-# No TTL: a sequence number naturally overwrites its entry when the uint8 wraps
-# (~25 s at 10 Hz), so old groups never pile up.
-blink_groups = {}  # {blink_seq: {"anchors": {anchor_id: corrected}, "reported": int}}
+# Key = (tag, blink_seq), both from the tag's frame, so identical on every
+# anchor that receives the blink. A group is solved once: as soon as every
+# connected anchor has reported, or group_deadline seconds after its first
+# report (BLE delivery from one anchor can lag the others by about a
+# second), whichever comes first. At most MAX_GROUPS are pending; dicts keep
+# insertion order, so the oldest group is always first and flushing stops
+# at the first one still inside its deadline.
+GROUP_DEADLINE_S = 1.0
+MAX_GROUPS = 1024
+STATS_EVERY_S = 10.0
+group_deadline = GROUP_DEADLINE_S
+blink_groups = {}  # {(tag, blink_seq): {"t": first_seen, "sync_seq": int, "anchors": {anchor_id: corrected}}}
+# Recently solved keys, so a report arriving after its group was solved is
+# counted as late instead of opening a new one-anchor group.
+solved_groups = {}  # {(tag, blink_seq): solved_at}
+connected = set()   # addresses with notifications running
+
+# Latency vs completeness of the grouping stage. latency is first report to
+# solve; complete groups are solved early, the rest wait out the deadline.
+group_stats = {
+    "groups": 0, "complete": 0, "deadline": 0, "evicted": 0, "late": 0,
+    "reports": 0, "solves": 0, "latency_sum": 0.0, "latency_max": 0.0,
+}
 
 # Anchor geometry defaults: {anchor_id: (x_m, y_m)}.
 anchor_positions = {
@@ -82,10 +120,15 @@ def parse_args():
     p.add_argument("--scan-time", type=float, default=5.0,
                    metavar="SEC", help="Initial scan duration in seconds (default: 5)")
     p.add_argument("--log", metavar="FILE", help="CSV file to log all data (appended)")
+    p.add_argument("--record", metavar="FILE",
+                   help="Session log file (default: tdoa_TIMESTAMP.uwbl)")
     p.add_argument(
         "--anchor", action="append", default=[], metavar="ID:X,Y",
         help="Anchor position mapping, e.g. --anchor 10:0,0 (repeat for each anchor)"
     )
+    p.add_argument("--group-deadline", type=float, default=GROUP_DEADLINE_S, metavar="SEC",
+                   help="Solve a blink this long after its first report even if some "
+                        f"anchors are missing (default: {GROUP_DEADLINE_S})")
     p.add_argument("--quiet", action="store_true",
                    help="Only print position (x, y) output")
     return p.parse_args()
@@ -115,79 +158,88 @@ def log_row(row: list):
 
 def solve_tdoa_2d(ref_id: int, ref_xy, obs):
     # obs: list of (anchor_id, (x,y), delta_range_m), where delta_range_m = ri-rref
-    x = sum(pos[0] for _, pos, _ in obs) / len(obs)
-    y = sum(pos[1] for _, pos, _ in obs) / len(obs)
-
-    xr, yr = ref_xy
-    max_iter = 10
-    eps = 1e-9
-
-    for _ in range(max_iter):
-        r_ref = math.hypot(x - xr, y - yr)
-        if r_ref < eps:
-            r_ref = eps
-
-        h11 = 0.0
-        h12 = 0.0
-        h22 = 0.0
-        g1 = 0.0
-        g2 = 0.0
-        rss = 0.0
-
-        for _, (xi, yi), delta_m in obs:
-            ri = math.hypot(x - xi, y - yi)
-            if ri < eps:
-                ri = eps
-
-            # f = model - measurement = (ri-rref)-delta
-            f = (ri - r_ref) - delta_m
-            rss += f * f
-
-            dfx = (x - xi) / ri - (x - xr) / r_ref
-            dfy = (y - yi) / ri - (y - yr) / r_ref
-
-            h11 += dfx * dfx
-            h12 += dfx * dfy
-            h22 += dfy * dfy
-            g1 += dfx * f
-            g2 += dfy * f
-
-        det = h11 * h22 - h12 * h12
-        if abs(det) < 1e-12:
-            return None, None, "singular geometry"
-
-        # Solve H*step = -g
-        step_x = (-g1 * h22 + g2 * h12) / det
-        step_y = (g1 * h12 - g2 * h11) / det
-
-        x += step_x
-        y += step_y
-
-        if step_x * step_x + step_y * step_y < 1e-8:
-            rms = math.sqrt(rss / max(len(obs), 1))
-            return x, y, rms
-
-    # Return last iterate even if not fully converged.
-    rms = math.sqrt(rss / max(len(obs), 1))
+    positions = {ref_id: ref_xy}
+    arrivals = {ref_id: 0.0}
+    for aid, xy, delta_m in obs:
+        positions[aid] = xy
+        arrivals[aid] = delta_m
+
+    fix = uwb_solver.tdoa_fix(positions, arrivals)
+    if fix is None:
+        return None, None, "singular geometry"
+
+    (x, y), rms = fix
     return x, y, rms
 
-def update_tdoa(ts: str, sync_seq: int, blink_seq: int, anchor_id: int, corrected: float, sync_tx: int = 0):
-    key = blink_seq
+def print_group_stats():
+    st = group_stats
+    if not st["groups"]:
+        return
+    print(
+        f"[GROUPS] {st['groups']} solved  complete={st['complete']}"
+        f"  deadline={st['deadline']}  evicted={st['evicted']}  late={st['late']}"
+        f"  anchors/group={st['reports'] / st['groups']:.2f}  solves={st['solves']}"
+        f"  latency avg={st['latency_sum'] / st['groups'] * 1e3:.0f} ms"
+        f"  max={st['latency_max'] * 1e3:.0f} ms"
+    )
+
+def close_group(key, now: float, reason: str):
+    group = blink_groups.pop(key)
+    latency = now - group["t"]
+
+    st = group_stats
+    st["groups"] += 1
+    st[reason] += 1
+    st["reports"] += len(group["anchors"])
+    st["latency_sum"] += latency
+    st["latency_max"] = max(st["latency_max"], latency)
+
+    solved_groups[key] = now
+    while len(solved_groups) > MAX_GROUPS:
+        del solved_groups[next(iter(solved_groups))]
+
+    ts = datetime.fromtimestamp(now).strftime("%H:%M:%S.%f")[:-3]
+    solve_group(ts, now, key, group)
+
+def flush_groups(now: float):
+    while blink_groups:
+        key = next(iter(blink_groups))
+        if len(blink_groups) > MAX_GROUPS:
+            close_group(key, now, "evicted")
+        elif now - blink_groups[key]["t"] >= group_deadline:
+            close_group(key, now, "deadline")
+        else:
+            break
+
+    while solved_groups:
+        key = next(iter(solved_groups))
+        if now - solved_groups[key] <= 2 * group_deadline:
+            break
+        del solved_groups[key]
+
+def update_tdoa(now: float, sync_seq: int, tag: int, blink_seq: int, anchor_id: int, corrected: float):
+    flush_groups(now)
+
+    key = (tag, blink_seq)
+    if key in solved_groups:
+        group_stats["late"] += 1
+        return
+
     group = blink_groups.get(key)
     if group is None:
-        group = {"anchors": {}, "reported": 0, "sync_tx": sync_tx}
-        blink_groups[key] = group
-    elif sync_tx != 0 and group["sync_tx"] != 0 and sync_tx != group["sync_tx"]:
-        # Different sync reference means a new blink cycle for the same
-        # seq number (tag uint8 wrapped). Reset the group.
-        group = {"anchors": {}, "reported": 0, "sync_tx": sync_tx}
+        group = {"t": now, "sync_seq": sync_seq, "anchors": {}}
         blink_groups[key] = group
 
     group["anchors"][anchor_id] = corrected
+    if len(group["anchors"]) >= max(len(connected), 2):
+        close_group(key, now, "complete")
+
+def solve_group(ts: str, now: float, key, group):
+    tag, blink_seq = key
+    sync_seq = group["sync_seq"]
     anchors = group["anchors"]
-    count = len(anchors)
 
-    if count < 2 or count == group["reported"]:
+    if len(anchors) < 2:
         return
 
     ref_id = min(anchors.keys())
@@ -217,13 +269,13 @@ def update_tdoa(ts: str, sync_seq: int, blink_seq: int, anchor_id: int, correcte
         delta_parts.append(part)
     delta_str = "  ".join(delta_parts)
     if not quiet_mode:
-        print(f"[{ts}] [TDOA] sync={sync_seq:3d} blink={blink_seq:3d} ref=a{ref_id}  {delta_str}")
+        print(f"[{ts}] [TDOA] sync={sync_seq:3d} tag={tag:x} blink={blink_seq:3d} ref=a{ref_id}  {delta_str}")
 
     for aid, dt_ticks, dt_ns, delta_m, anchor_sep_m in deltas:
-        all_entries.append({
-            "time": ts, "type": "TDOA",
+        record({
+            "time": now, "type": "TDOA",
             "anchor_id": aid, "ref_anchor": ref_id,
-            "blink_seq": blink_seq, "sync_seq": sync_seq,
+            "tag": tag, "blink_seq": blink_seq, "sync_seq": sync_seq,
             "delta_ticks": dt_ticks, "delta_ns": round(dt_ns, 3),
             "delta_m": round(delta_m, 4),
             "anchor_sep_m": round(anchor_sep_m, 3) if anchor_sep_m is not None else None,
@@ -233,7 +285,8 @@ def update_tdoa(ts: str, sync_seq: int, blink_seq: int, anchor_id: int, correcte
             "", "", "", "", "", "",
             ref_id, f"{dt_ticks:.0f}", f"{dt_ns:.3f}",
             "", "", "", f"{delta_m:.4f}",
-            f"{anchor_sep_m:.3f}" if anchor_sep_m is not None else ""
+            f"{anchor_sep_m:.3f}" if anchor_sep_m is not None else "",
+            tag
         ])
 
     # Multilateration from 3+ anchors with known coordinates.
@@ -249,6 +302,7 @@ def update_tdoa(ts: str, sync_seq: int, blink_seq: int, anchor_id: int, correcte
             obs.append((aid, anchor_positions[aid], delta_m))
 
         if len(obs) >= 2:
+            group_stats["solves"] += 1
             x, y, err = solve_tdoa_2d(ref_id, anchor_positions[ref_id], obs)
             if x is not None:
                 # Reject solutions far outside the anchor bounding box (2m margin)
@@ -261,12 +315,12 @@ def update_tdoa(ts: str, sync_seq: int, blink_seq: int, anchor_id: int, correcte
                         print(f"{x:.3f}, {y:.3f}")
                     else:
                         print(
-                            f"[{ts}] [POS ] sync={sync_seq:3d} blink={blink_seq:3d}"
+                            f"[{ts}] [POS ] sync={sync_seq:3d} tag={tag:x} blink={blink_seq:3d}"
                             f"  x={x:.3f} m  y={y:.3f} m  rms={err:.4f} m"
                         )
-                    all_entries.append({
-                        "time": ts, "type": "POS",
-                        "blink_seq": blink_seq, "sync_seq": sync_seq,
+                    record({
+                        "time": now, "type": "POS",
+                        "tag": tag, "blink_seq": blink_seq, "sync_seq": sync_seq,
                         "x_m": round(x, 3), "y_m": round(y, 3),
                         "rms_m": round(err, 4),
                     })
@@ -274,57 +328,48 @@ def update_tdoa(ts: str, sync_seq: int, blink_seq: int, anchor_id: int, correcte
                         ts, "", "POS", "", blink_seq, sync_seq,
                         "", "", "", "", "", "",
                         ref_id, "", "", f"{x:.3f}", f"{y:.3f}", f"{err:.4f}",
-                        "", ""
+                        "", "", tag
                     ])
                 else:
                     if not quiet_mode:
                         print(
-                            f"[{ts}] [POS ] sync={sync_seq:3d} blink={blink_seq:3d}"
+                            f"[{ts}] [POS ] sync={sync_seq:3d} tag={tag:x} blink={blink_seq:3d}"
                             f"  REJECTED x={x:.3f} y={y:.3f} (outside bounds)"
                         )
             else:
                 if not quiet_mode:
                     print(
-                        f"[{ts}] [POS ] sync={sync_seq:3d} blink={blink_seq:3d}"
+                        f"[{ts}] [POS ] sync={sync_seq:3d} tag={tag:x} blink={blink_seq:3d}"
                         f"  solver skipped ({err})"
                     )
-
-    group["reported"] = count
 # Per-device handler
 
 async def handle_device(device, stop_event: asyncio.Event):
     addr  = device.address
     short = addr[-8:]   # last 8 chars of MAC for compact display
 
-    buf = ""
+    dec = uwb_tlm.Decoder()
 
     def on_notify(_handle, data: bytearray):
-        nonlocal buf
-        buf += data.decode("utf-8", errors="replace")
-        while "\n" in buf:
-            line, buf = buf.split("\n", 1)
-            line = line.strip()
-            if not line:
-                continue
+        now = time.time()
+        ts  = datetime.fromtimestamp(now).strftime("%H:%M:%S.%f")[:-3]
 
-            ts     = datetime.now().strftime("%H:%M:%S.%f")[:-3]
-            parts  = line.split(",")
-
-            if parts[0] == "SYNC":
-                if len(parts) != 8:
-                    print(f"[{ts}] [{short}] WARN unexpected SYNC: {line!r}")
-                    continue
-                try:
-                    anchor_id = int(parts[1])
-                    seq       = int(parts[2])
-                    tx_ts     = int(parts[3])
-                    rx_ts     = int(parts[4])
-                    offset    = int(parts[5])
-                    drift     = float(parts[6])
-                    corrected = float(parts[7])
-                except ValueError:
-                    print(f"[{ts}] [{short}] WARN parse error: {line!r}")
-                    continue
+        try:
+            records = dec.decode(data)
+        except uwb_tlm.DecodeError as exc:
+            print(f"[{ts}] [{short}] WARN {exc}: {bytes(data).hex()}")
+            return
+
+        for rec in records:
+            anchor_id = rec["anchor_id"]
+
+            if rec["type"] == "SYNC":
+                seq       = rec["seq"]
+                tx_ts     = rec["tx_ts"]
+                rx_ts     = rec["rx_ts"]
+                offset    = rec["offset"]
+                drift     = rec["drift"]
+                corrected = rec["corrected"]
 
                 if not quiet_mode:
                     print(
@@ -333,8 +378,8 @@ async def handle_device(device, stop_event: asyncio.Event):
                         f"  offset={offset:+d}  drift={drift:.9f}"
                         f"  corrected={corrected:.0f}"
                     )
-                all_entries.append({
-                    "time": ts, "addr": addr, "type": "SYNC",
+                record({
+                    "time": now, "addr": addr, "type": "SYNC",
                     "anchor_id": anchor_id, "seq": seq,
                     "tx_ts": tx_ts, "rx_ts": rx_ts,
                     "offset": offset, "drift": drift,
@@ -343,44 +388,34 @@ async def handle_device(device, stop_event: asyncio.Event):
                 log_row([
                     ts, addr, "SYNC", anchor_id, seq, "",
                     tx_ts, rx_ts, offset, drift, corrected, "",
-                    "", "", "", "", "", "", "", ""
+                    "", "", "", "", "", "", "", "", ""
                 ])
 
-            elif parts[0] == "BLINK":
-                if len(parts) != 6:
-                    print(f"[{ts}] [{short}] WARN unexpected BLINK: {line!r}")
-                    continue
-                try:
-                    anchor_id   = int(parts[1])
-                    blink_seq   = int(parts[2])
-                    sync_seq    = int(parts[3])
-                    sync_tx_ts  = int(parts[4])
-                    master_time = float(parts[5])
-                except ValueError:
-                    print(f"[{ts}] [{short}] WARN parse error: {line!r}")
-                    continue
+            elif rec["type"] == "BLINK":
+                tag         = rec["tag"]
+                blink_seq   = rec["seq"]
+                sync_seq    = rec["sync_seq"]
+                sync_tx_ts  = rec["sync_tx_ts"]
+                master_time = rec["corrected"]
 
                 if not quiet_mode:
                     print(
-                        f"[{ts}] [{short}] BLINK a={anchor_id:3d}"
+                        f"[{ts}] [{short}] BLINK a={anchor_id:3d}  tag={tag:x}"
                         f"  bseq={blink_seq:3d}  sseq={sync_seq:3d}"
                         f"  sync_tx={sync_tx_ts}  master_time={master_time:.0f}"
                     )
-                all_entries.append({
-                    "time": ts, "addr": addr, "type": "BLINK",
-                    "anchor_id": anchor_id, "blink_seq": blink_seq,
+                record({
+                    "time": now, "addr": addr, "type": "BLINK",
+                    "anchor_id": anchor_id, "tag": tag, "blink_seq": blink_seq,
                     "sync_seq": sync_seq, "sync_tx_ts": sync_tx_ts,
                     "master_time": master_time,
                 })
                 log_row([
                     ts, addr, "BLINK", anchor_id, blink_seq, sync_seq,
                     sync_tx_ts, "", "", "", "", master_time,
-                    "", "", "", "", "", "", "", ""
+                    "", "", "", "", "", "", "", "", tag
                 ])
-                update_tdoa(ts, sync_seq, blink_seq, anchor_id, corrected=master_time, sync_tx=sync_tx_ts)
-
-            else:
-                print(f"[{ts}] [{short}] WARN unknown: {line!r}")
+                update_tdoa(now, sync_seq, tag, blink_seq, anchor_id, corrected=master_time)
 
     while not stop_event.is_set():
         try:
@@ -388,11 +423,14 @@ async def handle_device(device, stop_event: asyncio.Event):
             async with BleakClient(device, timeout=10.0) as client:
                 print(f"  Connected  [{addr}]  MTU={client.mtu_size}")
                 await client.start_notify(NUS_TX_UUID, on_notify)
+                connected.add(addr)
                 # Stay connected until stop or disconnection exception
                 while not stop_event.is_set() and client.is_connected:
                     await asyncio.sleep(0.5)
+                connected.discard(addr)
                 await client.stop_notify(NUS_TX_UUID)
         except Exception as exc:
+            connected.discard(addr)
             if stop_event.is_set():
                 break
             print(f"  [{short}] disconnected ({exc}), retrying in {RECONNECT_SEC}s ...")
@@ -402,6 +440,21 @@ async def handle_device(device, stop_event: asyncio.Event):
                 pass
 
     print(f"  [{short}] handler exited")
+
+async def group_timer(stop_event: asyncio.Event):
+    # groups missing an anchor get no further notifications to close them,
+    # so the deadline is also checked from here.
+    last_stats = time.time()
+    while not stop_event.is_set():
+        try:
+            await asyncio.wait_for(stop_event.wait(), timeout=min(0.1, group_deadline / 4))
+        except asyncio.TimeoutError:
+            pass
+        now = time.time()
+        flush_groups(now)
+        if not quiet_mode and now - last_stats >= STATS_EVERY_S:
+            print_group_stats()
+            last_stats = now
 # Main
 
 async def main(scan_time: float, log_path: str):
@@ -423,7 +476,7 @@ async def main(scan_time: float, log_path: str):
                 "time", "addr", "type", "anchor_id", "seq", "sync_seq",
                 "tx_ts", "rx_ts", "offset", "drift", "corrected", "master_time",
                 "ref_anchor", "delta_ticks", "delta_ns", "x_m", "y_m", "rms_m",
-                "delta_m", "anchor_sep_m"
+                "delta_m", "anchor_sep_m", "tag"
             ])
         print(f"Logging to {log_path}")
     found = {}
@@ -449,6 +502,7 @@ async def main(scan_time: float, log_path: str):
         asyncio.create_task(handle_device(dev, stop_event))
         for dev in found.values()
     ]
+    tasks.append(asyncio.create_task(group_timer(stop_event)))
 
     try:
         await asyncio.gather(*tasks)
@@ -459,6 +513,11 @@ async def main(scan_time: float, log_path: str):
         # Give tasks a moment to exit cleanly
         await asyncio.gather(*tasks, return_exceptions=True)
 
+    now = time.time()
+    for key in list(blink_groups):
+        close_group(key, now, "deadline")
+    print_group_stats()
+
     if csv_file:
         csv_file.close()
 
@@ -466,14 +525,27 @@ async def main(scan_time: float, log_path: str):
 
 def entry():
     args = parse_args()
-    global anchor_positions, quiet_mode
+    global anchor_positions, quiet_mode, recorder, group_deadline
     quiet_mode = args.quiet
+    if args.group_deadline <= 0:
+        print("Argument error: --group-deadline must be positive")
+        sys.exit(2)
+    group_deadline = args.group_deadline
     if args.anchor:
         try:
             anchor_positions = parse_anchor_positions(args.anchor)
         except ValueError as exc:
             print(f"Argument error: {exc}")
             sys.exit(2)
+
+    path = args.record or datetime.now().strftime("tdoa_%Y%m%d_%H%M%S.uwbl")
+    recorder = uwb_log.Writer(path, {
+        "tool": "ble_tdoa_multi_client",
+        "start_time": datetime.now().isoformat(),
+        "anchor_positions": {str(k): list(v) for k, v in anchor_positions.items()},
+    })
+    print(f"Recording to {path}")
+
     try:
         asyncio.run(main(args.scan_time, args.log))
     except KeyboardInterrupt:
@@ -3,10 +3,11 @@
 BLE TDoA Slave Client
 
 Connects to DWM3001-TDOA (ble_tdoa_slave firmware), subscribes to
-NUS TX notifications, and prints the two CSV formats:
+NUS TX notifications, decodes the packed telemetry (scripts/uwb_tlm.py)
+and prints the two record types:
 
-  SYNC frames:  "SYNC,seq,tx_ts,rx_ts,offset,drift,corrected"
-  BLINK frames: "BLINK,rx_ts,master_time"
+  SYNC:  seq, tx_ts, rx_ts, offset, drift, corrected
+  BLINK: tag, seq, sync_seq, master_time
 
 Usage:
   python ble_tdoa_slave_client.py [--log <file.csv>]
@@ -15,11 +16,15 @@ Usage:
 import asyncio
 import argparse
 import csv
+import os
 import sys
 from datetime import datetime
 
 from bleak import BleakClient, BleakScanner
 
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "scripts"))
+import uwb_tlm
+
 DEVICE_NAME = "DWM3001-TDOA"
 NUS_TX_UUID = "6e400003-b5a3-f393-e0a9-e50e24dcca9e"
 
@@ -44,71 +49,54 @@ async def run(log_path):
         writer = csv.writer(csv_file)
         if csv_file.tell() == 0:
             writer.writerow(["type", "seq", "tx_ts", "rx_ts",
-                             "offset", "drift", "corrected", "master_time"])
+                             "offset", "drift", "corrected", "master_time", "tag"])
         print(f"Logging to {log_path}")
 
-    buf = ""
+    dec = uwb_tlm.Decoder()
 
     def on_notify(_handle, data: bytearray):
-        nonlocal buf
-        buf += data.decode("utf-8", errors="replace")
-        while "\n" in buf:
-            line, buf = buf.split("\n", 1)
-            line = line.strip()
-            if not line:
-                continue
-
-            ts = datetime.now().strftime("%H:%M:%S.%f")[:-3]
-            parts = line.split(",")
-
-            if parts[0] == "SYNC":
-                if len(parts) != 7:
-                    print(f"[WARN] unexpected SYNC format: {line!r}")
-                    continue
-                try:
-                    seq       = int(parts[1])
-                    tx_ts     = int(parts[2])
-                    rx_ts     = int(parts[3])
-                    offset    = int(parts[4])
-                    drift     = float(parts[5])
-                    corrected = float(parts[6])
-                except ValueError:
-                    print(f"[WARN] parse error: {line!r}")
-                    continue
+        ts = datetime.now().strftime("%H:%M:%S.%f")[:-3]
+
+        try:
+            records = dec.decode(data)
+        except uwb_tlm.DecodeError as exc:
+            print(f"[WARN] {exc}: {bytes(data).hex()}")
+            return
+
+        for rec in records:
+            if rec["type"] == "SYNC":
+                seq       = rec["seq"]
+                tx_ts     = rec["tx_ts"]
+                rx_ts     = rec["rx_ts"]
+                offset    = rec["offset"]
+                drift     = rec["drift"]
+                corrected = rec["corrected"]
 
                 print(
                     f"[{ts}] SYNC  seq={seq:4d}  tx={tx_ts}  rx={rx_ts}"
-                    f"  offset={offset:+d}  drift={drift:.9f}  corrected={corrected:.0f}"
+                    f"  offset={offset:+d}  drift={drift:.9f}  corrected={corrected}"
                 )
 
                 if writer:
                     writer.writerow(["SYNC", seq, tx_ts, rx_ts,
-                                     offset, drift, corrected, ""])
+                                     offset, drift, corrected, "", ""])
                     csv_file.flush()
 
-            elif parts[0] == "BLINK":
-                if len(parts) != 3:
-                    print(f"[WARN] unexpected BLINK format: {line!r}")
-                    continue
-                try:
-                    rx_ts       = int(parts[1])
-                    master_time = float(parts[2])
-                except ValueError:
-                    print(f"[WARN] parse error: {line!r}")
-                    continue
+            else:
+                tag         = rec["tag"]
+                seq         = rec["seq"]
+                sync_seq    = rec["sync_seq"]
+                master_time = rec["corrected"]
 
                 print(
-                    f"[{ts}] BLINK rx={rx_ts}  master_time={master_time:.0f}"
+                    f"[{ts}] BLINK tag={tag:x}  seq={seq:3d}  sync={sync_seq:3d}  master_time={master_time}"
                 )
 
                 if writer:
-                    writer.writerow(["BLINK", "", "", rx_ts,
-                                     "", "", "", master_time])
+                    writer.writerow(["BLINK", seq, "", "",
+                                     "", "", "", master_time, tag])
                     csv_file.flush()
 
-            else:
-                print(f"[WARN] unknown message type: {line!r}")
-
     async with BleakClient(device) as client:
         print(f"Connected (MTU={client.mtu_size})")
         await client.start_notify(NUS_TX_UUID, on_notify)
@@ -6,32 +6,45 @@
 #include <zephyr/bluetooth/gatt.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_clock.h"
+#include "uwb_dedup.h"
+#include "uwb_msg.h"
+#include "uwb_tlm.h"
+#include "uwb_ring.h"
 #include "dw3000_hw.h"
-#include "port.h"
 
 LOG_MODULE_REGISTER(ble_tdoa_slave, LOG_LEVEL_INF);
 #define NODE_ID   6
 #define ANT_DLY   26194
-#define MSG_SYNC  0x10
-#define MSG_BLINK 0x20
 
-#define MASK40  0xFFFFFFFFFFULL
-#define HALF40  (1LL << 39)
-#define FULL40  (1LL << 40)
+/* a repeat of a (tag, seq) blink within this window is dropped */
+#define DEDUP_WINDOW_MS 1000
+
+/* how often the IRQ latency histogram is logged */
+#define IRQ_STATS_PERIOD_MS 10000
+
+/* longest a record waits for its notification to fill up */
+#define TLM_FLUSH_MS 100
+
+/* a notification without a free buffer is retried this often, 1 ms apart */
+#define TLM_NOTIFY_RETRIES 3
+
 struct tdoa_entry {
     uint8_t  id;
     uint8_t  type;
-    uint8_t  seq;
     uint8_t  sync_seq;
+    uint32_t seq;
+    uint64_t tag;           /* BLINK only */
     uint64_t rx_ts;
     uint64_t tx_ts;
     int64_t  offset;
-    double   drift;
-    double   corrected;
+    int32_t  skew;          /* Q32 */
+    uint64_t corrected;
 };
 
-K_MSGQ_DEFINE(tdoa_queue, sizeof(struct tdoa_entry), 32, 4);
+UWB_RING_DEFINE(tdoa_ring, struct tdoa_entry, 32);
 
 #define BT_UUID_NUS_VAL \
     BT_UUID_128_ENCODE(0x6E400001, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9EULL)
@@ -90,162 +103,165 @@ BT_CONN_CB_DEFINE(conn_cb) = {
     .connected    = connected,
     .disconnected = disconnected,
 };
-static dwt_config_t uwb_cfg = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
-    .phrMode = DWT_PHRMODE_STD,
-    .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
-    .pdoaMode = DWT_PDOA_M0,
-};
-static int uwb_init(void)
-{
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
 
-    port_set_dw_ic_spi_slowrate();
+/* batches are sized to the negotiated ATT MTU */
+static void tlm_begin(struct uwb_tlm *tlm)
+{
+    uint16_t max = UWB_TLM_MAX;
 
-    if (dwt_probe((struct dwt_probe_s *)&dw3000_probe_interf) != DWT_SUCCESS)
-        return -1;
+    if (current_conn)
+        max = bt_gatt_get_mtu(current_conn) - 3;
 
-    port_set_dw_ic_spi_fastrate();
+    uwb_tlm_begin(tlm, NODE_ID, max);
+}
 
-    if (dwt_initialise(DWT_DW_INIT) != DWT_SUCCESS)
-        return -1;
+static int tlm_add(struct uwb_tlm *tlm, const struct tdoa_entry *e)
+{
+    if (e->type == UWB_MSG_SYNC)
+        return uwb_tlm_add_sync(tlm, e->seq, e->tx_ts, e->rx_ts,
+                                e->offset, e->skew, e->corrected);
 
-    if (dwt_configure(&uwb_cfg) != DWT_SUCCESS)
-        return -1;
+    return uwb_tlm_add_blink(tlm, e->tag, e->seq, e->sync_seq, e->corrected);
+}
 
-    dwt_settxantennadelay(ANT_DLY);
-    dwt_setrxantennadelay(ANT_DLY);
+/* batches and records the stack refused */
+static uint32_t tlm_failed;
+static uint32_t tlm_failed_recs;
 
-    return 0;
-}
-static uint64_t get_rx_ts(void)
+static void tlm_send(struct uwb_tlm *tlm)
 {
-    uint8_t ts[5];
-    dwt_readrxtimestamp(ts);
+    if (!notify_enabled || !current_conn)
+        return;
+
+    int err = bt_gatt_notify(current_conn, TX_ATTR, tlm->data, tlm->len);
 
-    uint64_t val = 0;
-    for (int i = 4; i >= 0; i--) {
-        val = (val << 8) | ts[i];
+    for (int i = 0; err == -ENOMEM && i < TLM_NOTIFY_RETRIES; i++) {
+        k_msleep(1);
+        err = bt_gatt_notify(current_conn, TX_ATTR, tlm->data, tlm->len);
+    }
+
+    if (err) {
+        tlm_failed++;
+        tlm_failed_recs += tlm->count;
     }
-    return val;
 }
+
 #define UWB_STACK_SIZE 4096
 #define UWB_PRIORITY   5
 
 static void uwb_rx_thread(void *a, void *b, void *c)
 {
-    uint8_t  rx_buf[32];
-    uint64_t prev_tx = 0;
-    uint64_t prev_rx = 0;
-    uint8_t  prev_seq = 0;
-    int64_t  offset  = 0;
-    double   drift   = 1.0;
+    /* each SYNC carries its own TX time, so the clock locks on the
+     * first one. blinks are exported with the last SYNC seen. */
+    struct uwb_clock clk;
+    uint64_t prev_tx  = 0;
+    int      prev_seq = -1;
+    static struct uwb_dedup seen;
+
+    uwb_clock_init(&clk, &uwb_clock_default_cfg);
+    uwb_dedup_init(&seen, DEDUP_WINDOW_MS);
+
+    uint32_t lost = 0;
+
+    /* double-buffered: the radio keeps listening while a frame is parsed */
+    if (uwb_rx_continuous_start() != 0)
+        LOG_ERR("continuous RX start failed");
 
     while (1) {
+        struct uwb_rx_desc *rx;
 
-        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+        uwb_rx_await(&rx, K_FOREVER);
 
-        uint32_t status;
-        while (!((status = dwt_readsysstatuslo()) &
-            (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR))) {}
+        struct uwb_async_stats st;
+        uwb_async_get_stats(&st);
+        if (st.rx_overrun + st.rx_dropped != lost) {
+            lost = st.rx_overrun + st.rx_dropped;
+            LOG_WRN("RX lost: overrun %u, ring full %u",
+                    st.rx_overrun, st.rx_dropped);
+        }
 
-        if (!(status & DWT_INT_RXFCG_BIT_MASK)) {
-            dwt_writesysstatuslo(SYS_STATUS_ALL_RX_ERR);
+        if (!(rx->status & DWT_INT_RXFCG_BIT_MASK)) {
+            uwb_rx_release(rx);
             continue;
         }
 
-        uint16_t len = dwt_getframelength();
-        dwt_readrxdata(rx_buf, len - FCS_LEN, 0);
-
-        uint64_t rx_time = get_rx_ts();
-        if (rx_buf[0] == MSG_BLINK) {
-
-            struct tdoa_entry entry = {
-                .id        = NODE_ID,
-                .type      = MSG_BLINK,
-                .seq       = rx_buf[1],
-                .sync_seq  = 0,
-                .rx_ts     = rx_time,
-                .tx_ts     = 0,
-                .offset    = 0,
-                .drift     = 1.0,
-                .corrected = 0.0,
-            };
-
-            if (prev_tx != 0) {
-                uint64_t slave_dt = (rx_time - prev_rx) & MASK40;
-                entry.sync_seq = prev_seq;
-                entry.tx_ts = prev_tx;
-                entry.corrected =
-                    (double)((uint64_t)((double)prev_tx + (double)slave_dt * drift) & MASK40);
-
-                k_msgq_put(&tdoa_queue, &entry, K_NO_WAIT);
+        const uint8_t *rx_buf = rx->data;
+        uint64_t rx_time = rx->rx_ts;
+        struct uwb_msg_blink_id blink;
+        struct uwb_msg_sync sync;
+
+        if (uwb_msg_blink_id_unpack(&blink, rx_buf, rx->len) == 0) {
+
+            struct tdoa_entry *e;
+
+            /* nothing to report until the clock is locked, and each
+             * (tag, seq) once */
+            if (clk.valid &&
+                uwb_dedup_check(&seen, blink.tag, blink.seq, k_uptime_get_32()) == 0 &&
+                (e = uwb_ring_reserve(&tdoa_ring))) {
+                *e = (struct tdoa_entry){
+                    .id        = NODE_ID,
+                    .type      = UWB_MSG_BLINK,
+                    .tag       = blink.tag,
+                    .seq       = blink.seq,
+                    .sync_seq  = prev_seq,
+                    .rx_ts     = rx_time,
+                    .tx_ts     = prev_tx,
+                    .offset    = uwb_clock_offset(&clk),
+                    .skew      = uwb_clock_skew_q32(&clk),
+                    .corrected = uwb_clock_to_master(&clk, rx_time),
+                };
+                uwb_ring_commit(&tdoa_ring);
             }
         }
         
-        if (rx_buf[0] == MSG_SYNC) {
-
-            uint8_t seq = rx_buf[1];
-
-            uint64_t tx_time = 0;
-            for (int i = 0; i < 5; i++) {
-                tx_time |= ((uint64_t)rx_buf[3 + i]) << (8 * i);
-            }
-
-            int64_t diff = (int64_t)((rx_time - tx_time) & MASK40);
-            if (diff > HALF40) diff -= FULL40;
-            offset = diff;
-
-            if (prev_tx != 0) {
-                uint64_t master_dt = (tx_time - prev_tx) & MASK40;
-                uint64_t slave_dt  = (rx_time - prev_rx) & MASK40;
-
-                if (slave_dt != 0)
-                    drift = (double)master_dt / (double)slave_dt;
+        if (uwb_msg_sync_unpack(&sync, rx_buf, rx->len) == 0) {
+
+            uint8_t seq = sync.seq;
+            uint64_t tx_time = sync.tx_ts;
+
+            if (uwb_clock_sync(&clk, rx_time, tx_time) == 0)
+                uwb_clock_skew(&clk, uwb_clock_ci_to_ppm(rx->carrier_integrator),
+                               UWB_CLOCK_CI_SIGMA_PPM);
+            else
+                LOG_WRN("SYNC %u rejected", seq);
+
+            uint64_t corrected = clk.valid
+                ? uwb_clock_to_master(&clk, rx_time)
+                : tx_time;
+
+            struct tdoa_entry *e = uwb_ring_reserve(&tdoa_ring);
+
+            if (e) {
+                *e = (struct tdoa_entry){
+                    .id        = NODE_ID,
+                    .type      = UWB_MSG_SYNC,
+                    .seq       = seq,
+                    .sync_seq  = seq,
+                    .rx_ts     = rx_time,
+                    .tx_ts     = tx_time,
+                    .offset    = uwb_clock_offset(&clk),
+                    .skew      = uwb_clock_skew_q32(&clk),
+                    .corrected = corrected,
+                };
+                uwb_ring_commit(&tdoa_ring);
             }
 
-            double corrected = (prev_tx != 0)
-                ? (double)((uint64_t)((double)prev_tx + ((double)rx_time - (double)prev_rx) * drift) & MASK40)
-                : (double)tx_time;
-
-            struct tdoa_entry entry = {
-                .id        = NODE_ID,
-                .type      = MSG_SYNC,
-                .seq       = seq,
-                .sync_seq  = seq,
-                .rx_ts     = rx_time,
-                .tx_ts     = tx_time,
-                .offset    = offset,
-                .drift     = drift,
-                .corrected = corrected,
-            };
-
-            k_msgq_put(&tdoa_queue, &entry, K_NO_WAIT);
-
             prev_seq = seq;
-            prev_tx = tx_time;
-            prev_rx = rx_time;
+            prev_tx  = tx_time;
         }
 
-        dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR);
+        uwb_rx_release(rx);
     }
 }
 K_THREAD_STACK_DEFINE(uwb_stack, UWB_STACK_SIZE);
+
 static struct k_thread uwb_thread_data;
 int main(void)
 {
-    if (uwb_init() != 0) return -1;
+    if (uwb_init(ANT_DLY) != 0) return -1;
+
+    uwb_ring_init(&tdoa_ring);
 
     k_thread_create(&uwb_thread_data, uwb_stack, UWB_STACK_SIZE,
         uwb_rx_thread, NULL, NULL, NULL,
@@ -256,34 +272,69 @@ int main(void)
     bt_le_adv_start(&adv_param, ad, ARRAY_SIZE(ad),
                     sd, ARRAY_SIZE(sd));
 
-    struct tdoa_entry entry;
-    char buf[96];
+    struct uwb_tlm tlm;
+    int64_t flush_at = 0;
+    uint32_t lost = 0;
+#if defined(CONFIG_DW3000_IRQ_STATS)
+    int64_t stats_at = k_uptime_get() + IRQ_STATS_PERIOD_MS;
+#endif
+
+    tlm_begin(&tlm);
 
     while (1) {
+        /* sleep until a record arrives, the batch is due or stats are */
+        int64_t wake_at = tlm.count ? flush_at : INT64_MAX;
+#if defined(CONFIG_DW3000_IRQ_STATS)
+        wake_at = MIN(wake_at, stats_at);
+#endif
+        k_timeout_t wait = (wake_at == INT64_MAX) ? K_FOREVER
+            : K_MSEC(MAX(wake_at - k_uptime_get(), 0));
+
+        /* encode records straight out of the ring, as many as fit */
+        struct tdoa_entry *e;
+        int n = uwb_ring_peek(&tdoa_ring, (void **)&e, UWB_RING_MAX_LEN, wait);
+        int had = tlm.count;
+        int done = 0;
+
+        while (done < n && tlm_add(&tlm, &e[done]) == 0)
+            done++;
+
+        if (done == 0 && n > 0 && tlm.count == 0) {
+            /* only with the 23-byte default MTU */
+            LOG_WRN("record does not fit the MTU");
+            done = 1;
+        }
+
+        uwb_ring_release(&tdoa_ring, done);
+
+        if (had == 0 && tlm.count > 0)
+            flush_at = k_uptime_get() + TLM_FLUSH_MS;
 
-        k_msgq_get(&tdoa_queue, &entry, K_FOREVER);
-
-        int len;
-
-        if (entry.type == MSG_SYNC) {
-            len = snprintf(buf, sizeof(buf),
-                "SYNC,%u,%u,%llu,%llu,%lld,%.9f,%.0f\n",
-                entry.id, entry.seq,
-                entry.tx_ts, entry.rx_ts,
-                entry.offset, entry.drift,
-                entry.corrected);
-        } else {
-            len = snprintf(buf, sizeof(buf),
-                "BLINK,%u,%u,%u,%llu,%.0f\n",
-                entry.id, entry.seq,
-                entry.sync_seq, entry.tx_ts,
-                entry.corrected);
+        if (done < n) {
+            tlm_send(&tlm);
+            tlm_begin(&tlm);
         }
 
-        printk("%s", buf);
+        struct uwb_ring_stats rs;
+        uwb_ring_get_stats(&tdoa_ring, &rs);
+        if (rs.dropped + rs.refused + tlm_failed_recs != lost) {
+            lost = rs.dropped + rs.refused + tlm_failed_recs;
+            LOG_WRN("records lost: %u oldest dropped, %u refused, "
+                    "%u in %u failed notifications",
+                    rs.dropped, rs.refused, tlm_failed_recs, tlm_failed);
+        }
+
+        if (tlm.count && k_uptime_get() >= flush_at) {
+            tlm_send(&tlm);
+            tlm_begin(&tlm);
+        }
 
-        if (notify_enabled && current_conn) {
-            bt_gatt_notify(current_conn, TX_ATTR, buf, len);
+#if defined(CONFIG_DW3000_IRQ_STATS)
+        if (k_uptime_get() >= stats_at) {
+            dw3000_hw_irq_stats_log();
+            dw3000_hw_irq_stats_reset();
+            stats_at = k_uptime_get() + IRQ_STATS_PERIOD_MS;
         }
+#endif
     }
-}
\ No newline at end of file
+}
@@ -14,18 +14,22 @@
 #include <zephyr/bluetooth/gatt.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "uwb.h"
+#include "uwb_ring.h"
 
 LOG_MODULE_REGISTER(ble_tx_ts, LOG_LEVEL_INF);
 
+#define ANT_DLY 16385
+
 struct ts_entry {
 	uint8_t  seq;
 	uint64_t tx_ts;
 };
 
-K_MSGQ_DEFINE(ts_queue, sizeof(struct ts_entry), 32, 4);
+UWB_RING_DEFINE(ts_ring, struct ts_entry, 32);
+
+/* records formatted per wakeup of the BLE thread */
+#define DRAIN_MAX 8
 
 #define BT_UUID_NUS_VAL \
 	BT_UUID_128_ENCODE(0x6E400001, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9EULL)
@@ -110,52 +114,6 @@ BT_CONN_CB_DEFINE(conn_cb) = {
 	.disconnected = disconnected,
 };
 
-static dwt_config_t uwb_cfg = {
-	.chan           = 9,
-	.txPreambLength = DWT_PLEN_128,
-	.rxPAC          = DWT_PAC8,
-	.txCode         = 9,
-	.rxCode         = 9,
-	.sfdType        = DWT_SFD_DW_8,
-	.dataRate       = DWT_BR_6M8,
-	.phrMode        = DWT_PHRMODE_STD,
-	.phrRate        = DWT_PHRRATE_STD,
-	.sfdTO          = (129 + 8 - 8),
-	.stsMode        = DWT_STS_MODE_OFF,
-	.stsLength      = DWT_STS_LEN_64,
-	.pdoaMode       = DWT_PDOA_M0,
-};
-
-static int uwb_init(void)
-{
-	dw_device_init();
-	dw3000_hw_wakeup_pin_low();
-	Sleep(5);
-	port_set_dw_ic_spi_slowrate();
-
-	if (dwt_probe((struct dwt_probe_s *)&dw3000_probe_interf) != DWT_SUCCESS) {
-		LOG_ERR("dwt_probe failed");
-		return -1;
-	}
-
-	port_set_dw_ic_spi_fastrate();
-
-	if (dwt_initialise(DWT_DW_INIT) != DWT_SUCCESS) {
-		LOG_ERR("dwt_initialise failed");
-		return -1;
-	}
-
-	if (dwt_configure(&uwb_cfg) != DWT_SUCCESS) {
-		LOG_ERR("dwt_configure failed");
-		return -1;
-	}
-
-	dwt_setrxantennadelay(16385);
-	dwt_settxantennadelay(16385);
-
-	return 0;
-}
-
 #define UWB_STACK_SIZE 4096
 #define UWB_PRIORITY   5
 
@@ -176,6 +134,7 @@ static void uwb_tx_thread(void *a, void *b, void *c)
 
 		dwt_writetxdata(sizeof(msg), msg, 0);
 		dwt_writetxfctrl(sizeof(msg) + FCS_LEN, 0, 0);
+		uwb_sts_reload();
 		dwt_starttx(DWT_START_TX_IMMEDIATE);
 
 		while (!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK)) {
@@ -190,14 +149,13 @@ static void uwb_tx_thread(void *a, void *b, void *c)
 			ts = (ts << 8) | ts_raw[i];
 		}
 
-		struct ts_entry entry = {
-			.seq   = seq,
-			.tx_ts = ts,
-		};
+		/* a full ring drops its oldest record, not the whole backlog */
+		struct ts_entry *e = uwb_ring_reserve(&ts_ring);
 
-		if (k_msgq_put(&ts_queue, &entry, K_NO_WAIT) != 0) {
-			k_msgq_purge(&ts_queue);
-			k_msgq_put(&ts_queue, &entry, K_NO_WAIT);
+		if (e) {
+			e->seq   = seq;
+			e->tx_ts = ts;
+			uwb_ring_commit(&ts_ring);
 		}
 
 		seq++;
@@ -212,11 +170,14 @@ int main(void)
 {
 	LOG_INF("BLE TX Timestamp Streamer starting");
 
-	if (uwb_init() != 0) {
+	if (uwb_radio_init(ANT_DLY) != 0) {
 		LOG_ERR("DW3000 init failed");
 		return -1;
 	}
 	LOG_INF("DW3000 ready");
+
+	uwb_ring_init(&ts_ring);
+
 	k_thread_create(&uwb_thread_data, uwb_stack, UWB_STACK_SIZE,
 			uwb_tx_thread, NULL, NULL, NULL,
 			UWB_PRIORITY, 0, K_NO_WAIT);
@@ -234,19 +195,37 @@ int main(void)
 	}
 	LOG_INF("Advertising as \"%s\"", CONFIG_BT_DEVICE_NAME);
 
-	struct ts_entry entry;
-	char buf[32];
+	char buf[DRAIN_MAX][32];
+	int len[DRAIN_MAX];
+	uint32_t lost = 0;
 
 	while (1) {
-		k_msgq_get(&ts_queue, &entry, K_FOREVER);
+		struct ts_entry *e;
+		int n = uwb_ring_peek(&ts_ring, (void **)&e, DRAIN_MAX, K_FOREVER);
+
+		/* format in place, then let go before notify can block */
+		for (int i = 0; i < n; i++) {
+			len[i] = snprintf(buf[i], sizeof(buf[i]), "seq=%u ts=%llu\n",
+					  e[i].seq, e[i].tx_ts);
+		}
 
-		int len = snprintf(buf, sizeof(buf), "seq=%u ts=%llu\n",
-				   entry.seq, entry.tx_ts);
+		uwb_ring_release(&ts_ring, n);
+
+		for (int i = 0; i < n; i++) {
+			printk("%s", buf[i]);
+
+			if (notify_enabled && current_conn) {
+				bt_gatt_notify(current_conn, TX_ATTR, buf[i], len[i]);
+			}
+		}
 
-		printk("%s", buf);
+		struct uwb_ring_stats rs;
 
-		if (notify_enabled && current_conn) {
-			bt_gatt_notify(current_conn, TX_ATTR, buf, len);
+		uwb_ring_get_stats(&ts_ring, &rs);
+		if (rs.dropped + rs.refused != lost) {
+			lost = rs.dropped + rs.refused;
+			LOG_WRN("records lost: %u oldest dropped, %u refused",
+				rs.dropped, rs.refused);
 		}
 	}
 
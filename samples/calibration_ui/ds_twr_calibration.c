@@ -3,21 +3,16 @@
 #include <string.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
+#include "uwb.h"
+#include "uwb_timing.h"
+#include "uwb_msg.h"
 #include "port.h"
 
 #define ROLE_INITIATOR 1
 
-#define SPEED_OF_LIGHT 299702547.0
-#define UUS_TO_DWT_TIME 63898
-
-#define POLL_TX_TO_RESP_RX_DLY_UUS 900
-#define RESP_RX_TO_FINAL_TX_DLY_UUS 900
-
-#define MSG_POLL  0x01
-#define MSG_RESP  0x02
-#define MSG_FINAL 0x03
+/* RX timestamp -> delayed TX offsets, measured at boot */
+static uint32_t poll_rx_to_resp_tx_dly_uus;
+static uint32_t resp_rx_to_final_tx_dly_uus;
 
 #define AVG_WINDOW 15
 
@@ -27,22 +22,6 @@ static double dist_buffer[AVG_WINDOW];
 static int dist_index = 0;
 static int dist_count = 0;
 
-static dwt_config_t config = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
-    .phrMode = DWT_PHRMODE_STD,
-    .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
-    .pdoaMode = DWT_PDOA_M0,
-};
-
 static uint64_t get_tx_timestamp()
 {
     uint8_t ts[5];
@@ -69,32 +48,6 @@ static uint64_t get_rx_timestamp()
     return value;
 }
 
-static int uwb_init()
-{
-    dw_device_init();
-
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
-
-    port_set_dw_ic_spi_slowrate();
-
-    if (dwt_probe((struct dwt_probe_s *)&dw3000_probe_interf) != DWT_SUCCESS)
-        return -1;
-
-    port_set_dw_ic_spi_fastrate();
-
-    if (dwt_initialise(DWT_DW_INIT) != DWT_SUCCESS)
-        return -1;
-
-    if (dwt_configure(&config) != DWT_SUCCESS)
-        return -1;
-
-    dwt_setrxantennadelay(antenna_delay);
-    dwt_settxantennadelay(antenna_delay);
-
-    return 0;
-}
-
 void process_uart_command(char *cmd)
 {
     if (strncmp(cmd, "SET_DELAY", 9) == 0)
@@ -115,19 +68,22 @@ void process_uart_command(char *cmd)
 
 static void initiator_loop()
 {
-    uint8_t poll_msg[2] = {MSG_POLL, 0};
+    uint8_t poll_msg[UWB_MSG_POLL_LEN];
     uint8_t resp_msg[32];
-    uint8_t final_msg[32];
+    uint8_t final_msg[UWB_MSG_FINAL_LEN];
 
     uint8_t seq = 0;
 
     while (1)
     {
-        poll_msg[1] = seq;
+        struct uwb_msg_poll poll = { .seq = seq };
+
+        uwb_msg_poll_pack(&poll, poll_msg);
 
         dwt_writetxdata(sizeof(poll_msg), poll_msg, 0);
         dwt_writetxfctrl(sizeof(poll_msg) + FCS_LEN, 0, 0);
 
+        uwb_sts_reload();
         dwt_starttx(DWT_START_TX_IMMEDIATE);
 
         while (!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
@@ -136,6 +92,7 @@ static void initiator_loop()
 
         uint64_t t1 = get_tx_timestamp();
 
+        uwb_sts_reload();
         dwt_rxenable(DWT_START_RX_IMMEDIATE);
 
         uint32_t status;
@@ -145,44 +102,37 @@ static void initiator_loop()
 
         if (status & DWT_INT_RXFCG_BIT_MASK)
         {
-            uint16_t len = dwt_getframelength();
+            uint16_t len = dwt_getframelength() - FCS_LEN;
+            struct uwb_msg_resp resp;
 
-            dwt_readrxdata(resp_msg, len - FCS_LEN, 0);
+            if (len > sizeof(resp_msg))
+                len = sizeof(resp_msg);
+            dwt_readrxdata(resp_msg, len, 0);
 
-            uint64_t t4 = get_rx_timestamp();
-
-            uint64_t t2 = 0;
-            uint64_t t3 = 0;
+            if (uwb_msg_resp_unpack(&resp, resp_msg, len) != 0 || resp.seq != seq)
+                goto next;
 
-            for (int i = 0; i < 5; i++)
-            {
-                t2 |= ((uint64_t)resp_msg[2 + i]) << (8 * i);
-                t3 |= ((uint64_t)resp_msg[7 + i]) << (8 * i);
-            }
+            uint64_t t4 = get_rx_timestamp();
 
             uint32_t final_tx_time =
-                (t4 + RESP_RX_TO_FINAL_TX_DLY_UUS * UUS_TO_DWT_TIME) >> 8;
+                (t4 + (uint64_t)resp_rx_to_final_tx_dly_uus * UUS_TO_DWT_TIME) >> 8;
 
             dwt_setdelayedtrxtime(final_tx_time);
 
             uint64_t t5 =
                 (((uint64_t)(final_tx_time & 0xFFFFFFFE)) << 8);
 
-            final_msg[0] = MSG_FINAL;
-            final_msg[1] = seq;
+            struct uwb_msg_final final = {
+                .seq = seq, .anchor = resp.anchor, .tag = resp.tag,
+                .t1 = t1, .t4 = t4, .t5 = t5,
+            };
 
-            for (int i = 0; i < 5; i++)
-                final_msg[2 + i] = (t1 >> (8 * i));
+            uwb_msg_final_pack(&final, final_msg);
 
-            for (int i = 0; i < 5; i++)
-                final_msg[7 + i] = (t4 >> (8 * i));
-
-            for (int i = 0; i < 5; i++)
-                final_msg[12 + i] = (t5 >> (8 * i));
-
-            dwt_writetxdata(17, final_msg, 0);
-            dwt_writetxfctrl(17 + FCS_LEN, 0, 0);
+            dwt_writetxdata(UWB_MSG_FINAL_LEN, final_msg, 0);
+            dwt_writetxfctrl(UWB_MSG_FINAL_LEN + FCS_LEN, 0, 0);
 
+            uwb_sts_reload();
             dwt_starttx(DWT_START_TX_DELAYED);
 
             while (!(dwt_readsysstatuslo() &
@@ -191,6 +141,7 @@ static void initiator_loop()
             dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
         }
 
+next:
         dwt_writesysstatuslo(
             DWT_INT_RXFCG_BIT_MASK |
             SYS_STATUS_ALL_RX_ERR);
@@ -206,10 +157,11 @@ static void initiator_loop()
 static void responder_loop()
 {
     uint8_t rx_buf[32];
-    uint8_t resp_msg[32];
+    uint8_t resp_msg[UWB_MSG_RESP_LEN];
 
     while (1)
     {
+        uwb_sts_reload();
         dwt_rxenable(DWT_START_RX_IMMEDIATE);
 
         uint32_t status;
@@ -220,18 +172,19 @@ static void responder_loop()
 
         if (status & DWT_INT_RXFCG_BIT_MASK)
         {
-            uint16_t len = dwt_getframelength();
+            uint16_t len = dwt_getframelength() - FCS_LEN;
+            struct uwb_msg_poll poll;
 
-            dwt_readrxdata(rx_buf, len - FCS_LEN, 0);
+            if (len > sizeof(rx_buf))
+                len = sizeof(rx_buf);
+            dwt_readrxdata(rx_buf, len, 0);
 
-            if (rx_buf[0] == MSG_POLL)
+            if (uwb_msg_poll_unpack(&poll, rx_buf, len) == 0)
             {
-                uint8_t seq = rx_buf[1];
-
                 uint64_t t2 = get_rx_timestamp();
 
                 uint32_t resp_tx_time =
-                    (t2 + POLL_TX_TO_RESP_RX_DLY_UUS *
+                    (t2 + (uint64_t)poll_rx_to_resp_tx_dly_uus *
                               UUS_TO_DWT_TIME) >>
                     8;
 
@@ -242,18 +195,18 @@ static void responder_loop()
                                  0xFFFFFFFE))
                      << 8);
 
-                resp_msg[0] = MSG_RESP;
-                resp_msg[1] = seq;
+                struct uwb_msg_resp resp = {
+                    .seq = poll.seq, .tag = poll.tag, .anchor = poll.anchor,
+                    .t2 = t2, .t3 = t3,
+                    .last_seq = poll.seq, .last_mm = UWB_MSG_DIST_NONE,
+                };
 
-                for (int i = 0; i < 5; i++)
-                    resp_msg[2 + i] = (t2 >> (8 * i));
+                uwb_msg_resp_pack(&resp, resp_msg);
 
-                for (int i = 0; i < 5; i++)
-                    resp_msg[7 + i] = (t3 >> (8 * i));
-
-                dwt_writetxdata(12, resp_msg, 0);
-                dwt_writetxfctrl(12 + FCS_LEN, 0, 0);
+                dwt_writetxdata(UWB_MSG_RESP_LEN, resp_msg, 0);
+                dwt_writetxfctrl(UWB_MSG_RESP_LEN + FCS_LEN, 0, 0);
 
+                uwb_sts_reload();
                 dwt_starttx(DWT_START_TX_DELAYED);
 
                 while (!(dwt_readsysstatuslo() &
@@ -262,6 +215,7 @@ static void responder_loop()
                 dwt_writesysstatuslo(
                     DWT_INT_TXFRS_BIT_MASK);
 
+                uwb_sts_reload();
                 dwt_rxenable(DWT_START_RX_IMMEDIATE);
 
                 while (!((status =
@@ -269,21 +223,24 @@ static void responder_loop()
                          (DWT_INT_RXFCG_BIT_MASK |
                           SYS_STATUS_ALL_RX_ERR)));
 
+                struct uwb_msg_final final;
+                int ok = 0;
+
                 if (status &
                     DWT_INT_RXFCG_BIT_MASK)
                 {
-                    dwt_readrxdata(rx_buf, 17, 0);
-
-                    uint64_t t1 = 0, t4 = 0, t5 = 0;
+                    len = dwt_getframelength() - FCS_LEN;
+                    if (len > sizeof(rx_buf))
+                        len = sizeof(rx_buf);
+                    dwt_readrxdata(rx_buf, len, 0);
 
-                    for (int i = 0; i < 5; i++)
-                        t1 |= ((uint64_t)rx_buf[2 + i]) << (8 * i);
-
-                    for (int i = 0; i < 5; i++)
-                        t4 |= ((uint64_t)rx_buf[7 + i]) << (8 * i);
+                    ok = uwb_msg_final_unpack(&final, rx_buf, len) == 0 &&
+                         final.seq == poll.seq;
+                }
 
-                    for (int i = 0; i < 5; i++)
-                        t5 |= ((uint64_t)rx_buf[12 + i]) << (8 * i);
+                if (ok)
+                {
+                    uint64_t t1 = final.t1, t4 = final.t4, t5 = final.t5;
 
                     uint64_t t6 = get_rx_timestamp();
 
@@ -334,12 +291,24 @@ int main(void)
 {
     printf("UWB Calibration Firmware Started\n");
 
-    if (uwb_init() != 0)
+    if (uwb_radio_init(antenna_delay) != 0)
     {
         printf("UWB INIT FAILED\n");
         return -1;
     }
 
+    /* find the shortest reply delays this board can meet */
+    uwb_timing_calibrate();
+    uwb_timing_selftest(UWB_MSG_FINAL_LEN);
+
+    poll_rx_to_resp_tx_dly_uus =
+        uwb_reply_dly_uus(&uwb_default_config, UWB_MSG_POLL_LEN, UWB_MSG_RESP_LEN);
+    resp_rx_to_final_tx_dly_uus =
+        uwb_reply_dly_uus(&uwb_default_config, UWB_MSG_RESP_LEN, UWB_MSG_FINAL_LEN);
+
+    printf("REPLY_DLY %u %u\n",
+           poll_rx_to_resp_tx_dly_uus, resp_rx_to_final_tx_dly_uus);
+
 #if ROLE_INITIATOR
     initiator_loop();
 #else
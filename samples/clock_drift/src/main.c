@@ -15,12 +15,12 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "uwb.h"
 
 LOG_MODULE_REGISTER(clock_drift, LOG_LEVEL_INF);
 
+#define ANT_DLY 16385
+
 #define DRIFT_MODE  0
 
 #define DW_TICKS_PER_SEC        63897600000ULL
@@ -36,54 +36,6 @@ LOG_MODULE_REGISTER(clock_drift, LOG_LEVEL_INF);
 #define BLINK_INTERVAL_MS       100
 #define DRIFT_WINDOW            16     
 
-static dwt_config_t uwb_cfg = {
-    .chan           = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC          = DWT_PAC8,
-    .txCode         = 9,
-    .rxCode         = 9,
-    .sfdType        = DWT_SFD_DW_8,
-    .dataRate       = DWT_BR_6M8,
-    .phrMode        = DWT_PHRMODE_STD,
-    .phrRate        = DWT_PHRRATE_STD,
-    .sfdTO          = (129 + 8 - 8),
-    .stsMode        = DWT_STS_MODE_OFF,
-    .stsLength      = DWT_STS_LEN_64,
-    .pdoaMode       = DWT_PDOA_M0,
-};
-
-static int uwb_init(void)
-{
-    dw_device_init();
-
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
-
-    port_set_dw_ic_spi_slowrate();
-
-    if (dwt_probe((struct dwt_probe_s *)&dw3000_probe_interf) != DWT_SUCCESS) {
-        LOG_ERR("CAN NOT FIND CHIP DRIVER");
-        return -1;
-    }
-
-    port_set_dw_ic_spi_fastrate();
-
-    if (dwt_initialise(DWT_DW_INIT) != DWT_SUCCESS) {
-        LOG_ERR("INITIALISATION FAILED");
-        return -1;
-    }
-
-    if (dwt_configure(&uwb_cfg) != DWT_SUCCESS) {
-        LOG_ERR("RADIO CONFIG FAILED");
-        return -1;
-    }
-
-    dwt_setrxantennadelay(16385);
-    dwt_settxantennadelay(16385);
-
-    return 0;
-}
-,
 static uint64_t read_rx_ts(void)
 {
     uint8_t buf[5];
@@ -163,6 +115,7 @@ static void tx_loop(void)
 
         dwt_writetxdata(sizeof(tx_msg), tx_msg, 0);
         dwt_writetxfctrl(sizeof(tx_msg) + FCS_LEN, 0, 0);
+        uwb_sts_reload();
         dwt_starttx(DWT_START_TX_IMMEDIATE);
 
         while (!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK)) {}
@@ -202,6 +155,7 @@ static void rx_drift_loop(void)
 
     LOG_INF("[DRIFT] Starting RX drift measurement (window %d pkts)", DRIFT_WINDOW);
 
+    uwb_sts_reload();
     dwt_rxenable(DWT_START_RX_IMMEDIATE);
 
     while (1) {
@@ -210,6 +164,7 @@ static void rx_drift_loop(void)
 
         if (!(status & DWT_INT_RXFCG_BIT_MASK)) {
             dwt_writesysstatuslo(SYS_STATUS_ALL_RX_ERR | SYS_STATUS_ALL_RX_TO);
+            uwb_sts_reload();
             dwt_rxenable(DWT_START_RX_IMMEDIATE);
             continue;
         }
@@ -231,6 +186,7 @@ static void rx_drift_loop(void)
         dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
                              SYS_STATUS_ALL_RX_ERR  |
                              SYS_STATUS_ALL_RX_TO);
+        uwb_sts_reload();
         dwt_rxenable(DWT_START_RX_IMMEDIATE);
 
         if (!have_first) {
@@ -291,7 +247,7 @@ int main(void)
 {
     LOG_INF("clock_drift sample  (DRIFT_MODE=%d)", DRIFT_MODE);
 
-    if (uwb_init() != 0) {
+    if (uwb_radio_init(ANT_DLY) != 0) {
         LOG_ERR("UWB STARTUP FAILED");
         return -1;
     }
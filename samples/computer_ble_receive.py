@@ -1,8 +1,12 @@
 import asyncio
+import os
+import sys
 from bleak import BleakClient, BleakScanner
 from collections import defaultdict
-import numpy as np
-from scipy.optimize import least_squares
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "scripts"))
+import uwb_solver
+import uwb_tlm
 
 DEVICE_NAME = "DWM3001-TDOA"
 UUID = "6e400003-b5a3-f393-e0a9-e50e24dcca9e"
@@ -16,61 +20,38 @@ ANCHORS = {
     10: (0.5, 0.5),
 }
 
+# (tag, seq) -> {anchor: master_time}, oldest first. Blinks that never
+# reach three anchors are dropped once MAX_PENDING newer ones are waiting.
+MAX_PENDING = 256
 data_store = defaultdict(dict)
 
-def tdoa_residuals(pos, anchor_positions, tdoa_meters):
-    x, y = pos
-    ref_pos = anchor_positions[0]
-    d_ref = np.sqrt((x - ref_pos[0])**2 + (y - ref_pos[1])**2)
-
-    residuals = []
-    for i in range(len(tdoa_meters)):
-        ai = anchor_positions[i + 1]
-        d_i = np.sqrt((x - ai[0])**2 + (y - ai[1])**2)
-        residuals.append((d_i - d_ref) - tdoa_meters[i])
-
-    return residuals
-
 def compute_position(seq_data):
     if len(seq_data) < 3:
         return None
 
-    ids = sorted(seq_data.keys())
-    ref_id = ids[0]
-    t_ref = seq_data[ref_id]
-
-    anchor_positions = [ANCHORS[ref_id]]
-    tdoa_meters = []
+    # arrival times in meters, only differences matter
+    arrivals = {aid: C * t * DTU_TO_SEC for aid, t in seq_data.items()}
 
-    for i in range(1, len(ids)):
-        aid = ids[i]
-        dt = seq_data[aid] - t_ref
-        dd = C * dt * DTU_TO_SEC
-        anchor_positions.append(ANCHORS[aid])
-        tdoa_meters.append(dd)
-
-    x0 = np.mean([p[0] for p in anchor_positions])
-    y0 = np.mean([p[1] for p in anchor_positions])
+    fix = uwb_solver.tdoa_fix(ANCHORS, arrivals)
+    if fix is None:
+        return None
 
-    result = least_squares(
-        tdoa_residuals, [x0, y0],
-        args=(anchor_positions, tdoa_meters)
-    )
+    return fix[0]
 
-    if result.success:
-        return (result.x[0], result.x[1])
-    return None
+def process_packet(node_id, tag, seq, master_time):
+    key = (tag, seq)
 
-def process_packet(node_id, seq, master_time):
+    data_store[key][node_id] = master_time
 
-    data_store[seq][node_id] = master_time
+    while len(data_store) > MAX_PENDING:
+        del data_store[next(iter(data_store))]
 
-    # Wait until all 3 anchors received same seq
-    if len(data_store[seq]) >= 3:
+    # Wait until all 3 anchors received the same blink
+    if len(data_store.get(key, ())) >= 3:
 
-        seq_data = data_store[seq]
+        seq_data = data_store[key]
 
-        print(f"\n=== SEQ {seq} ===")
+        print(f"\n=== TAG {tag:x} SEQ {seq} ===")
 
         for nid, t in seq_data.items():
             print(f"Anchor {nid}: {t}")
@@ -85,20 +66,16 @@ def process_packet(node_id, seq, master_time):
             print(f"Δt({ids[i]}-{ids[0]}) = {dt} DTU → {dd:.3f} m")
 
         # Cleanup
-        del data_store[seq]
+        del data_store[key]
 
 def make_callback():
+    dec = uwb_tlm.Decoder()
+
     def callback(_, data: bytearray):
         try:
-            line = data.decode().strip()
-            parts = line.split(",")
-
-            if parts[0] == "BLINK":
-                node_id = int(parts[1])
-                seq = int(parts[2])
-                master_time = float(parts[4])
-
-                process_packet(node_id, seq, master_time)
+            for rec in dec.decode(data):
+                if rec["type"] == "BLINK":
+                    process_packet(rec["anchor_id"], rec["tag"], rec["seq"], rec["corrected"])
 
         except Exception as e:
             print("Parse error:", e)
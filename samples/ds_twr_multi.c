@@ -1,11 +1,13 @@
-#include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
 #include "port.h"
+#include "uwb.h"
+#include "uwb_timing.h"
+#include "uwb_ts.h"
+#include "uwb_msg.h"
+#include "loc_twr.h"
 
 LOG_MODULE_REGISTER(ds_twr, LOG_LEVEL_INF);
 
@@ -13,328 +15,565 @@ LOG_MODULE_REGISTER(ds_twr, LOG_LEVEL_INF);
 #define NODE_ID        2 // make sure all boards have unique NODE_ID
 #define ANT_DLY 26194
 
-#define SPEED_OF_LIGHT 299702547.0
-#define UUS_TO_DWT_TIME 63898
-
-#define POLL_TX_TO_RESP_RX_DLY_UUS  900
-#define RESP_RX_TO_FINAL_TX_DLY_UUS 900
-
-#define MSG_POLL  0x01
-#define MSG_RESP  0x02
-#define MSG_FINAL  0x03
-#define MSG_REPORT 0x04
-
-static dwt_config_t config = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
-    .phrMode = DWT_PHRMODE_STD,
-    .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
-    .pdoaMode = DWT_PDOA_M0,
+// 1: one POLL answered by all anchors in slots, one FINAL for all (2+N frames)
+// 0: POLL/RESP/FINAL with each anchor in turn (3N frames)
+#define BROADCAST_MODE 1
+
+/* RX timestamp -> delayed TX offsets, measured at boot. the tag sends
+ * its own in the (B)POLL and the anchors use those, so both ends build
+ * their windows from the same values. */
+static uint32_t poll_rx_to_resp_tx_dly_uus;
+static uint32_t resp_rx_to_final_tx_dly_uus;
+
+/* frame layouts are in uwb_msg.h.
+ * broadcast: anchor NODE_ID k (1..BCAST_MAX_ANCHORS) replies
+ * resp_dly + (k-1)*slot after the BPOLL and expects the BFINAL
+ * final_dly after the last slot. the tag picks all three so all anchors
+ * agree, and the BFINAL holds one t4 per anchor. */
+#define BCAST_MAX_ANCHORS 8
+#define BFINAL_MAX UWB_MSG_TAIL_LEN(BFINAL,BFINAL_ENT,BCAST_MAX_ANCHORS)
+
+/* guard between slots on top of RESP airtime and tag RX re-arm */
+#define BCAST_GUARD_UUS 30
+
+/* there is no REPORT frame: an anchor returns the distance of its previous
+ * exchange with a tag in the next RESP (last_seq + last_mm, or
+ * UWB_MSG_DIST_NONE) */
+
+#if ROLE_INITIATOR
+
+/* a position needs LOC_DIM+1 of them, fewer only range */
+#define NUM_ANCHORS 3
+
+/* anchor positions in meters, a fix is solved once 3 of them have a range */
+#define LOC_DIM 2
+
+static const struct {
+    uint8_t id;
+    float   pos[3];
+} anchor_pos[]={
+    {1,{0.00f,0.00f,0.00f}},
+    {2,{0.90f,0.00f,0.00f}},
+    {3,{0.90f,0.60f,0.00f}},
+    {4,{0.00f,0.60f,0.00f}},
 };
 
-static uint64_t get_tx_ts()
+/* ranges collected during one round */
+static float round_pos[LOC_MAX_ANCHORS][3];
+static float round_r[LOC_MAX_ANCHORS];
+static uint8_t round_id[LOC_MAX_ANCHORS];
+static int round_n;
+
+static void round_add(uint8_t anchor_id, uint16_t mm)
 {
-    uint8_t ts[5];
-    dwt_readtxtimestamp(ts);
-    uint64_t val = 0;
-    for(int i=4;i>=0;i--)
-        val = (val<<8) | ts[i];
-    return val;
+    for(int i=0;i<(int)ARRAY_SIZE(anchor_pos) && round_n<LOC_MAX_ANCHORS;i++)
+    {
+        if(anchor_pos[i].id!=anchor_id)
+            continue;
+
+        memcpy(round_pos[round_n],anchor_pos[i].pos,sizeof(round_pos[0]));
+        round_r[round_n]=mm/1000.0f;
+        round_id[round_n]=anchor_id;
+        round_n++;
+        return;
+    }
 }
 
-static uint64_t get_rx_ts()
+/* one weighted fit over every range of the round */
+static void round_solve(uint8_t seq)
 {
-    uint8_t ts[5];
-    dwt_readrxtimestamp(ts);
-    uint64_t val = 0;
-    for(int i=4;i>=0;i--)
-        val = (val<<8) | ts[i];
-    return val;
+    static struct loc_twr_ws ws;
+    struct loc_twr_fix fix;
+
+    int n=round_n;
+    round_n=0;
+
+    if(n<LOC_DIM+1 || loc_twr_solve(&ws,LOC_DIM,n,round_pos,round_r,NULL,&fix)!=0)
+        return;
+
+    LOG_INF("POS,%d,%.3f,%.3f,%.3f,%d/%d",seq,(double)fix.p[0],(double)fix.p[1],
+            (double)fix.rms,fix.n_used,n);
+
+    for(int i=0;i<n;i++)
+    {
+        if(fix.rejected&(1<<i))
+            LOG_WRN("Anchor %d range rejected",round_id[i]);
+    }
 }
 
-static int uwb_init()
+/* piggybacked result of the previous exchange */
+static void log_last_range(uint8_t anchor_id, uint8_t seq, uint16_t mm)
 {
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
-    port_set_dw_ic_spi_slowrate();
-    if(dwt_probe((struct dwt_probe_s*)&dw3000_probe_interf)!=DWT_SUCCESS)
-        return -1;
-    port_set_dw_ic_spi_fastrate();
-    if(dwt_initialise(DWT_DW_INIT)!=DWT_SUCCESS)
-        return -1;
-    if(dwt_configure(&config)!=DWT_SUCCESS)
-        return -1;
-    dwt_setrxantennadelay(ANT_DLY);
-    dwt_settxantennadelay(ANT_DLY);
-    return 0;
-}
+    if(mm==UWB_MSG_DIST_NONE)
+        return;
 
-#if ROLE_INITIATOR
+    LOG_INF("Anchor %d: %u.%03u m  seq=%d",anchor_id,mm/1000,mm%1000,seq);
 
-#define NUM_ANCHORS 2
-static uint8_t anchor_list[NUM_ANCHORS]={1,2};
+    round_add(anchor_id,mm);
+}
 
-static void initiator_loop()
-{
-    dwt_setrxtimeout(5000);
+#if BROADCAST_MODE
 
-    uint8_t poll_msg[4];
-    uint8_t resp_msg[32];
-    uint8_t final_msg[32];
-    uint8_t report_buf[32];
+static void initiator_bcast_loop()
+{
+    uint8_t poll_msg[UWB_MSG_BPOLL_LEN];
+    uint8_t rx_buf[UWB_MSG_MAX];
+    uint8_t final_msg[BFINAL_MAX];
+    uint16_t rx_len;
     uint8_t seq=0;
 
+    /* RESP airtime + time to re-arm RX after the previous one */
+    uint32_t slot_uus=
+        (uwb_airtime_ns(&uwb_default_config,UWB_MSG_BRESP_LEN)+
+         uwb_rx_service_ns(UWB_MSG_BRESP_LEN)+999)/1000+BCAST_GUARD_UUS;
+
+    uint32_t last_slot_uus=
+        poll_rx_to_resp_tx_dly_uus+(BCAST_MAX_ANCHORS-1)*slot_uus;
+
+    /* RX ends one slot after the last RESP starts */
+    uint32_t window_uus=last_slot_uus+slot_uus;
+
+    LOG_INF("Broadcast: first RESP %u uus, slot %u uus",
+            poll_rx_to_resp_tx_dly_uus,slot_uus);
+
+    /* the radio opens RX just before the first slot, one timeout covers
+     * every slot. no preamble timeout: a slot may stay empty. */
+    struct uwb_rx_window win;
+    uwb_rx_window_for_reply(&win,&uwb_default_config,UWB_MSG_BPOLL_LEN,
+                            poll_rx_to_resp_tx_dly_uus,UWB_MSG_BRESP_LEN);
+    win.timeout_uus+=(BCAST_MAX_ANCHORS-1)*slot_uus;
+    win.pre_timeout_pacs=0;
+
     while(1)
     {
-        for(int a=0;a<NUM_ANCHORS;a++)
-        {
-            uint8_t anchor_id=anchor_list[a];
+        struct uwb_msg_bpoll poll={
+            .seq=seq,
+            .tag=NODE_ID,
+            .resp_dly_uus=poll_rx_to_resp_tx_dly_uus,
+            .slot_uus=slot_uus,
+            .final_dly_uus=resp_rx_to_final_tx_dly_uus,
+        };
 
-            poll_msg[0]=MSG_POLL;
-            poll_msg[1]=seq;
-            poll_msg[2]=anchor_id;
-            poll_msg[3]=NODE_ID;
+        uwb_rx_window_set(&win);
+        uwb_msg_bpoll_pack(&poll,poll_msg);
 
-            dwt_writetxdata(sizeof(poll_msg),poll_msg,0);
-            dwt_writetxfctrl(sizeof(poll_msg)+FCS_LEN,0,0);
-            dwt_starttx(DWT_START_TX_IMMEDIATE);
+        /* the first RESP lands in the window the POLL opened */
+        int rx=uwb_tx_rx(poll_msg,sizeof(poll_msg),rx_buf,sizeof(rx_buf),&rx_len);
 
-            while(!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-            dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
+        uint64_t t1=uwb_get_tx_ts();
 
-            uint64_t t1=get_tx_ts();
+        int n=0;
 
-            dwt_rxenable(DWT_START_RX_IMMEDIATE);
+        /* collect RESPs until every anchor answered or the window closed */
+        for(int i=0;n<NUM_ANCHORS;i++)
+        {
+            if(i>0)
+            {
+                /* only what is left of the slots, not the whole window again */
+                int64_t left=uwb_ts_sub(uwb_ts_add(t1,(int64_t)window_uus*UUS_TO_DWT_TIME),
+                                        uwb_get_sys_time())/UUS_TO_DWT_TIME;
+                if(left<=0)
+                    break;
 
-            uint32_t status;
-            while(!((status=dwt_readsysstatuslo()) &
-                  (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)));
+                struct uwb_rx_window rest={.timeout_uus=(uint32_t)left};
+                uwb_rx_window_set(&rest);
 
-            if(!(status & DWT_INT_RXFCG_BIT_MASK))
-            {
-                LOG_WRN("No RESP from anchor %d",anchor_id);
-                dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-                    SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
-                continue;
+                rx=uwb_rx(rx_buf,sizeof(rx_buf),&rx_len);
             }
 
-            uint16_t len=dwt_getframelength();
-            dwt_readrxdata(resp_msg,len-FCS_LEN,0);
+            if(rx!=0)
+                break;
 
-            if(resp_msg[0]!=MSG_RESP)
-            {
-                dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-                    SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+            struct uwb_msg_bresp resp;
+
+            if(uwb_msg_bresp_unpack(&resp,rx_buf,rx_len)!=0 ||
+               resp.seq!=seq || resp.tag!=NODE_ID)
                 continue;
-            }
 
-            uint64_t t4=get_rx_ts();
+            log_last_range(resp.anchor,resp.last_seq,resp.last_mm);
 
-            dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-                SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+            struct uwb_msg_bfinal_ent e={
+                .anchor=resp.anchor,
+                .t4=uwb_get_rx_ts(),
+            };
+            uwb_msg_bfinal_ent_pack(&e,UWB_MSG_TAIL_AT(BFINAL,BFINAL_ENT,final_msg,n));
+            n++;
+        }
 
-            uint64_t t2=0, t3=0;
-            for(int i=0;i<5;i++)
-            {
-                t2 |= ((uint64_t)resp_msg[4+i])<<(8*i);
-                t3 |= ((uint64_t)resp_msg[9+i])<<(8*i);
-            }
+        /* RESPs carry the previous round's ranges */
+        round_solve(seq-1);
 
-            uint32_t final_tx_time=
-                (t4 + RESP_RX_TO_FINAL_TX_DLY_UUS*UUS_TO_DWT_TIME)>>8;
-            dwt_setdelayedtrxtime(final_tx_time);
+        if(n==0)
+        {
+            LOG_WRN("No RESP, seq=%d",seq);
+            seq++;
+            Sleep(200);
+            continue;
+        }
 
-            uint64_t t5=(((uint64_t)(final_tx_time&0xFFFFFFFE))<<8);
+        /* after the last possible slot, so no RESP is cut off */
+        uint32_t final_tx_time=
+            (t1+(uint64_t)(last_slot_uus+resp_rx_to_final_tx_dly_uus)*UUS_TO_DWT_TIME)>>8;
 
-            final_msg[0]=MSG_FINAL;
-            final_msg[1]=seq;
-            final_msg[2]=anchor_id;
-            final_msg[3]=NODE_ID;
+        struct uwb_msg_bfinal final={
+            .seq=seq,
+            .tag=NODE_ID,
+            .n=n,
+            .t1=t1,
+            .t5=(((uint64_t)(final_tx_time&0xFFFFFFFE))<<8),
+        };
+        uwb_msg_bfinal_pack(&final,final_msg);
+
+        if(uwb_tx_delayed(final_msg,UWB_MSG_TAIL_LEN(BFINAL,BFINAL_ENT,n),final_tx_time)!=0)
+            LOG_WRN("FINAL late, seq=%d",seq);
+        else
+            LOG_INF("seq=%d: %d/%d anchors answered",seq,n,NUM_ANCHORS);
+
+        seq++;
+        Sleep(200);
+    }
+}
 
-            for(int i=0;i<5;i++) final_msg[4+i]=(t1>>(8*i));
-            for(int i=0;i<5;i++) final_msg[9+i]=(t4>>(8*i));
-            for(int i=0;i<5;i++) final_msg[14+i]=(t5>>(8*i));
+#else
 
-            dwt_writetxdata(19,final_msg,0);
-            dwt_writetxfctrl(19+FCS_LEN,0,0);
-            dwt_starttx(DWT_START_TX_DELAYED);
+static uint8_t anchor_list[NUM_ANCHORS]={1,2,3};
 
-            while(!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-            dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
+static void initiator_loop()
+{
+    struct uwb_rx_window win;
+    uwb_rx_window_for_reply(&win,&uwb_default_config,UWB_MSG_POLL_LEN,
+                            poll_rx_to_resp_tx_dly_uus,UWB_MSG_RESP_LEN);
+    uwb_rx_window_set(&win);
+
+    uint8_t poll_msg[UWB_MSG_POLL_LEN];
+    uint8_t resp_msg[UWB_MSG_MAX];
+    uint8_t final_msg[UWB_MSG_FINAL_LEN];
+    uint16_t resp_len;
+    uint8_t seq=0;
 
-            dwt_rxenable(DWT_START_RX_IMMEDIATE);
+    while(1)
+    {
+        for(int a=0;a<NUM_ANCHORS;a++)
+        {
+            uint8_t anchor_id=anchor_list[a];
 
-            while(!((status=dwt_readsysstatuslo()) &
-                  (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR)));
+            struct uwb_msg_poll poll={
+                .seq=seq,
+                .anchor=anchor_id,
+                .tag=NODE_ID,
+                .resp_dly_uus=poll_rx_to_resp_tx_dly_uus,
+                .final_dly_uus=resp_rx_to_final_tx_dly_uus,
+            };
+            uwb_msg_poll_pack(&poll,poll_msg);
 
-            if(!(status & DWT_INT_RXFCG_BIT_MASK))
+            if(uwb_tx_rx(poll_msg,sizeof(poll_msg),resp_msg,sizeof(resp_msg),&resp_len)!=0)
             {
-                LOG_WRN("No REPORT from anchor %d",anchor_id);
-                dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-                    SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+                LOG_WRN("No RESP from anchor %d",anchor_id);
                 continue;
             }
 
-            len=dwt_getframelength();
-            dwt_readrxdata(report_buf,len-FCS_LEN,0);
+            uint64_t t1=uwb_get_tx_ts();
 
-            if(report_buf[0]!=MSG_REPORT)
-            {
-                dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-                    SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+            struct uwb_msg_resp resp;
+
+            if(uwb_msg_resp_unpack(&resp,resp_msg,resp_len)!=0)
                 continue;
-            }
 
-            float dist_f;
-            memcpy(&dist_f,&report_buf[4],4);
-            double dist=(double)dist_f;
+            uint64_t t4=uwb_get_rx_ts();
 
-            LOG_INF("Anchor %d: %.2f m  seq=%d",anchor_id,dist,seq);
+            log_last_range(anchor_id,resp.last_seq,resp.last_mm);
 
-            dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-                SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+            uint32_t final_tx_time=
+                (t4 + (uint64_t)resp_rx_to_final_tx_dly_uus*UUS_TO_DWT_TIME)>>8;
+
+            struct uwb_msg_final final={
+                .seq=seq,
+                .anchor=anchor_id,
+                .tag=NODE_ID,
+                .t1=t1,
+                .t4=t4,
+                .t5=(((uint64_t)(final_tx_time&0xFFFFFFFE))<<8),
+            };
+            uwb_msg_final_pack(&final,final_msg);
+
+            if(uwb_tx_delayed(final_msg,sizeof(final_msg),final_tx_time)!=0)
+            {
+                LOG_WRN("FINAL late for anchor %d",anchor_id);
+                continue;
+            }
 
             Sleep(50);
         }
+
+        /* RESPs carry the previous round's ranges */
+        round_solve(seq-1);
+
         seq++;
         Sleep(200);
     }
 }
 
+#endif
+
 #else
 
-static void responder_loop()
+#define MAX_TAGS 8
+
+struct last_range {
+    uint8_t  tag;
+    uint8_t  seq;
+    uint16_t mm;
+};
+
+static struct last_range last_ranges[MAX_TAGS];
+static int num_tags;
+
+static struct last_range *last_range_get(uint8_t tag)
+{
+    for(int i=0;i<num_tags;i++)
+    {
+        if(last_ranges[i].tag==tag)
+            return &last_ranges[i];
+    }
+
+    /* table full: recycle a slot, that tag just misses one result */
+    struct last_range *r=num_tags<MAX_TAGS ?
+        &last_ranges[num_tags++] : &last_ranges[tag%MAX_TAGS];
+
+    r->tag=tag;
+    r->mm=UWB_MSG_DIST_NONE;
+    return r;
+}
+
+static void last_range_set(uint8_t tag, uint8_t seq, int32_t mm)
+{
+    struct last_range *r=last_range_get(tag);
+
+    if(mm<0)
+        mm=0;
+    if(mm>UWB_MSG_DIST_NONE-1)
+        mm=UWB_MSG_DIST_NONE-1;
+
+    r->seq=seq;
+    r->mm=(uint16_t)mm;
+}
+
+/* fill last_seq, last_mm for this tag. each result is sent once. */
+static void last_range_put(uint8_t tag, uint8_t *seq, uint16_t *mm)
+{
+    struct last_range *r=last_range_get(tag);
+
+    *seq=r->seq;
+    *mm=r->mm;
+
+    r->mm=UWB_MSG_DIST_NONE;
+}
+
+#if BROADCAST_MODE
+
+static void responder_bcast_loop()
 {
-    uint8_t rx_buf[32];
-    uint8_t resp_msg[32];
+    uint8_t rx_buf[UWB_MSG_MAX];
+    uint8_t resp_msg[UWB_MSG_BRESP_LEN];
+    uint16_t rx_len;
+
+    __ASSERT(NODE_ID>=1 && NODE_ID<=BCAST_MAX_ANCHORS,"anchor NODE_ID out of slot range");
 
     while(1)
     {
-        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+        struct uwb_msg_bpoll poll;
 
-        uint32_t status;
-        while(!((status=dwt_readsysstatuslo())&
-            (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR)));
+        /* wait for a POLL as long as it takes */
+        uwb_rx_window_set(NULL);
 
-        if(!(status & DWT_INT_RXFCG_BIT_MASK))
-        {
-            dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-                SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
+        if(uwb_rx(rx_buf,sizeof(rx_buf),&rx_len)!=0 || uwb_msg_bpoll_unpack(&poll,rx_buf,rx_len)!=0)
+            continue;
+
+        uint8_t seq=poll.seq;
+        uint8_t tag_id=poll.tag;
+        uint32_t slot=poll.slot_uus;
+        uint32_t final_dly=poll.final_dly_uus;
+
+        uint64_t t2=uwb_get_rx_ts();
+
+        uint32_t resp_tx_time=
+            (t2+(uint64_t)(poll.resp_dly_uus+(NODE_ID-1)*slot)*UUS_TO_DWT_TIME)>>8;
+
+        uint64_t t3=(((uint64_t)(resp_tx_time&0xFFFFFFFE))<<8);
+
+        struct uwb_msg_bresp resp={
+            .seq=seq,
+            .tag=tag_id,
+            .anchor=NODE_ID,
+        };
+        last_range_put(tag_id,&resp.last_seq,&resp.last_mm);
+        uwb_msg_bresp_pack(&resp,resp_msg);
+
+        /* FINAL follows the last slot */
+        struct uwb_rx_window win;
+        uwb_rx_window_for_reply(&win,&uwb_default_config,UWB_MSG_BRESP_LEN,
+                                (BCAST_MAX_ANCHORS-NODE_ID)*slot+final_dly,
+                                BFINAL_MAX);
+        uwb_rx_window_set(&win);
+
+        /* late RESP (counted in tx_late) or no FINAL */
+        if(uwb_tx_delayed_rx(resp_msg,sizeof(resp_msg),resp_tx_time,rx_buf,sizeof(rx_buf),&rx_len)!=0)
             continue;
-        }
 
-        uint16_t len=dwt_getframelength();
-        dwt_readrxdata(rx_buf,len-FCS_LEN,0);
+        struct uwb_msg_bfinal final;
 
-        if(rx_buf[0]==MSG_POLL && rx_buf[2]==NODE_ID)
+        if(uwb_msg_bfinal_unpack(&final,rx_buf,rx_len)!=0 ||
+           final.seq!=seq || final.tag!=tag_id)
+            continue;
+
+        if(final.n>BCAST_MAX_ANCHORS || rx_len<UWB_MSG_TAIL_LEN(BFINAL,BFINAL_ENT,final.n))
+            continue;
+
+        uint64_t t6=uwb_get_rx_ts();
+
+        for(int i=0;i<final.n;i++)
         {
-            uint8_t seq=rx_buf[1];
-            uint8_t tag_id=rx_buf[3];
+            struct uwb_msg_bfinal_ent e;
 
-            uint64_t t2=get_rx_ts();
+            uwb_msg_bfinal_ent_unpack(&e,UWB_MSG_TAIL_AT(BFINAL,BFINAL_ENT,rx_buf,i));
 
-            uint32_t resp_tx_time=
-                (t2+POLL_TX_TO_RESP_RX_DLY_UUS*UUS_TO_DWT_TIME)>>8;
-            dwt_setdelayedtrxtime(resp_tx_time);
+            if(e.anchor!=NODE_ID)
+                continue;
 
-            uint64_t t3=(((uint64_t)(resp_tx_time&0xFFFFFFFE))<<8);
+            int64_t tof;
+            if(uwb_ds_twr_tof_q8(final.t1,t2,t3,e.t4,final.t5,t6,&tof)!=0)
+                break;
 
-            resp_msg[0]=MSG_RESP;
-            resp_msg[1]=seq;
-            resp_msg[2]=tag_id;
-            resp_msg[3]=NODE_ID;
+            int32_t mm=uwb_tof_q8_to_mm(tof);
 
-            for(int i=0;i<5;i++) resp_msg[4+i]=(t2>>(8*i));
-            for(int i=0;i<5;i++) resp_msg[9+i]=(t3>>(8*i));
+            last_range_set(tag_id,seq,mm);
 
-            dwt_writetxdata(14,resp_msg,0);
-            dwt_writetxfctrl(14+FCS_LEN,0,0);
-            dwt_starttx(DWT_START_TX_DELAYED);
+            LOG_INF("Tag %d: %d mm  seq=%d",tag_id,mm,seq);
+            break;
+        }
+    }
+}
 
-            while(!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-            dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
+#else
 
-            dwt_rxenable(DWT_START_RX_IMMEDIATE);
+static void responder_loop()
+{
+    uint8_t rx_buf[UWB_MSG_MAX];
+    uint8_t resp_msg[UWB_MSG_RESP_LEN];
+    uint16_t rx_len;
 
-            while(!((status=dwt_readsysstatuslo())&
-                (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR)));
+    /* the radio opens RX for the FINAL right after the RESP */
+    struct uwb_rx_window final_win;
 
-            if(status & DWT_INT_RXFCG_BIT_MASK)
-            {
-                dwt_readrxdata(rx_buf,19,0);
+    while(1)
+    {
+        struct uwb_msg_poll poll;
+
+        uwb_rx_window_set(NULL);
+
+        if(uwb_rx(rx_buf,sizeof(rx_buf),&rx_len)!=0)
+            continue;
 
-                if(rx_buf[0]!=MSG_FINAL)
-                    goto cleanup;
+        if(uwb_msg_poll_unpack(&poll,rx_buf,rx_len)==0 && poll.anchor==NODE_ID)
+        {
+            uint8_t seq=poll.seq;
+            uint8_t tag_id=poll.tag;
 
-                uint64_t t1=0,t4=0,t5=0;
+            uint64_t t2=uwb_get_rx_ts();
 
-                for(int i=0;i<5;i++) t1|=((uint64_t)rx_buf[4+i])<<(8*i);
-                for(int i=0;i<5;i++) t4|=((uint64_t)rx_buf[9+i])<<(8*i);
-                for(int i=0;i<5;i++) t5|=((uint64_t)rx_buf[14+i])<<(8*i);
+            /* the tag's delays, it opens its windows from them */
+            uint32_t resp_tx_time=
+                (t2+(uint64_t)poll.resp_dly_uus*UUS_TO_DWT_TIME)>>8;
+
+            uint64_t t3=(((uint64_t)(resp_tx_time&0xFFFFFFFE))<<8);
 
-                uint64_t t6=get_rx_ts();
+            struct uwb_msg_resp resp={
+                .seq=seq,
+                .tag=tag_id,
+                .anchor=NODE_ID,
+                .t2=t2,
+                .t3=t3,
+            };
+            last_range_put(tag_id,&resp.last_seq,&resp.last_mm);
+            uwb_msg_resp_pack(&resp,resp_msg);
+
+            uwb_rx_window_for_reply(&final_win,&uwb_default_config,UWB_MSG_RESP_LEN,
+                                    poll.final_dly_uus,UWB_MSG_FINAL_LEN);
+            uwb_rx_window_set(&final_win);
+
+            if(uwb_tx_delayed_rx(resp_msg,sizeof(resp_msg),resp_tx_time,rx_buf,sizeof(rx_buf),&rx_len)==0)
+            {
+                struct uwb_msg_final final;
 
-                double Ra=(double)(t4-t1);
-                double Rb=(double)(t6-t3);
-                double Da=(double)(t5-t4);
-                double Db=(double)(t3-t2);
+                if(uwb_msg_final_unpack(&final,rx_buf,rx_len)!=0)
+                    continue;
 
-                double tof=(Ra*Rb - Da*Db)/(Ra+Rb+Da+Db);
-                tof*=DWT_TIME_UNITS;
-                double dist=tof*SPEED_OF_LIGHT;
+                uint64_t t6=uwb_get_rx_ts();
 
-                uint8_t report_msg[8];
-                report_msg[0]=MSG_REPORT;
-                report_msg[1]=seq;
-                report_msg[2]=tag_id;
-                report_msg[3]=NODE_ID;
-                float dist_f=(float)dist;
-                memcpy(&report_msg[4],&dist_f,4);
+                int64_t tof;
+                if(uwb_ds_twr_tof_q8(final.t1,t2,t3,final.t4,final.t5,t6,&tof)!=0)
+                    continue;
 
-                dwt_writetxdata(sizeof(report_msg),report_msg,0);
-                dwt_writetxfctrl(sizeof(report_msg)+FCS_LEN,0,0);
-                dwt_starttx(DWT_START_TX_IMMEDIATE);
+                int32_t mm=uwb_tof_q8_to_mm(tof);
 
-                while(!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-                dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
+                last_range_set(tag_id,seq,mm);
 
-                LOG_INF("Tag %d: %.2f m",tag_id,dist);
+                LOG_INF("Tag %d: %d mm",tag_id,mm);
             }
         }
-
-cleanup:
-        dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK |
-            SYS_STATUS_ALL_RX_TO | SYS_STATUS_ALL_RX_ERR);
     }
 }
 
 #endif
 
+#endif
+
 int main(void)
 {
     LOG_INF("DW3000 DS-TWR Start");
 
-    if(uwb_init()!=0)
+    if(uwb_init(ANT_DLY)!=0)
     {
         LOG_ERR("Init failed");
         return -1;
     }
 
+    /* find the shortest reply delays this board can meet */
+    uwb_timing_calibrate();
+    uwb_timing_selftest(BROADCAST_MODE ? BFINAL_MAX : UWB_MSG_FINAL_LEN);
+
+#if BROADCAST_MODE
+    poll_rx_to_resp_tx_dly_uus =
+        uwb_reply_dly_uus(&uwb_default_config, UWB_MSG_BPOLL_LEN, UWB_MSG_BRESP_LEN);
+    resp_rx_to_final_tx_dly_uus =
+        uwb_reply_dly_uus(&uwb_default_config, UWB_MSG_BRESP_LEN, BFINAL_MAX);
+#else
+    poll_rx_to_resp_tx_dly_uus =
+        uwb_reply_dly_uus(&uwb_default_config, UWB_MSG_POLL_LEN, UWB_MSG_RESP_LEN);
+    resp_rx_to_final_tx_dly_uus =
+        uwb_reply_dly_uus(&uwb_default_config, UWB_MSG_RESP_LEN, UWB_MSG_FINAL_LEN);
+#endif
+
+    LOG_INF("Reply delays: RESP %u uus, FINAL %u uus",
+            poll_rx_to_resp_tx_dly_uus, resp_rx_to_final_tx_dly_uus);
+
 #if ROLE_INITIATOR
     LOG_INF("Initiator (Tag) ID=%d",NODE_ID);
+#if NUM_ANCHORS<LOC_DIM+1
+    LOG_WRN("%d anchors: ranges only, a position needs %d",NUM_ANCHORS,LOC_DIM+1);
+#endif
+#if BROADCAST_MODE
+    initiator_bcast_loop();
+#else
     initiator_loop();
+#endif
 #else
     LOG_INF("Responder (Anchor) ID=%d",NODE_ID);
+#if BROADCAST_MODE
+    responder_bcast_loop();
+#else
     responder_loop();
+#endif
 #endif
 
     return 0;
@@ -16,12 +16,12 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "uwb.h"
 
 LOG_MODULE_REGISTER(self_drift, LOG_LEVEL_INF);
 
+#define ANT_DLY 16385
+
 /* Interval between probe packets (must be << 17200 ms to avoid 40-bit rollover) */
 #define INTERVAL_MS     1000
 
@@ -31,52 +31,6 @@ LOG_MODULE_REGISTER(self_drift, LOG_LEVEL_INF);
 /* 40-bit counter mask (rollover safety for consecutive pairs) */
 #define TS_MASK_40BIT    0xFFFFFFFFFFULL
 
-static dwt_config_t uwb_cfg = {
-    .chan           = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC          = DWT_PAC8,
-    .txCode         = 9,
-    .rxCode         = 9,
-    .sfdType        = DWT_SFD_DW_8,
-    .dataRate       = DWT_BR_6M8,
-    .phrMode        = DWT_PHRMODE_STD,
-    .phrRate        = DWT_PHRRATE_STD,
-    .sfdTO          = (129 + 8 - 8),
-    .stsMode        = DWT_STS_MODE_OFF,
-    .stsLength      = DWT_STS_LEN_64,
-    .pdoaMode       = DWT_PDOA_M0,
-};
-
-static int uwb_init(void)
-{
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
-    port_set_dw_ic_spi_slowrate();
-
-    if (dwt_probe((struct dwt_probe_s *)&dw3000_probe_interf) != DWT_SUCCESS) {
-        LOG_ERR("CAN NOT FIND CHIP DRIVER");
-        return -1;
-    }
-
-    port_set_dw_ic_spi_fastrate();
-
-    if (dwt_initialise(DWT_DW_INIT) != DWT_SUCCESS) {
-        LOG_ERR("INITIALISATION FAILED");
-        return -1;
-    }
-
-    if (dwt_configure(&uwb_cfg) != DWT_SUCCESS) {
-        LOG_ERR("RADIO CONFIG FAILED");
-        return -1;
-    }
-
-    dwt_setrxantennadelay(16385);
-    dwt_settxantennadelay(16385);
-
-    return 0;
-}
-
 /* Send one packet and return its 40-bit TX timestamp */
 static uint64_t send_probe(uint8_t seq)
 {
@@ -85,6 +39,7 @@ static uint64_t send_probe(uint8_t seq)
 
     dwt_writetxdata(sizeof(msg), msg, 0);
     dwt_writetxfctrl(sizeof(msg) + FCS_LEN, 0, 0);
+    uwb_sts_reload();
     dwt_starttx(DWT_START_TX_IMMEDIATE);
 
     while (!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK)) {}
@@ -103,7 +58,7 @@ int main(void)
 {
     LOG_INF("self_clock_drift: starting");
 
-    if (uwb_init() != 0) {
+    if (uwb_radio_init(ANT_DLY) != 0) {
         LOG_ERR("UWB STARTUP FAILED");
         return -1;
     }
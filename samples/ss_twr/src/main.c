@@ -1,8 +1,9 @@
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
+#include "uwb.h"
+#include "uwb_timing.h"
+#include "uwb_msg.h"
 #include "port.h"
 
 LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
@@ -10,107 +11,37 @@ LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 #define ROLE_INITIATOR 0
 
 #define ANT_DLY              16385
-#define SPEED_OF_LIGHT       299702547.0
 
 #define RESP_DELAY_UUS       1000
-#define UUS_TO_DWT_TIME      63898
-
-#define MSG_POLL  0x01
-#define MSG_RESP  0x02
-
-static dwt_config_t uwb_cfg = {
-    .chan           = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC          = DWT_PAC8,
-    .txCode         = 9,
-    .rxCode         = 9,
-    .sfdType        = DWT_SFD_DW_8,
-    .dataRate       = DWT_BR_6M8,
-    .phrMode        = DWT_PHRMODE_STD,
-    .phrRate        = DWT_PHRRATE_STD,
-    .sfdTO          = (129 + 8 - 8),
-    .stsMode        = DWT_STS_MODE_OFF,
-    .stsLength      = DWT_STS_LEN_64,
-    .pdoaMode       = DWT_PDOA_M0,
-};
-
-static int uwb_init(void)
-{
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
-    port_set_dw_ic_spi_slowrate();
-
-    if (dwt_probe((struct dwt_probe_s *)&dw3000_probe_interf) != DWT_SUCCESS) {
-        LOG_ERR("dwt_probe failed");
-        return -1;
-    }
-
-    port_set_dw_ic_spi_fastrate();
-
-    if (dwt_initialise(DWT_DW_INIT) != DWT_SUCCESS) {
-        LOG_ERR("dwt_initialise failed");
-        return -1;
-    }
-
-    if (dwt_configure(&uwb_cfg) != DWT_SUCCESS) {
-        LOG_ERR("dwt_configure failed");
-        return -1;
-    }
-
-    dwt_setrxantennadelay(ANT_DLY);
-    dwt_settxantennadelay(ANT_DLY);
-
-    return 0;
-}
-
-static uint64_t read_ts(void (*read_fn)(uint8_t *))
-{
-    uint8_t raw[5];
-    read_fn(raw);
-    uint64_t ts = 0;
-    for (int i = 4; i >= 0; i--) {
-        ts = (ts << 8) | raw[i];
-    }
-    return ts;
-}
 
 #if ROLE_INITIATOR
 static void initiator_loop(void)
 {
     uint8_t seq = 0;
-    uint8_t poll_msg[4] = {0xAB, 0xCD, MSG_POLL, 0};
-    uint8_t resp_buf[32];
+    uint8_t poll_msg[UWB_MSG_POLL_LEN];
+    uint8_t resp_buf[UWB_MSG_MAX];
+    uint16_t resp_len;
+    struct uwb_rx_window win;
 
     LOG_INF("Role: INITIATOR");
 
-    while (1) {
-        poll_msg[3] = seq;
-
-        dwt_writetxdata(sizeof(poll_msg), poll_msg, 0);
-        dwt_writetxfctrl(sizeof(poll_msg) + FCS_LEN, 0, 0);
-        dwt_starttx(DWT_START_TX_IMMEDIATE);
-        while (!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-        dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
-
-        uint64_t t1 = read_ts(dwt_readtxtimestamp);
+    /* the radio turns RX on by itself just before the RESP is due */
+    uwb_rx_window_for_reply(&win, &uwb_default_config, UWB_MSG_POLL_LEN, RESP_DELAY_UUS,
+                            UWB_MSG_RESP_LEN);
+    uwb_rx_window_set(&win);
 
-        dwt_rxenable(DWT_START_RX_IMMEDIATE);
-        uint32_t status;
-        while (!((status = dwt_readsysstatuslo()) &
-                 (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR)));
-
-        if (status & DWT_INT_RXFCG_BIT_MASK) {
-            uint16_t len = dwt_getframelength();
-            dwt_readrxdata(resp_buf, len - FCS_LEN, 0);
+    while (1) {
+        struct uwb_msg_poll poll = { .seq = seq };
+        struct uwb_msg_resp resp;
 
-            uint64_t t4 = read_ts(dwt_readrxtimestamp);
+        uwb_msg_poll_pack(&poll, poll_msg);
 
-            uint64_t t2 = 0, t3 = 0;
-            for (int i = 4; i >= 0; i--) {
-                t2 = (t2 << 8) | resp_buf[4 + i];
-                t3 = (t3 << 8) | resp_buf[9 + i];
-            }
+        if (uwb_tx_rx(poll_msg, sizeof(poll_msg), resp_buf, sizeof(resp_buf), &resp_len) == 0 &&
+            uwb_msg_resp_unpack(&resp, resp_buf, resp_len) == 0) {
+            uint64_t t1 = uwb_get_tx_ts();
+            uint64_t t4 = uwb_get_rx_ts();
+            uint64_t t2 = resp.t2;
+            uint64_t t3 = resp.t3;
 
             double round_trip  = (double)(t4 - t1);
             double reply_time  = (double)(t3 - t2);
@@ -123,8 +54,6 @@ static void initiator_loop(void)
             LOG_WRN("No response received");
         }
 
-        dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR | SYS_STATUS_ALL_RX_TO);
-
         seq++;
         Sleep(500);
     }
@@ -133,54 +62,42 @@ static void initiator_loop(void)
 #else
 static void responder_loop(void)
 {
-    uint8_t rx_buf[32];
+    uint8_t rx_buf[UWB_MSG_MAX];
+    uint16_t rx_len;
 
     LOG_INF("Role: RESPONDER");
 
     while (1) {
-        dwt_rxenable(DWT_START_RX_IMMEDIATE);
-        uint32_t status;
-        while (!((status = dwt_readsysstatuslo()) &
-                 (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR)));
+        struct uwb_msg_poll poll;
 
-        if (status & DWT_INT_RXFCG_BIT_MASK) {
-            uint16_t len = dwt_getframelength();
-            dwt_readrxdata(rx_buf, len - FCS_LEN, 0);
-
-            if (rx_buf[2] != MSG_POLL) {
-                dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR | SYS_STATUS_ALL_RX_TO);
+        if (uwb_rx(rx_buf, sizeof(rx_buf), &rx_len) == 0) {
+            if (uwb_msg_poll_unpack(&poll, rx_buf, rx_len) != 0) {
                 continue;
             }
 
-            uint64_t t2 = read_ts(dwt_readrxtimestamp);
+            uint64_t t2 = uwb_get_rx_ts();
 
             uint32_t resp_tx_time = (t2 + (RESP_DELAY_UUS * UUS_TO_DWT_TIME)) >> 8;
-            dwt_setdelayedtrxtime(resp_tx_time);
 
-            uint64_t t3 = (((uint64_t)(resp_tx_time & 0xFFFFFFFEUL)) << 8) + ANT_DLY;
+            struct uwb_msg_resp resp = {
+                .seq = poll.seq,
+                .t2 = t2,
+                .t3 = (((uint64_t)(resp_tx_time & 0xFFFFFFFEUL)) << 8) + ANT_DLY,
+                .last_mm = UWB_MSG_DIST_NONE,
+            };
+            uint8_t resp_msg[UWB_MSG_RESP_LEN];
 
-            uint8_t resp_msg[14];
-            resp_msg[0] = 0xAB;
-            resp_msg[1] = 0xCD;
-            resp_msg[2] = MSG_RESP;
-            resp_msg[3] = rx_buf[3];
-            for (int i = 0; i < 5; i++) resp_msg[4 + i] = (t2 >> (8 * i)) & 0xFF;
-            for (int i = 0; i < 5; i++) resp_msg[9 + i] = (t3 >> (8 * i)) & 0xFF;
+            uwb_msg_resp_pack(&resp, resp_msg);
 
-            dwt_writetxdata(sizeof(resp_msg), resp_msg, 0);
-            dwt_writetxfctrl(sizeof(resp_msg) + FCS_LEN, 0, 0);
-            if (dwt_starttx(DWT_START_TX_DELAYED) != DWT_SUCCESS) {
+            if (uwb_tx_delayed(resp_msg, sizeof(resp_msg), resp_tx_time) != 0) {
                 LOG_WRN("Delayed TX failed - too late");
+                continue;
             }
-            while (!(dwt_readsysstatuslo() & DWT_INT_TXFRS_BIT_MASK));
-            dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
 
-            LOG_INF("RESP sent  seq=%d", rx_buf[3]);
+            LOG_INF("RESP sent  seq=%d", poll.seq);
         } else {
             LOG_WRN("RX error");
         }
-
-        dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR | SYS_STATUS_ALL_RX_TO);
     }
 }
 #endif
@@ -189,7 +106,7 @@ int main(void)
 {
     LOG_INF("Starting up board");
 
-    if (uwb_init() != 0) {
+    if (uwb_init(ANT_DLY) != 0) {
         LOG_ERR("UWB init failed");
         return -1;
     }
@@ -4,74 +4,242 @@
 #include <zephyr/logging/log.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_msg.h"
+#include "uwb_tdma.h"
 
 LOG_MODULE_REGISTER(tdoa_tag, LOG_LEVEL_INF);
 
 #define TAG_ID 1
 #define ANT_DLY 26194
 
-#define MSG_BLINK 0x20
-
-static dwt_config_t config = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
-    .phrMode = DWT_PHRMODE_STD,
-    .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
-    .pdoaMode = DWT_PDOA_M0,
+/* 0: short blink, TAG_ID is the 16-bit address
+ * 1: long blink with the 64-bit TAG_EUI64, free-running only */
+#define BLINK_LONG 0
+#define TAG_EUI64 (0xDECA000000000000ULL | TAG_ID)
+
+/* 1: blink in the slot the master assigns in SYNC
+ * 0: free-running blinks every BLINK_PERIOD_MS (pure ALOHA) */
+#define TDMA_MODE 1
+
+/* free-running only. 1: the DW3000 goes to SLEEP after each blink and is
+ * woken for the next one. 0: it stays in IDLE between blinks */
+#define SLEEP_MODE 0
+
+#define BLINK_PERIOD_MS 100
+
+/* blinks per wake-to-TX latency report in SLEEP_MODE */
+#define LATENCY_REPORT_EVERY 100
+
+/* the sequence number is the only part of a blink that changes, it
+ * follows the frame control byte */
+#define BLINK_SEQ_OFS 1
+
+#if BLINK_LONG
+#define BLINK_SEQ_LEN 4
+#else
+#define BLINK_SEQ_LEN 2
+#endif
+
+#if TDMA_MODE && SLEEP_MODE
+#error "SLEEP_MODE needs TDMA_MODE 0, the tag cannot hear SYNC while asleep"
+#endif
+
+#if !TDMA_MODE && defined(CONFIG_UWB_PROFILE_STS)
+#error "the STS profile needs TDMA_MODE, the anchors key the STS to the SYNC sequence"
+#endif
+
+#if TDMA_MODE && BLINK_LONG
+#error "BLINK_LONG needs TDMA_MODE 0, the schedule has 16-bit tag ids and short blink slots"
+#endif
+
+/* longer than one superframe, so one lost SYNC does not stall the tag */
+#define SYNC_RX_TIMEOUT_UUS 150000
+
+/* the blink for seq, returns its length */
+static uint16_t blink_pack(uint8_t *buf, uint32_t seq)
+{
+#if BLINK_LONG
+    struct uwb_msg_blink64 b = { .seq = seq, .tag = TAG_EUI64 };
+
+    return uwb_msg_blink64_pack(&b, buf);
+#else
+    struct uwb_msg_blink b = { .seq = seq, .tag = TAG_ID };
+
+    return uwb_msg_blink_pack(&b, buf);
+#endif
+}
+
+#if TDMA_MODE
+
+static void tag_tdma_loop(void)
+{
+    uint8_t tx_buf[UWB_MSG_BLINK_LEN];
+    uint16_t blink_seq = 0;
+    struct uwb_tdma_sched sched;
+    int last_slot = -2;
+    const struct uwb_rx_window sync_win = { .timeout_uus = SYNC_RX_TIMEOUT_UUS };
+
+    while(1)
+    {
+        struct uwb_rx_desc *rx;
+        struct uwb_msg_sync sync;
+
+        uwb_rx_window_set(&sync_win);
+        uwb_rx_submit(DWT_START_RX_IMMEDIATE);
+        uwb_rx_await(&rx, K_FOREVER);
+
+        if(!(rx->status & DWT_INT_RXFCG_BIT_MASK) ||
+           uwb_msg_sync_unpack(&sync, rx->data, rx->len) != 0 ||
+           uwb_tdma_decode(&sched, rx->data, rx->len) != 0)
+        {
+            uwb_rx_release(rx);
+            continue;
+        }
+
+        uint64_t sync_rx = rx->rx_ts;
+        int sts_bad = rx->sts_bad;
+        uwb_rx_release(rx);
+
+        /* the blink is keyed to this superframe, and so is the next SYNC */
+        uwb_sts_set_index(sync.seq);
+
+        if(sts_bad)
+        {
+            LOG_WRN("SYNC %u STS mismatch, resynced", sync.seq);
+            continue;
+        }
+
+        int slot = uwb_tdma_slot_of(&sched, TAG_ID);
+
+        if(slot != last_slot)
+        {
+            if(slot < 0)
+                LOG_WRN("Tag %d not in TDMA schedule, not blinking", TAG_ID);
+            else
+                LOG_INF("TDMA slot %d of %u", slot, sched.n_slots);
+            last_slot = slot;
+        }
+
+        if(slot < 0)
+            continue;
+
+        uint16_t len = blink_pack(tx_buf, blink_seq);
+
+        if(uwb_tx_delayed(tx_buf, len,
+                          uwb_tdma_tx_time(&sched, sync_rx, slot)) != 0)
+        {
+            LOG_WRN("BLINK late, slot %d", slot);
+            continue;
+        }
+
+        blink_seq++;
+    }
+}
+
+#elif SLEEP_MODE
+
+/* host time from the wake pulse to each step, in us */
+struct wake_latency {
+    uint32_t n;
+    uint32_t ready_sum, ready_max;  /* chip back in IDLE_RC, config restored */
+    uint32_t load_sum, load_max;    /* frame in the TX buffer */
+    uint32_t tx_sum, tx_max;        /* TX started */
 };
 
-/* INIT */
+static void latency_add(uint32_t *sum, uint32_t *max, uint32_t us)
+{
+    *sum += us;
+    if(us > *max)
+        *max = us;
+}
 
-static int uwb_init(void)
+static void latency_report(struct wake_latency *lat)
 {
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
+    LOG_INF("wake-to-TX avg %u max %u us (ready %u/%u, load %u/%u) over %u blinks",
+            lat->tx_sum / lat->n, lat->tx_max,
+            lat->ready_sum / lat->n, lat->ready_max,
+            lat->load_sum / lat->n, lat->load_max, lat->n);
 
-    port_set_dw_ic_spi_slowrate();
+    *lat = (struct wake_latency){0};
+}
 
-    if(dwt_probe((struct dwt_probe_s*)&dw3000_probe_interf)!=DWT_SUCCESS)
-        return -1;
+static void tag_sleep_loop(void)
+{
+    /* built once; the radio loses its TX buffer in SLEEP, so the whole
+     * frame goes out in one write after each wake */
+    uint8_t tx_buf[UWB_MSG_BLINK64_LEN];
+    uint32_t blink_seq = 0;
+    uint16_t len = blink_pack(tx_buf, blink_seq);
+    struct wake_latency lat = {0};
+    int64_t next = k_uptime_ticks();
 
-    port_set_dw_ic_spi_fastrate();
+    uwb_sleep_config();
 
-    if(dwt_initialise(DWT_DW_INIT)!=DWT_SUCCESS)
-        return -1;
+    /* first blink goes out from IDLE and puts the chip to sleep */
+    dwt_writetxdata(len, tx_buf, 0);
+    dwt_writetxfctrl(len + FCS_LEN, 0, 0);
+    uwb_sts_reload();
+    dwt_starttx(DWT_START_TX_IMMEDIATE);
 
-    if(dwt_configure(&config)!=DWT_SUCCESS)
-        return -1;
+    while(1)
+    {
+        next += k_ms_to_ticks_ceil64(BLINK_PERIOD_MS);
+        k_sleep(K_TIMEOUT_ABS_TICKS(next));
 
-    dwt_settxantennadelay(ANT_DLY);
+        uint32_t t0 = k_cycle_get_32();
 
-    return 0;
+        if(uwb_wakeup() != 0)
+        {
+            LOG_WRN("DW3000 did not wake up");
+            continue;
+        }
+
+        uint32_t t1 = k_cycle_get_32();
+
+        blink_pack(tx_buf, ++blink_seq);
+        dwt_writetxdata(len, tx_buf, 0);
+        dwt_writetxfctrl(len + FCS_LEN, 0, 0);
+
+        uwb_sts_reload();
+
+        uint32_t t2 = k_cycle_get_32();
+
+        /* no TX done wait: the chip sleeps again as soon as the frame
+         * is out, and polling its status would wake it */
+        dwt_starttx(DWT_START_TX_IMMEDIATE);
+
+        uint32_t t3 = k_cycle_get_32();
+
+        latency_add(&lat.ready_sum, &lat.ready_max, k_cyc_to_us_floor32(t1 - t0));
+        latency_add(&lat.load_sum, &lat.load_max, k_cyc_to_us_floor32(t2 - t1));
+        latency_add(&lat.tx_sum, &lat.tx_max, k_cyc_to_us_floor32(t3 - t0));
+
+        if(++lat.n == LATENCY_REPORT_EVERY)
+            latency_report(&lat);
+    }
 }
 
-/* BLINK LOOP */
+#else
 
 static void tag_loop(void)
 {
-    uint8_t tx_buf[2];
-    static uint8_t blink_seq = 0;
+    uint8_t tx_buf[UWB_MSG_BLINK64_LEN];
+    uint32_t blink_seq = 0;
+    uint16_t len = blink_pack(tx_buf, blink_seq);
+
+    /* the frame stays in the TX buffer while the chip is IDLE, later
+     * blinks only rewrite the sequence field */
+    dwt_writetxdata(len, tx_buf, 0);
+    dwt_writetxfctrl(len + FCS_LEN, 0, 0);
 
     while(1)
     {
-        tx_buf[0] = MSG_BLINK;
-        tx_buf[1] = blink_seq++;   // ✅ sequence number
-
-        dwt_writetxdata(2, tx_buf, 0);
-        dwt_writetxfctrl(2 + FCS_LEN, 0, 0);
+        blink_pack(tx_buf, blink_seq);
+        dwt_writetxdata(BLINK_SEQ_LEN, &tx_buf[BLINK_SEQ_OFS], BLINK_SEQ_OFS);
 
+        uwb_sts_reload();
         dwt_starttx(DWT_START_TX_IMMEDIATE);
 
         while(!(dwt_readsysstatuslo() &
@@ -79,23 +247,41 @@ static void tag_loop(void)
 
         dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
 
-        LOG_INF("BLINK sent seq=%d", tx_buf[1]);
+        LOG_INF("BLINK sent seq=%u", blink_seq);
+
+        blink_seq++;
 
-        k_msleep(100);  // 10 Hz
+        k_msleep(BLINK_PERIOD_MS);
     }
 }
 
+#endif
+
 int main(void)
 {
     LOG_INF("TDOA Tag Start");
 
-    if(uwb_init()!=0)
+#if TDMA_MODE
+    if(uwb_init(ANT_DLY)!=0)
+    {
+        LOG_ERR("Init failed");
+        return -1;
+    }
+
+    tag_tdma_loop();
+#else
+    if(uwb_radio_init(ANT_DLY)!=0)
     {
         LOG_ERR("Init failed");
         return -1;
     }
 
+#if SLEEP_MODE
+    tag_sleep_loop();
+#else
     tag_loop();
+#endif
+#endif
 
     return 0;
 }
\ No newline at end of file
@@ -4,173 +4,188 @@
 #include <zephyr/logging/log.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_clock.h"
+#include "uwb_dedup.h"
+#include "uwb_hub.h"
+#include "uwb_msg.h"
+#include "uwb_tdma.h"
 
 LOG_MODULE_REGISTER(tdoa_slave, LOG_LEVEL_INF);
 
 #define NODE_ID 2
 #define ANT_DLY 26194
-#define MSG_SYNC 0x10
-#define MSG_BLINK 0x20
-
-#define MASK40 0xFFFFFFFFFFULL
-#define HALF40 (1LL<<39)
-#define FULL40 (1LL<<40)
-
-static dwt_config_t config = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
-    .phrMode = DWT_PHRMODE_STD,
-    .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
-    .pdoaMode = DWT_PDOA_M0,
-};
-
-/* RX timestamp */
-
-static uint64_t get_rx_ts(void)
-{
-    uint8_t ts[5];
-    dwt_readrxtimestamp(ts);
-
-    uint64_t val = 0;
 
-    for(int i=4;i>=0;i--)
-        val = (val<<8) | ts[i];
+/* a repeat of a (tag, seq) blink within this window is dropped */
+#define DEDUP_WINDOW_MS 1000
 
-    return val;
-}
+/* 1: forward blinks to the master in this anchor's report slot
+ * 0: log them locally only */
+#define HUB_MODE 1
 
-/* INIT */
+#if HUB_MODE
 
-static int uwb_init(void)
+/* time since a SYNC was received, from the radio clock */
+static uint32_t since_sync_us(uint64_t sync_rx)
 {
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
-
-    port_set_dw_ic_spi_slowrate();
-
-    if(dwt_probe((struct dwt_probe_s*)&dw3000_probe_interf)!=DWT_SUCCESS)
-        return -1;
+    uint32_t dt = dwt_readsystimestamphi32() - (uint32_t)(sync_rx >> 8);
 
-    port_set_dw_ic_spi_fastrate();
+    return ((uint64_t)dt << 8) / UUS_TO_DWT_TIME;
+}
 
-    if(dwt_initialise(DWT_DW_INIT)!=DWT_SUCCESS)
-        return -1;
+/* leave anchor RX for one delayed TX of the report, then listen again */
+static void hub_send_report(const struct uwb_tdma_sched *sched, uint64_t sync_rx,
+                            int slot, const struct uwb_hub_report *report)
+{
+    uint8_t frame[UWB_HUB_REPORT_LEN(UWB_HUB_MAX_RECS)];
+    int len = uwb_hub_encode(report, frame, sizeof(frame));
 
-    if(dwt_configure(&config)!=DWT_SUCCESS)
-        return -1;
+    uwb_rx_continuous_stop();
 
-    dwt_settxantennadelay(ANT_DLY);
-    dwt_setrxantennadelay(ANT_DLY);
+    if(len > 0 && uwb_tx_submit(frame, len, DWT_START_TX_DELAYED,
+                                uwb_tdma_report_tx_time(sched, sync_rx, slot)) == 0)
+        uwb_tx_await(NULL, K_MSEC(10));
+    else
+        LOG_WRN("REPORT %u late", report->sync_seq);
 
-    return 0;
+    if(uwb_rx_continuous_start() != 0)
+        LOG_ERR("continuous RX start failed");
 }
-/* Time stamp converter for message receiving*/
-/* Convert local DW time → master time */
-static uint64_t local_to_master(uint64_t local,
-                               int64_t offset,
-                               double drift)
-{
-    double corrected =
-        ((double)local - (double)offset) / drift;
 
-    return ((uint64_t)corrected) & MASK40;
-}
+#endif
+
 /* SYNC RECEIVER */
 static void slave_loop(void)
 {
-    uint8_t rx_buf[32];
+    /* each SYNC carries its own TX time, so the clock locks on the
+     * first one */
+    struct uwb_clock clk;
+    static struct uwb_dedup seen;
+
+    uwb_clock_init(&clk, &uwb_clock_default_cfg);
+    uwb_dedup_init(&seen, DEDUP_WINDOW_MS);
 
-    uint64_t prev_tx = 0;
-    uint64_t prev_rx = 0;
+    uint32_t lost = 0;
 
-    int64_t offset = 0;
-    double drift = 1.0;
+#if HUB_MODE
+    struct uwb_tdma_sched sched;
+    struct uwb_hub_report report;
+    uint64_t sync_rx = 0;
+    int report_slot = -1;
+    int64_t report_due = 0;
+    uint32_t long_tags = 0;
+#endif
+
+    /* double-buffered: the radio keeps listening while a frame is parsed */
+    if(uwb_rx_continuous_start() != 0)
+        LOG_ERR("continuous RX start failed");
 
     while(1)
     {
-        dwt_rxenable(DWT_START_RX_IMMEDIATE);
+        struct uwb_rx_desc *rx;
+        k_timeout_t timeout = K_FOREVER;
 
-        uint32_t status;
+#if HUB_MODE
+        /* the tag slots are over */
+        if(report_slot >= 0 && k_uptime_ticks() >= report_due)
+        {
+            hub_send_report(&sched, sync_rx, report_slot, &report);
+            report_slot = -1;
+        }
 
-        while(!((status=dwt_readsysstatuslo()) &
-              (DWT_INT_RXFCG_BIT_MASK |
-               SYS_STATUS_ALL_RX_ERR)));
+        if(report_slot >= 0)
+            timeout = K_TIMEOUT_ABS_TICKS(report_due);
+#endif
 
-        if(!(status & DWT_INT_RXFCG_BIT_MASK))
-        {
-            dwt_writesysstatuslo(
-                DWT_INT_RXFCG_BIT_MASK |
-                SYS_STATUS_ALL_RX_ERR);
+        if(uwb_rx_await(&rx, timeout) != 0)
             continue;
+
+        struct uwb_async_stats st;
+        uwb_async_get_stats(&st);
+        if(st.rx_overrun + st.rx_dropped != lost)
+        {
+            lost = st.rx_overrun + st.rx_dropped;
+            LOG_WRN("RX lost: overrun %u, ring full %u",
+                    st.rx_overrun, st.rx_dropped);
         }
 
-        uint16_t len = dwt_getframelength();
-        dwt_readrxdata(rx_buf,len-FCS_LEN,0);
+        if(!(rx->status & DWT_INT_RXFCG_BIT_MASK))
+        {
+            uwb_rx_release(rx);
+            continue;
+        }
 
-        uint64_t rx_time = get_rx_ts();
+        const uint8_t *rx_buf = rx->data;
+        uint64_t rx_time = rx->rx_ts;
+        struct uwb_msg_blink_id blink;
+        struct uwb_msg_sync sync;
 
         /* BLINK */
 
-        if(rx_buf[0]==MSG_BLINK)
+        if(!rx->sts_bad && uwb_msg_blink_id_unpack(&blink, rx_buf, rx->len)==0)
         {
-            if(prev_tx == 0)
+            if(!clk.valid)
             {
                 LOG_WRN("BLINK ignored: sync not ready");
             }
-            else
+            else if(uwb_dedup_check(&seen, blink.tag, blink.seq, k_uptime_get_32())==0)
             {
                 uint64_t master_time =
-                    local_to_master(rx_time, offset, drift);
+                    uwb_clock_to_master(&clk, rx_time);
 
-                LOG_INF("BLINK,%llu,%llu",
+                LOG_INF("BLINK,%llx,%u,%llu,%llu",
+                        blink.tag,
+                        blink.seq,
                         rx_time,
                         master_time);
+
+#if HUB_MODE
+                int slot = (report_slot >= 0) ? uwb_tdma_slot_at(&sched, sync_rx, rx_time) : -1;
+
+                /* the schedule and REPORT records carry 16-bit tags, a
+                 * long blink can only be logged here */
+                if(blink.tag > UINT16_MAX)
+                {
+                    if((long_tags++ % 100) == 0)
+                        LOG_WRN("BLINK %llx not reported, 16-bit tags only (%u so far)",
+                                blink.tag, long_tags);
+                }
+                /* only the tag scheduled in the slot */
+                else if(slot >= 0 && sched.tags[slot] != 0 && sched.tags[slot] == blink.tag)
+                    uwb_hub_report_add(&report, blink.tag, blink.seq, master_time);
+#endif
             }
         }
 
         /* SYNC */
 
-        if(rx_buf[0]==MSG_SYNC)
+        if(uwb_msg_sync_unpack(&sync, rx_buf, rx->len)==0)
         {
-            uint8_t seq = rx_buf[1];
-
-            uint64_t tx_time = 0;
-
-            for(int i=0;i<5;i++)
-                tx_time |= ((uint64_t)rx_buf[3+i])<<(8*i);
+            uint8_t seq = sync.seq;
+            uint64_t tx_time = sync.tx_ts;
 
-            int64_t diff = (int64_t)((rx_time - tx_time) & MASK40);
+            /* the blinks and reports after it are keyed to its sequence */
+            uwb_sts_set_index(sync.seq);
 
-            if(diff > HALF40)
-                diff -= FULL40;
-
-            offset = diff;
-
-            if(prev_tx != 0)
+            if(rx->sts_bad)
             {
-                uint64_t master_dt = (tx_time - prev_tx) & MASK40;
-                uint64_t slave_dt  = (rx_time - prev_rx) & MASK40;
-
-                if(slave_dt != 0)
-                    drift = (double)master_dt / (double)slave_dt;
+                LOG_WRN("SYNC %u STS mismatch, resynced", seq);
+                uwb_rx_release(rx);
+                continue;
             }
 
-            double corrected =
-                ((double)rx_time - (double)offset) / drift;
+            if(uwb_clock_sync(&clk, rx_time, tx_time) == 0)
+                uwb_clock_skew(&clk, uwb_clock_ci_to_ppm(rx->carrier_integrator),
+                               UWB_CLOCK_CI_SIGMA_PPM);
+            else
+                LOG_WRN("SYNC %u rejected", seq);
+
+            int64_t offset = uwb_clock_offset(&clk);
+            double drift = uwb_clock_ratio(&clk);
+            uint64_t corrected = uwb_clock_to_master(&clk, rx_time);
 
-            LOG_INF("SYNC,%u,%llu,%llu,%lld,%.9f,%.0f",
+            LOG_INF("SYNC,%u,%llu,%llu,%lld,%.9f,%llu",
                     seq,
                     tx_time,
                     rx_time,
@@ -178,13 +193,24 @@ static void slave_loop(void)
                     drift,
                     corrected);
 
-            prev_tx = tx_time;
-            prev_rx = rx_time;
+#if HUB_MODE
+            report_slot = -1;
+
+            if(uwb_tdma_decode(&sched, rx_buf, rx->len) == 0 &&
+               (report_slot = uwb_tdma_report_of(&sched, NODE_ID)) >= 0)
+            {
+                /* wake with a turnaround to spare before the report slot */
+                int32_t wait_us = uwb_tdma_report_ofs_uus(&sched, report_slot) -
+                                  UWB_HOST_TURNAROUND_US - since_sync_us(rx_time);
+
+                report_due = k_uptime_ticks() + k_us_to_ticks_floor64(MAX(wait_us, 0));
+                sync_rx = rx_time;
+                uwb_hub_report_begin(&report, NODE_ID, seq);
+            }
+#endif
         }
 
-        dwt_writesysstatuslo(
-            DWT_INT_RXFCG_BIT_MASK |
-            SYS_STATUS_ALL_RX_ERR);
+        uwb_rx_release(rx);
     }
 }
 
@@ -192,7 +218,7 @@ int main(void)
 {
     LOG_INF("TDOA Slave Anchor Start");
 
-    if(uwb_init()!=0)
+    if(uwb_init(ANT_DLY)!=0)
     {
         LOG_ERR("Init failed");
         return -1;
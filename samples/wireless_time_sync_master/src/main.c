@@ -4,36 +4,30 @@
 #include <zephyr/logging/log.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_hub.h"
+#include "uwb_msg.h"
+#include "uwb_tdma.h"
+#include "uwb_ts.h"
+#include "loc_tdoa.h"
 
 LOG_MODULE_REGISTER(tdoa_master, LOG_LEVEL_INF);
 
 #define NODE_ID 1
 #define ANT_DLY 26194
 
-#define MSG_SYNC 0x10
 #define SYNC_PERIOD_MS 100
-#define UUS_TO_DWT_TIME 63898
-
-
-static dwt_config_t config = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
-    .phrMode = DWT_PHRMODE_STD,
-    .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
-    .pdoaMode = DWT_PDOA_M0,
-};
 
+/* TDMA: tag ids in slot order, announced in every SYNC */
+static const uint16_t tdma_tags[] = {1, 2, 3, 4};
+
+/* 1: slave anchors report their blinks in the superframe and the master
+ *    prints one TDOA line per blink with every anchor's timestamp
+ * 0: SYNC only, each slave exports its own blinks */
+#define HUB_MODE 1
+
+#if !HUB_MODE
 
 static uint64_t get_tx_ts(void)
 {
@@ -48,34 +42,17 @@ static uint64_t get_tx_ts(void)
     return val;
 }
 
-static int uwb_init(void)
+static void master_sync_loop(void)
 {
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
+    uint8_t sync_msg[UWB_TDMA_HDR_OFS + UWB_TDMA_HDR_LEN + UWB_TDMA_MAX_SLOTS * UWB_TDMA_TAG_LEN];
+    struct uwb_tdma_sched sched;
 
-    port_set_dw_ic_spi_slowrate();
+    uwb_tdma_init(&sched, tdma_tags, ARRAY_SIZE(tdma_tags), UWB_MSG_BLINK_LEN);
 
-    if(dwt_probe((struct dwt_probe_s*)&dw3000_probe_interf)!=DWT_SUCCESS)
-        return -1;
+    int sync_len = uwb_tdma_encode(&sched, sync_msg, sizeof(sync_msg));
 
-    port_set_dw_ic_spi_fastrate();
-
-    if(dwt_initialise(DWT_DW_INIT)!=DWT_SUCCESS)
-        return -1;
-
-    if(dwt_configure(&config)!=DWT_SUCCESS)
-        return -1;
-
-    dwt_settxantennadelay(ANT_DLY);
-    dwt_setrxantennadelay(ANT_DLY);
-
-    return 0;
-}
-
-static void master_sync_loop(void)
-{
-    uint8_t sync_msg[16];
+    LOG_INF("TDMA: %u slots of %u uus, first at %u uus",
+            sched.n_slots, sched.slot_uus, sched.first_slot_uus);
 
     uint16_t seq = 0;
 
@@ -90,21 +67,24 @@ static void master_sync_loop(void)
     for(int i=4;i>=0;i--)
         now = (now<<8) | ts[i];
 
-    next_tx_time = now + (SYNC_PERIOD_MS * 1000 * UUS_TO_DWT_TIME);
+    next_tx_time = now + ((uint64_t)SYNC_PERIOD_MS * 1000 * UUS_TO_DWT_TIME);
 
     while(1)
     {
-        sync_msg[0] = MSG_SYNC;
-        sync_msg[1] = seq;
-        sync_msg[2] = NODE_ID;
+        uint32_t dly = next_tx_time >> 8;
+        struct uwb_msg_sync sync = {
+            .seq = seq,
+            .node = NODE_ID,
+            .tx_ts = uwb_delayed_tx_ts(dly, ANT_DLY),
+        };
 
-        for(int i=0;i<5;i++)
-            sync_msg[3+i] = (last_tx_time>>(8*i));
+        uwb_msg_sync_pack(&sync, sync_msg);
 
-        dwt_writetxdata(8, sync_msg, 0);
-        dwt_writetxfctrl(8+FCS_LEN,0,0);
+        dwt_writetxdata(sync_len, sync_msg, 0);
+        dwt_writetxfctrl(sync_len+FCS_LEN,0,0);
 
-        dwt_setdelayedtrxtime(next_tx_time >> 8);
+        dwt_setdelayedtrxtime(dly);
+        uwb_sts_set_index(UWB_TDMA_SYNC_STS_INDEX(seq));
         dwt_starttx(DWT_START_TX_DELAYED);
 
         while(!(dwt_readsysstatuslo() &
@@ -114,26 +94,234 @@ static void master_sync_loop(void)
 
         last_tx_time = get_tx_ts();
 
+        if(last_tx_time != sync.tx_ts)
+            LOG_WRN("SYNC %u sent at %llu, announced %llu", seq, last_tx_time, sync.tx_ts);
+
+        LOG_INF("MASTER,%u,%llu", seq, last_tx_time);
+
+        next_tx_time += ((uint64_t)SYNC_PERIOD_MS * 1000 * UUS_TO_DWT_TIME);
+
+        seq++;
+    }
+}
+
+#else
+
+/* slave anchors, in report slot order */
+static const uint8_t hub_anchors[] = {2, 3, 4};
+
+/* anchor positions in meters, for the fix computed on the master */
+#define LOC_DIM 2
+
+static const struct {
+    uint8_t id;
+    float   pos[3];
+} hub_pos[] = {
+    {1, {0.0f, 0.0f, 0.0f}},
+    {2, {5.0f, 0.0f, 0.0f}},
+    {3, {5.0f, 4.0f, 0.0f}},
+    {4, {0.0f, 4.0f, 0.0f}},
+};
+
+/* POS,tag,blink_seq,x,y,z,rms,solve_us from the anchors with a known
+ * position, the first of them is the TDoA reference */
+static void hub_locate(const struct uwb_hub_blink *b)
+{
+    static struct loc_tdoa_ws ws;
+    float anchors[LOC_MAX_ANCHORS][3];
+    float d[LOC_MAX_ANCHORS];
+    uint64_t ref_ts = 0;
+    int n = 0;
+
+    for(int k = 0; k < b->n; k++)
+    {
+        for(int j = 0; j < (int)ARRAY_SIZE(hub_pos); j++)
+        {
+            if(hub_pos[j].id != b->anchors[k])
+                continue;
+
+            if(n == 0)
+                ref_ts = b->ts[k];
+
+            memcpy(anchors[n], hub_pos[j].pos, sizeof(anchors[n]));
+            d[n] = loc_ticks_to_m_q16(uwb_ts_sub(b->ts[k], ref_ts)) / 65536.0f;
+            n++;
+        }
+    }
+
+    if(n < LOC_DIM + 1)
+        return;
+
+    struct loc_fix fix;
+    uint32_t t0 = k_cycle_get_32();
+    int ret = loc_tdoa_solve(&ws, LOC_DIM, n, anchors, d, &fix);
+    uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - t0);
+
+    if(ret != 0)
+        return;
+
+    LOG_INF("POS,%u,%u,%.3f,%.3f,%.3f,%.3f,%u",
+            b->tag, b->seq, (double)fix.p[0], (double)fix.p[1], (double)fix.p[2],
+            (double)fix.rms, us);
+}
+
+/* TDOA,sync_seq,tag,blink_seq,n,anchor:ts,... with ts in master time */
+static void hub_export(const struct uwb_hub *hub)
+{
+    char line[200];
+
+    for(int i = 0; i < hub->n_blinks; i++)
+    {
+        const struct uwb_hub_blink *b = &hub->blinks[i];
+
+        int len = snprintk(line, sizeof(line), "TDOA,%u,%u,%u,%u",
+                           hub->sync_seq, b->tag, b->seq, b->n);
+
+        for(int k = 0; k < b->n && len < (int)sizeof(line); k++)
+            len += snprintk(&line[len], sizeof(line) - len, ",%u:%llu",
+                            b->anchors[k], b->ts[k]);
+
+        LOG_INF("%s", line);
+
+        hub_locate(b);
+    }
+}
+
+static void master_hub_loop(void)
+{
+    uint8_t sync_msg[UWB_TDMA_SYNC_MAX];
+    struct uwb_tdma_sched sched;
+    struct uwb_hub_report report;
+    static struct uwb_hub hub;
+
+    uwb_tdma_init(&sched, tdma_tags, ARRAY_SIZE(tdma_tags), UWB_MSG_BLINK_LEN);
+    uwb_tdma_set_reports(&sched, hub_anchors, ARRAY_SIZE(hub_anchors),
+                         UWB_HUB_REPORT_LEN(MIN(sched.n_slots, UWB_HUB_MAX_RECS)));
+
+    int sync_len = uwb_tdma_encode(&sched, sync_msg, sizeof(sync_msg));
+
+    LOG_INF("TDMA: %u slots of %u uus, first at %u uus",
+            sched.n_slots, sched.slot_uus, sched.first_slot_uus);
+    LOG_INF("HUB: %u reports of %u uus, first at %u uus",
+            sched.n_anchors, sched.report_uus, sched.report_ofs_uus);
+
+    uint16_t seq = 0;
+    uint64_t last_tx_time = 0;
+    uint64_t next_tx_time = (uint64_t)dwt_readsystimestamphi32() << 8;
+
+    memset(&hub.stats, 0, sizeof(hub.stats));
+
+    while(1)
+    {
+        struct uwb_tx_desc tx;
+
+        next_tx_time += ((uint64_t)SYNC_PERIOD_MS * 1000 * UUS_TO_DWT_TIME);
+
+        uint32_t dly = next_tx_time >> 8;
+        struct uwb_msg_sync sync = {
+            .seq = seq,
+            .node = NODE_ID,
+            .tx_ts = uwb_delayed_tx_ts(dly, ANT_DLY),
+        };
+
+        uwb_msg_sync_pack(&sync, sync_msg);
+        uwb_sts_set_index(UWB_TDMA_SYNC_STS_INDEX(seq));
+
+        if(uwb_tx_submit(sync_msg, sync_len, DWT_START_TX_DELAYED, dly) != 0 ||
+           uwb_tx_await(&tx, K_MSEC(SYNC_PERIOD_MS)) != 0)
+        {
+            /* fell behind, restart the period from now */
+            LOG_WRN("SYNC %u late", seq);
+            next_tx_time = (uint64_t)dwt_readsystimestamphi32() << 8;
+            continue;
+        }
+
+        last_tx_time = tx.tx_ts;
+
+        if(last_tx_time != sync.tx_ts)
+            LOG_WRN("SYNC %u sent at %llu, announced %llu", seq, last_tx_time, sync.tx_ts);
+
+        /* listen through the tag and report slots */
+        int64_t end = k_uptime_ticks() +
+                      k_us_to_ticks_ceil64(uwb_tdma_end_uus(&sched) + UWB_HOST_TURNAROUND_US);
+
+        uwb_hub_begin(&hub, seq);
+        uwb_sts_set_index(seq);
+        uwb_rx_continuous_start();
+
+        struct uwb_rx_desc *rx;
+        struct uwb_msg_blink blink;
+
+        while(uwb_rx_await(&rx, K_TIMEOUT_ABS_TICKS(end)) == 0)
+        {
+            /* keyed to another superframe, e.g. replayed */
+            if(rx->sts_bad)
+            {
+                uwb_rx_release(rx);
+                continue;
+            }
+
+            if(uwb_msg_blink_unpack(&blink, rx->data, rx->len) == 0)
+            {
+                int slot = uwb_tdma_slot_at(&sched, last_tx_time, rx->rx_ts);
+
+                /* only the tag scheduled in that slot */
+                if(slot >= 0 && sched.tags[slot] != 0 && sched.tags[slot] == blink.tag)
+                {
+                    struct uwb_hub_rec rec = {
+                        .tag = blink.tag,
+                        .seq = blink.seq,
+                        .ts = rx->rx_ts,
+                    };
+
+                    uwb_hub_add(&hub, NODE_ID, &rec);
+                }
+            }
+            else if(uwb_hub_decode(&report, rx->data, rx->len) == 0)
+            {
+                uwb_hub_add_report(&hub, &report);
+            }
+
+            uwb_rx_release(rx);
+        }
+
+        uwb_rx_continuous_stop();
+
+        hub_export(&hub);
 
         LOG_INF("MASTER,%u,%llu", seq, last_tx_time);
 
-        next_tx_time += (SYNC_PERIOD_MS * 1000 * UUS_TO_DWT_TIME);
+        if((seq % 100) == 0 && (hub.stats.stale || hub.stats.dup || hub.stats.overflow))
+            LOG_WRN("HUB: reports %u, stale %u, dup %u, overflow %u",
+                    hub.stats.reports, hub.stats.stale, hub.stats.dup, hub.stats.overflow);
 
         seq++;
     }
 }
 
+#endif
+
 int main(void)
 {
     LOG_INF("TDOA Master Anchor Start");
 
-    if(uwb_init()!=0)
+#if HUB_MODE
+    if(uwb_init(ANT_DLY)!=0)
+    {
+        LOG_ERR("Init failed");
+        return -1;
+    }
+
+    master_hub_loop();
+#else
+    if(uwb_radio_init(ANT_DLY)!=0)
     {
         LOG_ERR("Init failed");
         return -1;
     }
 
     master_sync_loop();
+#endif
 
     return 0;
 }
\ No newline at end of file
@@ -2,112 +2,86 @@
 #include <zephyr/logging/log.h>
 
 #include "deca_device_api.h"
-#include "deca_probe_interface.h"
-#include "dw3000_hw.h"
-#include "port.h"
+#include "dw3000_spi.h"
+#include "uwb.h"
+#include "uwb_msg.h"
 
 LOG_MODULE_REGISTER(tdoa_slave, LOG_LEVEL_INF);
 
 #define NODE_ID 2
 #define ANT_DLY 26194
-#define MSG_SYNC 0x10
 
 #define MASK40 0xFFFFFFFFFFULL
 #define HALF40 (1LL<<39)
 #define FULL40 (1LL<<40)
 
-static dwt_config_t config = {
-    .chan = 9,
-    .txPreambLength = DWT_PLEN_128,
-    .rxPAC = DWT_PAC8,
-    .txCode = 9,
-    .rxCode = 9,
-    .sfdType = DWT_SFD_DW_8,
-    .dataRate = DWT_BR_6M8,
-    .phrMode = DWT_PHRMODE_STD,
-    .phrRate = DWT_PHRRATE_STD,
-    .sfdTO = (129 + 8 - 8),
-    .stsMode = DWT_STS_MODE_OFF,
-    .stsLength = DWT_STS_LEN_64,
-    .pdoaMode = DWT_PDOA_M0,
-};
-
-
-static uint64_t get_rx_ts(void)
-{
-    uint8_t ts[5];
-    dwt_readrxtimestamp(ts);
-
-    uint64_t val = 0;
+/* SYNC frames between SPI cost reports, with CONFIG_DW3000_SPI_STATS */
+#define SPI_STATS_EVERY 100
 
-    for(int i=4;i>=0;i--)
-        val = (val<<8) | ts[i];
-
-    return val;
-}
-
-
-static int uwb_init(void)
+/* the master keys each SYNC to the previous one's sequence
+ * (UWB_TDMA_SYNC_STS_INDEX), so load this one's for the next. returns 0
+ * if its STS did not match and the timestamp is not to be used. */
+static int sync_sts_check(const struct uwb_msg_sync *sync)
 {
-    dw_device_init();
-    dw3000_hw_wakeup_pin_low();
-    Sleep(5);
-
-    port_set_dw_ic_spi_slowrate();
-
-    if(dwt_probe((struct dwt_probe_s*)&dw3000_probe_interf)!=DWT_SUCCESS)
-        return -1;
-
-    port_set_dw_ic_spi_fastrate();
-
-    if(dwt_initialise(DWT_DW_INIT)!=DWT_SUCCESS)
-        return -1;
-
-    if(dwt_configure(&config)!=DWT_SUCCESS)
-        return -1;
+    int ok = uwb_sts_ok();
 
-    dwt_settxantennadelay(ANT_DLY);
-    dwt_setrxantennadelay(ANT_DLY);
+    uwb_sts_set_index(sync->seq);
+    if(!ok)
+        LOG_WRN("SYNC %u STS mismatch, resynced", sync->seq);
 
-    return 0;
+    return ok;
 }
 
 
 static void slave_loop(void)
 {
-    uint8_t rx_buf[32];
+    uint8_t rx_buf[UWB_MSG_MAX];
 
     uint64_t prev_tx = 0;
     uint64_t prev_rx = 0;
 
     double drift = 1.0;
+#if defined(CONFIG_DW3000_SPI_STATS)
+    uint32_t n_sync = 0;
+#endif
 
     while(1)
     {
+        uwb_sts_reload();
         dwt_rxenable(DWT_START_RX_IMMEDIATE);
 
+        /* spin on the 4-byte status only; once RXFCG is up, length and
+         * timestamp come in one SPI batch and only the frame is left */
+        struct uwb_rx_info info;
         uint32_t status;
 
-        while(!((status=dwt_readsysstatuslo()) &
-              (DWT_INT_RXFCG_BIT_MASK |
-               SYS_STATUS_ALL_RX_ERR)));
+        while(!((status = dwt_readsysstatuslo()) &
+                (DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR)));
 
-        if(!(status & DWT_INT_RXFCG_BIT_MASK))
+        if(!(status & DWT_INT_RXFCG_BIT_MASK) || uwb_rx_info_read(&info) != 0)
+        {
+            dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR);
             continue;
+        }
+
+        uint16_t len = info.len;
+        if(len < FCS_LEN || len - FCS_LEN > (int)sizeof(rx_buf))
+        {
+            dwt_writesysstatuslo(DWT_INT_RXFCG_BIT_MASK | SYS_STATUS_ALL_RX_ERR);
+            continue;
+        }
 
-        uint16_t len = dwt_getframelength();
         dwt_readrxdata(rx_buf,len-FCS_LEN,0);
 
-        if(rx_buf[0]==MSG_SYNC)
-        {
-            uint8_t seq = rx_buf[1];
+        struct uwb_msg_sync sync;
 
-            uint64_t rx_time = get_rx_ts();
+        if(uwb_msg_sync_unpack(&sync,rx_buf,len-FCS_LEN)==0 && sync_sts_check(&sync))
+        {
+            uint8_t seq = sync.seq;
 
-            uint64_t tx_time = 0;
+            uint64_t rx_time = info.rx_ts;
 
-            for(int i=0;i<5;i++)
-                tx_time |= ((uint64_t)rx_buf[3+i])<<(8*i);
+            uint64_t tx_time = sync.tx_ts;
 
             int64_t diff = (int64_t)((rx_time - tx_time) & MASK40);
 
@@ -138,6 +112,15 @@ static void slave_loop(void)
 
             prev_tx = tx_time;
             prev_rx = rx_time;
+
+#if defined(CONFIG_DW3000_SPI_STATS)
+            if(++n_sync == SPI_STATS_EVERY)
+            {
+                dw3000_spi_stats_log();
+                dw3000_spi_stats_reset();
+                n_sync = 0;
+            }
+#endif
         }
 
         dwt_writesysstatuslo(
@@ -150,7 +133,7 @@ int main(void)
 {
     LOG_INF("TDOA Slave Anchor Start");
 
-    if(uwb_init()!=0)
+    if(uwb_radio_init(ANT_DLY)!=0)
     {
         LOG_ERR("Init failed");
         return -1;
@@ -0,0 +1,261 @@
+#!/usr/bin/env python3
+"""
+UWB Message Decoder Generator
+
+Reads the frame tables in lib/uwb/uwb_msg.h (UWB_MSG_TABLE,
+UWB_MSG_REC_TABLE, UWB_MSG_TAIL_TABLE and the UWB_MSG_*_F field lists)
+and writes scripts/uwb_msg.py, so the host scripts decode frames with
+exactly the layout the firmware packs. The firmware side is expanded by
+the C preprocessor from the same tables.
+
+Usage:
+  python3 gen_uwb_msg.py            # rewrite uwb_msg.py
+  python3 gen_uwb_msg.py --check    # exit 1 if uwb_msg.py is stale
+"""
+
+import argparse
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+HEADER = os.path.join(HERE, "..", "lib", "uwb", "uwb_msg.h")
+OUTPUT = os.path.join(HERE, "uwb_msg.py")
+
+SIZES = {"U8": 1, "U16": 2, "U32": 4, "U64": 8, "TS": 5}
+
+# plain constants copied over
+CONSTANTS = ("DIST_NONE", "MAX")
+
+
+def read_defines(text):
+    """{macro: (params, body)} with continuation lines joined."""
+    text = re.sub(r"/\*.*?\*/", "", text, flags=re.S)
+    text = text.replace("\\\n", " ")
+    defines = {}
+    for m in re.finditer(r"^\s*#define\s+(\w+)(\([^)]*\))?\s*(.*)$", text, re.M):
+        defines[m.group(1)] = (m.group(2), m.group(3).strip())
+    return defines
+
+
+def table(defines, name, arity):
+    body = defines[name][1]
+    rows = re.findall(r"\b[A-Z]\(([^()]*)\)", body)
+    out = []
+    for row in rows:
+        cols = [c.strip() for c in row.split(",")]
+        if len(cols) != arity:
+            sys.exit(f"{name}: bad row ({row})")
+        out.append(cols)
+    return out
+
+
+def fields(defines, macro):
+    if macro not in defines:
+        sys.exit(f"missing field list {macro}")
+    out = []
+    for kind, field in re.findall(r"\bF\(\s*(\w+)\s*,\s*(\w+)\s*\)", defines[macro][1]):
+        if kind not in SIZES:
+            sys.exit(f"{macro}: unknown field kind {kind}")
+        out.append((field, SIZES[kind]))
+    return out
+
+
+def parse(path):
+    with open(path) as f:
+        defines = read_defines(f.read())
+
+    msgs = [(NAME, int(typ, 0), fields(defines, fl))
+            for NAME, _, typ, fl in table(defines, "UWB_MSG_TABLE", 4)]
+    recs = [(NAME, fields(defines, fl))
+            for NAME, _, fl in table(defines, "UWB_MSG_REC_TABLE", 3)]
+    tails = table(defines, "UWB_MSG_TAIL_TABLE", 3)
+    consts = [(c, int(defines["UWB_MSG_" + c][1], 0)) for c in CONSTANTS]
+
+    return msgs, recs, tails, consts
+
+
+def spec(flds, start):
+    """((field, offset, size), ...) from a field list."""
+    out, ofs = [], start
+    for name, size in flds:
+        out.append((name, ofs, size))
+        ofs += size
+    return tuple(out), ofs
+
+
+RUNTIME = '''
+
+class DecodeError(ValueError):
+    pass
+
+
+def _fields(b, ofs, layout):
+    return {name: int.from_bytes(b[ofs + o:ofs + o + n], "little") for name, o, n in layout}
+
+
+def decode(frame):
+    """One frame (payload without FCS) -> dict with its "type" name and
+    fields, plus "records" for frames that end with records and "tail"
+    for any other bytes after the fixed part."""
+    b = bytes(frame)
+    if not b:
+        raise DecodeError("empty frame")
+    if b[0] not in BY_TYPE:
+        raise DecodeError(f"unknown type 0x{b[0]:02x}")
+
+    name = BY_TYPE[b[0]]
+    length, layout = MESSAGES[name]
+    if len(b) < length:
+        raise DecodeError(f"short {name}: {len(b)} < {length}")
+
+    msg = {"type": name}
+    msg.update(_fields(b, 0, layout))
+
+    if name in TAILS:
+        count, rec = TAILS[name]
+        rec_len, rec_layout = RECORDS[rec]
+        n = msg[count]
+        if len(b) < length + n * rec_len:
+            raise DecodeError(f"truncated {name}: {n} records")
+        msg["records"] = [_fields(b, length + i * rec_len, rec_layout) for i in range(n)]
+    elif len(b) > length:
+        msg["tail"] = b[length:]
+
+    return msg
+
+
+def encode(name, records=(), tail=b"", **fields):
+    """Build a frame. Missing fields are 0, a tail count field is set
+    from len(records)."""
+    length, layout = MESSAGES[name]
+    if name in TAILS:
+        fields[TAILS[name][0]] = len(records)
+
+    b = bytearray(length)
+    b[0] = TYPES[name]
+    for field, o, n in layout:
+        b[o:o + n] = int(fields.get(field, 0)).to_bytes(n, "little")
+
+    if records:
+        rec_len, rec_layout = RECORDS[TAILS[name][1]]
+        for r in records:
+            rb = bytearray(rec_len)
+            for field, o, n in rec_layout:
+                rb[o:o + n] = int(r.get(field, 0)).to_bytes(n, "little")
+            b += rb
+
+    return bytes(b + tail)
+
+
+def main():
+    src = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    for line in src:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            print(decode(bytes.fromhex(line)))
+        except (ValueError, DecodeError) as e:
+            print(f"# {e}: {line}")
+
+
+if __name__ == "__main__":
+    main()
+'''
+
+
+def generate(msgs, recs, tails, consts):
+    out = ['#!/usr/bin/env python3',
+           '"""',
+           'UWB frame decoder, generated by gen_uwb_msg.py from lib/uwb/uwb_msg.h.',
+           'Do not edit: change the tables there and rerun the generator.',
+           '',
+           'decode() turns a frame into a dict, encode() builds one, both with the',
+           'field names of the C structs.',
+           '',
+           'Usage as a tool, on hex dumps of frames (one per line):',
+           '  python3 uwb_msg.py dump.txt',
+           '"""',
+           '',
+           'import sys',
+           '']
+
+    for name, value in consts:
+        out.append(f"{name} = 0x{value:X}" if value > 255 else f"{name} = {value}")
+    out.append('')
+
+    for name, typ, _ in msgs:
+        out.append(f"{name} = 0x{typ:02X}")
+    out.append('')
+
+    layouts = {}
+    for name, _, flds in msgs:
+        layouts[name] = spec(flds, 1)
+        out.append(f"{name}_LEN = {layouts[name][1]}")
+    for name, flds in recs:
+        layouts[name] = spec(flds, 0)
+        out.append(f"{name}_LEN = {layouts[name][1]}")
+    out.append('')
+
+    out.append('TYPES = {')
+    for name, _, _ in msgs:
+        out.append(f'    "{name}": {name},')
+    out.append('}')
+    out.append('BY_TYPE = {v: k for k, v in TYPES.items()}')
+    out.append('')
+
+    def emit(var, names):
+        out.append(f'# name: (length, ((field, offset, size), ...))')
+        out.append(f'{var} = {{')
+        for name in names:
+            layout, length = layouts[name]
+            out.append(f'    "{name}": ({name}_LEN, (')
+            for field, ofs, size in layout:
+                out.append(f'        ("{field}", {ofs}, {size}),')
+            out.append('    )),')
+        out.append('}')
+        out.append('')
+
+    emit('MESSAGES', [m[0] for m in msgs])
+    emit('RECORDS', [r[0] for r in recs])
+
+    rec_names = {r[0] for r in recs}
+    out.append('# frame: (count field, record)')
+    out.append('TAILS = {')
+    for name, count, rec in tails:
+        if rec not in rec_names or count not in [f for f, _, _ in layouts[name][0]]:
+            sys.exit(f"UWB_MSG_TAIL_TABLE: bad row {name}")
+        out.append(f'    "{name}": ("{count}", "{rec}"),')
+    out.append('}')
+
+    return "\n".join(out) + RUNTIME
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    ap.add_argument("--check", action="store_true", help="only check that the output is current")
+    ap.add_argument("--header", default=HEADER)
+    ap.add_argument("--output", default=OUTPUT)
+    args = ap.parse_args()
+
+    text = generate(*parse(args.header))
+
+    if args.check:
+        try:
+            with open(args.output) as f:
+                current = f.read()
+        except FileNotFoundError:
+            current = None
+        if current != text:
+            print(f"{args.output} is stale, run {os.path.basename(__file__)}")
+            sys.exit(1)
+        return
+
+    with open(args.output, "w") as f:
+        f.write(text)
+    print(f"wrote {args.output}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+"""
+TDoA Blink Collision Simulator
+
+Monte Carlo model of tags blinking at a fixed rate, comparing the
+free-running (pure ALOHA) tag_tdoa loop with the TDMA superframe
+announced in the master's SYNC frame.
+
+ALOHA:  each tag blinks every PERIOD with its own random phase, a little
+        scheduling jitter and a crystal offset, so phases slowly slide
+        through each other.
+TDMA:   tag k blinks in slot k after the SYNC, timed by delayed TX on the
+        tag's own clock. Errors come from SYNC RX timestamp jitter and
+        the crystal offset over the slot offset. Tags beyond the number
+        of slots are not scheduled and do not blink.
+
+A blink is lost if any other blink overlaps it on air.
+
+Usage:
+  python3 tdma_sim.py
+  python3 tdma_sim.py --max-tags 40 --frames 2000 --plot
+"""
+
+import argparse
+import random
+
+# Default radio profile (ch9, 6.8 Mbps, 128 preamble), 2-byte blink
+BLINK_AIRTIME_US = 181
+GUARD_US = 50
+FIRST_SLOT_US = 481
+# each slot adds a 2-byte tag id to the SYNC, pushing the first slot out
+SYNC_TAG_US = 2.4
+PERIOD_US = 100_000
+
+# k_msleep() wakeup jitter on the free-running tag
+ALOHA_JITTER_US = 30
+# crystal offset spread, +-ppm
+PPM = 20
+# SYNC RX timestamp jitter (1 sigma)
+SYNC_JITTER_US = 0.01
+
+
+def overlaps(starts, airtime):
+    """Indices of transmissions that overlap another one."""
+    order = sorted(range(len(starts)), key=lambda i: starts[i])
+    hit = set()
+    for a, b in zip(order, order[1:]):
+        if starts[b] - starts[a] < airtime:
+            hit.add(a)
+            hit.add(b)
+    return hit
+
+
+def sim_aloha(n_tags, frames, airtime, rng):
+    phase = [rng.uniform(0, PERIOD_US) for _ in range(n_tags)]
+    drift = [rng.uniform(-PPM, PPM) * 1e-6 for _ in range(n_tags)]
+
+    sent = lost = 0
+    for f in range(frames):
+        starts = []
+        for t in range(n_tags):
+            period = PERIOD_US * (1 + drift[t])
+            starts.append(phase[t] + f * period + rng.uniform(0, ALOHA_JITTER_US))
+        # blinks near frame edges can hit the neighbouring frame too
+        starts_all = starts + [s - PERIOD_US for s in starts] + [s + PERIOD_US for s in starts]
+        hit = overlaps(starts_all, airtime)
+        sent += n_tags
+        lost += sum(1 for i in range(n_tags) if i in hit)
+    return sent, lost, 0
+
+
+def sim_tdma(n_tags, frames, airtime, slots, rng):
+    slot_us = airtime + GUARD_US
+    drift = [rng.uniform(-PPM, PPM) * 1e-6 for _ in range(n_tags)]
+    scheduled = min(n_tags, slots)
+    first_us = FIRST_SLOT_US + slots * SYNC_TAG_US
+
+    sent = lost = 0
+    for _ in range(frames):
+        starts = []
+        for t in range(scheduled):
+            offset = first_us + t * slot_us
+            starts.append(offset * (1 + drift[t]) + rng.gauss(0, SYNC_JITTER_US))
+        hit = overlaps(starts, airtime)
+        sent += scheduled
+        lost += len(hit)
+    return sent, lost, n_tags - scheduled
+
+
+def main():
+    parser = argparse.ArgumentParser(description="ALOHA vs TDMA blink collision rate")
+    parser.add_argument("--max-tags", type=int, default=32, help="Largest tag count (default: 32)")
+    parser.add_argument("--step", type=int, default=2, help="Tag count step (default: 2)")
+    parser.add_argument("--frames", type=int, default=1000, help="Superframes per point (default: 1000)")
+    parser.add_argument("--slots", type=int, default=16, help="TDMA slots per superframe (default: 16)")
+    parser.add_argument("--airtime", type=float, default=BLINK_AIRTIME_US, help=f"Blink airtime in us (default: {BLINK_AIRTIME_US})")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--plot", action="store_true", help="Plot with matplotlib")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+
+    print("=" * 60)
+    print("Blink collision rate, %d us airtime, %d ms period" % (args.airtime, PERIOD_US // 1000))
+    print("=" * 60)
+    print(f"{'tags':>5} {'ALOHA lost':>12} {'TDMA lost':>12} {'TDMA unsched':>14}")
+
+    rows = []
+    for n in range(args.step, args.max_tags + 1, args.step):
+        a_sent, a_lost, _ = sim_aloha(n, args.frames, args.airtime, rng)
+        t_sent, t_lost, t_unsched = sim_tdma(n, args.frames, args.airtime, args.slots, rng)
+
+        a_rate = a_lost / a_sent if a_sent else 0.0
+        t_rate = t_lost / t_sent if t_sent else 0.0
+        rows.append((n, a_rate, t_rate))
+
+        print(f"{n:>5} {a_rate * 100:>11.2f}% {t_rate * 100:>11.2f}% {t_unsched:>14}")
+
+    if args.plot:
+        import matplotlib.pyplot as plt
+
+        ns = [r[0] for r in rows]
+        plt.plot(ns, [r[1] * 100 for r in rows], "o-", label="ALOHA")
+        plt.plot(ns, [r[2] * 100 for r in rows], "s-", label="TDMA")
+        plt.axvline(args.slots, color="gray", linestyle="--", label="TDMA slots")
+        plt.xlabel("Tags")
+        plt.ylabel("Blinks lost to collision (%)")
+        plt.legend()
+        plt.grid(True)
+        plt.show()
+
+
+if __name__ == "__main__":
+    main()
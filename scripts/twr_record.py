@@ -2,23 +2,25 @@
 """
 DS-TWR Distance Recorder
 
-Reads distance measurements from the tag over serial
-and saves them to a JSON file for later analysis.
+Reads distance measurements from the tag over serial and appends them to
+a binary session log (uwb_log.py) as they arrive, so a crash keeps
+everything recorded so far.
 
 Usage:
   python3 twr_record.py --port /dev/ttyACM0
-  python3 twr_record.py --port /dev/ttyACM0 -o my_recording.json
+  python3 twr_record.py --port /dev/ttyACM0 -o my_recording.uwbl
+  python3 uwb_log.py replay my_recording.uwbl
 
-Press Ctrl+C to stop recording and save.
+Press Ctrl+C to stop recording.
 """
 
 import serial
 import re
-import json
-import time
 import argparse
 from datetime import datetime
 
+import uwb_log
+
 PORT = "/dev/ttyACM0"
 BAUD = 115200
 
@@ -36,15 +38,15 @@ PATTERN = re.compile(
 
 
 def main():
-    parser = argparse.ArgumentParser(description="Record DS-TWR distances to JSON")
+    parser = argparse.ArgumentParser(description="Record DS-TWR distances to a session log")
     parser.add_argument("--port", default=PORT, help=f"Serial port (default: {PORT})")
     parser.add_argument("--baud", type=int, default=BAUD, help=f"Baud rate (default: {BAUD})")
-    parser.add_argument("-o", "--output", default=None, help="Output filename (default: twr_TIMESTAMP.json)")
+    parser.add_argument("-o", "--output", default=None, help="Output filename (default: twr_TIMESTAMP.uwbl)")
     args = parser.parse_args()
 
     if args.output is None:
         ts = datetime.now().strftime("%Y%m%d_%H%M%S")
-        args.output = f"twr_{ts}.json"
+        args.output = f"twr_{ts}.uwbl"
 
     print("=" * 60)
     print("DS-TWR Distance Recorder")
@@ -52,18 +54,23 @@ def main():
     print(f"Serial: {args.port} @ {args.baud}")
     print(f"Output: {args.output}")
     print(f"Anchors: {list(ANCHORS.keys())}")
-    print("Press Ctrl+C to stop and save.")
+    print("Press Ctrl+C to stop.")
     print("=" * 60)
     print()
 
     ser = serial.Serial(args.port, args.baud, timeout=0.1)
     ser.reset_input_buffer()
 
-    samples = []
-    current_round = {}
-    last_anchor = None
-    sample_count = 0
     start_time = datetime.now()
+    log = uwb_log.Writer(args.output, {
+        "tool": "twr_record",
+        "start_time": start_time.isoformat(),
+        "port": args.port,
+        "anchor_positions": {str(k): v for k, v in ANCHORS.items()},
+    })
+
+    current_round = set()
+    sample_count = 0
 
     try:
         while True:
@@ -84,51 +91,28 @@ def main():
 
             # if we see an anchor we already have, the sweep is complete
             if anchor_id in current_round and len(current_round) >= 2:
-                samples.append({
-                    "sample": sample_count,
-                    "timestamp": datetime.now().isoformat(),
-                    "distances": dict(current_round),
-                })
                 sample_count += 1
                 if sample_count % 10 == 0:
                     print(f"  [{sample_count} samples saved]")
-                current_round = {}
+                current_round = set()
 
-            current_round[anchor_id] = dist
+            current_round.add(anchor_id)
+            log.write({"type": "RANGE", "sample": sample_count, "anchor_id": anchor_id,
+                       "seq": int(m.group(3)), "distance_m": dist})
 
             print(f"[{sample_count:05d}] A{anchor_id}: {dist:.2f} m")
 
     except KeyboardInterrupt:
         if current_round:
-            samples.append({
-                "sample": sample_count,
-                "timestamp": datetime.now().isoformat(),
-                "distances": dict(current_round),
-            })
             sample_count += 1
 
     finally:
         ser.close()
+        log.close()
 
-    end_time = datetime.now()
-    duration = (end_time - start_time).total_seconds()
-
-    output = {
-        "session_info": {
-            "start_time": start_time.isoformat(),
-            "end_time": end_time.isoformat(),
-            "duration_seconds": round(duration, 1),
-            "total_samples": sample_count,
-            "port": args.port,
-        },
-        "anchor_positions": {str(k): v for k, v in ANCHORS.items()},
-        "samples": samples,
-    }
-
-    with open(args.output, "w") as f:
-        json.dump(output, f, indent=2)
+    duration = (datetime.now() - start_time).total_seconds()
 
-    print(f"\n\nSaved {sample_count} samples to {args.output}")
+    print(f"\n\nSaved {sample_count} samples ({log.count} ranges) to {args.output}")
     print(f"Duration: {duration:.1f}s")
 
 
@@ -9,16 +9,14 @@ Usage:
 
 import serial
 import re
-import math
 import argparse
-import numpy as np
 import matplotlib.pyplot as plt
 from matplotlib.animation import FuncAnimation
-from itertools import combinations
-from statistics import median
 from collections import deque
 from datetime import datetime
 
+import uwb_solver
+
 
 PORT = "/dev/ttyACM0"
 BAUD = 115200
@@ -35,8 +33,7 @@ ANCHORS = {
 MIN_ANCHORS = 3          # need at least 3 for trilateration
 MAX_DISTANCE = 30.0      # reject distances above this (meters)
 MIN_DISTANCE = 0.05      # reject distances below this (meters)
-MAX_RESIDUAL = 1.0        # max error per anchor to accept a solution (meters)
-MAX_SPREAD = 2.0          # max spread between triplet solutions (meters)
+MAX_RESIDUAL = 1.0        # max rms range error to accept a solution (meters)
 TRAIL_LENGTH = 200        # how many past positions to show
 
 PATTERN = re.compile(
@@ -44,68 +41,22 @@ PATTERN = re.compile(
 )
 
 
-def trilaterate_3(a1, a2, a3, d1, d2, d3):
-    x1, y1 = a1
-    x2, y2 = a2
-    x3, y3 = a3
-
-    A = np.array([
-        [2 * (x2 - x1), 2 * (y2 - y1)],
-        [2 * (x3 - x1), 2 * (y3 - y1)],
-    ])
-
-    b = np.array([
-        d1**2 - d2**2 + x2**2 + y2**2 - x1**2 - y1**2,
-        d1**2 - d3**2 + x3**2 + y3**2 - x1**2 - y1**2,
-    ])
-
-    try:
-        sol = np.linalg.solve(A, b)
-        return float(sol[0]), float(sol[1])
-    except np.linalg.LinAlgError:
-        return None
-
-
-def residual_ok(x, y, anchor_ids, distances):
-    for aid in anchor_ids:
-        ax, ay = ANCHORS[aid]
-        d_est = math.hypot(x - ax, y - ay)
-        if abs(d_est - distances[aid]) > MAX_RESIDUAL:
-            return False
-    return True
-
-
 def compute_position(distances):
-    available = [aid for aid in distances if aid in ANCHORS]
+    """One weighted fit over all ranges (uwb_solver), outliers dropped."""
+    available = {aid: d for aid, d in distances.items() if aid in ANCHORS}
 
     if len(available) < MIN_ANCHORS:
         return None
 
-    solutions = []
-
-    for combo in combinations(available, 3):
-        a1, a2, a3 = combo
-        sol = trilaterate_3(
-            ANCHORS[a1], ANCHORS[a2], ANCHORS[a3],
-            distances[a1], distances[a2], distances[a3],
-        )
-        if sol is None:
-            continue
-
-        x, y = sol
-        if residual_ok(x, y, combo, distances):
-            solutions.append((x, y))
-
-    if not solutions:
+    fix = uwb_solver.twr_fix(ANCHORS, available)
+    if fix is None:
         return None
 
-    xs = [s[0] for s in solutions]
-    ys = [s[1] for s in solutions]
-
-    if (max(xs) - min(xs)) > MAX_SPREAD or (max(ys) - min(ys)) > MAX_SPREAD:
+    (x, y), rms, used = fix
+    if rms > MAX_RESIDUAL:
         return None
 
-    return median(xs), median(ys), len(solutions)
+    return x, y, len(used)
 
 
 class LivePlot:
@@ -166,7 +117,7 @@ class LivePlot:
         self.ax.grid(True, alpha=0.3, linestyle="--")
         self.ax.set_aspect("equal")
 
-    def update(self, x, y, n_anchors, n_triplets):
+    def update(self, x, y, n_anchors, n_used):
         self.x_hist.append(x)
         self.y_hist.append(y)
         self.count += 1
@@ -177,7 +128,7 @@ class LivePlot:
         self.info_text.set_text(
             f"Position: ({x:.2f}, {y:.2f}) m\n"
             f"Sample: {self.count}\n"
-            f"Anchors: {n_anchors}  Triplets: {n_triplets}"
+            f"Anchors: {n_anchors}  Used: {n_used}"
         )
 
         return self.trail_line, self.pos_dot, self.info_text
@@ -227,14 +178,14 @@ def run_live(port, baud):
 
             result = compute_position(distances)
             if result is not None:
-                x, y, n_tri = result
+                x, y, n_used = result
                 ts = datetime.now().strftime("%H:%M:%S.%f")[:-3]
                 print(
                     f"{viz.count+1:05d} | {ts} | "
                     f"X={x:6.2f} m  Y={y:6.2f} m | "
-                    f"Anchors={len(distances)}  Triplets={n_tri}"
+                    f"Anchors={len(distances)}  Used={n_used}"
                 )
-                return viz.update(x, y, len(distances), n_tri)
+                return viz.update(x, y, len(distances), n_used)
 
         return viz.trail_line, viz.pos_dot, viz.info_text
 
@@ -14,15 +14,14 @@ import math
 import time
 import random
 import argparse
-import numpy as np
 import matplotlib.pyplot as plt
 from mpl_toolkits.mplot3d import Axes3D
 from matplotlib.animation import FuncAnimation
-from itertools import combinations
-from statistics import median
 from collections import deque
 from datetime import datetime
 
+import uwb_solver
+
 
 PORT = "/dev/ttyACM0"
 BAUD = 115200
@@ -39,8 +38,7 @@ ANCHORS = {
 MIN_ANCHORS = 4
 MAX_DISTANCE = 30.0
 MIN_DISTANCE = 0.05
-MAX_RESIDUAL = 1.0
-MAX_SPREAD = 2.0
+MAX_RESIDUAL = 1.0       # max rms range error to accept a solution (meters)
 TRAIL_LENGTH = 200
 
 PATTERN = re.compile(
@@ -48,74 +46,22 @@ PATTERN = re.compile(
 )
 
 
-def trilaterate_4(a1, a2, a3, a4, d1, d2, d3, d4):
-    x1, y1, z1 = a1
-    x2, y2, z2 = a2
-    x3, y3, z3 = a3
-    x4, y4, z4 = a4
-
-    A = np.array([
-        [2 * (x2 - x1), 2 * (y2 - y1), 2 * (z2 - z1)],
-        [2 * (x3 - x1), 2 * (y3 - y1), 2 * (z3 - z1)],
-        [2 * (x4 - x1), 2 * (y4 - y1), 2 * (z4 - z1)],
-    ])
-
-    b = np.array([
-        d1**2 - d2**2 + x2**2 + y2**2 + z2**2 - x1**2 - y1**2 - z1**2,
-        d1**2 - d3**2 + x3**2 + y3**2 + z3**2 - x1**2 - y1**2 - z1**2,
-        d1**2 - d4**2 + x4**2 + y4**2 + z4**2 - x1**2 - y1**2 - z1**2,
-    ])
-
-    try:
-        sol = np.linalg.solve(A, b)
-        return float(sol[0]), float(sol[1]), float(sol[2])
-    except np.linalg.LinAlgError:
-        return None
-
-
-def residual_ok(x, y, z, anchor_ids, distances):
-    for aid in anchor_ids:
-        ax, ay, az = ANCHORS[aid]
-        d_est = math.sqrt((x - ax)**2 + (y - ay)**2 + (z - az)**2)
-        if abs(d_est - distances[aid]) > MAX_RESIDUAL:
-            return False
-    return True
-
-
 def compute_position(distances):
-    available = [aid for aid in distances if aid in ANCHORS]
+    """One weighted fit over all ranges (uwb_solver), outliers dropped."""
+    available = {aid: d for aid, d in distances.items() if aid in ANCHORS}
 
     if len(available) < MIN_ANCHORS:
         return None
 
-    solutions = []
-
-    for combo in combinations(available, 4):
-        a1, a2, a3, a4 = combo
-        sol = trilaterate_4(
-            ANCHORS[a1], ANCHORS[a2], ANCHORS[a3], ANCHORS[a4],
-            distances[a1], distances[a2], distances[a3], distances[a4],
-        )
-        if sol is None:
-            continue
-
-        x, y, z = sol
-        if residual_ok(x, y, z, combo, distances):
-            solutions.append((x, y, z))
-
-    if not solutions:
+    fix = uwb_solver.twr_fix(ANCHORS, available)
+    if fix is None:
         return None
 
-    xs = [s[0] for s in solutions]
-    ys = [s[1] for s in solutions]
-    zs = [s[2] for s in solutions]
-
-    if (max(xs) - min(xs)) > MAX_SPREAD or \
-       (max(ys) - min(ys)) > MAX_SPREAD or \
-       (max(zs) - min(zs)) > MAX_SPREAD:
+    (x, y, z), rms, used = fix
+    if rms > MAX_RESIDUAL:
         return None
 
-    return median(xs), median(ys), median(zs), len(solutions)
+    return x, y, z, len(used)
 
 
 class LivePlot:
@@ -172,7 +118,7 @@ class LivePlot:
         self.ax.set_zlabel("Z (m)", fontsize=11, fontweight="bold")
         self.ax.set_title("DS-TWR Live 3D Position", fontsize=14, fontweight="bold")
 
-    def update(self, x, y, z, n_anchors, n_quads):
+    def update(self, x, y, z, n_anchors, n_used):
         self.x_hist.append(x)
         self.y_hist.append(y)
         self.z_hist.append(z)
@@ -185,7 +131,7 @@ class LivePlot:
         self.info_text.set_text(
             f"Position: ({x:.2f}, {y:.2f}, {z:.2f}) m\n"
             f"Sample: {self.count}\n"
-            f"Anchors: {n_anchors}  Quads: {n_quads}"
+            f"Anchors: {n_anchors}  Used: {n_used}"
         )
 
         return self.trail_line, self.pos_dot, self.info_text
@@ -235,14 +181,14 @@ def run_live(port, baud):
 
             result = compute_position(distances)
             if result is not None:
-                x, y, z, n_q = result
+                x, y, z, n_used = result
                 ts = datetime.now().strftime("%H:%M:%S.%f")[:-3]
                 print(
                     f"{viz.count+1:05d} | {ts} | "
                     f"X={x:6.2f}  Y={y:6.2f}  Z={z:6.2f} m | "
-                    f"Anchors={len(distances)}  Quads={n_q}"
+                    f"Anchors={len(distances)}  Used={n_used}"
                 )
-                return viz.update(x, y, z, len(distances), n_q)
+                return viz.update(x, y, z, len(distances), n_used)
 
         return viz.trail_line, viz.pos_dot, viz.info_text
 
@@ -295,13 +241,13 @@ def run_sim():
 
         result = compute_position(distances)
         if result is not None:
-            x, y, z, n_q = result
+            x, y, z, n_used = result
             print(
                 f"{viz.count+1:05d} | "
                 f"truth=({gx:5.2f},{gy:5.2f},{gz:5.2f}) "
-                f"est=({x:5.2f},{y:5.2f},{z:5.2f}) m | Quads={n_q}"
+                f"est=({x:5.2f},{y:5.2f},{z:5.2f}) m | Used={n_used}"
             )
-            return viz.update(x, y, z, len(distances), n_q)
+            return viz.update(x, y, z, len(distances), n_used)
 
         return viz.trail_line, viz.pos_dot, viz.info_text
 
@@ -0,0 +1,578 @@
+#!/usr/bin/env python3
+"""
+UWB Session Log
+
+Append-only binary log for the recorders (twr_record.py,
+ble_tdoa_multi_client.py), written record by record so memory stays flat
+and a crash only loses the record being written.
+
+File layout (little endian):
+
+  header   "UWBLOG" u8 version, u32 schema length, schema JSON
+  record   u16 payload length, u8 type, payload
+  trailer  u64 offset of the last INDEX record, "UWBEND"
+
+The schema JSON holds the session metadata (anchor positions, tool, ...)
+and the field list and struct format of every record type, so readers
+decode with the layout the file was written with. An INDEX record is
+appended every INDEX_EVERY records and on close; it covers the records
+since the previous one (first offset, count, time span) and points back
+to it. The trailer is only there after a clean close: readers then walk
+the index chain from the end, otherwise they scan the records and stop
+at a torn tail.
+
+Usage:
+  python3 uwb_log.py info session.uwbl
+  python3 uwb_log.py dump session.uwbl --type BLINK
+  python3 uwb_log.py convert ../samples/ble_tdoa_slave/tdoa_data.json
+  python3 uwb_log.py replay session.uwbl --speed 1
+  python3 uwb_log.py replay session.uwbl --speed 0 --anchor 0:0.9,0 --anchor 6:0.9,0.6 --anchor 7:0,0
+"""
+
+import argparse
+import json
+import math
+import os
+import struct
+import sys
+import time
+from datetime import datetime
+
+MAGIC = b"UWBLOG"
+END_MAGIC = b"UWBEND"
+VERSION = 1
+
+REC_HDR = struct.Struct("<HB")
+TRAILER = struct.Struct("<Q6s")
+
+INDEX_EVERY = 256
+FLUSH_SEC = 1.0
+
+# DW3000 timestamp period in seconds
+DWT_TIME_UNIT_S = 1.0 / (499.2e6 * 128.0)
+SPEED_OF_LIGHT_M_S = 299_792_458.0
+
+# blinks seen by several anchors are grouped until all of them reported,
+# or for this long after the first; BLE delivery from one anchor can lag
+# the others by about a second
+GROUP_WINDOW_S = 2.0
+
+# name -> (type id, [(field, struct code)])
+RECORDS = {
+    "SYNC": (1, [("time", "d"), ("addr", "6s"), ("anchor_id", "H"), ("seq", "H"),
+                 ("tx_ts", "Q"), ("rx_ts", "Q"), ("offset", "q"), ("drift", "d"),
+                 ("corrected", "d")]),
+    "BLINK": (2, [("time", "d"), ("addr", "6s"), ("anchor_id", "H"), ("blink_seq", "I"),
+                  ("sync_seq", "H"), ("sync_tx_ts", "Q"), ("master_time", "d"), ("tag", "Q")]),
+    "TDOA": (3, [("time", "d"), ("anchor_id", "H"), ("ref_anchor", "H"), ("blink_seq", "I"),
+                 ("sync_seq", "H"), ("delta_ticks", "d"), ("delta_ns", "d"), ("delta_m", "d"),
+                 ("anchor_sep_m", "d"), ("tag", "Q")]),
+    "POS": (4, [("time", "d"), ("blink_seq", "I"), ("sync_seq", "H"), ("x_m", "d"),
+                ("y_m", "d"), ("rms_m", "d"), ("tag", "Q")]),
+    "RANGE": (5, [("time", "d"), ("sample", "I"), ("anchor_id", "H"), ("seq", "I"),
+                  ("distance_m", "d")]),
+    "INDEX": (0x7F, [("prev", "Q"), ("first_ofs", "Q"), ("count", "I"), ("t_first", "d"),
+                     ("t_last", "d")]),
+}
+
+
+class LogError(ValueError):
+    pass
+
+
+def _schema(meta):
+    return {
+        "version": VERSION,
+        "meta": meta or {},
+        "records": {name: {"id": rid, "fields": [list(f) for f in fields]}
+                    for name, (rid, fields) in RECORDS.items()},
+    }
+
+
+def _compile(schema):
+    """type id -> (name, field names, codes, Struct)"""
+    types = {}
+    for name, rec in schema["records"].items():
+        names = [f[0] for f in rec["fields"]]
+        codes = [f[1] for f in rec["fields"]]
+        types[rec["id"]] = (name, names, codes, struct.Struct("<" + "".join(codes)))
+    return types
+
+
+def _pack_value(code, v):
+    if code == "6s":
+        return bytes.fromhex(v.replace(":", "")) if v else bytes(6)
+    if code == "d":
+        return math.nan if v is None else float(v)
+    return int(v or 0)
+
+
+def _unpack_value(code, v):
+    if code == "6s":
+        return ":".join(f"{b:02X}" for b in v) if any(v) else ""
+    if code == "d" and math.isnan(v):
+        return None
+    return v
+
+
+class Writer:
+    """Incremental writer. write() takes the same dicts the tools used to
+    keep in memory; missing fields are written as 0 / NaN, a missing time
+    as the current time."""
+
+    def __init__(self, path, meta=None, index_every=INDEX_EVERY, flush_sec=FLUSH_SEC):
+        self.path = path
+        self.index_every = index_every
+        self.flush_sec = flush_sec
+        self.count = 0
+
+        schema = json.dumps(_schema(meta)).encode()
+        self._types = {name: (rid, fields, struct.Struct("<" + "".join(c for _, c in fields)))
+                       for name, (rid, fields) in RECORDS.items()}
+
+        self._f = open(path, "wb")
+        self._f.write(MAGIC + struct.pack("<BI", VERSION, len(schema)) + schema)
+        self._f.flush()
+
+        self._prev_index = 0
+        self._chunk_ofs = self._f.tell()
+        self._chunk_count = 0
+        self._chunk_t = None
+        self._last_flush = time.monotonic()
+
+    def write(self, rec):
+        if self._f is None:
+            return
+
+        rid, fields, st = self._types[rec["type"]]
+        t = rec.get("time")
+        if t is None:
+            t = time.time()
+        rec = dict(rec, time=t)
+
+        payload = st.pack(*(_pack_value(code, rec.get(name)) for name, code in fields))
+        self._f.write(REC_HDR.pack(len(payload), rid) + payload)
+
+        if self._chunk_t is None:
+            self._chunk_t = [t, t]
+        self._chunk_t[1] = t
+        self._chunk_count += 1
+        self.count += 1
+
+        if self._chunk_count >= self.index_every:
+            self._write_index()
+
+        now = time.monotonic()
+        if now - self._last_flush >= self.flush_sec:
+            self._f.flush()
+            self._last_flush = now
+
+    def _write_index(self):
+        ofs = self._f.tell()
+        t_first, t_last = self._chunk_t or (math.nan, math.nan)
+        rid, _, st = self._types["INDEX"]
+        payload = st.pack(self._prev_index, self._chunk_ofs, self._chunk_count, t_first, t_last)
+        self._f.write(REC_HDR.pack(len(payload), rid) + payload)
+        self._f.flush()
+
+        self._prev_index = ofs
+        self._chunk_ofs = self._f.tell()
+        self._chunk_count = 0
+        self._chunk_t = None
+
+    def close(self):
+        if self._f is None:
+            return
+        if self._chunk_count or not self._prev_index:
+            self._write_index()
+        self._f.write(TRAILER.pack(self._prev_index, END_MAGIC))
+        self._f.close()
+        self._f = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+class Reader:
+    """Iterates the records of a log as dicts. INDEX records are skipped
+    unless raw=True. truncated is set once a torn tail has been hit."""
+
+    def __init__(self, path):
+        self.path = path
+        self._f = open(path, "rb")
+        self.size = os.fstat(self._f.fileno()).st_size
+
+        head = self._f.read(len(MAGIC) + 5)
+        if len(head) < len(MAGIC) + 5 or head[:len(MAGIC)] != MAGIC:
+            raise LogError(f"{path}: not a UWB log")
+        version, schema_len = struct.unpack_from("<BI", head, len(MAGIC))
+        if version != VERSION:
+            raise LogError(f"{path}: unknown version {version}")
+
+        self.schema = json.loads(self._f.read(schema_len))
+        self.meta = self.schema.get("meta", {})
+        self.data_ofs = self._f.tell()
+        self.end = self.size
+        self.closed_cleanly = False
+        self.truncated = False
+        self._types = _compile(self.schema)
+        self._index_id = self.schema["records"]["INDEX"]["id"]
+
+        if self.size >= self.data_ofs + TRAILER.size:
+            self._f.seek(self.size - TRAILER.size)
+            last_index, magic = TRAILER.unpack(self._f.read(TRAILER.size))
+            if magic == END_MAGIC:
+                self.closed_cleanly = True
+                self.end = self.size - TRAILER.size
+                self._last_index = last_index
+
+    def close(self):
+        self._f.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def _decode(self, rid, payload):
+        entry = self._types.get(rid)
+        if entry is None:
+            return None
+        name, names, codes, st = entry
+        if len(payload) < st.size:
+            raise LogError(f"short {name} record")
+        values = st.unpack_from(payload)
+        rec = {"type": name}
+        for n, c, v in zip(names, codes, values):
+            rec[n] = _unpack_value(c, v)
+        return rec
+
+    def records(self, start=None, raw=False):
+        """yield records from byte offset start (default: first record)"""
+        f = self._f
+        ofs = self.data_ofs if start is None else start
+        f.seek(ofs)
+
+        while ofs + REC_HDR.size <= self.end:
+            length, rid = REC_HDR.unpack(f.read(REC_HDR.size))
+            if ofs + REC_HDR.size + length > self.end:
+                self.truncated = True
+                return
+            payload = f.read(length)
+            ofs += REC_HDR.size + length
+
+            if rid == self._index_id and not raw:
+                continue
+            rec = self._decode(rid, payload)
+            if rec is None:
+                continue
+            if raw:
+                rec["_ofs"] = ofs - REC_HDR.size - length
+            yield rec
+
+        if ofs != self.end:
+            self.truncated = True
+
+    def __iter__(self):
+        return self.records()
+
+    def index(self):
+        """[(first_ofs, count, t_first, t_last)] in file order. Walks the
+        chain back from the trailer, or scans a log that was not closed."""
+        chunks = []
+        if self.closed_cleanly:
+            ofs = self._last_index
+            while ofs:
+                self._f.seek(ofs)
+                length, rid = REC_HDR.unpack(self._f.read(REC_HDR.size))
+                rec = self._decode(rid, self._f.read(length))
+                chunks.append((rec["first_ofs"], rec["count"], rec["t_first"], rec["t_last"]))
+                ofs = rec["prev"]
+            chunks.reverse()
+        else:
+            for rec in self.records(raw=True):
+                if rec["type"] == "INDEX":
+                    chunks.append((rec["first_ofs"], rec["count"], rec["t_first"], rec["t_last"]))
+        return chunks
+
+    def seek_time(self, t):
+        """byte offset of the first chunk that may hold records at or after t"""
+        for first_ofs, count, _, t_last in self.index():
+            if count and t_last is not None and t_last >= t:
+                return first_ofs
+        return self.end
+
+
+# conversion of the old JSON recordings
+
+def _clock_seconds(s):
+    """'HH:MM:SS.mmm' -> seconds of the day"""
+    h, m, sec = s.split(":")
+    return int(h) * 3600 + int(m) * 60 + float(sec)
+
+
+def convert_json(src, dst):
+    with open(src) as f:
+        data = json.load(f)
+
+    # twr_record.py session
+    if isinstance(data, dict) and "samples" in data:
+        meta = {"tool": "twr_record", "source": os.path.basename(src),
+                "anchor_positions": data.get("anchor_positions", {}),
+                **data.get("session_info", {})}
+        with Writer(dst, meta) as w:
+            for sample in data["samples"]:
+                t = datetime.fromisoformat(sample["timestamp"]).timestamp()
+                for aid, dist in sample["distances"].items():
+                    w.write({"type": "RANGE", "time": t, "sample": sample["sample"],
+                             "anchor_id": int(aid), "distance_m": dist})
+            return w.count
+
+    # ble_tdoa_multi_client.py entries; times carry no date, keep them
+    # as seconds of the day and unwrap midnight
+    meta = {"tool": "ble_tdoa_multi_client", "source": os.path.basename(src)}
+    day = 0.0
+    last = None
+    with Writer(dst, meta) as w:
+        for entry in data:
+            if entry.get("type") not in RECORDS or entry["type"] == "INDEX":
+                continue
+            t = _clock_seconds(entry["time"]) + day
+            if last is not None and t < last - 43200:
+                day += 86400
+                t += 86400
+            last = t
+            w.write(dict(entry, time=t))
+        return w.count
+
+
+# replay
+
+def _fmt_time(t):
+    if t > 86400 * 365:
+        return datetime.fromtimestamp(t).strftime("%H:%M:%S.%f")[:-3]
+    h, rem = divmod(t % 86400, 3600)
+    m, s = divmod(rem, 60)
+    return f"{int(h):02d}:{int(m):02d}:{s:06.3f}"
+
+
+def _anchor_positions(meta, items):
+    positions = {int(k): tuple(v) for k, v in meta.get("anchor_positions", {}).items()}
+    for item in items:
+        aid, coords = item.split(":", 1)
+        positions[int(aid)] = tuple(float(c) for c in coords.split(","))
+    return positions
+
+
+class Replay:
+    """Feeds recorded BLINK and RANGE events to uwb_solver, the way the
+    live tools group them."""
+
+    def __init__(self, anchors, quiet=False):
+        import uwb_solver
+        self.solver = uwb_solver
+        self.anchors = anchors
+        self.quiet = quiet
+        self.groups = {}        # (tag, blink_seq) -> [t_first, sync_seq, {aid: master_time}]
+        self.sweep = None       # (sample, t, {aid: distance})
+        self.stats = {"blinks": 0, "groups": 0, "tdoa_fixes": 0, "sweeps": 0, "twr_fixes": 0}
+        self.solve_s = 0.0
+
+    def _fix(self, t, label, pos, rms, extra=""):
+        if not self.quiet:
+            coords = "  ".join(f"{a}={c:.3f}" for a, c in zip("xyz", pos))
+            print(f"[{_fmt_time(t)}] [POS ] {label}  {coords} m  rms={rms:.4f} m{extra}")
+
+    def _solve_group(self, key, group):
+        tag, blink_seq = key
+        t, sync_seq, seen = group
+        self.stats["groups"] += 1
+        known = {aid: ts for aid, ts in seen.items() if aid in self.anchors}
+        if len(known) < 3:
+            return
+
+        ref = min(known.values())
+        arrivals = {aid: (ts - ref) * DWT_TIME_UNIT_S * SPEED_OF_LIGHT_M_S
+                    for aid, ts in known.items()}
+
+        t0 = time.perf_counter()
+        fix = self.solver.tdoa_fix(self.anchors, arrivals)
+        self.solve_s += time.perf_counter() - t0
+        if fix is None:
+            return
+
+        self.stats["tdoa_fixes"] += 1
+        self._fix(t, f"sync={sync_seq:3d} tag={tag:x} blink={blink_seq:3d} n={len(known)}",
+                  fix[0], fix[1])
+
+    def _solve_sweep(self):
+        sample, t, dists = self.sweep
+        self.sweep = None
+        self.stats["sweeps"] += 1
+
+        t0 = time.perf_counter()
+        fix = self.solver.twr_fix(self.anchors, dists)
+        self.solve_s += time.perf_counter() - t0
+        if fix is None:
+            return
+
+        self.stats["twr_fixes"] += 1
+        pos, rms, used = fix
+        self._fix(t, f"sample={sample:5d}", pos, rms, f"  used={used}")
+
+    def expire(self, now):
+        for key in [k for k, g in self.groups.items() if now - g[0] > GROUP_WINDOW_S]:
+            self._solve_group(key, self.groups.pop(key))
+
+    def feed(self, rec):
+        t = rec["time"]
+        self.expire(t)
+
+        if rec["type"] == "BLINK":
+            self.stats["blinks"] += 1
+            # anchors may tag the same blink with different SYNCs, the
+            # tag's id and seq are what they share. logs from before blinks
+            # carried a tag have no tag field.
+            key = (rec.get("tag", 0), rec["blink_seq"])
+            group = self.groups.setdefault(key, [t, rec["sync_seq"], {}])
+            group[2][rec["anchor_id"]] = rec["master_time"]
+            # every anchor in; later reports can not change the fix
+            if self.anchors.keys() <= group[2].keys():
+                self._solve_group(key, self.groups.pop(key))
+
+        elif rec["type"] == "RANGE":
+            if self.sweep is not None and self.sweep[0] != rec["sample"]:
+                self._solve_sweep()
+            if self.sweep is None:
+                self.sweep = (rec["sample"], t, {})
+            self.sweep[2][rec["anchor_id"]] = rec["distance_m"]
+
+    def finish(self):
+        for key in list(self.groups):
+            self._solve_group(key, self.groups.pop(key))
+        if self.sweep is not None:
+            self._solve_sweep()
+
+
+def replay(path, speed, anchor_items, start, quiet):
+    with Reader(path) as log:
+        anchors = _anchor_positions(log.meta, anchor_items)
+        if not anchors:
+            print("No anchor positions in the log, pass --anchor ID:X,Y")
+            return 2
+
+        print(f"Anchors: {', '.join(f'a{k}={v}' for k, v in sorted(anchors.items()))}")
+        rp = Replay(anchors, quiet)
+
+        t_log0 = None
+        t_wall0 = time.monotonic()
+        n = 0
+        first = log.seek_time(start) if start is not None else None
+
+        for rec in log.records(first):
+            if start is not None and rec["time"] < start:
+                continue
+            if t_log0 is None:
+                t_log0 = rec["time"]
+            if speed > 0:
+                delay = (rec["time"] - t_log0) / speed - (time.monotonic() - t_wall0)
+                if delay > 0:
+                    time.sleep(delay)
+            rp.feed(rec)
+            n += 1
+        rp.finish()
+
+        wall = time.monotonic() - t_wall0
+        s = rp.stats
+        print(f"\n{n} records in {wall:.2f} s"
+              f"{'  (torn tail)' if log.truncated else ''}")
+        if s["groups"]:
+            print(f"  TDoA: {s['blinks']} blinks, {s['groups']} groups, {s['tdoa_fixes']} fixes")
+        if s["sweeps"]:
+            print(f"  TWR:  {s['sweeps']} sweeps, {s['twr_fixes']} fixes")
+        fixes = s["tdoa_fixes"] + s["twr_fixes"]
+        if fixes:
+            print(f"  solver {rp.solve_s * 1e3:.1f} ms, {rp.solve_s / fixes * 1e6:.0f} us/fix")
+    return 0
+
+
+def info(path):
+    with Reader(path) as log:
+        print(f"{path}: {log.size} bytes, {'closed' if log.closed_cleanly else 'not closed'}")
+        for k, v in log.meta.items():
+            if k != "anchor_positions":
+                print(f"  {k}: {v}")
+        for k, v in sorted(log.meta.get("anchor_positions", {}).items()):
+            print(f"  anchor {k}: {v}")
+
+        chunks = log.index()
+        counts = {}
+        for rec in log:
+            counts[rec["type"]] = counts.get(rec["type"], 0) + 1
+
+        spans = [(c[2], c[3]) for c in chunks if c[1]]
+        if spans:
+            t0, t1 = spans[0][0], spans[-1][1]
+            print(f"  {_fmt_time(t0)} .. {_fmt_time(t1)}  ({t1 - t0:.1f} s)")
+        print(f"  {len(chunks)} index blocks")
+        print("  " + "  ".join(f"{k}={v}" for k, v in sorted(counts.items())))
+        if log.truncated:
+            print("  torn tail after the last complete record")
+
+
+def dump(path, types):
+    with Reader(path) as log:
+        for rec in log:
+            if types and rec["type"] not in types:
+                continue
+            print(json.dumps(rec))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="UWB session log tools")
+    sub = parser.add_subparsers(dest="cmd", required=True)
+
+    p = sub.add_parser("info", help="Summary of a log")
+    p.add_argument("log")
+
+    p = sub.add_parser("dump", help="Print records as JSON lines")
+    p.add_argument("log")
+    p.add_argument("--type", action="append", default=[], help="Only this record type (repeatable)")
+
+    p = sub.add_parser("convert", help="Convert a JSON recording to a log")
+    p.add_argument("json", nargs="+")
+    p.add_argument("-o", "--output", help="Output file (one input only, default: <input>.uwbl)")
+
+    p = sub.add_parser("replay", help="Feed a log back through the solvers")
+    p.add_argument("log")
+    p.add_argument("--speed", type=float, default=1.0,
+                   help="Replay speed, 1 = real time, 0 = as fast as possible (default: 1)")
+    p.add_argument("--from", dest="start", type=float, help="Start at this log time in seconds")
+    p.add_argument("--anchor", action="append", default=[], metavar="ID:X,Y[,Z]",
+                   help="Anchor position, overrides the log metadata (repeatable)")
+    p.add_argument("--quiet", action="store_true", help="Only print the summary")
+
+    args = parser.parse_args()
+
+    if args.cmd == "info":
+        info(args.log)
+    elif args.cmd == "dump":
+        dump(args.log, args.type)
+    elif args.cmd == "convert":
+        if args.output and len(args.json) > 1:
+            parser.error("-o needs a single input")
+        for src in args.json:
+            dst = args.output or os.path.splitext(src)[0] + ".uwbl"
+            n = convert_json(src, dst)
+            print(f"{src} -> {dst}: {n} records, {os.path.getsize(dst)} bytes "
+                  f"(JSON {os.path.getsize(src)} bytes)")
+    elif args.cmd == "replay":
+        sys.exit(replay(args.log, args.speed, args.anchor, args.start, args.quiet))
+
+
+if __name__ == "__main__":
+    main()
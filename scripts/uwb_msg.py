@@ -0,0 +1,217 @@
+#!/usr/bin/env python3
+"""
+UWB frame decoder, generated by gen_uwb_msg.py from lib/uwb/uwb_msg.h.
+Do not edit: change the tables there and rerun the generator.
+
+decode() turns a frame into a dict, encode() builds one, both with the
+field names of the C structs.
+
+Usage as a tool, on hex dumps of frames (one per line):
+  python3 uwb_msg.py dump.txt
+"""
+
+import sys
+
+DIST_NONE = 0xFFFF
+MAX = 125
+
+POLL = 0x01
+RESP = 0x02
+FINAL = 0x03
+BPOLL = 0x05
+BRESP = 0x06
+BFINAL = 0x07
+SYNC = 0x10
+BLINK = 0x85
+BLINK64 = 0xC5
+REPORT = 0x30
+
+POLL_LEN = 8
+RESP_LEN = 17
+FINAL_LEN = 19
+BPOLL_LEN = 9
+BRESP_LEN = 7
+BFINAL_LEN = 14
+SYNC_LEN = 8
+BLINK_LEN = 5
+BLINK64_LEN = 13
+REPORT_LEN = 4
+BFINAL_ENT_LEN = 6
+REPORT_REC_LEN = 9
+
+TYPES = {
+    "POLL": POLL,
+    "RESP": RESP,
+    "FINAL": FINAL,
+    "BPOLL": BPOLL,
+    "BRESP": BRESP,
+    "BFINAL": BFINAL,
+    "SYNC": SYNC,
+    "BLINK": BLINK,
+    "BLINK64": BLINK64,
+    "REPORT": REPORT,
+}
+BY_TYPE = {v: k for k, v in TYPES.items()}
+
+# name: (length, ((field, offset, size), ...))
+MESSAGES = {
+    "POLL": (POLL_LEN, (
+        ("seq", 1, 1),
+        ("anchor", 2, 1),
+        ("tag", 3, 1),
+        ("resp_dly_uus", 4, 2),
+        ("final_dly_uus", 6, 2),
+    )),
+    "RESP": (RESP_LEN, (
+        ("seq", 1, 1),
+        ("tag", 2, 1),
+        ("anchor", 3, 1),
+        ("t2", 4, 5),
+        ("t3", 9, 5),
+        ("last_seq", 14, 1),
+        ("last_mm", 15, 2),
+    )),
+    "FINAL": (FINAL_LEN, (
+        ("seq", 1, 1),
+        ("anchor", 2, 1),
+        ("tag", 3, 1),
+        ("t1", 4, 5),
+        ("t4", 9, 5),
+        ("t5", 14, 5),
+    )),
+    "BPOLL": (BPOLL_LEN, (
+        ("seq", 1, 1),
+        ("tag", 2, 1),
+        ("resp_dly_uus", 3, 2),
+        ("slot_uus", 5, 2),
+        ("final_dly_uus", 7, 2),
+    )),
+    "BRESP": (BRESP_LEN, (
+        ("seq", 1, 1),
+        ("tag", 2, 1),
+        ("anchor", 3, 1),
+        ("last_seq", 4, 1),
+        ("last_mm", 5, 2),
+    )),
+    "BFINAL": (BFINAL_LEN, (
+        ("seq", 1, 1),
+        ("tag", 2, 1),
+        ("n", 3, 1),
+        ("t1", 4, 5),
+        ("t5", 9, 5),
+    )),
+    "SYNC": (SYNC_LEN, (
+        ("seq", 1, 1),
+        ("node", 2, 1),
+        ("tx_ts", 3, 5),
+    )),
+    "BLINK": (BLINK_LEN, (
+        ("seq", 1, 2),
+        ("tag", 3, 2),
+    )),
+    "BLINK64": (BLINK64_LEN, (
+        ("seq", 1, 4),
+        ("tag", 5, 8),
+    )),
+    "REPORT": (REPORT_LEN, (
+        ("anchor", 1, 1),
+        ("sync_seq", 2, 1),
+        ("n", 3, 1),
+    )),
+}
+
+# name: (length, ((field, offset, size), ...))
+RECORDS = {
+    "BFINAL_ENT": (BFINAL_ENT_LEN, (
+        ("anchor", 0, 1),
+        ("t4", 1, 5),
+    )),
+    "REPORT_REC": (REPORT_REC_LEN, (
+        ("tag", 0, 2),
+        ("seq", 2, 2),
+        ("ts", 4, 5),
+    )),
+}
+
+# frame: (count field, record)
+TAILS = {
+    "BFINAL": ("n", "BFINAL_ENT"),
+    "REPORT": ("n", "REPORT_REC"),
+}
+
+class DecodeError(ValueError):
+    pass
+
+
+def _fields(b, ofs, layout):
+    return {name: int.from_bytes(b[ofs + o:ofs + o + n], "little") for name, o, n in layout}
+
+
+def decode(frame):
+    """One frame (payload without FCS) -> dict with its "type" name and
+    fields, plus "records" for frames that end with records and "tail"
+    for any other bytes after the fixed part."""
+    b = bytes(frame)
+    if not b:
+        raise DecodeError("empty frame")
+    if b[0] not in BY_TYPE:
+        raise DecodeError(f"unknown type 0x{b[0]:02x}")
+
+    name = BY_TYPE[b[0]]
+    length, layout = MESSAGES[name]
+    if len(b) < length:
+        raise DecodeError(f"short {name}: {len(b)} < {length}")
+
+    msg = {"type": name}
+    msg.update(_fields(b, 0, layout))
+
+    if name in TAILS:
+        count, rec = TAILS[name]
+        rec_len, rec_layout = RECORDS[rec]
+        n = msg[count]
+        if len(b) < length + n * rec_len:
+            raise DecodeError(f"truncated {name}: {n} records")
+        msg["records"] = [_fields(b, length + i * rec_len, rec_layout) for i in range(n)]
+    elif len(b) > length:
+        msg["tail"] = b[length:]
+
+    return msg
+
+
+def encode(name, records=(), tail=b"", **fields):
+    """Build a frame. Missing fields are 0, a tail count field is set
+    from len(records)."""
+    length, layout = MESSAGES[name]
+    if name in TAILS:
+        fields[TAILS[name][0]] = len(records)
+
+    b = bytearray(length)
+    b[0] = TYPES[name]
+    for field, o, n in layout:
+        b[o:o + n] = int(fields.get(field, 0)).to_bytes(n, "little")
+
+    if records:
+        rec_len, rec_layout = RECORDS[TAILS[name][1]]
+        for r in records:
+            rb = bytearray(rec_len)
+            for field, o, n in rec_layout:
+                rb[o:o + n] = int(r.get(field, 0)).to_bytes(n, "little")
+            b += rb
+
+    return bytes(b + tail)
+
+
+def main():
+    src = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    for line in src:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            print(decode(bytes.fromhex(line)))
+        except (ValueError, DecodeError) as e:
+            print(f"# {e}: {line}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,415 @@
+#!/usr/bin/env python3
+"""
+Batch UWB Position Solver
+
+NumPy version of the lib/loc solvers, vectorised over epochs so a whole
+recorded session is solved in one call. The live tools use the same code
+through the single-fix wrappers twr_fix() and tdoa_fix().
+
+TWR:   weighted least squares seed (|p - a_i|^2 = r_i^2 differenced
+       against the weighted mean), Gauss-Newton refinement, then up to
+       MAX_DROP rounds dropping the worst range beyond GATE sigma while
+       more than dim + 2 ranges are left.
+TDoA:  Chan's linearised least squares seed (or the |p| = r_0 quadratic
+       with only dim + 1 anchors), Gauss-Newton refinement of the range
+       differences to the first anchor present in the epoch.
+
+Epochs are rows, anchors are columns, a missing measurement is NaN.
+Every Gauss-Newton step is one batched solve over all epochs.
+
+Usage:
+  python3 uwb_solver.py twr_custom_90x60_100426.json
+  python3 uwb_solver.py twr_custom_90x60_100426.json --out fixes.csv
+  python3 uwb_solver.py twr_custom_90x60_100426.json --bench --repeat 200
+"""
+
+import argparse
+import csv
+import json
+import time
+from itertools import combinations
+from statistics import median
+
+import numpy as np
+
+GN_ITERS = 8
+GN_TOL = 1e-6           # m
+SIGMA_M = 0.1           # TWR range sigma when none is given
+GATE = 3.0              # outlier gate, sigmas
+MAX_DROP = 2
+
+
+def _solve(h, g):
+    """Batched h x = g for small symmetric h. Returns x and a mask of the
+    epochs where h is not singular, x is NaN elsewhere."""
+    dim = h.shape[-1]
+    scale = np.maximum(np.trace(h, axis1=-2, axis2=-1) / dim, 1e-300)
+    det = np.linalg.det(h)
+    ok = np.isfinite(det) & (np.abs(det) > 1e-12 * scale ** dim)
+
+    h = np.where(ok[:, None, None], h, np.eye(dim))
+    g = np.where(ok[:, None], g, 0.0)
+
+    x = np.linalg.solve(h, g[..., None])[..., 0]
+    x[~ok] = np.nan
+    return x, ok
+
+
+def _norm(v):
+    return np.sqrt(np.einsum("...k,...k->...", v, v))
+
+
+# TWR
+
+def _twr_fit(anchors, r, w, iters):
+    sw = np.maximum(w.sum(axis=1), 1e-300)
+    b = r ** 2 - (anchors ** 2).sum(axis=1)
+    mean_a = (w @ anchors) / sw[:, None]
+    mean_b = (w * b).sum(axis=1) / sw
+
+    rows = -2.0 * (anchors[None] - mean_a[:, None])
+    h = np.einsum("en,enk,enc->ekc", w, rows, rows)
+    g = np.einsum("en,enk,en->ek", w, rows, b - mean_b[:, None])
+    p, ok = _solve(h, g)
+    p[~ok] = 0.0
+
+    for _ in range(iters):
+        diff = p[:, None, :] - anchors[None]
+        rr = np.maximum(_norm(diff), 1e-9)
+        j = diff / rr[..., None]
+
+        h = np.einsum("en,enk,enc->ekc", w, j, j)
+        g = np.einsum("en,enk,en->ek", w, j, rr - r)
+        step, ok_step = _solve(h, g)
+        ok &= ok_step
+
+        step[~ok] = 0.0
+        p -= step
+        if np.abs(step).max(initial=0.0) < GN_TOL:
+            break
+
+    res = _norm(p[:, None, :] - anchors[None]) - r
+    return p, res, ok
+
+
+def solve_twr(anchors, ranges, sigma=None, gate=GATE, max_drop=MAX_DROP, iters=GN_ITERS):
+    """Positions from ranges.
+
+    anchors: (N, D) positions, D = 2 or 3
+    ranges:  (E, N) meters, NaN where an anchor has no range
+    sigma:   scalar or (E, N)/(N,) range sigmas, default SIGMA_M
+
+    Returns pos (E, D), NaN where unsolvable, rms (E,) and used (E, N),
+    False for missing and rejected ranges.
+    """
+    anchors = np.asarray(anchors, dtype=float)
+    r = np.atleast_2d(np.asarray(ranges, dtype=float))
+    n_epochs, _ = r.shape
+    dim = anchors.shape[1]
+
+    s = np.broadcast_to(SIGMA_M if sigma is None else np.asarray(sigma, dtype=float), r.shape)
+    used = np.isfinite(r) & (r >= 0) & (s > 0)
+    w = np.where(used, 1.0 / np.where(used, s, 1.0) ** 2, 0.0)
+    r = np.where(used, r, 0.0)
+
+    # centred on the anchors, like the C solver
+    centre = anchors.mean(axis=0)
+    a = anchors - centre
+    rows = np.arange(n_epochs)
+
+    for drop in range(max_drop + 1):
+        w_used = np.where(used, w, 0.0)
+        p, res, ok = _twr_fit(a, r, w_used, iters)
+
+        if drop == max_drop:
+            break
+
+        z = np.abs(res) * np.sqrt(w_used)
+        worst = z.argmax(axis=1)
+        cut = ok & (used.sum(axis=1) > dim + 2) & (z[rows, worst] > gate)
+        if not cut.any():
+            break
+
+        used[cut, worst[cut]] = False
+
+    n_used = used.sum(axis=1)
+    ok &= n_used >= dim + 1
+
+    rms = np.sqrt((np.where(used, res, 0.0) ** 2).sum(axis=1) / np.maximum(n_used, 1))
+    pos = p + centre
+    pos[~ok] = np.nan
+    rms[~ok] = np.nan
+    return pos, rms, used
+
+
+# TDoA
+
+def solve_tdoa(anchors, arrivals, iters=GN_ITERS):
+    """Positions from arrival times.
+
+    anchors:  (N, D) positions, D = 2 or 3
+    arrivals: (E, N) arrival times in meters (time * c) on a common clock,
+              e.g. corrected master time, NaN where an anchor missed the
+              blink. Only differences within an epoch matter.
+
+    Returns pos (E, D), NaN where unsolvable, and rms (E,) of the range
+    difference residuals.
+    """
+    anchors = np.asarray(anchors, dtype=float)
+    t = np.atleast_2d(np.asarray(arrivals, dtype=float))
+    n_epochs, n = t.shape
+    dim = anchors.shape[1]
+    rows = np.arange(n_epochs)
+
+    have = np.isfinite(t)
+    ref = have.argmax(axis=1)
+    count = have.sum(axis=1)
+
+    # reference anchor at the origin
+    a = anchors[None] - anchors[ref][:, None]
+    d = np.where(have, t - t[rows, ref][:, None], 0.0)
+    w = (have & (np.arange(n)[None] != ref[:, None])).astype(float)
+
+    # Chan: 2 a_i.p + 2 d_i r_0 = |a_i|^2 - d_i^2
+    b = (a ** 2).sum(axis=2) - d ** 2
+    lin = np.concatenate([2.0 * a, 2.0 * d[..., None]], axis=2)
+    h = np.einsum("en,enk,enc->ekc", w, lin, lin)
+    g = np.einsum("en,enk,en->ek", w, lin, b)
+    u, ok_full = _solve(h, g)
+    p = np.where(ok_full[:, None], u[:, :dim], 0.0)
+
+    # one equation short: p = v + s r_0 with |p| = r_0
+    minimal = count == dim + 1
+    if minimal.any():
+        lp = lin[minimal, :, :dim]
+        wm = w[minimal]
+        hp = np.einsum("en,enk,enc->ekc", wm, lp, lp)
+        v, ok_v = _solve(hp, np.einsum("en,enk,en->ek", wm, lp, b[minimal]))
+        s, _ = _solve(hp, -np.einsum("en,enk,en->ek", wm, lp, lin[minimal, :, dim]))
+
+        qa = (s * s).sum(axis=1) - 1.0
+        qb = 2.0 * (v * s).sum(axis=1)
+        qc = (v * v).sum(axis=1)
+
+        flat = np.abs(qa) < 1e-9
+        root = np.sqrt(np.maximum(qb * qb - 4.0 * qa * qc, 0.0))
+        with np.errstate(divide="ignore", invalid="ignore"):
+            r0 = np.stack([
+                np.where(flat, -qc / qb, (-qb + root) / (2.0 * qa)),
+                np.where(flat, np.nan, (-qb - root) / (2.0 * qa)),
+            ], axis=1)
+
+        # both roots fit exactly: keep the one nearer the anchors
+        have_m = have[minimal]
+        centre = (a[minimal] * have_m[..., None]).sum(axis=1) / have_m.sum(axis=1)[:, None]
+        cand = v[:, None, :] + s[:, None, :] * r0[..., None]
+        miss = _norm(cand - centre[:, None, :])
+        miss = np.where(np.isfinite(r0) & (r0 >= 0), miss, np.inf)
+        pick = miss.argmin(axis=1)
+        best = cand[np.arange(len(pick)), pick]
+        best = np.where(np.isfinite(miss.min(axis=1))[:, None], best, v)
+
+        p[minimal] = np.where(ok_v[:, None], best, 0.0)
+        ok_full[minimal] = ok_v
+
+    ok = ok_full & (count >= dim + 1)
+    p[~ok] = 0.0
+
+    for _ in range(iters):
+        r0 = np.maximum(_norm(p), 1e-9)
+        diff = p[:, None, :] - a
+        ri = np.maximum(_norm(diff), 1e-9)
+        f = ri - r0[:, None] - d
+        j = diff / ri[..., None] - (p / r0[:, None])[:, None, :]
+
+        h = np.einsum("en,enk,enc->ekc", w, j, j)
+        g = np.einsum("en,enk,en->ek", w, j, f)
+        step, ok_step = _solve(h, g)
+        ok &= ok_step
+
+        step[~ok] = 0.0
+        p -= step
+        if np.abs(step).max(initial=0.0) < GN_TOL:
+            break
+
+    f = _norm(p[:, None, :] - a) - _norm(p)[:, None] - d
+    rms = np.sqrt((w * f ** 2).sum(axis=1) / np.maximum(w.sum(axis=1), 1))
+
+    pos = p + anchors[ref]
+    pos[~ok] = np.nan
+    rms[~ok] = np.nan
+    return pos, rms
+
+
+# single fixes for the live tools
+
+def twr_fix(anchor_positions, distances, sigma=None):
+    """One TWR fix. anchor_positions and distances are {anchor_id: ...}.
+    Returns (pos tuple, rms, ids used) or None."""
+    ids = [aid for aid in distances if aid in anchor_positions]
+    if not ids:
+        return None
+
+    pos, rms, used = solve_twr([anchor_positions[aid] for aid in ids],
+                               [[distances[aid] for aid in ids]], sigma)
+    if not np.isfinite(pos[0]).all():
+        return None
+
+    return tuple(float(c) for c in pos[0]), float(rms[0]), [aid for aid, u in zip(ids, used[0]) if u]
+
+
+def tdoa_fix(anchor_positions, arrivals):
+    """One TDoA fix. arrivals is {anchor_id: arrival in meters}, e.g. the
+    range difference to a reference anchor that has 0. Returns
+    (pos tuple, rms) or None."""
+    ids = [aid for aid in arrivals if aid in anchor_positions]
+    if not ids:
+        return None
+
+    pos, rms = solve_tdoa([anchor_positions[aid] for aid in ids],
+                          [[arrivals[aid] for aid in ids]])
+    if not np.isfinite(pos[0]).all():
+        return None
+
+    return tuple(float(c) for c in pos[0]), float(rms[0])
+
+
+# recorded sessions
+
+def _load_twr_log(path):
+    """twr_record.py session log -> the JSON session layout"""
+    import uwb_log
+
+    with uwb_log.Reader(path) as log:
+        samples = {}
+        for rec in log:
+            if rec["type"] == "RANGE":
+                samples.setdefault(rec["sample"], {})[str(rec["anchor_id"])] = rec["distance_m"]
+        return {
+            "anchor_positions": log.meta.get("anchor_positions", {}),
+            "samples": [{"sample": k, "distances": v} for k, v in sorted(samples.items())],
+        }
+
+
+def load_twr_session(path):
+    """twr_record.py JSON or session log -> anchor ids, anchors (N, D),
+    ranges (E, N)."""
+    if path.endswith(".uwbl"):
+        session = _load_twr_log(path)
+    else:
+        with open(path) as f:
+            session = json.load(f)
+
+    ids = sorted(int(k) for k in session["anchor_positions"])
+    anchors = np.array([session["anchor_positions"][str(k)] for k in ids], dtype=float)
+    col = {aid: i for i, aid in enumerate(ids)}
+
+    ranges = np.full((len(session["samples"]), len(ids)), np.nan)
+    for e, sample in enumerate(session["samples"]):
+        for k, dist in sample["distances"].items():
+            if int(k) in col:
+                ranges[e, col[int(k)]] = dist
+
+    return ids, anchors, ranges
+
+
+def _triplet_fix(anchors, r):
+    """the per-triplet median the trilateration scripts used before"""
+    dim = anchors.shape[1]
+    avail = [i for i in range(len(r)) if np.isfinite(r[i])]
+    sols = []
+
+    for combo in combinations(avail, dim + 1):
+        a0 = anchors[combo[0]]
+        a = np.array([2.0 * (anchors[i] - a0) for i in combo[1:]])
+        b = np.array([r[combo[0]] ** 2 - r[i] ** 2 + anchors[i] @ anchors[i] - a0 @ a0
+                      for i in combo[1:]])
+        try:
+            sols.append(np.linalg.solve(a, b))
+        except np.linalg.LinAlgError:
+            continue
+
+    if not sols:
+        return None
+    return [median(s[k] for s in sols) for k in range(dim)]
+
+
+def bench(anchors, ranges, repeat):
+    r = np.tile(ranges, (repeat, 1))
+    n_epochs = len(r)
+    print(f"{n_epochs} epochs, {anchors.shape[0]} anchors, {anchors.shape[1]}D")
+
+    t0 = time.perf_counter()
+    pos, _, _ = solve_twr(anchors, r)
+    t_batch = time.perf_counter() - t0
+
+    # the per-epoch paths are slow, time a slice and scale
+    n_slow = min(n_epochs, 2000)
+
+    t0 = time.perf_counter()
+    for e in range(n_slow):
+        solve_twr(anchors, r[e:e + 1])
+    t_single = (time.perf_counter() - t0) * n_epochs / n_slow
+
+    t0 = time.perf_counter()
+    for e in range(n_slow):
+        _triplet_fix(anchors, r[e])
+    t_triplet = (time.perf_counter() - t0) * n_epochs / n_slow
+
+    print(f"  TWR batch       {t_batch * 1e3:9.1f} ms  {n_epochs / t_batch:10.0f} fixes/s")
+    print(f"  TWR per epoch   {t_single * 1e3:9.1f} ms  {n_epochs / t_single:10.0f} fixes/s")
+    print(f"  TWR triplets    {t_triplet * 1e3:9.1f} ms  {n_epochs / t_triplet:10.0f} fixes/s")
+
+    # TDoA arrivals from the TWR fixes, the sessions carry no TDoA
+    good = np.isfinite(pos).all(axis=1)
+    dist = np.linalg.norm(pos[good][:, None, :] - anchors[None], axis=2)
+    rng = np.random.default_rng(1)
+    arrivals = dist + rng.normal(0.0, 0.05, dist.shape)
+
+    t0 = time.perf_counter()
+    tpos, _ = solve_tdoa(anchors, arrivals)
+    t_tdoa = time.perf_counter() - t0
+    err = np.linalg.norm(tpos - pos[good], axis=1)
+
+    print(f"  TDoA batch      {t_tdoa * 1e3:9.1f} ms  {len(arrivals) / t_tdoa:10.0f} fixes/s"
+          f"  (synthetic, median err {np.nanmedian(err):.3f} m)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Batch position solver for recorded UWB sessions")
+    parser.add_argument("session", help="twr_record.py session (.uwbl or JSON)")
+    parser.add_argument("--out", metavar="FILE", help="Write fixes to CSV")
+    parser.add_argument("--bench", action="store_true", help="Time batch vs per-epoch solving")
+    parser.add_argument("--repeat", type=int, default=100,
+                        help="Tile the session this many times for --bench (default: 100)")
+    args = parser.parse_args()
+
+    ids, anchors, ranges = load_twr_session(args.session)
+
+    if args.bench:
+        bench(anchors, ranges, args.repeat)
+        return
+
+    pos, rms, used = solve_twr(anchors, ranges)
+    good = np.isfinite(pos).all(axis=1)
+    print(f"{good.sum()}/{len(pos)} epochs solved, anchors {ids}")
+
+    if good.any():
+        print(f"  mean position {np.round(pos[good].mean(axis=0), 3).tolist()} m, "
+              f"median rms {np.median(rms[good]):.3f} m")
+
+    if args.out:
+        with open(args.out, "w", newline="") as f:
+            writer = csv.writer(f)
+            axes = ["x", "y", "z"][:anchors.shape[1]]
+            writer.writerow(["sample"] + axes + ["rms", "used"])
+            for e in range(len(pos)):
+                if not good[e]:
+                    continue
+                writer.writerow([e] + [f"{c:.4f}" for c in pos[e]] + [f"{rms[e]:.4f}",
+                                " ".join(str(ids[i]) for i in np.flatnonzero(used[e]))])
+        print(f"Wrote {args.out}")
+
+
+if __name__ == "__main__":
+    main()
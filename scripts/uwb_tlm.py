@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""
+Decoder for the packed anchor telemetry sent by ble_tdoa_slave
+(lib/uwb/uwb_tlm.h).
+
+Each BLE notification is one packet of records from one anchor. decode()
+returns them as dicts in the same shape the old CSV lines were parsed
+into:
+
+  SYNC:  type, anchor_id, seq, tx_ts, rx_ts, offset, drift, corrected
+  BLINK: type, anchor_id, tag, seq, sync_seq, sync_tx_ts, corrected
+
+A blink is named by (tag, seq), the seq alone repeats across tags.
+
+sync_tx_ts of a BLINK is filled in from the last SYNC seen from that
+anchor, so keep one Decoder per connection.
+
+Usage as a tool, on hex dumps of notifications (one per line):
+  python3 uwb_tlm.py dump.txt
+"""
+
+import sys
+
+VERSION = 3
+HDR_LEN = 3
+
+SYNC = 1
+BLINK = 2
+
+SEQ_ESC = 0x3F
+
+# BLINK header low bits: tag and seq widths in bytes, or below these the
+# packet's tag number and a one-byte seq delta
+BLINK_SHORT = 0x3E
+BLINK_LONG = 0x3F
+BLINK_WIDTHS = {BLINK_SHORT: (2, 2), BLINK_LONG: (8, 4)}
+BLINK_TAGS = 21
+
+# Q32 skew -> master ticks per local tick
+SKEW_ONE = float(1 << 32)
+
+
+def _u40(b, i):
+    return int.from_bytes(b[i:i + 5], "little")
+
+
+def _s40(b, i):
+    v = _u40(b, i)
+    return v - (1 << 40) if v & (1 << 39) else v
+
+
+class DecodeError(ValueError):
+    pass
+
+
+class Decoder:
+    def __init__(self):
+        # {anchor_id: (sync_seq, tx_ts)}
+        self.last_sync = {}
+
+    def decode(self, data):
+        data = bytes(data)
+        if len(data) < HDR_LEN:
+            raise DecodeError("short packet")
+        if data[0] != VERSION:
+            raise DecodeError(f"unknown version {data[0]}")
+
+        anchor_id = data[1]
+        count = data[2]
+        last_seq = {}
+        tags = []           # [tag, last seq] by tag number
+        out = []
+        i = HDR_LEN
+
+        for _ in range(count):
+            if i >= len(data):
+                raise DecodeError("truncated packet")
+
+            hdr = data[i]
+            i += 1
+            rtype = hdr >> 6
+            low = hdr & SEQ_ESC
+
+            if rtype == SYNC:
+                if low == SEQ_ESC:
+                    if i >= len(data):
+                        raise DecodeError("truncated SYNC")
+                    seq = data[i]
+                    i += 1
+                else:
+                    if rtype not in last_seq:
+                        raise DecodeError("seq delta without a base")
+                    seq = (last_seq[rtype] + low) & 0xFF
+                last_seq[rtype] = seq
+
+                if i + 24 > len(data):
+                    raise DecodeError("truncated SYNC")
+                tx_ts = _u40(data, i)
+                skew = int.from_bytes(data[i + 15:i + 19], "little", signed=True)
+                rec = {
+                    "type": "SYNC", "anchor_id": anchor_id, "seq": seq,
+                    "tx_ts": tx_ts,
+                    "rx_ts": _u40(data, i + 5),
+                    "offset": _s40(data, i + 10),
+                    "drift": 1.0 - skew / SKEW_ONE,
+                    "corrected": _u40(data, i + 19),
+                }
+                self.last_sync[anchor_id] = (seq, tx_ts)
+                i += 24
+            elif rtype == BLINK:
+                if low in BLINK_WIDTHS:
+                    tag_len, seq_len = BLINK_WIDTHS[low]
+                else:
+                    if low >= len(tags):
+                        raise DecodeError(f"unknown tag number {low}")
+                    tag_len, seq_len = 0, 1
+                body = 1 + tag_len + seq_len + 5
+                if i + body > len(data):
+                    raise DecodeError("truncated BLINK")
+                sync_seq = data[i]
+                j = i + 1 + tag_len
+                if tag_len:
+                    tag = int.from_bytes(data[i + 1:j], "little")
+                    seq = int.from_bytes(data[j:j + seq_len], "little")
+                    ent = next((t for t in tags if t[0] == tag), None)
+                    if ent:
+                        ent[1] = seq
+                    elif len(tags) < BLINK_TAGS:
+                        tags.append([tag, seq])
+                else:
+                    ent = tags[low]
+                    tag = ent[0]
+                    seq = ent[1] = (ent[1] + data[j]) & 0xFFFFFFFF
+                last = self.last_sync.get(anchor_id)
+                rec = {
+                    "type": "BLINK", "anchor_id": anchor_id,
+                    "tag": tag,
+                    "seq": seq,
+                    "sync_seq": sync_seq,
+                    "sync_tx_ts": last[1] if last and last[0] == sync_seq else 0,
+                    "corrected": _u40(data, j + seq_len),
+                }
+                i += body
+            else:
+                raise DecodeError(f"unknown record type {rtype}")
+
+            out.append(rec)
+
+        return out
+
+
+def main():
+    dec = Decoder()
+    src = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    for line in src:
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            for rec in dec.decode(bytes.fromhex(line)):
+                print(rec)
+        except (ValueError, DecodeError) as e:
+            print(f"WARN {e}: {line}")
+
+
+if __name__ == "__main__":
+    main()
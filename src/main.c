@@ -7,13 +7,13 @@
 #include "deca_probe_interface.h"
 #include "dw3000_hw.h"
 #include "port.h"
+#include "uwb_msg.h"
 
 LOG_MODULE_REGISTER(tdoa_tag, LOG_LEVEL_INF);
 
+#define TAG_ID 1
 #define ANT_DLY 26194
 
-#define MSG_BLINK 0x20
-
 static dwt_config_t config = {
     .chan = 9,
     .txPreambLength = DWT_PLEN_128,
@@ -60,16 +60,15 @@ static int uwb_init(void)
 
 static void tag_loop(void)
 {
-    uint8_t tx_buf[2];
-    static uint8_t blink_seq = 0;
+    uint8_t tx_buf[UWB_MSG_BLINK_LEN];
+    static struct uwb_msg_blink blink = { .tag = TAG_ID };
 
     while(1)
     {
-        tx_buf[0] = MSG_BLINK;
-        tx_buf[1] = blink_seq++;
+        uwb_msg_blink_pack(&blink, tx_buf);
 
-        dwt_writetxdata(2, tx_buf, 0);
-        dwt_writetxfctrl(2 + FCS_LEN, 0, 0);
+        dwt_writetxdata(sizeof(tx_buf), tx_buf, 0);
+        dwt_writetxfctrl(sizeof(tx_buf) + FCS_LEN, 0, 0);
 
         dwt_starttx(DWT_START_TX_IMMEDIATE);
 
@@ -78,7 +77,7 @@ static void tag_loop(void)
 
         dwt_writesysstatuslo(DWT_INT_TXFRS_BIT_MASK);
 
-        LOG_INF("BLINK sent seq=%u", tx_buf[1]);
+        LOG_INF("BLINK sent seq=%u", blink.seq++);
 
         k_msleep(100);  // 10 Hz
     }
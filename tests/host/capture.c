@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture.h"
+
+static void field(struct cap_rec *r, const char *key, const char *val)
+{
+    if(strcmp(key, "type") == 0)
+    {
+        if(strncmp(val, "\"SYNC\"", 6) == 0)
+            r->type = CAP_SYNC;
+        else if(strncmp(val, "\"BLINK\"", 7) == 0)
+            r->type = CAP_BLINK;
+        else if(strncmp(val, "\"TDOA\"", 6) == 0)
+            r->type = CAP_TDOA;
+        else if(strncmp(val, "\"POS\"", 5) == 0)
+            r->type = CAP_POS;
+    }
+    else if(strcmp(key, "anchor_id") == 0)
+        r->anchor_id = atoi(val);
+    else if(strcmp(key, "ref_anchor") == 0)
+        r->ref_anchor = atoi(val);
+    else if(strcmp(key, "seq") == 0)
+        r->seq = atoi(val);
+    else if(strcmp(key, "blink_seq") == 0)
+        r->blink_seq = atoi(val);
+    else if(strcmp(key, "sync_seq") == 0)
+        r->sync_seq = atoi(val);
+    else if(strcmp(key, "tx_ts") == 0)
+        r->tx_ts = strtoull(val, NULL, 10);
+    else if(strcmp(key, "rx_ts") == 0)
+        r->rx_ts = strtoull(val, NULL, 10);
+    else if(strcmp(key, "sync_tx_ts") == 0)
+        r->sync_tx_ts = strtoull(val, NULL, 10);
+    else if(strcmp(key, "master_time") == 0)
+        r->master_time = strtod(val, NULL);
+    else if(strcmp(key, "delta_ticks") == 0)
+        r->delta_ticks = strtod(val, NULL);
+    else if(strcmp(key, "x_m") == 0)
+        r->x_m = strtod(val, NULL);
+    else if(strcmp(key, "y_m") == 0)
+        r->y_m = strtod(val, NULL);
+}
+
+int capture_load(const char *path, struct cap_rec **recs)
+{
+    FILE *f = fopen(path, "r");
+    struct cap_rec *out = NULL, cur;
+    int n = 0, cap = 0, open = 0;
+    char line[512];
+
+    if(!f)
+        return -1;
+
+    while(fgets(line, sizeof(line), f))
+    {
+        char *p = line + strspn(line, " \t");
+
+        if(*p == '{')
+        {
+            memset(&cur, 0, sizeof(cur));
+            cur.anchor_id = cur.ref_anchor = -1;
+            open = 1;
+        }
+        else if(*p == '}' && open)
+        {
+            if(n == cap)
+            {
+                struct cap_rec *g;
+
+                cap = cap ? 2 * cap : 1024;
+                g = realloc(out, sizeof(*out) * cap);
+                if(!g)
+                {
+                    free(out);
+                    fclose(f);
+                    return -1;
+                }
+                out = g;
+            }
+            out[n++] = cur;
+            open = 0;
+        }
+        else if(*p == '"' && open)
+        {
+            char *end = strchr(p + 1, '"');
+
+            if(!end || end[1] != ':')
+                continue;
+
+            *end = '\0';
+            field(&cur, p + 1, end + 2 + strspn(end + 2, " "));
+        }
+    }
+
+    fclose(f);
+    *recs = out;
+    return n;
+}
@@ -0,0 +1,38 @@
+#ifndef HOST_CAPTURE_H
+#define HOST_CAPTURE_H
+
+#include <stdint.h>
+
+/* Reader for the ble_tdoa_multi_client.py captures
+ * (samples/ble_tdoa_slave/tdoa_data*.json): a pretty-printed JSON list
+ * of flat records, one "key": value per line. Only the fields the host
+ * tests use are kept; absent ones read as 0 (anchor ids as -1). */
+
+enum cap_type {
+    CAP_OTHER,
+    CAP_SYNC,
+    CAP_BLINK,
+    CAP_TDOA,
+    CAP_POS,
+};
+
+struct cap_rec {
+    enum cap_type type;
+    int      anchor_id;
+    int      ref_anchor;
+    int      seq;           /* SYNC */
+    int      blink_seq;
+    int      sync_seq;
+    uint64_t tx_ts;         /* SYNC */
+    uint64_t rx_ts;         /* SYNC */
+    uint64_t sync_tx_ts;    /* BLINK */
+    double   master_time;   /* BLINK, the anchor's master-time estimate */
+    double   delta_ticks;   /* TDOA */
+    double   x_m, y_m;      /* POS */
+};
+
+/* loads path into a malloc'd array (free() it), returns the record
+ * count or -1 */
+int capture_load(const char *path, struct cap_rec **recs);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef HOST_ZEPHYR_KERNEL_H
+#define HOST_ZEPHYR_KERNEL_H
+
+/* Host stand-ins for the Zephyr kernel objects lib/uwb uses, enough to
+ * run the library off target (tests/host).
+ *
+ * Objects are guarded by one process-wide lock, so the SPSC ring can be
+ * driven from two pthreads. A wait on an empty fifo or semaphore first
+ * runs the idle hook, which lets a simulated radio fire its next event
+ * from the waiting thread, the way the IRQ would preempt it on target.
+ * Without a hook the wait blocks on a condition variable. Timeouts are
+ * in milliseconds. */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <zephyr/toolchain.h>
+#include <zephyr/sys/atomic.h>
+#include <zephyr/sys/util.h>
+
+typedef struct {
+    int64_t ms;
+} k_timeout_t;
+
+#define K_NO_WAIT       ((k_timeout_t){0})
+#define K_FOREVER       ((k_timeout_t){-1})
+#define K_MSEC(ms)      ((k_timeout_t){(ms)})
+#define K_USEC(us)      ((k_timeout_t){((us) + 999) / 1000})
+
+#define __ASSERT(c, ...)    assert(c)
+#define __ASSERT_NO_MSG(c)  assert(c)
+
+/* called instead of blocking while the hook returns nonzero (it did
+ * something that may have satisfied the wait) */
+typedef int (*k_host_idle_t)(void);
+void k_host_set_idle(k_host_idle_t hook);
+
+/* fifo, items start with a reserved pointer */
+struct k_fifo {
+    void *head;
+    void *tail;
+};
+
+#define K_FIFO_DEFINE(name) struct k_fifo name = { NULL, NULL }
+
+void k_fifo_put(struct k_fifo *f, void *item);
+void *k_fifo_get(struct k_fifo *f, k_timeout_t timeout);
+
+struct k_sem {
+    unsigned int count;
+    unsigned int limit;
+};
+
+#define K_SEM_DEFINE(name, init, lim) struct k_sem name = { (init), (lim) }
+
+int k_sem_init(struct k_sem *s, unsigned int init, unsigned int limit);
+void k_sem_give(struct k_sem *s);
+int k_sem_take(struct k_sem *s, k_timeout_t timeout);
+void k_sem_reset(struct k_sem *s);
+unsigned int k_sem_count_get(struct k_sem *s);
+
+struct k_mem_slab {
+    char    *buffer;
+    size_t   block_size;
+    uint32_t num_blocks;
+    uint32_t num_used;
+    void    *free_list;
+    bool     ready;
+};
+
+#define K_MEM_SLAB_DEFINE_STATIC(name, size, n, align)                      \
+    static char __attribute__((aligned(align))) name##_buffer[(size) * (n)]; \
+    static struct k_mem_slab name = { name##_buffer, (size), (n), 0, NULL, false }
+
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, k_timeout_t timeout);
+void k_mem_slab_free(struct k_mem_slab *slab, void *mem);
+uint32_t k_mem_slab_num_used_get(struct k_mem_slab *slab);
+
+/* time, from the host monotonic clock unless a test sets it */
+int64_t k_uptime_get(void);
+uint32_t k_uptime_get_32(void);
+uint32_t k_cycle_get_32(void);
+void k_busy_wait(uint32_t us);
+int32_t k_msleep(int32_t ms);
+
+/* freeze k_uptime_get() at ms, or follow the host clock again with -1 */
+void k_host_set_uptime(int64_t ms);
+
+#endif
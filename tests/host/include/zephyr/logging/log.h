@@ -0,0 +1,21 @@
+#ifndef HOST_ZEPHYR_LOGGING_LOG_H
+#define HOST_ZEPHYR_LOGGING_LOG_H
+
+#include <stdio.h>
+
+/* warnings and errors go to stderr, the rest is dropped */
+
+#define LOG_LEVEL_ERR 1
+#define LOG_LEVEL_WRN 2
+#define LOG_LEVEL_INF 3
+#define LOG_LEVEL_DBG 4
+
+#define LOG_MODULE_REGISTER(...)
+#define LOG_MODULE_DECLARE(...)
+
+#define LOG_ERR(fmt, ...) fprintf(stderr, "E: " fmt "\n", ##__VA_ARGS__)
+#define LOG_WRN(fmt, ...) fprintf(stderr, "W: " fmt "\n", ##__VA_ARGS__)
+#define LOG_INF(fmt, ...) do { } while(0)
+#define LOG_DBG(fmt, ...) do { } while(0)
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef HOST_ZEPHYR_SYS_ATOMIC_H
+#define HOST_ZEPHYR_SYS_ATOMIC_H
+
+#include <stdbool.h>
+
+/* Zephyr's atomic API on the GCC builtins, sequentially consistent */
+
+typedef long atomic_t;
+typedef long atomic_val_t;
+
+static inline atomic_val_t atomic_get(const atomic_t *t)
+{
+    return __atomic_load_n(t, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_set(atomic_t *t, atomic_val_t v)
+{
+    return __atomic_exchange_n(t, v, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_inc(atomic_t *t)
+{
+    return __atomic_fetch_add(t, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_dec(atomic_t *t)
+{
+    return __atomic_fetch_sub(t, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline atomic_val_t atomic_add(atomic_t *t, atomic_val_t v)
+{
+    return __atomic_fetch_add(t, v, __ATOMIC_SEQ_CST);
+}
+
+static inline bool atomic_cas(atomic_t *t, atomic_val_t old, atomic_val_t v)
+{
+    return __atomic_compare_exchange_n(t, &old, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef HOST_ZEPHYR_SYS_UTIL_H
+#define HOST_ZEPHYR_SYS_UTIL_H
+
+#define ARRAY_SIZE(a)   (sizeof(a) / sizeof((a)[0]))
+#define MIN(a, b)       (((a) < (b)) ? (a) : (b))
+#define MAX(a, b)       (((a) > (b)) ? (a) : (b))
+#define ARG_UNUSED(x)   (void)(x)
+
+#endif
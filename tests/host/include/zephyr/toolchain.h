@@ -0,0 +1,6 @@
+#ifndef HOST_ZEPHYR_TOOLCHAIN_H
+#define HOST_ZEPHYR_TOOLCHAIN_H
+
+#define BUILD_ASSERT(c, ...) _Static_assert(c, "" __VA_ARGS__)
+
+#endif
@@ -0,0 +1,188 @@
+/* Replays the SYNCs of a capture through uwb_clock, one filter per
+ * anchor, and reports how well each tracks the master.
+ *
+ *   replay_clock [--one-step] [--states 2|3] [--gate sigmas] [--skew-q q]
+ *                capture.json...
+ *
+ * The captures in samples/ble_tdoa_slave predate the one-step SYNC: the
+ * tx_ts of SYNC n is the master TX time of SYNC n-1, so it is paired
+ * with the RX time of the previous record and pairs across a lost SYNC
+ * are skipped. --one-step pairs each record with itself.
+ *
+ * The residual is the filter's prediction of the master TX time minus
+ * the one received, before the update. Exits nonzero if a filter
+ * restarted or gated out more than 5% of its SYNCs. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uwb_clock.h"
+#include "uwb_ts.h"
+
+#include "capture.h"
+
+#define MAX_ANCHORS     16
+#define BURN_IN         20      /* pairs before residuals count */
+#define MAX_REJECT_RATE 0.05
+
+struct anchor {
+    int id;
+    struct uwb_clock clock;
+    const struct cap_rec *prev;
+    int pairs, gaps, rejected, restarts;
+    double *res;
+    int n_res;
+};
+
+static int cmp_abs(const void *a, const void *b)
+{
+    double x = fabs(*(const double *)a), y = fabs(*(const double *)b);
+
+    return (x > y) - (x < y);
+}
+
+static struct anchor *anchor_get(struct anchor *an, int *n, int id, int max_pairs,
+                                 const struct uwb_clock_cfg *cfg)
+{
+    for(int i = 0; i < *n; i++)
+        if(an[i].id == id)
+            return &an[i];
+
+    if(*n == MAX_ANCHORS)
+        return NULL;
+
+    struct anchor *a = &an[(*n)++];
+
+    memset(a, 0, sizeof(*a));
+    a->id = id;
+    a->res = malloc(sizeof(*a->res) * max_pairs);
+    uwb_clock_init(&a->clock, cfg);
+
+    return a;
+}
+
+static void feed(struct anchor *a, uint64_t local_rx, uint64_t master_tx)
+{
+    struct uwb_clock *c = &a->clock;
+    double r = 0;
+    int counted = c->valid && a->pairs >= BURN_IN;
+
+    if(c->valid)
+        r = (double)uwb_ts_sub(uwb_clock_to_master(c, local_rx), master_tx);
+
+    a->pairs++;
+
+    if(uwb_clock_sync(c, local_rx, master_tx) != 0)
+    {
+        a->rejected++;
+
+        /* a restart clears the reject run */
+        if(c->rejects == 0)
+            a->restarts++;
+        return;
+    }
+
+    if(counted)
+        a->res[a->n_res++] = r;
+}
+
+static int replay(const char *path, int one_step, const struct uwb_clock_cfg *cfg)
+{
+    struct cap_rec *recs;
+    struct anchor an[MAX_ANCHORS];
+    int n_an = 0, bad = 0;
+    int n = capture_load(path, &recs);
+
+    if(n < 0)
+    {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return 1;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        const struct cap_rec *r = &recs[i];
+
+        if(r->type != CAP_SYNC)
+            continue;
+
+        struct anchor *a = anchor_get(an, &n_an, r->anchor_id, n, cfg);
+        if(!a)
+            continue;
+
+        if(one_step)
+            feed(a, r->rx_ts, r->tx_ts);
+        else if(a->prev && ((r->seq - a->prev->seq) & 0xFF) == 1)
+            feed(a, a->prev->rx_ts, r->tx_ts);
+        else if(a->prev)
+            a->gaps++;
+
+        a->prev = r;
+    }
+
+    printf("%s\n", path);
+    printf("  anchor  pairs  gaps  rejected  restarts  rms[tick]  p99[tick]  max[tick]  skew[ppm]  sigma[ps]\n");
+
+    for(int i = 0; i < n_an; i++)
+    {
+        struct anchor *a = &an[i];
+        double ss = 0, p99 = 0, max = 0;
+
+        for(int j = 0; j < a->n_res; j++)
+            ss += a->res[j] * a->res[j];
+
+        qsort(a->res, a->n_res, sizeof(*a->res), cmp_abs);
+        if(a->n_res)
+        {
+            p99 = fabs(a->res[(int)(0.99 * (a->n_res - 1))]);
+            max = fabs(a->res[a->n_res - 1]);
+        }
+
+        printf("  %6d  %5d  %4d  %8d  %8d  %9.1f  %9.1f  %9.1f  %9.3f  %9.1f\n",
+               a->id, a->pairs, a->gaps, a->rejected, a->restarts,
+               a->n_res ? sqrt(ss / a->n_res) : 0.0, p99, max,
+               uwb_clock_skew_ppm(&a->clock), uwb_clock_sigma_ps(&a->clock));
+
+        if(a->restarts || a->rejected > MAX_REJECT_RATE * a->pairs)
+            bad = 1;
+
+        free(a->res);
+    }
+
+    free(recs);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    struct uwb_clock_cfg cfg = uwb_clock_default_cfg;
+    int one_step = 0, bad = 0, files = 0;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--one-step") == 0)
+            one_step = 1;
+        else if(strcmp(argv[i], "--states") == 0 && i + 1 < argc)
+            cfg.states = atoi(argv[++i]);
+        else if(strcmp(argv[i], "--gate") == 0 && i + 1 < argc)
+            cfg.gate = atof(argv[++i]);
+        else if(strcmp(argv[i], "--skew-q") == 0 && i + 1 < argc)
+            cfg.skew_q = atof(argv[++i]);
+        else
+        {
+            bad |= replay(argv[i], one_step, &cfg);
+            files++;
+        }
+    }
+
+    if(!files)
+    {
+        fprintf(stderr, "usage: %s [--one-step] [--states 2|3] [--gate sigmas] [--skew-q q] capture.json...\n",
+                argv[0]);
+        return 2;
+    }
+
+    return bad;
+}
@@ -0,0 +1,248 @@
+#include <pthread.h>
+#include <time.h>
+
+#include <zephyr/kernel.h>
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t changed = PTHREAD_COND_INITIALIZER;
+static k_host_idle_t idle;
+static int64_t uptime_ms = -1;
+
+void k_host_set_idle(k_host_idle_t hook)
+{
+    idle = hook;
+}
+
+static int64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* wait for ready() under the lock. returns 0 once it holds, -1 on
+ * timeout. the idle hook runs unlocked, it may put or give. */
+static int wait_for(bool (*ready)(void *), void *obj, k_timeout_t timeout)
+{
+    struct timespec until;
+
+    /* condvars time out on the realtime clock */
+    clock_gettime(CLOCK_REALTIME, &until);
+    if(timeout.ms > 0)
+    {
+        int64_t ns = until.tv_nsec + timeout.ms * 1000000;
+        until.tv_sec += ns / 1000000000;
+        until.tv_nsec = ns % 1000000000;
+    }
+
+    while(!ready(obj))
+    {
+        if(timeout.ms == 0)
+            return -1;
+
+        if(idle)
+        {
+            pthread_mutex_unlock(&lock);
+            int busy = idle();
+            pthread_mutex_lock(&lock);
+
+            /* nothing left to happen, a real kernel would time out */
+            if(!busy && !ready(obj))
+                return -1;
+        }
+        else if(timeout.ms < 0)
+        {
+            pthread_cond_wait(&changed, &lock);
+        }
+        else if(pthread_cond_timedwait(&changed, &lock, &until) != 0)
+        {
+            return ready(obj) ? 0 : -1;
+        }
+    }
+
+    return 0;
+}
+
+void k_fifo_put(struct k_fifo *f, void *item)
+{
+    pthread_mutex_lock(&lock);
+
+    *(void **)item = NULL;
+    if(f->tail)
+        *(void **)f->tail = item;
+    else
+        f->head = item;
+    f->tail = item;
+
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+static bool fifo_ready(void *obj)
+{
+    return ((struct k_fifo *)obj)->head != NULL;
+}
+
+void *k_fifo_get(struct k_fifo *f, k_timeout_t timeout)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&lock);
+
+    if(wait_for(fifo_ready, f, timeout) == 0)
+    {
+        item = f->head;
+        f->head = *(void **)item;
+        if(!f->head)
+            f->tail = NULL;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return item;
+}
+
+int k_sem_init(struct k_sem *s, unsigned int init, unsigned int limit)
+{
+    s->count = init;
+    s->limit = limit;
+
+    return 0;
+}
+
+void k_sem_give(struct k_sem *s)
+{
+    pthread_mutex_lock(&lock);
+
+    if(s->count < s->limit)
+        s->count++;
+
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+}
+
+static bool sem_ready(void *obj)
+{
+    return ((struct k_sem *)obj)->count > 0;
+}
+
+int k_sem_take(struct k_sem *s, k_timeout_t timeout)
+{
+    int ret;
+
+    pthread_mutex_lock(&lock);
+
+    ret = wait_for(sem_ready, s, timeout);
+    if(ret == 0)
+        s->count--;
+
+    pthread_mutex_unlock(&lock);
+
+    return ret == 0 ? 0 : -11;
+}
+
+void k_sem_reset(struct k_sem *s)
+{
+    pthread_mutex_lock(&lock);
+    s->count = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+unsigned int k_sem_count_get(struct k_sem *s)
+{
+    return s->count;
+}
+
+int k_mem_slab_alloc(struct k_mem_slab *slab, void **mem, k_timeout_t timeout)
+{
+    int ret = -12;
+
+    (void)timeout;
+
+    pthread_mutex_lock(&lock);
+
+    if(!slab->ready)
+    {
+        for(uint32_t i = slab->num_blocks; i-- > 0;)
+        {
+            void *b = slab->buffer + i * slab->block_size;
+            *(void **)b = slab->free_list;
+            slab->free_list = b;
+        }
+        slab->ready = true;
+    }
+
+    if(slab->free_list)
+    {
+        *mem = slab->free_list;
+        slab->free_list = *(void **)*mem;
+        slab->num_used++;
+        ret = 0;
+    }
+
+    pthread_mutex_unlock(&lock);
+
+    return ret;
+}
+
+void k_mem_slab_free(struct k_mem_slab *slab, void *mem)
+{
+    pthread_mutex_lock(&lock);
+
+    assert((char *)mem >= slab->buffer &&
+           (char *)mem < slab->buffer + slab->num_blocks * slab->block_size);
+    assert(slab->num_used > 0);
+
+    *(void **)mem = slab->free_list;
+    slab->free_list = mem;
+    slab->num_used--;
+
+    pthread_mutex_unlock(&lock);
+}
+
+uint32_t k_mem_slab_num_used_get(struct k_mem_slab *slab)
+{
+    return slab->num_used;
+}
+
+void k_host_set_uptime(int64_t ms)
+{
+    uptime_ms = ms;
+}
+
+int64_t k_uptime_get(void)
+{
+    if(uptime_ms >= 0)
+        return uptime_ms;
+
+    return mono_ns() / 1000000;
+}
+
+uint32_t k_uptime_get_32(void)
+{
+    return (uint32_t)k_uptime_get();
+}
+
+uint32_t k_cycle_get_32(void)
+{
+    return (uint32_t)mono_ns();
+}
+
+void k_busy_wait(uint32_t us)
+{
+    int64_t end = mono_ns() + (int64_t)us * 1000;
+
+    while(mono_ns() < end)
+        ;
+}
+
+int32_t k_msleep(int32_t ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    nanosleep(&ts, NULL);
+
+    return 0;
+}
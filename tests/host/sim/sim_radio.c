@@ -0,0 +1,605 @@
+#include <string.h>
+
+#include <zephyr/kernel.h>
+
+#include "deca_device_api.h"
+#include "deca_probe_interface.h"
+#include "dw3000_hw.h"
+#include "dw3000_spi.h"
+#include "port.h"
+
+#include "sim_radio.h"
+
+enum ev_kind { EV_FRAME, EV_TIMEOUT, EV_ERROR, EV_OVERRUN, EV_TX_DONE };
+
+struct ev {
+    enum ev_kind kind;
+    uint8_t  data[128];
+    uint16_t len;
+    uint64_t ts;
+    uint32_t iv0;       /* STS counter word it was sent with */
+    int      iv_any;    /* sent before sim_radio_sts_peer(), always matches */
+};
+
+static struct {
+    dwt_cb_t tx_done, rx_ok, rx_to, rx_err;
+    port_deca_isr_t isr;
+
+    struct ev queue[SIM_RADIO_QUEUE_LEN];
+    int q_head, q_len;
+
+    /* event dwt_isr() is reporting, read back through dwt_read*() */
+    struct ev cur;
+
+    uint8_t  tx_buf[128];
+    uint16_t tx_len;
+    uint32_t dly;
+    int      tx_pending;
+    int      tx_resp;
+    uint64_t tx_ts;
+    int      late;
+
+    int      rx_on;
+    int      dbl_buf;
+    uint32_t rx_timeout_uus;
+    uint16_t ant_dly;
+    uint64_t now;
+    int      mutex_depth;
+    int      sts_used;
+    uint32_t iv0_cfg;       /* dwt_configurestsiv() */
+    uint32_t iv0;           /* loaded by dwt_configurestsloadiv() */
+    uint32_t peer_iv0;
+    int      peer_iv_set;
+    uint32_t last_iv0;
+    int      sts_frames;
+    int      sts_bad;       /* frame dwt_isr() is reporting */
+
+    sim_radio_tx_hook_t hook;
+    struct sim_radio_stats stats;
+} r;
+
+static int idle(void);
+
+void sim_radio_reset(void)
+{
+    memset(&r, 0, sizeof(r));
+    k_host_set_idle(idle);
+}
+
+static int push(enum ev_kind kind, const uint8_t *data, uint16_t len, uint64_t ts)
+{
+    if(r.q_len == SIM_RADIO_QUEUE_LEN || len > sizeof(r.queue[0].data))
+        return -1;
+
+    struct ev *e = &r.queue[(r.q_head + r.q_len++) % SIM_RADIO_QUEUE_LEN];
+
+    e->kind = kind;
+    e->len = len;
+    e->ts = ts;
+    e->iv0 = r.peer_iv0;
+    e->iv_any = !r.peer_iv_set;
+    if(len)
+        memcpy(e->data, data, len);
+
+    return 0;
+}
+
+int sim_radio_rx_frame(const uint8_t *data, uint16_t len, uint64_t rx_ts)
+{
+    return push(EV_FRAME, data, len, rx_ts);
+}
+
+int sim_radio_rx_timeout(void)
+{
+    return push(EV_TIMEOUT, NULL, 0, 0);
+}
+
+int sim_radio_rx_error(void)
+{
+    return push(EV_ERROR, NULL, 0, 0);
+}
+
+int sim_radio_rx_overrun(void)
+{
+    return push(EV_OVERRUN, NULL, 0, 0);
+}
+
+void sim_radio_tx_late(int n)
+{
+    r.late = n;
+}
+
+void sim_radio_on_tx(sim_radio_tx_hook_t hook)
+{
+    r.hook = hook;
+}
+
+const uint8_t *sim_radio_tx_frame(uint16_t *len)
+{
+    *len = r.tx_len;
+    return r.tx_buf;
+}
+
+int sim_radio_rx_on(void)
+{
+    return r.rx_on;
+}
+
+int sim_radio_queued(void)
+{
+    return r.q_len;
+}
+
+void sim_radio_get_stats(struct sim_radio_stats *s)
+{
+    *s = r.stats;
+}
+
+int sim_radio_mutex_depth(void)
+{
+    return r.mutex_depth;
+}
+
+/* raise the IRQ for e, the registered ISR calls dwt_isr() */
+static void fire(const struct ev *e)
+{
+    r.cur = *e;
+    r.stats.isr_calls++;
+
+    /* on target the IRQ thread would block on the driver mutex here */
+    if(r.mutex_depth)
+        r.stats.isr_locked++;
+
+    if(r.isr)
+        r.isr();
+}
+
+/* a frame went out or came in on the current STS counter */
+static void sts_frame(void)
+{
+    if(r.sts_used)
+        r.stats.sts_stale++;
+    if(r.sts_frames++ && r.iv0 == r.last_iv0)
+        r.stats.sts_repeat++;
+
+    r.sts_used = 1;
+    r.last_iv0 = r.iv0;
+}
+
+static int idle(void)
+{
+    if(r.tx_pending)
+    {
+        struct ev e = { .kind = EV_TX_DONE, .ts = r.tx_ts };
+
+        r.tx_pending = 0;
+        r.stats.tx_done++;
+        r.now = r.tx_ts;
+        sts_frame();
+
+        /* the receiver is on before the host hears about the TX */
+        if(r.tx_resp)
+            r.rx_on = 1;
+
+        fire(&e);
+
+        if(r.hook)
+            r.hook(r.tx_buf, r.tx_len, r.tx_ts);
+
+        return 1;
+    }
+
+    if(!r.rx_on)
+        return 0;
+
+    if(r.q_len)
+    {
+        struct ev e = r.queue[r.q_head];
+
+        r.q_head = (r.q_head + 1) % SIM_RADIO_QUEUE_LEN;
+        r.q_len--;
+
+        /* single buffer RX ends with any event, double buffer RX only
+         * stops on errors */
+        if(!r.dbl_buf || e.kind != EV_FRAME)
+            r.rx_on = 0;
+
+        if(e.kind == EV_FRAME)
+        {
+            r.now = e.ts;
+            r.sts_bad = !e.iv_any && e.iv0 != r.iv0;
+            sts_frame();
+        }
+
+        fire(&e);
+
+        return 1;
+    }
+
+    if(!r.dbl_buf && r.rx_timeout_uus)
+    {
+        struct ev e = { .kind = EV_TIMEOUT };
+
+        r.rx_on = 0;
+        fire(&e);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+int sim_radio_run(void)
+{
+    int n = 0;
+
+    while(idle())
+        n++;
+
+    return n;
+}
+
+/* driver */
+
+void dwt_isr(void)
+{
+    dwt_cb_data_t cb = { 0 };
+
+    switch(r.cur.kind)
+    {
+    case EV_TX_DONE:
+        cb.status = DWT_INT_TXFRS_BIT_MASK;
+        if(r.tx_done)
+            r.tx_done(&cb);
+        break;
+
+    case EV_FRAME:
+        cb.status = DWT_INT_RXFCG_BIT_MASK;
+        cb.datalength = r.cur.len + FCS_LEN;
+        if(r.rx_ok)
+            r.rx_ok(&cb);
+        break;
+
+    case EV_TIMEOUT:
+        cb.status = DWT_INT_RXFTO_BIT_MASK;
+        if(r.rx_to)
+            r.rx_to(&cb);
+        break;
+
+    case EV_ERROR:
+        cb.status = DWT_INT_RXPHE_BIT_MASK;
+        if(r.rx_err)
+            r.rx_err(&cb);
+        break;
+
+    case EV_OVERRUN:
+        cb.status = DWT_INT_RXOVRR_BIT_MASK;
+        if(r.rx_err)
+            r.rx_err(&cb);
+        break;
+    }
+}
+
+void dwt_setcallbacks(dwt_cb_t cbTxDone, dwt_cb_t cbRxOk, dwt_cb_t cbRxTo, dwt_cb_t cbRxErr,
+                      dwt_cb_t cbSPIErr, dwt_cb_t cbSPIRdy, dwt_cb_t cbDualSPIEv)
+{
+    (void)cbSPIErr;
+    (void)cbSPIRdy;
+    (void)cbDualSPIEv;
+
+    r.tx_done = cbTxDone;
+    r.rx_ok = cbRxOk;
+    r.rx_to = cbRxTo;
+    r.rx_err = cbRxErr;
+}
+
+void dwt_setinterrupt(uint32_t bitmask_lo, uint32_t bitmask_hi, dwt_INT_options_e INT_options)
+{
+    (void)bitmask_lo;
+    (void)bitmask_hi;
+    (void)INT_options;
+}
+
+void dwt_setinterrupt_db(uint8_t bitmask, dwt_INT_options_e INT_options)
+{
+    (void)bitmask;
+    (void)INT_options;
+}
+
+void dwt_writesysstatuslo(uint32_t mask)
+{
+    (void)mask;
+}
+
+void dwt_setdblrxbuffmode(dwt_dbl_buff_state_e dbl_buff_state, dwt_dbl_buff_mode_e dbl_buff_mode)
+{
+    (void)dbl_buff_mode;
+
+    r.dbl_buf = (dbl_buff_state == DBL_BUF_STATE_EN);
+}
+
+void dwt_signal_rx_buff_free(void)
+{
+    r.stats.buf_frees++;
+}
+
+void dwt_setrxtimeout(uint32_t time)
+{
+    r.rx_timeout_uus = time;
+}
+
+void dwt_setpreambledetecttimeout(uint16_t timeout)
+{
+    (void)timeout;
+}
+
+void dwt_setrxaftertxdelay(uint32_t rxDelayTime)
+{
+    (void)rxDelayTime;
+}
+
+int dwt_rxenable(int mode)
+{
+    (void)mode;
+
+    r.rx_on = 1;
+    r.stats.rx_enables++;
+
+    return DWT_SUCCESS;
+}
+
+void dwt_forcetrxoff(void)
+{
+    r.rx_on = 0;
+    r.tx_pending = 0;
+    r.stats.trx_off++;
+}
+
+int dwt_writetxdata(uint16_t txDataLength, uint8_t *txDataBytes, uint16_t txBufferOffset)
+{
+    if(txBufferOffset + txDataLength > sizeof(r.tx_buf))
+        return DWT_ERROR;
+
+    memcpy(&r.tx_buf[txBufferOffset], txDataBytes, txDataLength);
+    r.tx_len = txBufferOffset + txDataLength;
+
+    return DWT_SUCCESS;
+}
+
+void dwt_writetxfctrl(uint16_t txFrameLength, uint16_t txBufferOffset, uint8_t ranging)
+{
+    (void)txFrameLength;
+    (void)txBufferOffset;
+    (void)ranging;
+}
+
+void dwt_setdelayedtrxtime(uint32_t starttime)
+{
+    r.dly = starttime;
+}
+
+int dwt_starttx(uint8_t mode)
+{
+    if(mode & DWT_START_TX_DELAYED)
+    {
+        if(r.late > 0)
+        {
+            r.late--;
+            r.stats.tx_late++;
+            return DWT_ERROR;
+        }
+
+        r.tx_ts = ((((uint64_t)(r.dly & 0xFFFFFFFEUL)) << 8) + r.ant_dly) & 0xFFFFFFFFFFULL;
+    }
+    else
+    {
+        r.tx_ts = (r.now + 1000) & 0xFFFFFFFFFFULL;
+    }
+
+    r.rx_on = 0;
+    r.tx_pending = 1;
+    r.tx_resp = !!(mode & DWT_RESPONSE_EXPECTED);
+    r.stats.tx_started++;
+
+    return DWT_SUCCESS;
+}
+
+void dwt_readrxdata(uint8_t *buffer, uint16_t length, uint16_t rxBufferOffset)
+{
+    memcpy(buffer, &r.cur.data[rxBufferOffset], length);
+}
+
+static void put_ts(uint8_t *p, uint64_t ts)
+{
+    for(int i = 0; i < 5; i++)
+        p[i] = ts >> (8 * i);
+}
+
+void dwt_readrxtimestamp(uint8_t *timestamp)
+{
+    put_ts(timestamp, r.cur.ts);
+}
+
+void dwt_readtxtimestamp(uint8_t *timestamp)
+{
+    put_ts(timestamp, r.tx_ts);
+}
+
+void dwt_readsystime(uint8_t *timestamp)
+{
+    put_ts(timestamp, r.now);
+}
+
+uint32_t dwt_readsystimestamphi32(void)
+{
+    return r.now >> 8;
+}
+
+int16_t dwt_readclockoffset(void)
+{
+    return 0;
+}
+
+int32_t dwt_readcarrierintegrator(void)
+{
+    return 0;
+}
+
+/* init and power, all succeed */
+
+const struct dwt_probe_s dw3000_probe_interf;
+
+int dwt_probe(struct dwt_probe_s *probe_interf)
+{
+    (void)probe_interf;
+    return DWT_SUCCESS;
+}
+
+int dwt_initialise(int mode)
+{
+    (void)mode;
+    return DWT_SUCCESS;
+}
+
+int dwt_configure(dwt_config_t *config)
+{
+    (void)config;
+    return DWT_SUCCESS;
+}
+
+void dwt_setrxantennadelay(uint16_t antennaDly)
+{
+    (void)antennaDly;
+}
+
+void dwt_settxantennadelay(uint16_t antennaDly)
+{
+    r.ant_dly = antennaDly;
+}
+
+void dwt_configurestskey(dwt_sts_cp_key_t *pStsKey)
+{
+    (void)pStsKey;
+}
+
+void dwt_configurestsiv(dwt_sts_cp_iv_t *pStsIv)
+{
+    r.iv0_cfg = pStsIv->iv0;
+}
+
+void dwt_configurestsloadiv(void)
+{
+    r.iv0 = r.iv0_cfg;
+    r.sts_used = 0;
+    r.stats.sts_loads++;
+}
+
+int dwt_readstsquality(int16_t *rxStsQualityIndex)
+{
+    *rxStsQualityIndex = r.sts_bad ? 0 : 1000;
+
+    return r.sts_bad ? -1 : 0;
+}
+
+void sim_radio_sts_peer(uint32_t iv0)
+{
+    r.peer_iv0 = iv0;
+    r.peer_iv_set = 1;
+}
+
+uint32_t sim_radio_sts_iv0(void)
+{
+    return r.iv0;
+}
+
+void dwt_configuresleep(uint16_t mode, uint8_t wake)
+{
+    (void)mode;
+    (void)wake;
+}
+
+void dwt_entersleepafter(int event_mask)
+{
+    (void)event_mask;
+}
+
+uint8_t dwt_checkidlerc(void)
+{
+    return 1;
+}
+
+void dwt_restoreconfig(void)
+{
+}
+
+/* board */
+
+/* registers the lib batches reads of, the rest read as 0 */
+#define SIM_REG_RX_TIME     0x64
+#define SIM_REG_RX_BUFFER_0 0x120000
+
+int dw3000_spi_batch(const struct dw3000_spi_op *ops, int n)
+{
+    uint8_t ts[5];
+
+    put_ts(ts, r.cur.ts);
+    r.stats.spi_batches++;
+
+    for(int i = 0; i < n; i++)
+    {
+        const struct dw3000_spi_op *op = &ops[i];
+
+        memset(op->buf, 0, op->len);
+
+        if(op->write)
+            continue;
+
+        if(op->reg == SIM_REG_RX_TIME)
+            memcpy(op->buf, ts, MIN(op->len, sizeof(ts)));
+        else if(op->reg == SIM_REG_RX_BUFFER_0)
+            memcpy(op->buf, r.cur.data, MIN(op->len, sizeof(r.cur.data)));
+    }
+
+    return 0;
+}
+
+void dw_device_init(void)
+{
+}
+
+void Sleep(uint32_t Delay)
+{
+    (void)Delay;
+}
+
+void port_set_dw_ic_spi_slowrate(void)
+{
+}
+
+decaIrqStatus_t decamutexon(void)
+{
+    r.mutex_depth++;
+    return 1;
+}
+
+void decamutexoff(decaIrqStatus_t s)
+{
+    r.mutex_depth--;
+}
+
+void port_set_dw_ic_spi_fastrate(void)
+{
+}
+
+void port_set_dwic_isr(port_deca_isr_t deca_isr)
+{
+    r.isr = deca_isr;
+}
+
+void dw3000_hw_wakeup(void)
+{
+}
+
+void dw3000_hw_wakeup_pin_low(void)
+{
+}
@@ -0,0 +1,77 @@
+#ifndef SIM_RADIO_H
+#define SIM_RADIO_H
+
+#include <stdint.h>
+
+/* Simulated DW3000 for the host tests.
+ *
+ * Implements the dwt_* calls lib/uwb makes, plus the port and probe
+ * glue, on a model of one radio. Events are scripted by the test and
+ * played through the ISR uwb_async registered with port_set_dwic_isr()
+ * whenever a thread would block in the kernel (k_host_set_idle), so the
+ * interrupt path runs exactly as on target, only without preemption.
+ *
+ * Per idle step the radio does one thing, in this order: completes a
+ * started TX (then turns RX on if a response was expected), delivers the
+ * next queued RX event if the receiver is on, or times out a single RX
+ * that has a frame wait timeout set. Otherwise the wait times out. */
+
+#define SIM_RADIO_QUEUE_LEN 32
+
+/* called when a frame goes out, e.g. to queue the peer's answer */
+typedef void (*sim_radio_tx_hook_t)(const uint8_t *data, uint16_t len, uint64_t tx_ts);
+
+struct sim_radio_stats {
+    uint32_t rx_enables;
+    uint32_t tx_started;
+    uint32_t tx_late;
+    uint32_t tx_done;
+    uint32_t buf_frees;     /* dwt_signal_rx_buff_free() */
+    uint32_t trx_off;       /* dwt_forcetrxoff() */
+    uint32_t isr_calls;
+    uint32_t isr_locked;    /* IRQs raised inside decamutexon() */
+    uint32_t spi_batches;   /* dw3000_spi_batch() */
+    uint32_t sts_loads;     /* dwt_configurestsloadiv() */
+    uint32_t sts_stale;     /* frames sent or received without an STS
+                             * IV reload since the previous one */
+    uint32_t sts_repeat;    /* frames on the same STS counter as the
+                             * frame before them */
+};
+
+/* back to power-on state, drops queued events and the TX hook */
+void sim_radio_reset(void);
+
+/* queue RX events. a frame carries its payload without the FCS. */
+int sim_radio_rx_frame(const uint8_t *data, uint16_t len, uint64_t rx_ts);
+int sim_radio_rx_timeout(void);
+int sim_radio_rx_error(void);
+int sim_radio_rx_overrun(void);
+
+/* play events until nothing more can happen without the firmware, as
+ * if the IRQs came in while the application thread was busy. returns
+ * the number played. */
+int sim_radio_run(void);
+
+/* the next n delayed TX starts are rejected as late */
+void sim_radio_tx_late(int n);
+
+void sim_radio_on_tx(sim_radio_tx_hook_t hook);
+
+/* frames queued from now on carry an STS sent with this IV counter
+ * word. before the first call they match whatever the receiver loaded. */
+void sim_radio_sts_peer(uint32_t iv0);
+
+/* IV counter word loaded by the last dwt_configurestsloadiv() */
+uint32_t sim_radio_sts_iv0(void);
+
+/* last frame handed to dwt_writetxdata() */
+const uint8_t *sim_radio_tx_frame(uint16_t *len);
+
+int sim_radio_rx_on(void);
+int sim_radio_queued(void);
+void sim_radio_get_stats(struct sim_radio_stats *s);
+
+/* decamutexon() calls not yet matched by decamutexoff() */
+int sim_radio_mutex_depth(void);
+
+#endif
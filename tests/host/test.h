@@ -0,0 +1,71 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* minimal checks for the host tests: a failed CHECK reports and counts,
+ * the test main returns TEST_RESULT() as its exit code */
+
+static int test_failures;
+
+#define CHECK(c)                                                            \
+    do {                                                                    \
+        if(!(c))                                                            \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #c); \
+            test_failures++;                                                \
+        }                                                                   \
+    } while(0)
+
+#define CHECK_EQ(a, b)                                                      \
+    do {                                                                    \
+        long long _a = (long long)(a), _b = (long long)(b);                 \
+        if(_a != _b)                                                        \
+        {                                                                   \
+            fprintf(stderr, "%s:%d: %s == %lld, expected %lld (%s)\n",  \
+                    __FILE__, __LINE__, #a, _a, _b, #b);                    \
+            test_failures++;                                                \
+        }                                                                   \
+    } while(0)
+
+#define RUN(fn)                                                             \
+    do {                                                                    \
+        int _before = test_failures;                                        \
+        fn();                                                               \
+        printf("%-40s %s\n", #fn, test_failures == _before ? "ok" : "FAIL"); \
+    } while(0)
+
+#define TEST_RESULT() (test_failures ? 1 : 0)
+
+/* deterministic xorshift64*, so a failure reproduces */
+static uint64_t test_rng_state = 0x9E3779B97F4A7C15ULL;
+
+static inline uint64_t test_rand64(void)
+{
+    uint64_t x = test_rng_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    test_rng_state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* uniform in [lo, hi) */
+static inline double test_uniform(double lo, double hi)
+{
+    return lo + (hi - lo) * (double)(test_rand64() >> 11) / (double)(1ULL << 53);
+}
+
+static inline uint64_t test_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+#endif
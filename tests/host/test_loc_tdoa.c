@@ -0,0 +1,451 @@
+/* loc_tdoa on random geometries, float against Q16.16, and on the fixes
+ * ble_tdoa_multi_client.py logged in the captures.
+ *
+ *   test_loc_tdoa                    run the checks
+ *   test_loc_tdoa --bench [n]        time a fix at 4, 8 and 16 anchors
+ *   test_loc_tdoa capture.json...    solve the TDOA groups of a capture
+ *                                    and compare with its POS records */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loc_tdoa.h"
+
+#include "capture.h"
+#include "test.h"
+
+#define TICK_S          (1.0 / (499.2e6 * 128.0))
+#define C_M_S           299792458.0
+
+#define Q16(x)          ((int32_t)lround((x) * 65536.0))
+#define FROM_Q16(x)     ((double)(x) / 65536.0)
+
+/* anchors spread over a room, the tag inside it or a little outside */
+struct geom {
+    int   dim, n;
+    float a[LOC_MAX_ANCHORS][3];
+    float d[LOC_MAX_ANCHORS];
+    double p[3];
+};
+
+static double dist(const float *a, const double *p, int dim)
+{
+    double s = 0;
+
+    for(int k = 0; k < dim; k++)
+        s += ((double)a[k] - p[k]) * ((double)a[k] - p[k]);
+
+    return sqrt(s);
+}
+
+static void geom_random(struct geom *g, int dim, int n, double size, double noise_m)
+{
+    g->dim = dim;
+    g->n = n;
+
+    for(int i = 0; i < n; i++)
+    {
+        for(int k = 0; k < 3; k++)
+            g->a[i][k] = (k < dim) ? (float)test_uniform(0, size) : 0;
+    }
+
+    for(int k = 0; k < 3; k++)
+        g->p[k] = (k < dim) ? test_uniform(-0.1 * size, 1.1 * size) : 0;
+
+    double r0 = dist(g->a[0], g->p, dim);
+
+    g->d[0] = 0;
+    for(int i = 1; i < n; i++)
+        g->d[i] = (float)(dist(g->a[i], g->p, dim) - r0 + noise_m * test_uniform(-1, 1));
+}
+
+static double err_m(const float *p, const double *truth, int dim)
+{
+    double s = 0;
+
+    for(int k = 0; k < dim; k++)
+        s += (p[k] - truth[k]) * (p[k] - truth[k]);
+
+    return sqrt(s);
+}
+
+static int solve_q16(const struct geom *g, struct loc_fix_q16 *fix)
+{
+    static struct loc_tdoa_ws_q16 ws;
+    int32_t a[LOC_MAX_ANCHORS][3], d[LOC_MAX_ANCHORS];
+
+    for(int i = 0; i < g->n; i++)
+    {
+        for(int k = 0; k < 3; k++)
+            a[i][k] = Q16(g->a[i][k]);
+        d[i] = Q16(g->d[i]);
+    }
+
+    return loc_tdoa_solve_q16(&ws, g->dim, g->n, (const int32_t (*)[3])a, d, fix);
+}
+
+/* geometry dilution makes a few random layouts ill-conditioned; those
+ * may miss, but never more than a handful. the Q16 inputs are rounded
+ * to 15 um, which a bad layout turns into centimeters */
+static void exact_random(int dim)
+{
+    static struct loc_tdoa_ws ws;
+    int runs = 0, miss = 0, miss_q = 0, apart = 0;
+
+    for(int n = dim + 2; n <= LOC_MAX_ANCHORS; n++)
+    {
+        for(int r = 0; r < 200; r++)
+        {
+            struct geom g;
+            struct loc_fix fix;
+            struct loc_fix_q16 fq;
+
+            geom_random(&g, dim, n, 20.0, 0);
+            runs++;
+
+            if(loc_tdoa_solve(&ws, dim, n, (const float (*)[3])g.a, g.d, &fix) != 0 ||
+               err_m(fix.p, g.p, dim) > 0.01)
+            {
+                miss++;
+                continue;
+            }
+
+            if(solve_q16(&g, &fq) != 0)
+            {
+                miss_q++;
+                continue;
+            }
+
+            float pq[3] = { FROM_Q16(fq.p[0]), FROM_Q16(fq.p[1]), FROM_Q16(fq.p[2]) };
+
+            if(err_m(pq, g.p, dim) > 0.05)
+                miss_q++;
+            if(err_m(pq, (double[3]){ fix.p[0], fix.p[1], fix.p[2] }, dim) > 0.01)
+                apart++;
+        }
+    }
+
+    printf("  %dD: %d layouts, float missed %d, q16 missed %d, apart %d\n",
+           dim, runs, miss, miss_q, apart);
+
+    CHECK(miss <= runs / 200);
+    CHECK(miss_q <= runs / 200);
+    CHECK(apart <= runs / 200);
+}
+
+static void exact_2d(void)
+{
+    exact_random(2);
+}
+
+static void exact_3d(void)
+{
+    exact_random(3);
+}
+
+/* dim + 1 anchors: one equation short, the root nearer the centroid is
+ * taken, so only tags inside the anchor hull are checked */
+static void minimal_anchors(void)
+{
+    static struct loc_tdoa_ws ws;
+    float a[3][3] = { { 0, 0, 0 }, { 10, 0, 0 }, { 0, 10, 0 } };
+    int miss = 0;
+
+    for(int r = 0; r < 1000; r++)
+    {
+        double u = test_uniform(0.05, 0.9), v = test_uniform(0.05, 0.95 - u);
+        double p[3] = { 10 * u, 10 * v, 0 };
+        double r0 = dist(a[0], p, 2);
+        float d[3] = { 0, (float)(dist(a[1], p, 2) - r0), (float)(dist(a[2], p, 2) - r0) };
+        struct loc_fix fix;
+
+        if(loc_tdoa_solve(&ws, 2, 3, (const float (*)[3])a, d, &fix) != 0 ||
+           err_m(fix.p, p, 2) > 0.01)
+            miss++;
+    }
+
+    printf("  3 anchors, tag inside: missed %d of 1000\n", miss);
+    CHECK(miss <= 10);
+}
+
+/* 10 cm of uniform range difference noise on 8 anchors in a 20 m room */
+static void noisy(void)
+{
+    static struct loc_tdoa_ws ws;
+    double ss = 0;
+    int n = 0, fail = 0;
+
+    for(int r = 0; r < 2000; r++)
+    {
+        struct geom g;
+        struct loc_fix fix;
+
+        geom_random(&g, 2, 8, 20.0, 0.1);
+        if(loc_tdoa_solve(&ws, 2, 8, (const float (*)[3])g.a, g.d, &fix) != 0)
+        {
+            fail++;
+            continue;
+        }
+
+        double e = err_m(fix.p, g.p, 2);
+
+        ss += e * e;
+        n++;
+        CHECK(fix.iters <= LOC_GN_ITERS);
+        CHECK(fix.rms < 0.2f);
+    }
+
+    printf("  2D, 8 anchors, 10 cm noise: rms error %.3f m, %d failed\n", sqrt(ss / n), fail);
+    CHECK(fail <= 10);
+    CHECK(sqrt(ss / n) < 0.5);
+}
+
+static void bad_input(void)
+{
+    static struct loc_tdoa_ws ws;
+    static struct loc_tdoa_ws_q16 wq;
+    float a[4][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 2, 0, 0 }, { 3, 0, 0 } };
+    int32_t aq[4][3] = { { 0 } };
+    float d[4] = { 0 };
+    int32_t dq[4] = { 0 };
+    struct loc_fix fix;
+    struct loc_fix_q16 fq;
+
+    CHECK_EQ(loc_tdoa_solve(&ws, 2, 2, (const float (*)[3])a, d, &fix), -1);
+    CHECK_EQ(loc_tdoa_solve(&ws, 3, 3, (const float (*)[3])a, d, &fix), -1);
+    CHECK_EQ(loc_tdoa_solve(&ws, 1, 4, (const float (*)[3])a, d, &fix), -1);
+    CHECK_EQ(loc_tdoa_solve(&ws, 2, LOC_MAX_ANCHORS + 1, (const float (*)[3])a, d, &fix), -1);
+    CHECK_EQ(loc_tdoa_solve_q16(&wq, 2, 2, (const int32_t (*)[3])aq, dq, &fq), -1);
+
+    /* all anchors on a line */
+    CHECK_EQ(loc_tdoa_solve(&ws, 2, 4, (const float (*)[3])a, d, &fix), -1);
+    CHECK_EQ(loc_tdoa_solve_q16(&wq, 2, 4, (const int32_t (*)[3])aq, dq, &fq), -1);
+}
+
+static void ticks_to_m(void)
+{
+    static const int64_t ticks[] = { 0, 1, -1, 213, -213, 4000, 65536, -100000, 1000000 };
+
+    for(unsigned i = 0; i < sizeof(ticks) / sizeof(ticks[0]); i++)
+    {
+        double m = ticks[i] * TICK_S * C_M_S;
+
+        /* the lib uses c in air, 300 ppm below vacuum */
+        CHECK(fabs(FROM_Q16(loc_ticks_to_m_q16(ticks[i])) - m) < 2e-5 + 4e-4 * fabs(m));
+    }
+}
+
+/* per-fix time on random 2D layouts, float and Q16 */
+static int bench(int n_fix)
+{
+    static const int sizes[] = { 4, 8, 16 };
+    static struct loc_tdoa_ws ws;
+    struct geom *g = malloc(sizeof(*g) * 64);
+    int bad = 0;
+
+    printf("anchors  float[us]  q16[us]  iters\n");
+
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int n = sizes[s], iters = 0;
+        uint64_t t0, t_f, t_q;
+
+        /* only layouts that solve, so a failure is a regression */
+        for(int i = 0; i < 64; i++)
+        {
+            struct loc_fix fix;
+
+            do
+                geom_random(&g[i], 2, n, 20.0, 0.05);
+            while(loc_tdoa_solve(&ws, 2, n, (const float (*)[3])g[i].a, g[i].d, &fix) != 0);
+        }
+
+        t0 = test_now_ns();
+        for(int i = 0; i < n_fix; i++)
+        {
+            struct loc_fix fix;
+
+            if(loc_tdoa_solve(&ws, 2, n, (const float (*)[3])g[i & 63].a, g[i & 63].d, &fix) == 0)
+                iters += fix.iters;
+            else
+                bad++;
+        }
+        t_f = test_now_ns() - t0;
+
+        t0 = test_now_ns();
+        for(int i = 0; i < n_fix; i++)
+        {
+            struct loc_fix_q16 fq;
+
+            solve_q16(&g[i & 63], &fq);
+        }
+        t_q = test_now_ns() - t0;
+
+        printf("%7d  %9.2f  %7.2f  %5.1f\n", n, t_f / 1e3 / n_fix, t_q / 1e3 / n_fix,
+               (double)iters / n_fix);
+    }
+
+    free(g);
+    return bad ? 1 : 0;
+}
+
+/* the client's default layout */
+static const struct {
+    int   id;
+    float x, y;
+} capture_anchors[] = {
+    { 7, 0.0f, 0.0f },
+    { 0, 0.9f, 0.0f },
+    { 6, 0.9f, 0.6f },
+};
+
+static int anchor_index(int id)
+{
+    for(unsigned i = 0; i < sizeof(capture_anchors) / sizeof(capture_anchors[0]); i++)
+        if(capture_anchors[i].id == id)
+            return (int)i;
+
+    return -1;
+}
+
+/* rms of the range difference residuals at p, anchor 0 the reference */
+static double fit_rms(const float (*a)[3], const float *d, int n, const double *p)
+{
+    double r0 = dist(a[0], p, 2), ss = 0;
+
+    for(int i = 1; i < n; i++)
+    {
+        double e = dist(a[i], p, 2) - r0 - d[i];
+
+        ss += e * e;
+    }
+
+    return sqrt(ss / (n - 1));
+}
+
+/* every POS record is logged right after the TDOA records of its group,
+ * relative to the lowest anchor id; the latest delta per anchor wins */
+static int replay(const char *path)
+{
+    static struct loc_tdoa_ws ws;
+    struct cap_rec *recs;
+    int n = capture_load(path, &recs);
+    int fixes = 0, agree = 0, other_root = 0, other = 0, worse = 0, failed = 0;
+
+    if(n < 0)
+    {
+        fprintf(stderr, "%s: cannot read\n", path);
+        return 1;
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        const struct cap_rec *pos = &recs[i];
+
+        if(pos->type != CAP_POS)
+            continue;
+
+        float d[3] = { 0 };
+        int have[3] = { 0 }, ref = -1;
+
+        for(int j = i - 1; j >= 0; j--)
+        {
+            const struct cap_rec *t = &recs[j];
+
+            if(t->type != CAP_TDOA)
+                continue;
+            if(t->blink_seq != pos->blink_seq || t->sync_seq != pos->sync_seq)
+                break;
+
+            int k = anchor_index(t->anchor_id);
+            if(ref < 0)
+                ref = t->ref_anchor;
+            if(k < 0 || t->ref_anchor != ref || have[k])
+                continue;
+
+            have[k] = 1;
+            d[k] = (float)(t->delta_ticks * TICK_S * C_M_S);
+        }
+
+        int r = anchor_index(ref);
+        if(r < 0)
+            continue;
+
+        have[r] = 1;
+        d[r] = 0;
+
+        /* the reference goes first */
+        float aa[3][3] = { { 0 } }, dd[3];
+        int m = 0;
+
+        for(int k = -1; k < 3; k++)
+        {
+            int src = (k < 0) ? r : k;
+
+            if(k == r || !have[src])
+                continue;
+            aa[m][0] = capture_anchors[src].x;
+            aa[m][1] = capture_anchors[src].y;
+            dd[m++] = d[src];
+        }
+
+        if(m < 3)
+            continue;
+
+        struct loc_fix fix;
+
+        fixes++;
+        if(loc_tdoa_solve(&ws, 2, 3, (const float (*)[3])aa, dd, &fix) != 0)
+        {
+            failed++;
+            continue;
+        }
+
+        double pp[3] = { pos->x_m, pos->y_m, 0 }, fp[3] = { fix.p[0], fix.p[1], 0 };
+        double rms_pos = fit_rms(aa, dd, 3, pp), rms_fix = fit_rms(aa, dd, 3, fp);
+
+        if(hypot(fp[0] - pp[0], fp[1] - pp[1]) < 0.005)
+            agree++;
+        else if(rms_pos < 0.005 && rms_fix < 0.005)
+            other_root++;
+        else if(rms_fix > rms_pos + 0.005)
+            worse++;
+        else
+            other++;
+    }
+
+    if(!fixes)
+        printf("%s: no POS records\n", path);
+    else
+        printf("%s: %d fixes: %d within 5 mm of the client, %d on the other root, "
+               "%d fit better, %d fit worse, %d failed\n",
+               path, fixes, agree, other_root, other, worse, failed);
+
+    free(recs);
+    return agree + other_root + other < 0.95 * fixes;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return bench(argc > 2 ? atoi(argv[2]) : 200000);
+
+    if(argc > 1)
+    {
+        int bad = 0;
+
+        for(int i = 1; i < argc; i++)
+            bad |= replay(argv[i]);
+        return bad;
+    }
+
+    RUN(exact_2d);
+    RUN(exact_3d);
+    RUN(minimal_anchors);
+    RUN(noisy);
+    RUN(bad_input);
+    RUN(ticks_to_m);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,335 @@
+/* loc_twr on random layouts: exact ranges, noise, and one NLOS range
+ * that the residual gate has to drop.
+ *
+ *   test_loc_twr              run the checks
+ *   test_loc_twr --bench [n]  time a fix at 4, 8 and 16 anchors against
+ *                             the per-triplet median the trilateration
+ *                             scripts used, and count NLOS rejections */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loc_twr.h"
+
+#include "test.h"
+
+#define ROOM_M      20.0
+#define NOISE_M     0.03
+#define NLOS_M      1.5
+
+struct geom {
+    int   dim, n;
+    float a[LOC_MAX_ANCHORS][3];
+    float r[LOC_MAX_ANCHORS];
+    double p[3];
+    int   nlos;             /* index of the biased range, -1 if none */
+};
+
+static double gauss(void)
+{
+    double u = test_uniform(1e-12, 1.0), v = test_uniform(0.0, 1.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* anchors anywhere in the room, the tag inside it */
+static void geom_random(struct geom *g, int dim, int n, double noise_m, int nlos)
+{
+    g->dim = dim;
+    g->n = n;
+    g->nlos = nlos ? (int)(test_rand64() % (uint64_t)n) : -1;
+
+    for(int i = 0; i < n; i++)
+        for(int k = 0; k < 3; k++)
+            g->a[i][k] = (k < dim) ? (float)test_uniform(0, ROOM_M) : 0;
+
+    for(int k = 0; k < 3; k++)
+        g->p[k] = (k < dim) ? test_uniform(0.1 * ROOM_M, 0.9 * ROOM_M) : 0;
+
+    for(int i = 0; i < n; i++)
+    {
+        double s = 0;
+
+        for(int k = 0; k < dim; k++)
+            s += (g->a[i][k] - g->p[k]) * (g->a[i][k] - g->p[k]);
+
+        g->r[i] = (float)(sqrt(s) + noise_m * gauss() + (i == g->nlos ? NLOS_M : 0));
+    }
+}
+
+static double err_m(const float *p, const double *truth, int dim)
+{
+    double s = 0;
+
+    for(int k = 0; k < dim; k++)
+        s += (p[k] - truth[k]) * (p[k] - truth[k]);
+
+    return sqrt(s);
+}
+
+static int solve(const struct geom *g, struct loc_twr_fix *fix)
+{
+    static struct loc_twr_ws ws;
+
+    return loc_twr_solve(&ws, g->dim, g->n, (const float (*)[3])g->a, g->r, NULL, fix);
+}
+
+static void exact_random(int dim)
+{
+    int runs = 0, miss = 0;
+
+    for(int n = dim + 1; n <= LOC_MAX_ANCHORS; n++)
+    {
+        for(int r = 0; r < 200; r++)
+        {
+            struct geom g;
+            struct loc_twr_fix fix;
+
+            geom_random(&g, dim, n, 0, 0);
+            runs++;
+
+            if(solve(&g, &fix) != 0 || err_m(fix.p, g.p, dim) > 0.005)
+            {
+                miss++;
+                continue;
+            }
+
+            CHECK_EQ(fix.rejected, 0);
+            CHECK_EQ(fix.n_used, n);
+        }
+    }
+
+    printf("  %dD: %d layouts, missed %d\n", dim, runs, miss);
+    CHECK(miss <= runs / 200);
+}
+
+static void exact_2d(void)
+{
+    exact_random(2);
+}
+
+static void exact_3d(void)
+{
+    exact_random(3);
+}
+
+/* a range with a large sigma barely counts */
+static void weights(void)
+{
+    static struct loc_twr_ws ws;
+    float a[5][3] = { { 0, 0, 0 }, { 10, 0, 0 }, { 0, 10, 0 }, { 10, 10, 0 }, { 5, 0, 0 } };
+    double p[3] = { 4, 6, 0 };
+    float r[5], sigma[5];
+    struct loc_twr_fix fix;
+
+    for(int i = 0; i < 5; i++)
+    {
+        r[i] = (float)hypot(a[i][0] - p[0], a[i][1] - p[1]);
+        sigma[i] = 0.05f;
+    }
+
+    /* 30 cm off but 100 times less certain */
+    r[4] += 0.3f;
+    sigma[4] = 5.0f;
+
+    CHECK_EQ(loc_twr_solve(&ws, 2, 5, (const float (*)[3])a, r, sigma, &fix), 0);
+    CHECK(err_m(fix.p, p, 2) < 0.001);
+    CHECK_EQ(fix.rejected, 0);
+
+    /* trusted like the rest it is gated out */
+    sigma[4] = 0.05f;
+    CHECK_EQ(loc_twr_solve(&ws, 2, 5, (const float (*)[3])a, r, sigma, &fix), 0);
+    CHECK_EQ(fix.rejected, 1 << 4);
+    CHECK(err_m(fix.p, p, 2) < 0.001);
+}
+
+/* dim + 2 anchors or fewer: nothing is dropped, the bias stays in */
+static void too_few_to_reject(void)
+{
+    for(int r = 0; r < 200; r++)
+    {
+        struct geom g;
+        struct loc_twr_fix fix;
+
+        geom_random(&g, 2, 4, NOISE_M, 1);
+        if(solve(&g, &fix) != 0)
+            continue;
+
+        CHECK_EQ(fix.rejected, 0);
+        CHECK_EQ(fix.n_used, 4);
+    }
+}
+
+static void nlos_rejected(void)
+{
+    int hit = 0, false_rej = 0, runs = 0;
+
+    for(int r = 0; r < 2000; r++)
+    {
+        struct geom g;
+        struct loc_twr_fix fix;
+
+        geom_random(&g, 2, 8, NOISE_M, 1);
+        if(solve(&g, &fix) != 0)
+            continue;
+
+        runs++;
+        if(fix.rejected & (1u << g.nlos))
+            hit++;
+        if(fix.rejected & ~(1u << g.nlos))
+            false_rej++;
+    }
+
+    printf("  8 anchors: NLOS dropped in %d of %d, a good range dropped in %d\n",
+           hit, runs, false_rej);
+    CHECK(hit >= 0.95 * runs);
+}
+
+static void bad_input(void)
+{
+    static struct loc_twr_ws ws;
+    float a[4][3] = { { 0, 0, 0 }, { 1, 0, 0 }, { 2, 0, 0 }, { 3, 0, 0 } };
+    float r[4] = { 1, 1, 1, 1 };
+    struct loc_twr_fix fix;
+
+    CHECK_EQ(loc_twr_solve(&ws, 2, 2, (const float (*)[3])a, r, NULL, &fix), -1);
+    CHECK_EQ(loc_twr_solve(&ws, 3, 3, (const float (*)[3])a, r, NULL, &fix), -1);
+    CHECK_EQ(loc_twr_solve(&ws, 4, 4, (const float (*)[3])a, r, NULL, &fix), -1);
+    CHECK_EQ(loc_twr_solve(&ws, 2, LOC_MAX_ANCHORS + 1, (const float (*)[3])a, r, NULL, &fix), -1);
+
+    /* all anchors on a line */
+    CHECK_EQ(loc_twr_solve(&ws, 2, 4, (const float (*)[3])a, r, NULL, &fix), -1);
+}
+
+/* what scripts/uwb_solver.py _triplet_fix does: solve every 3-anchor
+ * subset (2D) by differencing against its first anchor and take the
+ * median of each coordinate */
+static int cmp_float(const void *a, const void *b)
+{
+    float x = *(const float *)a, y = *(const float *)b;
+
+    return (x > y) - (x < y);
+}
+
+static float median(float *v, int n)
+{
+    qsort(v, n, sizeof(*v), cmp_float);
+    return (n & 1) ? v[n / 2] : 0.5f * (v[n / 2 - 1] + v[n / 2]);
+}
+
+static int triplet_fix(const struct geom *g, float *p, int *n_triplets)
+{
+    static float xs[560], ys[560];
+    int m = 0;
+
+    *n_triplets = 0;
+
+    for(int i = 0; i < g->n; i++)
+        for(int j = i + 1; j < g->n; j++)
+            for(int k = j + 1; k < g->n; k++)
+            {
+                const float *a0 = g->a[i], *a1 = g->a[j], *a2 = g->a[k];
+                float n0 = a0[0] * a0[0] + a0[1] * a0[1];
+                float m00 = 2 * (a1[0] - a0[0]), m01 = 2 * (a1[1] - a0[1]);
+                float m10 = 2 * (a2[0] - a0[0]), m11 = 2 * (a2[1] - a0[1]);
+                float b0 = g->r[i] * g->r[i] - g->r[j] * g->r[j] + a1[0] * a1[0] + a1[1] * a1[1] - n0;
+                float b1 = g->r[i] * g->r[i] - g->r[k] * g->r[k] + a2[0] * a2[0] + a2[1] * a2[1] - n0;
+                float det = m00 * m11 - m01 * m10;
+
+                (*n_triplets)++;
+                if(fabsf(det) < 1e-6f)
+                    continue;
+
+                xs[m] = (b0 * m11 - b1 * m01) / det;
+                ys[m] = (m00 * b1 - m10 * b0) / det;
+                m++;
+            }
+
+    if(!m)
+        return -1;
+
+    p[0] = median(xs, m);
+    p[1] = median(ys, m);
+    p[2] = 0;
+
+    return 0;
+}
+
+/* random 2D layouts, 3 cm of range noise and one range 1.5 m long */
+static int bench(int n_fix)
+{
+    static const int sizes[] = { 4, 8, 16 };
+    struct geom *g = malloc(sizeof(*g) * 256);
+    int bad = 0;
+
+    printf("anchors  wls[us]  triplets  triplet[us]  nlos dropped  good dropped  "
+           "median err wls[m]  triplet[m]\n");
+
+    for(unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        int n = sizes[s], n_trip = 0, hit = 0, false_rej = 0, solved = 0;
+        float e_w[256], e_t[256];
+        uint64_t t0, t_w, t_t;
+
+        for(int i = 0; i < 256; i++)
+            geom_random(&g[i], 2, n, NOISE_M, 1);
+
+        t0 = test_now_ns();
+        for(int i = 0; i < n_fix; i++)
+        {
+            struct loc_twr_fix fix;
+
+            if(solve(&g[i & 255], &fix) != 0)
+                bad = 1;
+        }
+        t_w = test_now_ns() - t0;
+
+        t0 = test_now_ns();
+        for(int i = 0; i < n_fix; i++)
+        {
+            float p[3];
+
+            triplet_fix(&g[i & 255], p, &n_trip);
+        }
+        t_t = test_now_ns() - t0;
+
+        /* accuracy and rejections over the distinct layouts */
+        for(int i = 0; i < 256; i++)
+        {
+            struct loc_twr_fix fix;
+            float p[3];
+
+            if(solve(&g[i], &fix) != 0 || triplet_fix(&g[i], p, &n_trip) != 0)
+                continue;
+
+            e_w[solved] = (float)err_m(fix.p, g[i].p, 2);
+            e_t[solved] = (float)err_m(p, g[i].p, 2);
+            solved++;
+            hit += (fix.rejected >> g[i].nlos) & 1;
+            false_rej += (fix.rejected & ~(1u << g[i].nlos)) != 0;
+        }
+
+        printf("%7d  %7.2f  %8d  %11.2f  %8d/%-4d  %8d/%-4d  %17.3f  %10.3f\n",
+               n, t_w / 1e3 / n_fix, n_trip, t_t / 1e3 / n_fix, hit, solved,
+               false_rej, solved, median(e_w, solved), median(e_t, solved));
+    }
+
+    free(g);
+    return bad;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return bench(argc > 2 ? atoi(argv[2]) : 100000);
+
+    RUN(exact_2d);
+    RUN(exact_3d);
+    RUN(weights);
+    RUN(too_few_to_reject);
+    RUN(nlos_rejected);
+    RUN(bad_input);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,491 @@
+/* uwb_async and the blocking helpers in uwb.c on the simulated radio:
+ * descriptor pool, reference counts, RX error and overrun recovery, the
+ * TX completion ring. */
+
+#include <string.h>
+
+#include "uwb.h"
+#include "uwb_async.h"
+#include "uwb_msg.h"
+
+#include "sim/sim_radio.h"
+#include "test.h"
+
+#define ANT_DLY 16385
+
+static void setup(void)
+{
+    sim_radio_reset();
+    CHECK_EQ(uwb_init(ANT_DLY), 0);
+    uwb_async_flush();
+    uwb_rx_window_set(NULL);
+}
+
+static struct uwb_async_stats stats(void)
+{
+    struct uwb_async_stats st;
+
+    uwb_async_get_stats(&st);
+    return st;
+}
+
+static void rx_frame(void)
+{
+    static const uint8_t frame[] = { 0x10, 7, 1, 2, 3, 4, 5 };
+    uint8_t buf[UWB_MSG_MAX];
+    uint16_t len = 0;
+    uint32_t ok = stats().rx_ok;
+    struct sim_radio_stats rs;
+    struct uwb_rx_desc *d;
+
+    setup();
+    sim_radio_rx_frame(frame, sizeof(frame), 0x1234567890ULL);
+
+    CHECK_EQ(uwb_rx(buf, sizeof(buf), &len), 0);
+    CHECK_EQ(len, sizeof(frame));
+    CHECK(memcmp(buf, frame, sizeof(frame)) == 0);
+    CHECK_EQ(stats().rx_ok, ok + 1);
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+
+    /* data and timestamp came in one SPI batch */
+    sim_radio_rx_frame(frame, sizeof(frame), 0x0987654321ULL);
+    CHECK_EQ(uwb_rx_submit(DWT_START_RX_IMMEDIATE), 0);
+    CHECK_EQ(uwb_rx_await(&d, K_FOREVER), 0);
+    CHECK_EQ(d->len, sizeof(frame));
+    CHECK(memcmp(d->data, frame, sizeof(frame)) == 0);
+    CHECK_EQ(d->rx_ts, 0x0987654321ULL);
+    uwb_rx_release(d);
+
+    sim_radio_get_stats(&rs);
+    CHECK_EQ(rs.spi_batches, 2);
+}
+
+static void rx_timeout_and_error(void)
+{
+    struct uwb_rx_window w = { .timeout_uus = 500 };
+    uint8_t buf[UWB_MSG_MAX];
+    uint16_t len;
+    struct uwb_async_stats before;
+
+    setup();
+    before = stats();
+
+    /* nothing queued: the frame wait timeout ends the RX */
+    uwb_rx_window_set(&w);
+    CHECK_EQ(uwb_rx(buf, sizeof(buf), &len), -1);
+    CHECK_EQ(stats().rx_timeout, before.rx_timeout + 1);
+
+    sim_radio_rx_error();
+    CHECK_EQ(uwb_rx(buf, sizeof(buf), &len), -1);
+    CHECK_EQ(stats().rx_error, before.rx_error + 1);
+
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+    CHECK(!sim_radio_rx_on());
+}
+
+static void rx_too_long(void)
+{
+    uint8_t frame[UWB_MSG_MAX];
+    uint8_t buf[40];
+    uint8_t guard[8];
+    uint16_t len = 0;
+    uint32_t dropped = uwb_rx_too_long();
+
+    setup();
+    memset(frame, 0xA5, sizeof(frame));
+    memset(guard, 0, sizeof(guard));
+
+    /* a hub REPORT arriving at a TWR responder */
+    sim_radio_rx_frame(frame, sizeof(frame), 1);
+    CHECK_EQ(uwb_rx(buf, sizeof(buf), &len), -1);
+    CHECK_EQ(uwb_rx_too_long(), dropped + 1);
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+
+    for(int i = 0; i < (int)sizeof(guard); i++)
+        CHECK_EQ(guard[i], 0);
+
+    /* a frame of exactly the buffer size still fits */
+    sim_radio_rx_frame(frame, sizeof(buf), 2);
+    CHECK_EQ(uwb_rx(buf, sizeof(buf), &len), 0);
+    CHECK_EQ(len, sizeof(buf));
+}
+
+static const uint8_t reply[] = { 0x02, 9, 1, 2 };
+
+static void answer(const uint8_t *data, uint16_t len, uint64_t tx_ts)
+{
+    (void)data;
+    (void)len;
+
+    sim_radio_rx_frame(reply, sizeof(reply), tx_ts + 100000);
+}
+
+static void tx_rx_exchange(void)
+{
+    static const uint8_t poll[] = { 0x01, 9, 0, 1 };
+    uint8_t buf[UWB_MSG_MAX];
+    uint16_t len = 0, sent;
+
+    setup();
+    sim_radio_on_tx(answer);
+
+    CHECK_EQ(uwb_tx_rx((uint8_t *)poll, sizeof(poll), buf, sizeof(buf), &len), 0);
+    CHECK_EQ(len, sizeof(reply));
+    CHECK(memcmp(buf, reply, sizeof(reply)) == 0);
+    CHECK(memcmp(sim_radio_tx_frame(&sent), poll, sizeof(poll)) == 0);
+    CHECK_EQ(sent, sizeof(poll));
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+}
+
+static void tx_delayed(void)
+{
+    static const uint8_t frame[] = { 0x10, 1, 2 };
+    uint32_t dly = 0x12345679;
+    struct uwb_tx_desc tx;
+    struct sim_radio_stats rs;
+    uint32_t late;
+    uint8_t buf[UWB_MSG_MAX];
+    uint16_t len;
+
+    setup();
+
+    CHECK_EQ(uwb_tx_submit(frame, sizeof(frame), DWT_START_TX_DELAYED, dly), 0);
+    CHECK_EQ(uwb_tx_await(&tx, K_MSEC(10)), 0);
+    CHECK_EQ(tx.tx_ts, uwb_delayed_tx_ts(dly, ANT_DLY));
+
+    /* late: nothing goes out, the chained RX is not left on */
+    late = stats().tx_late;
+    sim_radio_tx_late(1);
+    CHECK_EQ(uwb_tx_delayed_rx((uint8_t *)frame, sizeof(frame), dly, buf, sizeof(buf), &len), -1);
+    CHECK_EQ(stats().tx_late, late + 1);
+    CHECK(!sim_radio_rx_on());
+
+    sim_radio_get_stats(&rs);
+    CHECK_EQ(rs.tx_done, 1);
+    CHECK_EQ(uwb_tx_await(NULL, K_MSEC(10)), -1);
+}
+
+static void tx_ring(void)
+{
+    static const uint8_t frame[] = { 0x10 };
+    struct uwb_tx_desc tx;
+    uint64_t ts[UWB_TX_RING_LEN + 1];
+
+    setup();
+
+    /* completions pile up while nobody awaits them */
+    for(int i = 0; i < UWB_TX_RING_LEN + 1; i++)
+    {
+        CHECK_EQ(uwb_tx_submit(frame, sizeof(frame), DWT_START_TX_DELAYED, 1000u * (i + 1)), 0);
+        sim_radio_run();
+        ts[i] = uwb_delayed_tx_ts(1000u * (i + 1), ANT_DLY);
+    }
+
+    /* in order, and the one that found the ring full is gone */
+    for(int i = 0; i < UWB_TX_RING_LEN; i++)
+    {
+        CHECK_EQ(uwb_tx_await(&tx, K_NO_WAIT), 0);
+        CHECK_EQ(tx.tx_ts, ts[i]);
+    }
+    CHECK_EQ(uwb_tx_await(&tx, K_NO_WAIT), -1);
+
+    /* flush forgets completions nobody collected */
+    CHECK_EQ(uwb_tx_submit(frame, sizeof(frame), DWT_START_TX_IMMEDIATE, 0), 0);
+    sim_radio_run();
+    uwb_async_flush();
+    CHECK_EQ(uwb_tx_await(&tx, K_NO_WAIT), -1);
+}
+
+static void refcount(void)
+{
+    uint8_t frame[] = { 0x85, 0, 0, 0, 0 };
+    struct uwb_rx_desc *d[3];
+
+    setup();
+    CHECK_EQ(uwb_rx_continuous_start(), 0);
+
+    for(int i = 0; i < 3; i++)
+    {
+        frame[1] = i;
+        sim_radio_rx_frame(frame, sizeof(frame), 100 + i);
+    }
+
+    /* the receiver stays on through good frames */
+    CHECK_EQ(sim_radio_run(), 3);
+    CHECK(sim_radio_rx_on());
+    CHECK_EQ(uwb_rx_pool_used(), 3);
+
+    for(int i = 0; i < 3; i++)
+    {
+        CHECK_EQ(uwb_rx_await(&d[i], K_NO_WAIT), 0);
+        CHECK_EQ(d[i]->data[1], i);
+        CHECK_EQ(d[i]->rx_ts, 100 + i);
+    }
+
+    /* a second holder keeps the descriptor alive past the first release */
+    uwb_rx_hold(d[1]);
+    uwb_rx_release(d[1]);
+    CHECK_EQ(uwb_rx_pool_used(), 3);
+    CHECK_EQ(d[1]->data[1], 1);
+
+    /* out of order */
+    uwb_rx_release(d[2]);
+    uwb_rx_release(d[0]);
+    CHECK_EQ(uwb_rx_pool_used(), 1);
+    uwb_rx_release(d[1]);
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+
+    uwb_rx_continuous_stop();
+}
+
+static void pool_exhaustion(void)
+{
+    uint8_t frame[] = { 0x85, 0, 0, 0, 0 };
+    struct uwb_rx_desc *d;
+    struct uwb_async_stats before;
+    struct sim_radio_stats rs;
+    int n = 0;
+
+    setup();
+    before = stats();
+    CHECK_EQ(uwb_rx_continuous_start(), 0);
+
+    for(int i = 0; i < UWB_RX_POOL_LEN + 2; i++)
+    {
+        frame[1] = i;
+        sim_radio_rx_frame(frame, sizeof(frame), i);
+    }
+    sim_radio_run();
+
+    /* the newest frames are lost and counted, the radio got every
+     * buffer back */
+    CHECK_EQ(stats().rx_dropped, before.rx_dropped + 2);
+    sim_radio_get_stats(&rs);
+    CHECK_EQ(rs.buf_frees, UWB_RX_POOL_LEN + 2);
+
+    while(uwb_rx_await(&d, K_NO_WAIT) == 0)
+    {
+        CHECK_EQ(d->data[1], n);
+        uwb_rx_release(d);
+        n++;
+    }
+    CHECK_EQ(n, UWB_RX_POOL_LEN);
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+
+    uwb_rx_continuous_stop();
+}
+
+static void overrun_recovery(void)
+{
+    uint8_t frame[] = { 0x85, 7, 0, 0, 0 };
+    struct uwb_rx_desc *d;
+    struct uwb_async_stats before;
+    struct sim_radio_stats rs0, rs1;
+
+    setup();
+    before = stats();
+    CHECK_EQ(uwb_rx_continuous_start(), 0);
+    sim_radio_get_stats(&rs0);
+
+    sim_radio_rx_overrun();
+    sim_radio_rx_error();
+    sim_radio_rx_frame(frame, sizeof(frame), 42);
+    sim_radio_run();
+
+    /* both failures restart the receiver without waking anybody, the
+     * overrun also resets it */
+    sim_radio_get_stats(&rs1);
+    CHECK_EQ(stats().rx_overrun, before.rx_overrun + 1);
+    CHECK_EQ(rs1.trx_off, rs0.trx_off + 1);
+    CHECK_EQ(rs1.rx_enables, rs0.rx_enables + 2);
+    CHECK(sim_radio_rx_on());
+
+    CHECK_EQ(uwb_rx_await(&d, K_NO_WAIT), 0);
+    CHECK_EQ(d->rx_ts, 42);
+    uwb_rx_release(d);
+    CHECK_EQ(uwb_rx_await(&d, K_NO_WAIT), -1);
+
+    /* stop drops whatever is still queued */
+    sim_radio_rx_frame(frame, sizeof(frame), 43);
+    sim_radio_run();
+    uwb_rx_continuous_stop();
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+    CHECK(!sim_radio_rx_on());
+}
+
+/* continuous RX clears the timeouts through the window cache, so setting
+ * the old window again afterwards still programs it */
+static void window_after_continuous(void)
+{
+    struct uwb_rx_window w = { .timeout_uus = 500 };
+    struct uwb_rx_desc *d;
+    uint32_t timeouts;
+
+    setup();
+    uwb_rx_window_set(&w);
+    CHECK_EQ(uwb_rx_continuous_start(), 0);
+    uwb_rx_continuous_stop();
+
+    uwb_rx_window_set(&w);
+    timeouts = stats().rx_timeout;
+    CHECK_EQ(uwb_rx_submit(DWT_START_RX_IMMEDIATE), 0);
+    sim_radio_run();
+    if(uwb_rx_await(&d, K_NO_WAIT) == 0)
+        uwb_rx_release(d);
+    CHECK_EQ(stats().rx_timeout, timeouts + 1);
+
+    dwt_forcetrxoff();
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+}
+
+/* every driver sequence undoes its decamutexon(), also on the error
+ * paths, and no IRQ is raised while one is held */
+static void driver_mutex(void)
+{
+    static const uint8_t frame[] = { 0x10, 1 };
+    static const struct uwb_rx_window w = { .delay_uus = 100, .timeout_uus = 500 };
+    struct sim_radio_stats rs;
+
+    setup();
+
+    uwb_rx_window_set(&w);
+    CHECK_EQ(sim_radio_mutex_depth(), 0);
+
+    CHECK_EQ(uwb_tx_submit(frame, sizeof(frame), DWT_START_TX_IMMEDIATE, 0), 0);
+    CHECK_EQ(sim_radio_mutex_depth(), 0);
+    CHECK_EQ(uwb_tx_await(NULL, K_MSEC(10)), 0);
+
+    sim_radio_tx_late(1);
+    CHECK_EQ(uwb_tx_submit(frame, sizeof(frame), DWT_START_TX_DELAYED, 0x1000), -1);
+    CHECK_EQ(sim_radio_mutex_depth(), 0);
+
+    CHECK_EQ(uwb_rx_continuous_start(), 0);
+    CHECK_EQ(sim_radio_mutex_depth(), 0);
+    sim_radio_rx_frame(frame, sizeof(frame), 1000);
+    sim_radio_run();
+    uwb_rx_continuous_stop();
+    CHECK_EQ(sim_radio_mutex_depth(), 0);
+
+    sim_radio_get_stats(&rs);
+    CHECK(rs.isr_calls > 0);
+    CHECK_EQ(rs.isr_locked, 0);
+
+    uwb_rx_window_set(NULL);
+}
+
+#if defined(CONFIG_UWB_PROFILE_STS)
+/* every frame, sent or received, starts from the shared IV: one lost
+ * frame must not leave the STS counters of two nodes apart */
+static void sts_reload(void)
+{
+    static const uint8_t frame[] = { 0x10, 1 };
+    static const uint8_t poll[] = { 0x01, 9, 0, 1 };
+    static const struct uwb_rx_window w = { .delay_uus = 100, .timeout_uus = 500 };
+    uint8_t buf[UWB_MSG_MAX];
+    uint16_t len;
+    struct sim_radio_stats rs;
+
+    setup();
+
+    uwb_tx((uint8_t *)frame, sizeof(frame));
+    uwb_tx((uint8_t *)frame, sizeof(frame));
+
+    sim_radio_rx_frame(frame, sizeof(frame), 1000);
+    CHECK_EQ(uwb_rx(buf, sizeof(buf), &len), 0);
+
+    /* the reply of a chained RX */
+    uwb_rx_window_set(&w);
+    sim_radio_on_tx(answer);
+    CHECK_EQ(uwb_tx_rx((uint8_t *)poll, sizeof(poll), buf, sizeof(buf), &len), 0);
+    sim_radio_on_tx(NULL);
+    uwb_rx_window_set(NULL);
+
+    /* back to back frames in the double buffer receiver */
+    CHECK_EQ(uwb_rx_continuous_start(), 0);
+    for(int i = 0; i < 4; i++)
+        sim_radio_rx_frame(frame, sizeof(frame), 2000 + i);
+    sim_radio_run();
+    uwb_rx_continuous_stop();
+
+    sim_radio_get_stats(&rs);
+    CHECK_EQ(rs.tx_done, 3);
+    CHECK(rs.sts_loads >= 9);
+    CHECK_EQ(rs.sts_stale, 0);
+
+    uwb_async_flush();
+}
+
+/* frames keyed to different indices never share an STS counter, and one
+ * replayed under a later index fails the STS check */
+static void sts_index(void)
+{
+    static const uint8_t frame[] = { 0x10, 1 };
+    struct uwb_rx_desc *d;
+    struct sim_radio_stats rs;
+    uint32_t bad;
+
+    setup();
+
+    for(uint32_t i = 0; i < 4; i++)
+    {
+        uwb_sts_set_index(i);
+        uwb_tx((uint8_t *)frame, sizeof(frame));
+    }
+
+    sim_radio_get_stats(&rs);
+    CHECK_EQ(rs.tx_done, 4);
+    CHECK_EQ(rs.sts_repeat, 0);
+
+    /* the check itself: the same index twice in a row */
+    uwb_tx((uint8_t *)frame, sizeof(frame));
+    sim_radio_get_stats(&rs);
+    CHECK_EQ(rs.sts_repeat, 1);
+
+    /* a frame the peer sent under index 4 */
+    uwb_sts_set_index(4);
+    sim_radio_sts_peer(sim_radio_sts_iv0());
+    bad = stats().rx_sts_bad;
+
+    sim_radio_rx_frame(frame, sizeof(frame), 1000);
+    CHECK_EQ(uwb_rx_submit(DWT_START_RX_IMMEDIATE), 0);
+    CHECK_EQ(uwb_rx_await(&d, K_FOREVER), 0);
+    CHECK(d->status & DWT_INT_RXFCG_BIT_MASK);
+    CHECK_EQ(d->sts_bad, 0);
+    uwb_rx_release(d);
+
+    /* and the same frame again in the next superframe */
+    uwb_sts_set_index(5);
+    sim_radio_rx_frame(frame, sizeof(frame), 2000);
+    CHECK_EQ(uwb_rx_submit(DWT_START_RX_IMMEDIATE), 0);
+    CHECK_EQ(uwb_rx_await(&d, K_FOREVER), 0);
+    CHECK(d->status & DWT_INT_RXFCG_BIT_MASK);
+    CHECK_EQ(d->sts_bad, 1);
+    uwb_rx_release(d);
+
+    CHECK_EQ(stats().rx_sts_bad, bad + 1);
+    CHECK_EQ(uwb_rx_pool_used(), 0);
+
+    uwb_sts_set_index(0);
+}
+#endif
+
+int main(void)
+{
+    RUN(rx_frame);
+    RUN(rx_timeout_and_error);
+    RUN(rx_too_long);
+    RUN(tx_rx_exchange);
+    RUN(tx_delayed);
+    RUN(tx_ring);
+    RUN(refcount);
+    RUN(pool_exhaustion);
+    RUN(overrun_recovery);
+    RUN(window_after_continuous);
+    RUN(driver_mutex);
+#if defined(CONFIG_UWB_PROFILE_STS)
+    RUN(sts_reload);
+    RUN(sts_index);
+#endif
+
+    return TEST_RESULT();
+}
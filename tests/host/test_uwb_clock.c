@@ -0,0 +1,235 @@
+/* uwb_clock on synthetic SYNC streams: convergence, the 5 sigma gate,
+ * and the restart after UWB_CLOCK_MAX_REJECTS outliers in a row. The
+ * recorded captures are replayed by replay_clock. */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uwb.h"
+#include "uwb_clock.h"
+#include "uwb_ts.h"
+
+#include "test.h"
+
+#define TICKS_PER_S     (1.0 / DWT_TIME_UNITS)
+#define SYNC_PERIOD_S   0.0328
+#define NOISE_TICKS     8.0
+
+/* a slave whose clock is offset from the master and runs skew_ppm fast,
+ * changing by rate_ppm_s per second */
+struct sim {
+    uint64_t master;
+    double   offset;
+    double   skew_ppm;
+    double   rate_ppm_s;
+};
+
+static double gauss(void)
+{
+    double u = test_uniform(1e-12, 1.0), v = test_uniform(0.0, 1.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* next SYNC: master TX time and the slave's RX time of it */
+static void sim_next(struct sim *s, uint64_t *local_rx, uint64_t *master_tx)
+{
+    s->master = uwb_ts_add(s->master, (int64_t)(SYNC_PERIOD_S * TICKS_PER_S));
+    s->offset += s->skew_ppm * 1e-6 * SYNC_PERIOD_S * TICKS_PER_S;
+    s->skew_ppm += s->rate_ppm_s * SYNC_PERIOD_S;
+
+    *master_tx = s->master;
+    *local_rx = uwb_ts_add(s->master, llround(s->offset + NOISE_TICKS * gauss()));
+}
+
+static int run(struct uwb_clock *c, struct sim *s, int n)
+{
+    int rejected = 0;
+
+    for(int i = 0; i < n; i++)
+    {
+        uint64_t rx, tx;
+
+        sim_next(s, &rx, &tx);
+        if(uwb_clock_sync(c, rx, tx) != 0)
+            rejected++;
+    }
+
+    return rejected;
+}
+
+/* innovation variance the next offset update will gate on, for a
+ * two-state filter predicted over dt seconds */
+static double innovation_var(const struct uwb_clock *c, double dt)
+{
+    double P00 = c->P[0][0] + 2 * dt * c->P[0][1] + dt * dt * c->P[1][1];
+
+    return P00 + c->cfg.skew_q * dt * dt * dt / 3 + c->cfg.ts_sigma * c->cfg.ts_sigma;
+}
+
+/* local RX time whose offset innovation is y ticks for master_tx */
+static uint64_t rx_with_innovation(const struct uwb_clock *c, uint64_t master_tx,
+                                   uint64_t local_guess, double y)
+{
+    double dt = (double)uwb_ts_sub(local_guess, c->ref_local) * DWT_TIME_UNITS;
+    double pred = c->x[0] + c->x[1] * dt;
+
+    return uwb_ts_add(master_tx, llround(pred + y));
+}
+
+static void converges(void)
+{
+    struct uwb_clock c;
+    struct sim s = { .master = 0xFFF0000000ULL, .offset = 123456789.0, .skew_ppm = 12.5 };
+    uint64_t rx, tx;
+
+    uwb_clock_init(&c, NULL);
+    CHECK_EQ(run(&c, &s, 600), 0);
+
+    CHECK(fabs(uwb_clock_skew_ppm(&c) - 12.5) < 0.01);
+    CHECK(llabs(uwb_clock_offset(&c) - llround(s.offset)) < 3 * NOISE_TICKS);
+
+    /* mapping a later local stamp back lands on the master time */
+    sim_next(&s, &rx, &tx);
+    CHECK(llabs(uwb_ts_sub(uwb_clock_to_master(&c, rx), tx)) < 5 * NOISE_TICKS);
+    CHECK(uwb_clock_sigma_ps(&c) < NOISE_TICKS * 15.65);
+}
+
+static void gate_at_5_sigma(void)
+{
+    struct uwb_clock c, saved;
+    struct sim s = { .offset = -5e8, .skew_ppm = -3.0 };
+    uint64_t rx, tx;
+
+    uwb_clock_init(&c, NULL);
+    CHECK_EQ(c.cfg.gate, 5.0);
+    CHECK_EQ(run(&c, &s, 300), 0);
+
+    sim_next(&s, &rx, &tx);
+    saved = c;
+
+    double S = innovation_var(&c, (double)uwb_ts_sub(rx, c.ref_local) * DWT_TIME_UNITS);
+
+    /* just inside the gate: used */
+    rx = rx_with_innovation(&c, tx, rx, 4.8 * sqrt(S));
+    CHECK_EQ(uwb_clock_sync(&c, rx, tx), 0);
+    CHECK_EQ(c.rejects, 0);
+
+    /* just outside, either sign: dropped, state untouched */
+    for(int sign = -1; sign <= 1; sign += 2)
+    {
+        c = saved;
+        rx = rx_with_innovation(&c, tx, rx, sign * 5.2 * sqrt(S));
+        CHECK_EQ(uwb_clock_sync(&c, rx, tx), -1);
+        CHECK_EQ(c.rejects, 1);
+        CHECK_EQ(c.n_rejected, saved.n_rejected + 1);
+        CHECK(memcmp(c.x, saved.x, sizeof(c.x)) == 0);
+        CHECK(memcmp(c.P, saved.P, sizeof(c.P)) == 0);
+        CHECK_EQ(c.ref_local, saved.ref_local);
+    }
+}
+
+static void restart_after_max_rejects(void)
+{
+    struct uwb_clock c;
+    struct sim s = { .offset = 1e6, .skew_ppm = 5.0 };
+    uint64_t rx, tx;
+    int64_t before;
+
+    uwb_clock_init(&c, NULL);
+    CHECK_EQ(run(&c, &s, 300), 0);
+    before = uwb_clock_offset(&c);
+
+    /* the master rebooted: its time jumps by a second */
+    s.master = uwb_ts_add(s.master, (int64_t)TICKS_PER_S);
+    s.offset -= TICKS_PER_S;
+
+    for(int i = 1; i < UWB_CLOCK_MAX_REJECTS; i++)
+    {
+        sim_next(&s, &rx, &tx);
+        CHECK_EQ(uwb_clock_sync(&c, rx, tx), -1);
+        CHECK_EQ(c.rejects, i);
+        CHECK(llabs(uwb_clock_offset(&c) - before) < 100);
+    }
+
+    /* the last one in the run restarts on its own pair */
+    sim_next(&s, &rx, &tx);
+    CHECK_EQ(uwb_clock_sync(&c, rx, tx), -1);
+    CHECK_EQ(c.rejects, 0);
+    CHECK_EQ(c.n_rejected, UWB_CLOCK_MAX_REJECTS);
+    CHECK_EQ(uwb_clock_offset(&c), uwb_ts_sub(rx, tx));
+
+    /* and then tracks the new master */
+    CHECK_EQ(run(&c, &s, 300), 0);
+    CHECK(fabs(uwb_clock_skew_ppm(&c) - 5.0) < 0.02);
+    CHECK(llabs(uwb_clock_offset(&c) - llround(s.offset)) < 3 * NOISE_TICKS);
+}
+
+static void isolated_outliers_no_restart(void)
+{
+    struct uwb_clock c;
+    struct sim s = { .offset = 42, .skew_ppm = 1.0 };
+    uint64_t rx, tx;
+
+    uwb_clock_init(&c, NULL);
+    CHECK_EQ(run(&c, &s, 300), 0);
+
+    /* runs one short of the limit, broken by a good SYNC */
+    for(int k = 0; k < 10; k++)
+    {
+        for(int i = 0; i < UWB_CLOCK_MAX_REJECTS - 1; i++)
+        {
+            sim_next(&s, &rx, &tx);
+            CHECK_EQ(uwb_clock_sync(&c, uwb_ts_add(rx, 2000), tx), -1);
+        }
+
+        sim_next(&s, &rx, &tx);
+        CHECK_EQ(uwb_clock_sync(&c, rx, tx), 0);
+        CHECK_EQ(c.rejects, 0);
+    }
+
+    CHECK_EQ(c.n_rejected, 10 * (UWB_CLOCK_MAX_REJECTS - 1));
+    CHECK(fabs(uwb_clock_skew_ppm(&c) - 1.0) < 0.05);
+}
+
+static void three_state_tracks_ramp(void)
+{
+    struct uwb_clock_cfg cfg = uwb_clock_default_cfg;
+    struct uwb_clock c;
+    struct sim s = { .offset = 7e7, .skew_ppm = -8.0, .rate_ppm_s = 0.02 };
+
+    cfg.states = 3;
+    uwb_clock_init(&c, &cfg);
+    CHECK_EQ(run(&c, &s, 1500), 0);
+
+    CHECK(fabs(uwb_clock_skew_ppm(&c) - s.skew_ppm) < 0.01);
+    CHECK(fabs(c.x[2] / TICKS_PER_S * 1e6 - 0.02) < 0.005);
+}
+
+static void skew_measurement(void)
+{
+    struct uwb_clock c;
+    struct sim s = { .offset = 0, .skew_ppm = 20.0 };
+
+    /* a receiver skew estimate pins the skew after two SYNCs */
+    uwb_clock_init(&c, NULL);
+    run(&c, &s, 2);
+    uwb_clock_skew(&c, 20.0, UWB_CLOCK_CI_SIGMA_PPM);
+    CHECK(fabs(uwb_clock_skew_ppm(&c) - 20.0) < 3 * UWB_CLOCK_CI_SIGMA_PPM);
+
+    CHECK(fabs(uwb_clock_offset_to_ppm(16) - 1.0) < 1e-12);
+    CHECK(fabs(uwb_clock_offset_to_ppm(-32) + 2.0) < 1e-12);
+}
+
+int main(void)
+{
+    RUN(converges);
+    RUN(gate_at_5_sigma);
+    RUN(restart_after_max_rejects);
+    RUN(isolated_outliers_no_restart);
+    RUN(three_state_tracks_ramp);
+    RUN(skew_measurement);
+
+    return TEST_RESULT();
+}
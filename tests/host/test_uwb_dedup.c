@@ -0,0 +1,174 @@
+/* uwb_dedup: repeats inside the window are caught and nothing else is,
+ * entries expire in place, and a full probe run evicts its oldest entry.
+ *
+ * Tags with equal halves, tag = (k << 32) | k, fold to the same hash for
+ * the same seq, so the probe paths can be driven directly. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uwb_dedup.h"
+
+#include "test.h"
+
+#define WINDOW_MS   1000
+
+static struct uwb_dedup d;
+
+static uint64_t same_hash_tag(uint32_t k)
+{
+    return ((uint64_t)k << 32) | k;
+}
+
+static void repeat_in_window(void)
+{
+    uwb_dedup_init(&d, WINDOW_MS);
+
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 5000), 0);
+    /* same millisecond, even and odd */
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 5000), 1);
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 5001), 1);
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 5000 + WINDOW_MS - 2), 1);
+    CHECK_EQ(d.stats.dup, 3);
+
+    /* the next seq and the same seq on another tag are new */
+    CHECK_EQ(uwb_dedup_check(&d, 7, 101, 5010), 0);
+    CHECK_EQ(uwb_dedup_check(&d, 8, 100, 5010), 0);
+    CHECK_EQ(d.stats.dup, 3);
+    CHECK_EQ(d.stats.evicted, 0);
+}
+
+static void window_expiry(void)
+{
+    uwb_dedup_init(&d, WINDOW_MS);
+
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 5001), 0);
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 5001 + WINDOW_MS), 0);
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 5001 + WINDOW_MS + 1), 1);
+
+    /* across the uptime wrap */
+    uwb_dedup_init(&d, WINDOW_MS);
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 0xFFFFFF01u), 0);
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 0x00000100u), 1);
+    CHECK_EQ(uwb_dedup_check(&d, 7, 100, 0x00000401u), 0);
+    CHECK_EQ(d.stats.evicted, 0);
+}
+
+static void cross_tag_collision(void)
+{
+    uwb_dedup_init(&d, WINDOW_MS);
+
+    /* same hash and seq, different tags: both are kept */
+    for(uint32_t k = 1; k <= 4; k++)
+        CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(k), 42, 100), 0);
+    for(uint32_t k = 1; k <= 4; k++)
+        CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(k), 42, 200), 1);
+
+    /* tags that differ only in which half holds the bits */
+    CHECK_EQ(uwb_dedup_check(&d, 0x0000000100000000ull, 9, 300), 0);
+    CHECK_EQ(uwb_dedup_check(&d, 0x0000000000000001ull, 9, 300), 0);
+    CHECK_EQ(uwb_dedup_check(&d, 0x0000000100000000ull, 9, 301), 1);
+
+    CHECK_EQ(d.stats.dup, 5);
+    CHECK_EQ(d.stats.evicted, 0);
+}
+
+static void probe_eviction(void)
+{
+    uwb_dedup_init(&d, WINDOW_MS);
+
+    for(uint32_t k = 0; k < UWB_DEDUP_PROBE; k++)
+        CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(k), 1, 11 + 10 * k), 0);
+    CHECK_EQ(d.stats.evicted, 0);
+
+    /* one more than the probe run: the oldest, k = 0, goes */
+    CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(UWB_DEDUP_PROBE), 1, 101), 0);
+    CHECK_EQ(d.stats.evicted, 1);
+
+    for(uint32_t k = 1; k <= UWB_DEDUP_PROBE; k++)
+        CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(k), 1, 111), 1);
+
+    /* k = 0 was forgotten; seeing it again pushes out k = 1 */
+    CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(0), 1, 121), 0);
+    CHECK_EQ(d.stats.evicted, 2);
+    CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(0), 1, 131), 1);
+    CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(2), 1, 131), 1);
+}
+
+static void expired_reuse(void)
+{
+    uwb_dedup_init(&d, WINDOW_MS);
+
+    for(uint32_t k = 0; k < UWB_DEDUP_PROBE; k++)
+        CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(k), 1, 11), 0);
+
+    /* a full run of expired entries is reused without eviction */
+    for(uint32_t k = 0; k < UWB_DEDUP_PROBE; k++)
+        CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(100 + k), 1, 11 + WINDOW_MS), 0);
+    CHECK_EQ(d.stats.evicted, 0);
+
+    for(uint32_t k = 0; k < UWB_DEDUP_PROBE; k++)
+        CHECK_EQ(uwb_dedup_check(&d, same_hash_tag(100 + k), 1, 21 + WINDOW_MS), 1);
+}
+
+/* random traffic against a plain list: while nothing is evicted the
+ * table answers exactly like it, and it never reports a false repeat */
+struct seen {
+    uint64_t tag;
+    uint32_t seq;
+    uint32_t t_ms;
+};
+
+static void model(void)
+{
+    enum { N = 20000, TAGS = 16 };
+    static struct seen log[N];
+    int n = 0;
+    uint32_t now = 0xFFFF0000u;
+    uint32_t seq[TAGS] = {0};
+
+    uwb_dedup_init(&d, WINDOW_MS);
+
+    for(int i = 0; i < N; i++)
+    {
+        uint32_t t = test_rand64() % TAGS;
+        uint64_t tag = 0x1000000000000000ull + t * 0x10001ull;
+        int want = 0;
+
+        now += 1 + test_rand64() % 60;
+        /* mostly new blinks, some repeats of recent ones */
+        if(test_rand64() % 4 != 0 || seq[t] == 0)
+            seq[t]++;
+        uint32_t s = seq[t] - (uint32_t)(test_rand64() % 2);
+
+        for(int j = 0; j < n; j++)
+            if(log[j].tag == tag && log[j].seq == s &&
+               (now | 1) - log[j].t_ms < WINDOW_MS)
+                want = 1;
+
+        int got = uwb_dedup_check(&d, tag, s, now);
+
+        if(got)
+            CHECK(want);
+        if(d.stats.evicted == 0)
+            CHECK_EQ(got, want);
+        if(!want)
+            log[n++] = (struct seen){ tag, s, now | 1 };
+    }
+
+    /* about 32 blinks per window in a 128-entry table */
+    CHECK_EQ(d.stats.evicted, 0);
+    CHECK(d.stats.dup > 0);
+}
+
+int main(void)
+{
+    RUN(repeat_in_window);
+    RUN(window_expiry);
+    RUN(cross_tag_collision);
+    RUN(probe_eviction);
+    RUN(expired_reuse);
+    RUN(model);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,458 @@
+/* uwb_hub and the hub part of uwb_tdma, end to end: a master, slave
+ * anchors and TDMA tags run over many superframes, the same way the
+ * HUB_MODE samples drive the library, with blink loss, duplicated
+ * records and reports from a stale superframe. The hub's groups must
+ * match the ground truth exactly.
+ *
+ *   test_uwb_hub          run the checks
+ *   test_uwb_hub --sim    throughput table for 2-8 anchors, 4-16 tags */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "uwb.h"
+#include "uwb_hub.h"
+#include "uwb_tdma.h"
+#include "uwb_ts.h"
+
+#include "test.h"
+
+#define MASTER_ID       1
+#define BLINK_LEN       UWB_MSG_BLINK_LEN
+
+struct sim_cfg {
+    int    n_slaves;
+    int    n_tags;
+    int    superframes;
+    double p_loss;          /* an anchor misses a blink */
+    double p_report_loss;   /* a REPORT frame is lost */
+    double p_dup;           /* a slave lists a blink twice */
+    double p_stale;         /* a REPORT arrives a superframe late */
+};
+
+struct sim_result {
+    uint32_t blinks;        /* sent by tags */
+    uint32_t grouped;       /* groups the hub produced */
+    uint32_t fixes;         /* groups with 3 or more anchors */
+    uint32_t mismatches;    /* groups that differ from the truth */
+    uint32_t truncated;     /* records that did not fit a REPORT */
+    uint32_t want_dup, want_stale;
+    struct uwb_hub_stats stats;
+    uint32_t superframe_uus;
+    double   host_ns;       /* host CPU per superframe, hub side */
+};
+
+/* what the hub should end up with for one blink */
+struct truth {
+    uint16_t tag, seq;
+    uint8_t  n;
+    uint8_t  anchors[UWB_HUB_MAX_ANCHORS];
+    uint64_t ts[UWB_HUB_MAX_ANCHORS];
+};
+
+static int chance(double p)
+{
+    return test_uniform(0, 1) < p;
+}
+
+static struct truth *truth_find(struct truth *t, int n, uint16_t tag, uint16_t seq)
+{
+    for(int i = 0; i < n; i++)
+        if(t[i].tag == tag && t[i].seq == seq)
+            return &t[i];
+
+    return NULL;
+}
+
+static int group_matches(const struct uwb_hub_blink *b, const struct truth *t)
+{
+    if(!t || b->n != t->n)
+        return 0;
+
+    for(int i = 0; i < b->n; i++)
+    {
+        int found = 0;
+
+        for(int j = 0; j < t->n; j++)
+            if(b->anchors[i] == t->anchors[j] && b->ts[i] == t->ts[j])
+                found = 1;
+
+        if(!found)
+            return 0;
+    }
+
+    return 1;
+}
+
+static void sim_run(const struct sim_cfg *cfg, struct sim_result *res)
+{
+    uint16_t tags[UWB_TDMA_MAX_SLOTS];
+    uint8_t slaves[UWB_TDMA_MAX_ANCHORS];
+    uint8_t sync[UWB_MSG_MAX], frame[UWB_MSG_MAX];
+    struct uwb_tdma_sched sched, rx_sched;
+    struct uwb_hub hub;
+    struct uwb_hub_report late[UWB_TDMA_MAX_ANCHORS];
+    int n_late = 0;
+    uint64_t sync_ts = 0x00F0000000ULL;
+    uint64_t host_ns = 0;
+    uint16_t seq = 0;
+
+    memset(res, 0, sizeof(*res));
+    memset(&hub, 0, sizeof(hub));
+
+    for(int i = 0; i < cfg->n_tags; i++)
+        tags[i] = 250 + i;      /* crosses the 8-bit boundary */
+    for(int i = 0; i < cfg->n_slaves; i++)
+        slaves[i] = 2 + i;
+
+    CHECK_EQ(uwb_tdma_init(&sched, tags, cfg->n_tags, BLINK_LEN), 0);
+    CHECK_EQ(uwb_tdma_set_reports(&sched, slaves, cfg->n_slaves,
+                                  UWB_HUB_REPORT_LEN(UWB_HUB_MAX_RECS)), 0);
+    res->superframe_uus = uwb_tdma_end_uus(&sched);
+
+    for(int sf = 0; sf < cfg->superframes; sf++)
+    {
+        uint8_t sync_seq = (uint8_t)sf;
+        struct truth truth[UWB_TDMA_MAX_SLOTS];
+        struct uwb_hub_report reports[UWB_TDMA_MAX_ANCHORS];
+        int dups[UWB_TDMA_MAX_ANCHORS] = { 0 };
+        int n_truth = 0;
+
+        /* SYNC: every slave parses the same schedule back */
+        int len = uwb_tdma_encode(&sched, sync, sizeof(sync));
+        CHECK(len > 0);
+        CHECK_EQ(uwb_tdma_decode(&rx_sched, sync, len), 0);
+        CHECK_EQ(rx_sched.n_anchors, cfg->n_slaves);
+
+        for(int a = 0; a < cfg->n_slaves; a++)
+            uwb_hub_report_begin(&reports[a], slaves[a], sync_seq);
+
+        uint64_t t0 = test_now_ns();
+        uwb_hub_begin(&hub, sync_seq);
+        host_ns += test_now_ns() - t0;
+
+        /* tag slots */
+        for(int k = 0; k < cfg->n_tags; k++)
+        {
+            struct truth *t = &truth[n_truth++];
+            uint64_t slot_start = uwb_ts_add(sync_ts,
+                (int64_t)(sched.first_slot_uus + k * sched.slot_uus) * UUS_TO_DWT_TIME);
+
+            t->tag = tags[k];
+            t->seq = seq++;
+            t->n = 0;
+            res->blinks++;
+
+            /* master plus slaves, master is anchor index -1 */
+            for(int a = -1; a < cfg->n_slaves; a++)
+            {
+                uint8_t id = a < 0 ? MASTER_ID : slaves[a];
+                /* anywhere in the first half of the slot, up to ~30 m */
+                uint64_t rx = uwb_ts_add(slot_start,
+                    (int64_t)test_uniform(0, (double)sched.slot_uus * UUS_TO_DWT_TIME / 2));
+
+                if(chance(cfg->p_loss))
+                    continue;
+
+                if(a < 0)
+                {
+                    struct uwb_hub_rec rec = { t->tag, t->seq, rx };
+
+                    t0 = test_now_ns();
+                    CHECK_EQ(uwb_hub_add(&hub, MASTER_ID, &rec), 0);
+                    host_ns += test_now_ns() - t0;
+                }
+                else
+                {
+                    /* a slave keeps a blink only if it landed in its tag's slot */
+                    int slot = uwb_tdma_slot_at(&rx_sched, sync_ts, rx);
+
+                    CHECK_EQ(slot, k);
+                    if(slot < 0 || rx_sched.tags[slot] != t->tag)
+                        continue;
+
+                    if(uwb_hub_report_add(&reports[a], t->tag, t->seq, rx) != 0)
+                    {
+                        res->truncated++;
+                        continue;
+                    }
+
+                    if(chance(cfg->p_dup) &&
+                       uwb_hub_report_add(&reports[a], t->tag, t->seq, rx) == 0)
+                        dups[a]++;
+                }
+
+                t->anchors[t->n] = id;
+                t->ts[t->n] = rx;
+                t->n++;
+            }
+        }
+
+        /* a late report from the superframe before arrives first */
+        for(int i = 0; i < n_late; i++)
+        {
+            int rl = uwb_hub_encode(&late[i], frame, sizeof(frame));
+            struct uwb_hub_report r;
+
+            CHECK_EQ(uwb_hub_decode(&r, frame, rl), 0);
+            CHECK_EQ(uwb_hub_add_report(&hub, &r), -1);
+            res->want_stale++;
+        }
+        n_late = 0;
+
+        /* report slots */
+        for(int a = 0; a < cfg->n_slaves; a++)
+        {
+            struct uwb_hub_report r;
+            int rl;
+
+            CHECK_EQ(uwb_tdma_report_of(&rx_sched, slaves[a]), a);
+
+            rl = uwb_hub_encode(&reports[a], frame, sizeof(frame));
+            CHECK(rl > 0);
+
+            if(chance(cfg->p_stale))
+            {
+                late[n_late++] = reports[a];
+                rl = -1;
+            }
+            else if(chance(cfg->p_report_loss))
+                rl = -1;
+
+            if(rl < 0)
+            {
+                /* the hub never sees these timestamps */
+                for(int i = 0; i < n_truth; i++)
+                {
+                    struct truth *t = &truth[i];
+
+                    for(int j = 0; j < t->n; j++)
+                    {
+                        if(t->anchors[j] == slaves[a])
+                        {
+                            t->anchors[j] = t->anchors[t->n - 1];
+                            t->ts[j] = t->ts[t->n - 1];
+                            t->n--;
+                            break;
+                        }
+                    }
+                }
+                continue;
+            }
+
+            t0 = test_now_ns();
+            CHECK_EQ(uwb_hub_decode(&r, frame, rl), 0);
+            CHECK_EQ(uwb_hub_add_report(&hub, &r), 0);
+            host_ns += test_now_ns() - t0;
+
+            res->want_dup += dups[a];
+        }
+
+        /* the hub's groups against the truth, blinks nobody heard have none */
+        int expect = 0;
+
+        for(int i = 0; i < n_truth; i++)
+            expect += truth[i].n > 0;
+
+        if(hub.n_blinks != expect)
+            res->mismatches += abs(expect - hub.n_blinks);
+
+        for(int i = 0; i < hub.n_blinks; i++)
+        {
+            const struct uwb_hub_blink *b = &hub.blinks[i];
+
+            if(!group_matches(b, truth_find(truth, n_truth, b->tag, b->seq)))
+                res->mismatches++;
+
+            res->grouped++;
+            res->fixes += b->n >= 3;
+        }
+
+        sync_ts = uwb_ts_add(sync_ts, (int64_t)(res->superframe_uus + 1000) * UUS_TO_DWT_TIME);
+    }
+
+    res->stats = hub.stats;
+    res->host_ns = (double)host_ns / cfg->superframes;
+}
+
+static void report_codec(void)
+{
+    struct uwb_hub_report r, d;
+    uint8_t frame[UWB_MSG_MAX];
+    int len;
+
+    uwb_hub_report_begin(&r, 3, 200);
+    for(int i = 0; i < UWB_HUB_MAX_RECS; i++)
+        CHECK_EQ(uwb_hub_report_add(&r, 0x100 + i, 0xFFF0 + i, 0xFFFFFFFF00ULL + i), 0);
+    CHECK_EQ(uwb_hub_report_add(&r, 1, 1, 1), -1);
+
+    len = uwb_hub_encode(&r, frame, sizeof(frame));
+    CHECK_EQ(len, UWB_HUB_REPORT_LEN(UWB_HUB_MAX_RECS));
+    CHECK(len <= UWB_MSG_MAX);
+
+    CHECK_EQ(uwb_hub_decode(&d, frame, len), 0);
+    CHECK_EQ(d.anchor, 3);
+    CHECK_EQ(d.sync_seq, 200);
+    CHECK_EQ(d.n, UWB_HUB_MAX_RECS);
+    for(int i = 0; i < d.n; i++)
+    {
+        CHECK_EQ(d.recs[i].tag, 0x100 + i);
+        CHECK_EQ(d.recs[i].seq, 0xFFF0 + i);
+        CHECK_EQ(d.recs[i].ts, 0xFFFFFFFF00ULL + i);
+    }
+
+    /* a record short, or a count past the limit */
+    CHECK_EQ(uwb_hub_decode(&d, frame, len - 1), -1);
+    frame[3] = UWB_HUB_MAX_RECS + 1;
+    CHECK_EQ(uwb_hub_decode(&d, frame, sizeof(frame)), -1);
+
+    /* too small a buffer */
+    CHECK_EQ(uwb_hub_encode(&r, frame, len - 1), -1);
+}
+
+static void schedule_codec(void)
+{
+    static const uint16_t tags[] = { 10, 0, 0x1234 };
+    static const uint8_t anchors[] = { 2, 3, 4 };
+    struct uwb_tdma_sched s, d;
+    uint8_t sync[UWB_MSG_MAX];
+    int len;
+
+    CHECK_EQ(uwb_tdma_init(&s, tags, 3, BLINK_LEN), 0);
+    len = uwb_tdma_encode(&s, sync, sizeof(sync));
+    CHECK_EQ(uwb_tdma_decode(&d, sync, len), 0);
+    CHECK_EQ(d.n_anchors, 0);
+
+    CHECK_EQ(uwb_tdma_set_reports(&s, anchors, 3, UWB_HUB_REPORT_LEN(UWB_HUB_MAX_RECS)), 0);
+    len = uwb_tdma_encode(&s, sync, sizeof(sync));
+    CHECK(len <= UWB_TDMA_SYNC_MAX);
+    CHECK_EQ(uwb_tdma_decode(&d, sync, len), 0);
+    CHECK_EQ(d.n_slots, 3);
+    CHECK_EQ(d.slot_uus, s.slot_uus);
+    CHECK_EQ(d.first_slot_uus, s.first_slot_uus);
+    CHECK_EQ(d.n_anchors, 3);
+    CHECK_EQ(d.report_ofs_uus, s.report_ofs_uus);
+    CHECK_EQ(d.report_uus, s.report_uus);
+    CHECK_EQ(uwb_tdma_slot_of(&d, 0x1234), 2);
+    CHECK_EQ(uwb_tdma_slot_of(&d, 0x34), -1);
+    CHECK_EQ(uwb_tdma_report_of(&d, 4), 2);
+
+    /* reports start after the last tag slot and its gap */
+    CHECK(uwb_tdma_report_ofs_uus(&d, 0) >=
+          (uint32_t)d.first_slot_uus + d.n_slots * d.slot_uus + UWB_TDMA_REPORT_GAP_US);
+    CHECK_EQ(uwb_tdma_end_uus(&d), uwb_tdma_report_ofs_uus(&d, 3));
+
+    /* slot boundaries */
+    uint64_t sync_rx = 0xFFFFFF0000ULL;
+    uint64_t first = (uint64_t)d.first_slot_uus * UUS_TO_DWT_TIME;
+    uint64_t width = (uint64_t)d.slot_uus * UUS_TO_DWT_TIME;
+
+    CHECK_EQ(uwb_tdma_slot_at(&d, sync_rx, uwb_ts_add(sync_rx, first - 1)), -1);
+    CHECK_EQ(uwb_tdma_slot_at(&d, sync_rx, uwb_ts_add(sync_rx, first)), 0);
+    CHECK_EQ(uwb_tdma_slot_at(&d, sync_rx, uwb_ts_add(sync_rx, first + width)), 1);
+    CHECK_EQ(uwb_tdma_slot_at(&d, sync_rx, uwb_ts_add(sync_rx, first + 3 * width - 1)), 2);
+    CHECK_EQ(uwb_tdma_slot_at(&d, sync_rx, uwb_ts_add(sync_rx, first + 3 * width)), -1);
+
+    /* truncated report section: the tag part still parses */
+    CHECK_EQ(uwb_tdma_decode(&d, sync, len - 1), 0);
+    CHECK_EQ(d.n_anchors, 0);
+    CHECK_EQ(uwb_tdma_decode(&d, sync, UWB_TDMA_HDR_OFS + UWB_TDMA_HDR_LEN + 2), -1);
+}
+
+static void check_sim(const struct sim_cfg *cfg, struct sim_result *r)
+{
+    sim_run(cfg, r);
+
+    CHECK_EQ(r->mismatches, 0);
+    CHECK_EQ(r->stats.dup, r->want_dup);
+    CHECK_EQ(r->stats.stale, r->want_stale);
+    CHECK_EQ(r->stats.overflow, 0);
+}
+
+static void sim_clean(void)
+{
+    struct sim_cfg cfg = { .n_slaves = 7, .n_tags = UWB_HUB_MAX_RECS, .superframes = 500 };
+    struct sim_result r;
+
+    check_sim(&cfg, &r);
+
+    /* every blink, every anchor */
+    CHECK_EQ(r.grouped, r.blinks);
+    CHECK_EQ(r.fixes, r.blinks);
+    CHECK_EQ(r.truncated, 0);
+    CHECK_EQ(r.stats.reports, 7 * 500);
+}
+
+static void sim_full_slots(void)
+{
+    struct sim_cfg cfg = { .n_slaves = 3, .n_tags = UWB_TDMA_MAX_SLOTS, .superframes = 100 };
+    struct sim_result r;
+
+    /* more tags than a REPORT holds: the last slots reach the master only */
+    check_sim(&cfg, &r);
+
+    CHECK_EQ(r.grouped, r.blinks);
+    CHECK_EQ(r.truncated, 3 * 100 * (UWB_TDMA_MAX_SLOTS - UWB_HUB_MAX_RECS));
+    CHECK_EQ(r.fixes, 100 * UWB_HUB_MAX_RECS);
+}
+
+static void sim_lossy(void)
+{
+    struct sim_cfg cfg = {
+        .n_slaves = 5, .n_tags = 8, .superframes = 2000,
+        .p_loss = 0.2, .p_report_loss = 0.05, .p_dup = 0.02, .p_stale = 0.02,
+    };
+    struct sim_result r;
+
+    check_sim(&cfg, &r);
+
+    CHECK(r.want_dup > 0);
+    CHECK(r.want_stale > 0);
+    CHECK(r.fixes < r.grouped);
+}
+
+static void sim_table(void)
+{
+    static const int anchors[] = { 2, 4, 8 };
+    static const int tags[] = { 4, 8, 16 };
+
+    printf("anchors tags  superframe[ms]  blinks/s  fixes/s@10%%loss  truncated/sf  hub[us/sf]\n");
+
+    for(size_t i = 0; i < ARRAY_SIZE(anchors); i++)
+    {
+        for(size_t j = 0; j < ARRAY_SIZE(tags); j++)
+        {
+            struct sim_cfg cfg = {
+                .n_slaves = anchors[i] - 1, .n_tags = tags[j], .superframes = 2000,
+                .p_loss = 0.1, .p_report_loss = 0.02,
+            };
+            struct sim_result r;
+
+            check_sim(&cfg, &r);
+
+            double sf_s = r.superframe_uus * 1.0256e-6;
+
+            printf("%7d %4d  %14.2f  %8.0f  %15.0f  %12.1f  %10.2f\n", anchors[i], tags[j],
+                   sf_s * 1e3, tags[j] / sf_s,
+                   (double)r.fixes / cfg.superframes / sf_s,
+                   (double)r.truncated / cfg.superframes, r.host_ns / 1e3);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "--sim") == 0)
+    {
+        sim_table();
+        return TEST_RESULT();
+    }
+
+    RUN(report_codec);
+    RUN(schedule_codec);
+    RUN(sim_clean);
+    RUN(sim_full_slots);
+    RUN(sim_lossy);
+
+    return TEST_RESULT();
+}
@@ -0,0 +1,318 @@
+/* uwb_ring with a real producer and consumer thread: every record put
+ * is either consumed or counted as dropped, every attempt that was not
+ * put is counted as refused, records arrive in order and never torn.
+ *
+ *   test_uwb_ring             run the checks
+ *   test_uwb_ring --bench [n] throughput against a k_msgq-style queue */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+
+#include "uwb_ring.h"
+
+#include "test.h"
+
+/* same size as the ble_tdoa_slave telemetry record */
+struct rec {
+    uint32_t seq;
+    uint32_t fill[7];
+};
+
+UWB_RING_DEFINE(ring, struct rec, 16);
+
+static void rec_fill(struct rec *r, uint32_t seq)
+{
+    r->seq = seq;
+    for(int i = 0; i < 7; i++)
+        r->fill[i] = seq * 2654435761u + i;
+}
+
+static int rec_ok(const struct rec *r)
+{
+    for(int i = 0; i < 7; i++)
+        if(r->fill[i] != r->seq * 2654435761u + i)
+            return 0;
+
+    return 1;
+}
+
+struct stress {
+    uint32_t n;             /* records the producer tries to put */
+    uint32_t prod_yield;    /* producer yields every this many, power of 2 */
+    int      hold;          /* every this many claims, yield while holding */
+    volatile int done;
+
+    uint32_t consumed;
+    uint32_t torn;
+    uint32_t out_of_order;
+    uint32_t last_seq;
+    int      seen;
+};
+
+static void *producer(void *arg)
+{
+    struct stress *s = arg;
+
+    for(uint32_t seq = 0; seq < s->n; seq++)
+    {
+        /* mix the in-place and the copying interface */
+        if(seq & 1)
+        {
+            struct rec *slot = uwb_ring_reserve(&ring);
+
+            if(slot)
+            {
+                rec_fill(slot, seq);
+                uwb_ring_commit(&ring);
+            }
+        }
+        else
+        {
+            struct rec r;
+
+            rec_fill(&r, seq);
+            uwb_ring_put(&ring, &r);
+        }
+
+        if((seq & (s->prod_yield - 1)) == 0)
+            sched_yield();
+    }
+
+    s->done = 1;
+    return NULL;
+}
+
+static void consume(struct stress *s, struct rec *recs, int n)
+{
+    for(int i = 0; i < n; i++)
+    {
+        struct rec copy = recs[i];
+
+        if(!rec_ok(&copy))
+            s->torn++;
+        if(s->seen && copy.seq <= s->last_seq)
+            s->out_of_order++;
+
+        s->last_seq = copy.seq;
+        s->seen = 1;
+        s->consumed++;
+    }
+}
+
+static void *consumer(void *arg)
+{
+    struct stress *s = arg;
+    unsigned int k = 0;
+
+    while(1)
+    {
+        void *first;
+        int done = s->done;
+        int max = 1 + (k++ % 8);
+        int n = uwb_ring_peek(&ring, &first, max, K_MSEC(1));
+
+        if(n == 0)
+        {
+            if(done)
+                break;
+            continue;
+        }
+
+        /* sometimes hand part of the claim back */
+        int use = (k % 5 == 0 && n > 1) ? n / 2 : n;
+
+        /* let the producer run into the claimed records before we read them */
+        if(s->hold && k % s->hold == 0)
+            sched_yield();
+
+        consume(s, first, use);
+        uwb_ring_release(&ring, use);
+    }
+
+    return NULL;
+}
+
+static void run_stress(uint32_t n, uint32_t prod_yield, int hold)
+{
+    struct stress s = { .n = n, .prod_yield = prod_yield, .hold = hold };
+    struct uwb_ring_stats st;
+    pthread_t p, c;
+
+    uwb_ring_init(&ring);
+
+    pthread_create(&c, NULL, consumer, &s);
+    pthread_create(&p, NULL, producer, &s);
+    pthread_join(p, NULL);
+    pthread_join(c, NULL);
+
+    uwb_ring_get_stats(&ring, &st);
+
+    printf("  %u attempts: put %u, consumed %u, dropped %u, refused %u\n",
+           n, st.put, s.consumed, st.dropped, st.refused);
+
+    CHECK_EQ(s.torn, 0);
+    CHECK_EQ(s.out_of_order, 0);
+    CHECK_EQ(st.put + st.refused, n);
+    CHECK_EQ(st.put, s.consumed + st.dropped);
+}
+
+static void stress_fast_consumer(void)
+{
+    run_stress(500000, 4, 0);
+}
+
+static void stress_slow_consumer(void)
+{
+    /* forces both drops and refusals */
+    run_stress(500000, 64, 3);
+}
+
+static void single_thread(void)
+{
+    struct uwb_ring_stats st;
+    struct rec r;
+    void *first;
+
+    uwb_ring_init(&ring);
+    CHECK_EQ(uwb_ring_peek(&ring, &first, 8, K_NO_WAIT), 0);
+
+    /* overfill by 3: the 3 oldest go */
+    for(uint32_t i = 0; i < 19; i++)
+    {
+        rec_fill(&r, i);
+        CHECK_EQ(uwb_ring_put(&ring, &r), 0);
+    }
+
+    uwb_ring_get_stats(&ring, &st);
+    CHECK_EQ(st.dropped, 3);
+
+    /* claims stop at the end of the buffer */
+    CHECK_EQ(uwb_ring_peek(&ring, &first, 32, K_NO_WAIT), 13);
+    CHECK_EQ(((struct rec *)first)->seq, 3);
+
+    /* full with the oldest claimed: the new record is refused */
+    CHECK_EQ(uwb_ring_put(&ring, &r), -1);
+    uwb_ring_get_stats(&ring, &st);
+    CHECK_EQ(st.refused, 1);
+
+    /* give back all but 2, those come again first */
+    uwb_ring_release(&ring, 11);
+    CHECK_EQ(uwb_ring_peek(&ring, &first, 32, K_NO_WAIT), 2);
+    CHECK_EQ(((struct rec *)first)->seq, 14);
+    uwb_ring_release(&ring, 2);
+
+    CHECK_EQ(uwb_ring_peek(&ring, &first, 32, K_NO_WAIT), 3);
+    CHECK_EQ(((struct rec *)first)->seq, 16);
+    uwb_ring_release(&ring, 3);
+    CHECK_EQ(uwb_ring_peek(&ring, &first, 32, K_NO_WAIT), 0);
+}
+
+/* what k_msgq does: copy in and out under a lock, wake a reader */
+struct msgq {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    struct rec      buf[16];
+    uint32_t        head, tail;
+};
+
+static struct msgq mq = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int msgq_put(const struct rec *r)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&mq.lock);
+    if(mq.head - mq.tail < ARRAY_SIZE(mq.buf))
+    {
+        mq.buf[mq.head++ % ARRAY_SIZE(mq.buf)] = *r;
+        pthread_cond_signal(&mq.cond);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&mq.lock);
+
+    return ret;
+}
+
+static int msgq_get(struct rec *r)
+{
+    int ret = -1;
+
+    pthread_mutex_lock(&mq.lock);
+    if(mq.head != mq.tail)
+    {
+        *r = mq.buf[mq.tail++ % ARRAY_SIZE(mq.buf)];
+        ret = 0;
+    }
+    pthread_mutex_unlock(&mq.lock);
+
+    return ret;
+}
+
+/* per-record cost of moving bursts of 8 records through each queue,
+ * producer and consumer interleaved in one thread so that scheduling
+ * does not swamp the queue operations. the ring's k_sem_give() is the
+ * host stand-in (a pthread mutex and condvar), like the msgq lock. */
+static int bench(uint32_t n)
+{
+    uint32_t bad = 0;
+    uint64_t t0;
+    struct rec r;
+
+    uwb_ring_init(&ring);
+
+    t0 = test_now_ns();
+    for(uint32_t seq = 0; seq < n; seq += 8)
+    {
+        void *first;
+        int got;
+
+        for(uint32_t k = 0; k < 8; k++)
+        {
+            struct rec *slot = uwb_ring_reserve(&ring);
+
+            rec_fill(slot, seq + k);
+            uwb_ring_commit(&ring);
+        }
+
+        got = uwb_ring_peek(&ring, &first, 8, K_NO_WAIT);
+        for(int k = 0; k < got; k++)
+            bad += !rec_ok((struct rec *)first + k);
+        uwb_ring_release(&ring, got);
+    }
+    printf("uwb_ring     %6.1f ns/record\n", (double)(test_now_ns() - t0) / n);
+
+    t0 = test_now_ns();
+    for(uint32_t seq = 0; seq < n; seq += 8)
+    {
+        for(uint32_t k = 0; k < 8; k++)
+        {
+            rec_fill(&r, seq + k);
+            msgq_put(&r);
+        }
+
+        while(msgq_get(&r) == 0)
+            bad += !rec_ok(&r);
+    }
+    printf("msgq-style   %6.1f ns/record\n", (double)(test_now_ns() - t0) / n);
+
+    return bad ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return bench(argc > 2 ? (uint32_t)atoi(argv[2]) : 8000000);
+
+    RUN(single_thread);
+    RUN(stress_fast_consumer);
+    RUN(stress_slow_consumer);
+
+    return TEST_RESULT();
+}
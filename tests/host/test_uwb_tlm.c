@@ -0,0 +1,290 @@
+/* uwb_tlm: packets decode back to the records put in, blink seqs are
+ * delta-coded per tag, and full forms are used where a delta can't be.
+ *
+ *   test_uwb_tlm           run the checks
+ *   test_uwb_tlm --dump    print random packets as hex, one per line, for
+ *                          scripts/uwb_tlm.py */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "uwb_msg.h"
+#include "uwb_tlm.h"
+
+#include "test.h"
+
+struct rec {
+    int type;
+    uint8_t sync_seq;
+    uint64_t tag;           /* BLINK */
+    uint32_t seq;           /* BLINK, or the SYNC seq */
+    uint64_t tx_ts;         /* SYNC */
+    uint64_t corrected;
+};
+
+static int add(struct uwb_tlm *t, const struct rec *r)
+{
+    if(r->type == UWB_TLM_SYNC)
+        return uwb_tlm_add_sync(t, r->seq, r->tx_ts, r->tx_ts + 1000, -5, 1 << 20,
+                                r->corrected);
+
+    return uwb_tlm_add_blink(t, r->tag, r->seq, r->sync_seq, r->corrected);
+}
+
+/* the format as documented in uwb_tlm.h. returns the record count, or
+ * -1 on a malformed packet. */
+static int decode(const uint8_t *d, int len, struct rec *out)
+{
+    uint64_t tags[UWB_TLM_TAGS];
+    uint32_t seqs[UWB_TLM_TAGS];
+    int ntags = 0;
+    int last_sync = -1;
+    int i = UWB_TLM_HDR_LEN;
+
+    if(len < UWB_TLM_HDR_LEN || d[0] != UWB_TLM_VERSION)
+        return -1;
+
+    for(int n = 0; n < d[2]; n++)
+    {
+        struct rec *r = &out[n];
+        int low = d[i] & 0x3F;
+
+        memset(r, 0, sizeof(*r));
+        r->type = d[i++] >> 6;
+
+        if(r->type == UWB_TLM_SYNC)
+        {
+            if(low == UWB_TLM_SEQ_ESC)
+                r->seq = d[i++];
+            else if(last_sync < 0)
+                return -1;
+            else
+                r->seq = (uint8_t)(last_sync + low);
+            last_sync = r->seq;
+            r->tx_ts = uwb_msg_get_ts(&d[i]);
+            r->corrected = uwb_msg_get_ts(&d[i + 19]);
+            i += 24;
+        }
+        else if(r->type == UWB_TLM_BLINK)
+        {
+            r->sync_seq = d[i++];
+            if(low == UWB_TLM_BLINK_SHORT || low == UWB_TLM_BLINK_LONG)
+            {
+                int k;
+
+                if(low == UWB_TLM_BLINK_SHORT)
+                {
+                    r->tag = uwb_msg_get_u16(&d[i]);
+                    r->seq = uwb_msg_get_u16(&d[i + 2]);
+                    i += 4;
+                }
+                else
+                {
+                    r->tag = uwb_msg_get_u64(&d[i]);
+                    r->seq = uwb_msg_get_u32(&d[i + 8]);
+                    i += 12;
+                }
+
+                for(k = 0; k < ntags && tags[k] != r->tag; k++)
+                    ;
+                if(k < ntags)
+                    seqs[k] = r->seq;
+                else if(ntags < UWB_TLM_TAGS)
+                {
+                    tags[ntags] = r->tag;
+                    seqs[ntags++] = r->seq;
+                }
+            }
+            else
+            {
+                if(low >= ntags)
+                    return -1;
+                r->tag = tags[low];
+                r->seq = seqs[low] += d[i++];
+            }
+            r->corrected = uwb_msg_get_ts(&d[i]);
+            i += 5;
+        }
+        else
+            return -1;
+
+        if(i > len)
+            return -1;
+    }
+
+    return (i == len) ? d[2] : -1;
+}
+
+static void rec_eq(const struct rec *a, const struct rec *b)
+{
+    CHECK_EQ(a->type, b->type);
+    CHECK_EQ(a->seq, b->seq);
+    CHECK_EQ(a->corrected, b->corrected);
+    if(a->type == UWB_TLM_SYNC)
+        CHECK_EQ(a->tx_ts, b->tx_ts);
+    else
+    {
+        CHECK_EQ(a->tag, b->tag);
+        CHECK_EQ(a->sync_seq, b->sync_seq);
+    }
+}
+
+static struct rec blink(uint64_t tag, uint32_t seq)
+{
+    return (struct rec){ .type = UWB_TLM_BLINK, .sync_seq = 7, .tag = tag, .seq = seq,
+                         .corrected = 0x12345678ull + seq };
+}
+
+static void blink_delta(void)
+{
+    struct uwb_tlm t;
+    struct rec in[20], out[20];
+
+    /* two tags blinking in turn: full once each, then deltas */
+    uwb_tlm_begin(&t, 3, UWB_TLM_MAX);
+    for(int i = 0; i < 20; i++)
+    {
+        in[i] = blink(i % 2 ? 0x1234 : 0x0102030405060708ull, 1000 + i / 2);
+        CHECK_EQ(add(&t, &in[i]), 0);
+    }
+    CHECK_EQ(t.len, UWB_TLM_HDR_LEN + 11 + 19 + 18 * 8);
+
+    CHECK_EQ(decode(t.data, t.len, out), 20);
+    for(int i = 0; i < 20; i++)
+        rec_eq(&in[i], &out[i]);
+}
+
+static void blink_full(void)
+{
+    struct uwb_tlm t;
+    struct rec in[8], out[8];
+    int n = 0;
+
+    uwb_tlm_begin(&t, 3, UWB_TLM_MAX);
+
+    /* a repeat, a step back, a gap over 255 and a seq wrap */
+    in[n++] = blink(5, 10);
+    in[n++] = blink(5, 10);
+    in[n++] = blink(5, 9);
+    in[n++] = blink(5, 9 + 256);
+    in[n++] = blink(5, 9 + 256 + 255);
+    in[n++] = blink(0x10000, 0xFFFFFFFFu);
+    in[n++] = blink(0x10000, 2);
+    for(int i = 0; i < n; i++)
+        CHECK_EQ(add(&t, &in[i]), 0);
+    CHECK_EQ(t.len, UWB_TLM_HDR_LEN + 4 * 11 + 8 + 19 + 8);
+
+    CHECK_EQ(decode(t.data, t.len, out), n);
+    for(int i = 0; i < n; i++)
+        rec_eq(&in[i], &out[i]);
+}
+
+static void many_tags(void)
+{
+    struct uwb_tlm t;
+    struct rec in[2 * UWB_TLM_TAGS], out[2 * UWB_TLM_TAGS];
+    int n = 0;
+
+    /* every tag a short blink can name gets a number */
+    uwb_tlm_begin(&t, 3, UWB_TLM_MAX);
+    for(int i = 0; i < UWB_TLM_TAGS; i++)
+    {
+        in[n] = blink(100 + i, 1);
+        CHECK_EQ(add(&t, &in[n++]), 0);
+    }
+    CHECK_EQ(add(&t, &in[0]), -1);
+    CHECK_EQ(t.count, UWB_TLM_TAGS);
+    CHECK_EQ(decode(t.data, t.len, out), n);
+
+    uwb_tlm_begin(&t, 3, UWB_TLM_MAX);
+    n = 0;
+    for(int k = 1; k <= 2; k++)
+        for(int i = 0; i < 12; i++)
+        {
+            in[n] = blink(100 + i, k);
+            CHECK_EQ(add(&t, &in[n++]), 0);
+        }
+    /* the second round is all deltas */
+    CHECK_EQ(t.len, UWB_TLM_HDR_LEN + 12 * 11 + 12 * 8);
+
+    CHECK_EQ(decode(t.data, t.len, out), n);
+    for(int i = 0; i < n; i++)
+        rec_eq(&in[i], &out[i]);
+}
+
+/* random records split into packets like ble_tdoa_slave does */
+static int random_packets(int npkt, int dump)
+{
+    static struct rec in[256], out[256];
+    uint32_t seqs[6] = {0};
+    uint8_t sync_seq = 0;
+    struct uwb_tlm t;
+    int got = 0;
+
+    for(int p = 0; p < npkt; p++)
+    {
+        int n = 0, mtu = 23 + test_rand64() % (UWB_TLM_MAX - 20);
+
+        uwb_tlm_begin(&t, p, mtu);
+        for(;;)
+        {
+            struct rec *r = &in[n];
+            uint32_t k = test_rand64() % 7;
+
+            if(k == 6)
+            {
+                *r = (struct rec){ .type = UWB_TLM_SYNC, .seq = sync_seq,
+                                   .tx_ts = test_rand64() >> 24,
+                                   .corrected = test_rand64() >> 24 };
+                sync_seq += 1 + test_rand64() % 80;
+            }
+            else
+            {
+                seqs[k] += (test_rand64() % 8 == 0) ? test_rand64() % 600 : 1;
+                *r = blink(k < 3 ? k : 0xABCD000000ull + k, seqs[k]);
+                r->corrected = test_rand64() >> 24;
+            }
+
+            if(add(&t, r) != 0)
+                break;
+            n++;
+        }
+
+        CHECK(t.len <= mtu);
+        if(dump)
+        {
+            for(int i = 0; i < t.len; i++)
+                printf("%02x", t.data[i]);
+            printf("\n");
+            continue;
+        }
+
+        CHECK_EQ(decode(t.data, t.len, out), n);
+        for(int i = 0; i < n; i++)
+            rec_eq(&in[i], &out[i]);
+        got += n;
+    }
+
+    return got;
+}
+
+static void round_trip(void)
+{
+    CHECK(random_packets(2000, 0) > 2000);
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "--dump") == 0)
+    {
+        random_packets(20, 1);
+        return 0;
+    }
+
+    RUN(blink_delta);
+    RUN(blink_full);
+    RUN(many_tags);
+    RUN(round_trip);
+
+    return TEST_RESULT();
+}
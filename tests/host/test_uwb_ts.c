@@ -0,0 +1,360 @@
+/* uwb_ts against double (and long double) references: wrap-safe
+ * add/sub/cmp over the wrap boundaries, Q32 skew, clock mapping and
+ * DS-TWR time of flight.
+ *
+ *   test_uwb_ts             run the checks
+ *   test_uwb_ts --bench [n] time the integer paths against double */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zephyr/sys/util.h>
+
+#include "uwb_ts.h"
+
+#include "test.h"
+
+#define TS_WRAP         (1ULL << 40)
+#define C_AIR           299702547.0
+#define TICK_HZ         (499.2e6 * 128.0)
+#define MM_PER_TICK     (C_AIR / TICK_HZ * 1000.0)
+
+/* stamps that sit on or next to the wrap and half-wrap boundaries */
+static const uint64_t edge_ts[] = {
+    0, 1, 2, 0x7FFFFFFFFEULL, 0x7FFFFFFFFFULL, 0x8000000000ULL,
+    0x8000000001ULL, 0xFFFFFFFFFEULL, 0xFFFFFFFFFFULL, 0x123456789AULL,
+};
+
+static const int64_t edge_d[] = {
+    0, 1, -1, 2, -2, 1000, -1000, 0xFFFFFFFFLL, -0xFFFFFFFFLL,
+    UWB_TS_HALF - 1, -(UWB_TS_HALF - 1), UWB_TS_HALF,
+};
+
+static void ts_sub_edges(void)
+{
+    for(size_t i = 0; i < ARRAY_SIZE(edge_ts); i++)
+    {
+        for(size_t j = 0; j < ARRAY_SIZE(edge_d); j++)
+        {
+            uint64_t a = edge_ts[i];
+            int64_t d = edge_d[j];
+            uint64_t b = uwb_ts_add(a, d);
+
+            CHECK(b <= UWB_TS_MASK);
+            CHECK_EQ(uwb_ts_sub(b, a), d);
+            CHECK_EQ(uwb_ts_cmp(b, a), (d > 0) - (d < 0));
+
+            /* antisymmetric except at exactly half a wrap */
+            if(d != UWB_TS_HALF)
+            {
+                CHECK_EQ(uwb_ts_sub(a, b), -d);
+                CHECK_EQ(uwb_ts_cmp(a, b), -((d > 0) - (d < 0)));
+            }
+        }
+    }
+
+    /* half a wrap is "after", from either side */
+    CHECK_EQ(uwb_ts_sub(UWB_TS_HALF, 0), UWB_TS_HALF);
+    CHECK_EQ(uwb_ts_sub(0, UWB_TS_HALF), UWB_TS_HALF);
+}
+
+static void ts_sub_random(void)
+{
+    for(int i = 0; i < 1000000; i++)
+    {
+        uint64_t a = test_rand64() & UWB_TS_MASK;
+        uint64_t b = test_rand64() & UWB_TS_MASK;
+        int64_t d = (int64_t)((a - b) & UWB_TS_MASK);
+
+        if(d > UWB_TS_HALF)
+            d -= (int64_t)TS_WRAP;
+
+        if(uwb_ts_sub(a, b) != d)
+        {
+            CHECK_EQ(uwb_ts_sub(a, b), d);
+            return;
+        }
+
+        if(uwb_ts_add(b, d) != a)
+        {
+            CHECK_EQ(uwb_ts_add(b, d), a);
+            return;
+        }
+    }
+}
+
+static void skew_vs_double(void)
+{
+    int32_t worst = 0;
+
+    for(int i = 0; i < 200000; i++)
+    {
+        int64_t local_dt = (int64_t)test_uniform(1e5, 1e12);
+        double ppm = test_uniform(-900.0, 900.0);
+        int64_t ref_dt = (int64_t)llround((double)local_dt * (1.0 - ppm * 1e-6));
+        double ref = (double)(local_dt - ref_dt) / (double)local_dt * 4294967296.0;
+        int32_t err = abs(uwb_skew_q32(local_dt, ref_dt) - (int32_t)lround(ref));
+
+        if(err > worst)
+            worst = err;
+    }
+
+    /* both round the same quotient, the double one loses bits */
+    CHECK(worst <= 1);
+
+    CHECK_EQ(uwb_skew_q32(0, 100), 0);
+    CHECK_EQ(uwb_skew_q32(-5, 100), 0);
+    CHECK_EQ(uwb_skew_q32(1000000, 0), UWB_SKEW_Q32_MAX);
+    CHECK_EQ(uwb_skew_q32(1000000, 2000000), -UWB_SKEW_Q32_MAX);
+    CHECK_EQ(uwb_skew_q32(1LL << 39, 0), UWB_SKEW_Q32_MAX);
+
+    for(int32_t ppb = -900000; ppb <= 900000; ppb += 997)
+    {
+        long ref = lround((double)ppb * 4294967296.0 / 1e9);
+
+        CHECK(labs(uwb_skew_q32_from_ppb(ppb) - ref) <= 1);
+    }
+
+    CHECK_EQ(uwb_skew_q32_from_ppb(2000000), UWB_SKEW_Q32_MAX);
+    CHECK_EQ(uwb_skew_q32_from_ppb(-2000000), -UWB_SKEW_Q32_MAX);
+}
+
+static void skew_apply_vs_long_double(void)
+{
+    for(int i = 0; i < 1000000; i++)
+    {
+        int64_t dt = (int64_t)(test_rand64() & UWB_TS_MASK) - UWB_TS_HALF;
+        int32_t skew = (int32_t)(test_rand64() % (2 * UWB_SKEW_Q32_MAX + 1)) - UWB_SKEW_Q32_MAX;
+        long double p = (long double)dt * skew / 4294967296.0L;
+        int64_t ref = (int64_t)llroundl(p);
+
+        if(llabs(uwb_skew_apply(dt, skew) - ref) > 0)
+        {
+            /* a tie may round either way */
+            if(fabsl(p - (long double)(int64_t)p) != 0.5L)
+            {
+                CHECK_EQ(uwb_skew_apply(dt, skew), ref);
+                return;
+            }
+        }
+    }
+
+    CHECK_EQ(uwb_skew_apply(1LL << 32, 1), 1);
+    CHECK_EQ(uwb_skew_apply(-(1LL << 32), 1), -1);
+    CHECK_EQ(uwb_skew_apply(1LL << 39, 1 << 30), uwb_skew_apply(1LL << 39, UWB_SKEW_Q32_MAX));
+}
+
+static void to_remote_vs_double(void)
+{
+    for(int i = 0; i < 200000; i++)
+    {
+        uint64_t ref_local = test_rand64() & UWB_TS_MASK;
+        uint64_t ref_remote = test_rand64() & UWB_TS_MASK;
+        int64_t dt = (int64_t)test_uniform(-8e9, 8e9);
+        int32_t skew = (int32_t)test_uniform(-UWB_SKEW_Q32_MAX, UWB_SKEW_Q32_MAX);
+        uint64_t local = uwb_ts_add(ref_local, dt);
+
+        double rdt = (double)dt - (double)dt * skew / 4294967296.0;
+        uint64_t ref = uwb_ts_add(ref_remote, (int64_t)llround(rdt));
+        int64_t err = uwb_ts_sub(uwb_ts_to_remote(local, ref_local, ref_remote, skew), ref);
+
+        if(llabs(err) > 1)
+        {
+            CHECK_EQ(err, 0);
+            return;
+        }
+    }
+}
+
+/* one exchange with true ToF tof and reply delays, stamped by two
+ * clocks running ea and eb fast and starting anywhere in the wrap */
+struct exchange {
+    uint64_t t[6];
+    double tof;
+};
+
+static void exchange_make(struct exchange *x, double tof, double db, double da,
+                          double ea, double eb)
+{
+    double a0 = test_uniform(0, (double)TS_WRAP);
+    double b0 = test_uniform(0, (double)TS_WRAP);
+    double at[3] = { 0, 2 * tof + db, 2 * tof + db + da };
+    double bt[3] = { tof, tof + db, 3 * tof + db + da };
+
+    /* initiator stamps t1, t4, t5; responder t2, t3, t6 */
+    x->t[0] = (uint64_t)llround(a0 + at[0] * (1 + ea)) & UWB_TS_MASK;
+    x->t[3] = (uint64_t)llround(a0 + at[1] * (1 + ea)) & UWB_TS_MASK;
+    x->t[4] = (uint64_t)llround(a0 + at[2] * (1 + ea)) & UWB_TS_MASK;
+    x->t[1] = (uint64_t)llround(b0 + bt[0] * (1 + eb)) & UWB_TS_MASK;
+    x->t[2] = (uint64_t)llround(b0 + bt[1] * (1 + eb)) & UWB_TS_MASK;
+    x->t[5] = (uint64_t)llround(b0 + bt[2] * (1 + eb)) & UWB_TS_MASK;
+    x->tof = tof;
+}
+
+static void exchange_random(struct exchange *x)
+{
+    /* up to 150 m, 0.3-5 ms replies, +-20 ppm clocks */
+    exchange_make(x, test_uniform(0, 32000), test_uniform(1.9e7, 3.2e8),
+                  test_uniform(1.9e7, 3.2e8), test_uniform(-20e-6, 20e-6),
+                  test_uniform(-20e-6, 20e-6));
+}
+
+/* the float formula the samples used before uwb_ts */
+static double tof_double(const uint64_t *t)
+{
+    double ra = (double)uwb_ts_sub(t[3], t[0]);
+    double rb = (double)uwb_ts_sub(t[5], t[2]);
+    double da = (double)uwb_ts_sub(t[4], t[3]);
+    double db = (double)uwb_ts_sub(t[2], t[1]);
+
+    return (ra * rb - da * db) / (ra + rb + da + db);
+}
+
+static void tof_vs_double(void)
+{
+    double worst = 0, worst_true = 0;
+
+    for(int i = 0; i < 200000; i++)
+    {
+        struct exchange x;
+        int64_t q8;
+
+        exchange_random(&x);
+
+        if(uwb_ds_twr_tof_q8(x.t[0], x.t[1], x.t[2], x.t[3], x.t[4], x.t[5], &q8) != 0)
+        {
+            CHECK(0);
+            return;
+        }
+
+        double err = fabs(q8 / 256.0 - tof_double(x.t));
+        double err_true = fabs(q8 / 256.0 - x.tof);
+
+        if(err > worst)
+            worst = err;
+        if(err_true > worst_true)
+            worst_true = err_true;
+    }
+
+    printf("  tof: max |int - double| %.5f ticks, max |int - true| %.3f ticks\n",
+           worst, worst_true);
+
+    /* half an LSB of the Q8 result */
+    CHECK(worst <= 0.002);
+    /* stamp rounding only; the skew terms cancel in asymmetric DS-TWR */
+    CHECK(worst_true < 2.0);
+}
+
+static void tof_limits(void)
+{
+    struct exchange x;
+    int64_t q8;
+
+    /* replies close to the 2^32 tick limit still agree */
+    exchange_make(&x, 20000, 4.2e9, 4.2e9, 20e-6, -20e-6);
+    CHECK_EQ(uwb_ds_twr_tof_q8(x.t[0], x.t[1], x.t[2], x.t[3], x.t[4], x.t[5], &q8), 0);
+    CHECK(fabs(q8 / 256.0 - x.tof) < 2.0);
+
+    /* an interval past 2^32 ticks is refused */
+    exchange_make(&x, 20000, 4.4e9, 1e8, 0, 0);
+    CHECK_EQ(uwb_ds_twr_tof_q8(x.t[0], x.t[1], x.t[2], x.t[3], x.t[4], x.t[5], &q8), -1);
+
+    /* so is one running backwards */
+    exchange_make(&x, 20000, 1e8, 1e8, 0, 0);
+    CHECK_EQ(uwb_ds_twr_tof_q8(x.t[0], x.t[2], x.t[1], x.t[3], x.t[4], x.t[5], &q8), -1);
+
+    /* all stamps equal: zero denominator */
+    CHECK_EQ(uwb_ds_twr_tof_q8(5, 5, 5, 5, 5, 5, &q8), -1);
+}
+
+static void tof_to_mm(void)
+{
+    /* 0-300 m in 1/256 tick steps of a few mm */
+    for(int64_t q8 = -256 * 100; q8 < 256 * 64000; q8 += 37)
+    {
+        double ref = q8 / 256.0 * MM_PER_TICK;
+
+        if(fabs(uwb_tof_q8_to_mm(q8) - ref) > 1.0)
+        {
+            CHECK_EQ(uwb_tof_q8_to_mm(q8), lround(ref));
+            return;
+        }
+    }
+
+    CHECK_EQ(uwb_tof_q8_to_mm(0), 0);
+}
+
+static volatile int64_t sink;
+static volatile double dsink;
+
+static double bench_ns(uint64_t t0, int n)
+{
+    return (double)(test_now_ns() - t0) / n;
+}
+
+static int bench(int n)
+{
+    struct exchange *x = malloc(sizeof(*x) * n);
+    int32_t *skew = malloc(sizeof(*skew) * n);
+    uint64_t t0;
+
+    if(!x || !skew)
+        return 1;
+
+    for(int i = 0; i < n; i++)
+    {
+        exchange_random(&x[i]);
+        skew[i] = (int32_t)test_uniform(-90000, 90000);
+    }
+
+    t0 = test_now_ns();
+    for(int i = 0; i < n; i++)
+    {
+        int64_t q8 = 0;
+
+        uwb_ds_twr_tof_q8(x[i].t[0], x[i].t[1], x[i].t[2], x[i].t[3], x[i].t[4], x[i].t[5], &q8);
+        sink = uwb_tof_q8_to_mm(q8);
+    }
+    printf("ds-twr tof + mm     int    %6.1f ns\n", bench_ns(t0, n));
+
+    t0 = test_now_ns();
+    for(int i = 0; i < n; i++)
+        dsink = tof_double(x[i].t) * MM_PER_TICK;
+    printf("ds-twr tof + mm     double %6.1f ns\n", bench_ns(t0, n));
+
+    t0 = test_now_ns();
+    for(int i = 0; i < n; i++)
+        sink = (int64_t)uwb_ts_to_remote(x[i].t[5], x[i].t[1], x[i].t[0], skew[i]);
+    printf("local -> remote     int    %6.1f ns\n", bench_ns(t0, n));
+
+    t0 = test_now_ns();
+    for(int i = 0; i < n; i++)
+    {
+        double dt = (double)uwb_ts_sub(x[i].t[5], x[i].t[1]);
+
+        dsink = fmod((double)x[i].t[0] + dt - dt * skew[i] / 4294967296.0, (double)TS_WRAP);
+    }
+    printf("local -> remote     double %6.1f ns\n", bench_ns(t0, n));
+
+    free(x);
+    free(skew);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return bench(argc > 2 ? atoi(argv[2]) : 1000000);
+
+    RUN(ts_sub_edges);
+    RUN(ts_sub_random);
+    RUN(skew_vs_double);
+    RUN(skew_apply_vs_long_double);
+    RUN(to_remote_vs_double);
+    RUN(tof_vs_double);
+    RUN(tof_limits);
+    RUN(tof_to_mm);
+
+    return TEST_RESULT();
+}